@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "database.h"
+#include "intern.h"
+
+/*--------------------------------------
+ *  Library API
+ *------------------------------------- */
+
+// One environment's compile_commands.json, as contents or as a path
+struct EnvInput {
+  std::string name{};
+  std::optional<std::string_view> json{};  // contents, read instead of path
+  std::filesystem::path path{};            // read when json is absent
+};
+
+enum class ErrorCode : int {
+  config = 1,           // platformio.ini missing or malformed
+  no_environments,      // no [env:NAME] sections or no inputs
+  unknown_environment,  // the target is not one of the environments
+  input,                // an environment's database could not be read
+};
+
+// Failure of generate(); env names the environment at fault, if any
+struct GenError {
+  ErrorCode code{};
+  std::string env{};
+  std::string message{};
+};
+
+// Deduplicated compile commands for one target environment
+//
+// Owns the intern pool every entry points into, so the entries and their
+// views stay valid for the lifetime of the database. Nothing is printed
+// or written to disk.
+class CompileDatabase {
+ public:
+  const std::string& target_env() const { return target_.env; }
+
+  // Output entries, the target's own first
+  std::span<const Entry* const> entries() const { return target_.entries; }
+
+  // Entries of every input environment before deduplication
+  size_t input_entries() const;
+
+  // Contents of the equivalent compile_commands.json
+  std::expected<std::string, std::string> to_json() const;
+
+ private:
+  friend std::expected<CompileDatabase, GenError> generate(
+      std::span<const EnvInput> inputs,
+      std::string_view target_env,
+      const EntryRules& rules);
+
+  std::unique_ptr<InternPool> pool_{};
+  std::vector<EnvDatabase> envs_{};
+  TargetDatabase target_{};
+};
+
+/*-------------------------------------------------------------------
+ *  generate()
+ *
+ *  Filters and deduplicates compile commands like gen_cmds(), from
+ *  inputs given in memory or by path. Inputs are read in parallel.
+ *
+ *  Params:
+ *    inputs      environments in priority order after the target
+ *    target_env  name of the target input; the first input if empty
+ *    rules       applied to every entry, see EntryRules
+ *  Returns the database, or the error of the first failed input
+ *
+ *-----------------------------------------------------------------*/
+std::expected<CompileDatabase, GenError> generate(
+    std::span<const EnvInput> inputs,
+    std::string_view target_env = {},
+    const EntryRules& rules = {});
+
+// generate() for a PlatformIO project: the environments of its
+// platformio.ini, read from .pio/build/<env>/compile_commands.json, with
+// the rules of its [pio-clangd] section (see load_project_rules()).
+// An empty environment selects the project's default environment.
+std::expected<CompileDatabase, GenError> generate_project(
+    const std::string& proj_path,
+    const std::string& environment = {});
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdint>
+#include <expected>
+#include <glaze/glaze.hpp>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "database.h"
+#include "intern.h"
+#include "overrides.h"
+#include "targets.h"
+
+class PioConfig;
+
+/*--------------------------------------
+ *  build_flags edits without a compiledb run (--patch-flags)
+ *------------------------------------- */
+
+// Bumped whenever the baseline file changes shape
+inline constexpr uint32_t BASELINE_FORMAT_VERSION = 1;
+
+// build_flags and build_unflags of an environment, split into arguments
+struct BuildFlags {
+  std::vector<std::string> flags{};
+  std::vector<std::string> unflags{};
+
+  bool operator==(const BuildFlags&) const = default;
+
+  struct glaze {
+    using T = BuildFlags;
+    static constexpr auto value = glz::object(
+      "flags", &T::flags,
+      "unflags", &T::unflags);
+  };
+};
+
+// The flags an environment's compile_commands.json was generated with,
+// as far as they are known: those of platformio.ini when pio-clangd
+// first saw that database
+struct FlagBaseline {
+  std::string env{};
+  FileStamp database{};  // the compile_commands.json they belong to
+  BuildFlags build{};
+
+  struct glaze {
+    using T = FlagBaseline;
+    static constexpr auto value = glz::object(
+      "env", &T::env,
+      "database", &T::database,
+      "build", &T::build);
+  };
+};
+
+// Contents of <proj>/.pio/clangd/build_flags.json
+struct FlagBaselines {
+  uint32_t version{BASELINE_FORMAT_VERSION};
+  std::vector<FlagBaseline> envs{};
+
+  struct glaze {
+    using T = FlagBaselines;
+    static constexpr auto value = glz::object(
+      "version", &T::version,
+      "envs", &T::envs);
+  };
+};
+
+// Splits one build_flags line into arguments like a POSIX shell:
+// whitespace separates, quotes group and are removed, a backslash
+// escapes the next character except within single quotes
+std::vector<std::string> split_flags(std::string_view line);
+
+// build_flags and build_unflags of env, with extends and interpolation
+// applied by config
+BuildFlags read_build_flags(const PioConfig& config, const std::string& env);
+
+/*-------------------------------------------------------------------
+ *  diff_build_flags()
+ *
+ *  The change from the flags a database was built with to the current
+ *  ones, as an override rule covering every file: removing the flags
+ *  dropped from build_flags and those newly unflagged, "-DNAME" also
+ *  removing "-DNAME=value", and adding the new flags that pass the
+ *  clangd filter and no unflag removes.
+ *
+ *  Fails when the change cannot be patched: a flag no longer unflagged
+ *  comes back from wherever PlatformIO added it, and the output of a
+ *  "!command" is unknown.
+ *
+ *-----------------------------------------------------------------*/
+std::expected<OverrideRule, std::string> diff_build_flags(
+    const BuildFlags& built,
+    const BuildFlags& now);
+
+// Patches for every environment of one run
+struct FlagPatches {
+  std::vector<OverrideRule> deltas{};  // deltas[i] belongs to envs[i]
+  std::vector<std::string> warnings{};  // changes that need a compiledb
+  FlagBaselines baselines{};            // to write for the next run
+};
+
+// Compares the current flags of every environment with the baselines
+// of an earlier run. An environment whose compile_commands.json changed
+// since, or that has no baseline, gets the current flags as its
+// baseline and an empty delta.
+FlagPatches plan_flag_patches(const std::string& proj_path,
+                              const PioConfig& config,
+                              const std::vector<std::string>& environments);
+
+// Writes baselines to <proj>/.pio/clangd/build_flags.json
+std::expected<void, std::string> write_flag_baselines(
+    const std::string& proj_path,
+    const FlagBaselines& baselines);
+
+// Applies deltas[i] to the entries of envs[i], each distinct argument
+// list once, and sets their entries_patched. Returns the total number
+// of entries whose arguments changed.
+size_t patch_build_flags(std::span<EnvDatabase> envs,
+                         std::span<const OverrideRule> deltas,
+                         const std::string& proj_path,
+                         InternPool& pool);
@@ -1,16 +1,61 @@
 #pragma once
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
 #include <algorithm>
 #include <array>
 #include <expected>
+#include <functional>
 #include <glaze/glaze.hpp>
 #include <optional>
 #include <ranges>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
+#include "key_rules.h"
+
+// Optional behaviour of gen_cmds(), populated from the command line
+struct GenOptions {
+  std::string report_path{};   // write a JSON run report here if non-empty
+  bool profile{false};         // print hardware counters per phase
+  bool all_targets{false};     // also write .pio/clangd/<env>/ databases
+  bool switch_env{false};      // link the root database to a precomputed one
+  bool read_stdin{false};      // read the databases from stdin, see stream.h
+  bool write_stdout{false};    // write the database to stdout, not the file
+  bool prune_includes{false};  // drop missing or empty include directories
+  bool drop_missing{false};    // drop entries of deleted source files
+  bool add_builtins{false};    // add the compilers' builtin includes, macros
+  bool clangd_config{false};   // factor common flags into .clangd
+  bool rsp_output{false};      // shared flag lists in response files
+  bool infer_new{false};       // entries for sources not built yet
+  bool patch_flags{false};     // apply build_flags edits since compiledb
+  bool dedup_content{false};   // merge identical copies of a library
+  size_t max_entries{};        // write the most relevant ones, 0 for all
+  std::vector<std::string> include{};  // globs of entries to keep
+  std::vector<std::string> exclude{};  // globs of entries to drop
+  std::string overrides_path{};        // per-subtree flag rules, JSON
+};
+
+class InternPool;
+class StatCache;
+struct Entry;
+
+// State shared by the gen_cmds() runs of a workspace, which may run
+// concurrently; null members are created per run
+struct GenShared {
+  InternPool* pool{};       // entries view into it
+  StatCache* stat_cache{};  // file system state, see stat_cache.h
+  bool quiet{false};        // only print errors and warnings
+  // Called with the entries of the root compile_commands.json, with all
+  // of their flags, once it is written
+  std::function<void(std::span<const Entry* const>)> on_output{};
+};
 
 // generates compile_commands.json in project root
-int gen_cmds(const std::string& proj_path, const std::string& environment);
+int gen_cmds(const std::string& proj_path,
+             const std::string& environment,
+             const GenOptions& options = {},
+             const GenShared& shared = {});
 
 /*--------------------------------------
  *  Utility functions and structures
@@ -59,8 +104,8 @@ inline constexpr std::array<std::string_view, 16> STEMS = {
 
 // Flags that require a separate value argument
 // Must be sorted for std::binary_search.
-inline constexpr std::array<std::string_view, 4> FLAGS_WITH_VALUES = {
-    "--sysroot", "-I", "-include", "-isystem"};
+inline constexpr std::array<std::string_view, 6> FLAGS_WITH_VALUES = {
+    "--sysroot", "-I", "-imacros", "-include", "-iquote", "-isystem"};
 
 // Determines if a flag is essential for LSP semantic analysis.
 constexpr bool essential_flag(std::string_view token) {
@@ -95,33 +140,118 @@ inline auto tokenize_command(std::string_view cmd) {
 }
 
 // Process tokens from a range and filter essential flags
-inline void process_tokens(auto&& tokens_range,
-                           std::vector<std::string>& filtered) {
+// filtered may hold strings or views into the tokens
+// Returns the number of tokens examined, excluding the compiler driver
+inline size_t process_tokens(auto&& tokens_range, auto& filtered) {
   auto it = std::ranges::begin(tokens_range);
   auto end = std::ranges::end(tokens_range);
   if (it == end) {
-    return;  // range is empty, nothing to do
+    return 0;  // range is empty, nothing to do
   }
+  size_t examined = 0;
   for (++it; it != end; ++it) {
+    ++examined;
     std::string_view arg{*it};
     if (essential_flag(arg)) {
-      filtered.push_back(std::string(arg));
+      filtered.emplace_back(arg);
 
       // Handle Flags with Separate Values (-I /path)
       if (std::binary_search(FLAGS_WITH_VALUES.begin(), FLAGS_WITH_VALUES.end(),
                              arg) &&
           std::next(it) != end &&
           !std::string_view(*std::next(it)).starts_with('-')) {
-        filtered.push_back(std::string(std::string_view(*++it)));
+        filtered.emplace_back(std::string_view(*++it));
+        ++examined;
       }
     }
   }
+  return examined;
 }
 
+// Search chain an include directory flag adds to
+enum class SearchChain { none, quote, bracket, system };
+
+// Include directory named by a flag, see include_dir()
+struct IncludeDir {
+  SearchChain chain{SearchChain::none};  // none if args[i] names none
+  std::string_view dir{};                // without trailing separators
+  size_t tokens{1};                      // 2 for "-I dir"
+};
+
+// Parses the -iquote, -I or -isystem flag at args[i] of filtered args
+IncludeDir include_dir(std::span<const std::string_view> args, size_t i);
+
+/*-------------------------------------------------------------------
+ *  ArgCanonicalizer
+ *
+ *  Removes redundant flags from the filtered arguments of one command,
+ *  preserving the order of the rest:
+ *    - a directory repeated within its search chain (-iquote, -I or
+ *      -isystem); as in GCC the first occurrence determines the position
+ *    - an -iquote or -I directory that is also an -isystem directory; GCC
+ *      ignores those and searches the directory as a system directory
+ *    - a -D or -U identical to the macro's current definition
+ *  PlatformIO repeats include paths from build_flags, the library
+ *  dependency finder and the framework, and clangd stats every one of
+ *  them on each header lookup.
+ *
+ *  Reuse one instance across commands, its hash sets keep their capacity.
+ *
+ *-----------------------------------------------------------------*/
+class ArgCanonicalizer {
+ public:
+  // Canonicalizes args in place, returns the number of tokens removed
+  size_t canonicalize(std::vector<std::string_view>& args);
+
+ private:
+  boost::unordered_flat_set<std::string_view> system_dirs_;  // all -isystem
+  boost::unordered_flat_set<std::string_view> seen_quote_;
+  boost::unordered_flat_set<std::string_view> seen_bracket_;
+  boost::unordered_flat_set<std::string_view> seen_system_;
+  // Macro name to its last -D or -U token
+  boost::unordered_flat_map<std::string_view, std::string_view> macros_;
+};
+
+// True for "/x", "\\server\\x" and "C:/x", whatever the host platform
+constexpr bool is_absolute_path(std::string_view path) {
+  return path.starts_with('/') || path.starts_with('\\') ||
+         (path.size() > 2 && path[1] == ':' &&
+          (path[2] == '/' || path[2] == '\\'));
+}
+
+/*-------------------------------------------------------------------
+ *  make_dedup_key()
+ *
+ *  Builds the deduplication key for a compile command: the normalized
+ *  directory/file path with the segments rules match removed, by
+ *  default the environment of .pio/libdeps/ENV_NAME/ and
+ *  .pio/build/ENV_NAME/ and a framework's variant directory, so the
+ *  same source from different environments maps to the same key.
+ *
+ *  Params:
+ *    cmd    compile command to build the key for
+ *    key    output buffer, overwritten. Reuse it across calls: when the
+ *           path needs no lexical normalization (no "." or ".."
+ *           segments, repeated or back slashes) and key has enough
+ *           capacity, no memory is allocated.
+ *    rules  segments to remove, see key_rules.h
+ *
+ *-----------------------------------------------------------------*/
+void make_dedup_key(const CompileCommand& cmd,
+                    std::string& key,
+                    const KeyRules& rules = default_key_rules());
+
+// Same for file, taken relative to directory unless it is absolute
+void make_dedup_key(std::string_view directory,
+                    std::string_view file,
+                    std::string& key,
+                    const KeyRules& rules = default_key_rules());
+
 /*-------------------------------------------------------------------
  *  get_env()
  *
- *  Parses platformio.ini to extract environment names
+ *  Parses platformio.ini (and its extra_configs) to extract environment
+ *  names, see load_pio_config()
  *
  *  Params:
  *    project_path  path to platformio.ini or directory containing it
@@ -0,0 +1,56 @@
+#pragma once
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "database.h"
+
+/*--------------------------------------
+ *  Flags factored into .clangd (--clangd-config)
+ *------------------------------------- */
+
+// Lines delimiting the generated part of .clangd, the rest of the file
+// belongs to the user
+inline constexpr std::string_view CLANGD_CONFIG_BEGIN =
+    "# >>> pio-clangd: generated by --clangd-config, do not edit";
+inline constexpr std::string_view CLANGD_CONFIG_END = "# <<< pio-clangd";
+
+// A database with the flags its entries end with moved out
+//
+// clangd appends CompileFlags.Add of every matching .clangd fragment to
+// a command, so an entry's trimmed arguments followed by its group's
+// flags and the common flags give back the exact original command.
+// .clangd only applies to files under the project, entries of files
+// outside it keep all of their flags.
+struct FactoredDatabase {
+  // Flags every library source under prefix ends with, after its own
+  struct Group {
+    std::string prefix{};  // "lib/Foo/" or ".pio/libdeps/<env>/Foo/"
+    std::span<const std::string_view> flags{};
+  };
+
+  std::span<const std::string_view> common{};  // every file in the project
+  std::vector<Group> groups{};
+  std::vector<Entry> entries{};                // trimmed copies, same order
+  std::vector<const Entry*> output{};          // points into entries
+  size_t flags_factored{};                     // tokens removed from entries
+};
+
+// Factors the longest run of flags shared by the end of every entry
+// under proj_path, then per library root the longest run shared by the
+// end of what is left. A run never starts with the value of a flag.
+FactoredDatabase factor_common_flags(std::span<const Entry* const> entries,
+                                     const std::string& proj_path);
+
+// .clangd fragments adding the factored flags, groups before the
+// common flags so clangd appends them in their original order
+std::string render_clangd_config(const FactoredDatabase& factored);
+
+// Replaces the generated block of <proj_path>/.clangd with fragments,
+// leaving the rest of the file alone. Empty fragments remove the block,
+// and the file if nothing else is left in it.
+std::expected<void, std::string> update_clangd_config(
+    const std::string& proj_path,
+    std::string_view fragments);
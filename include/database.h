@@ -0,0 +1,200 @@
+#pragma once
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <glaze/glaze.hpp>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "clangd.h"
+#include "intern.h"
+#include "overrides.h"
+#include "path_filter.h"
+#include "profile.h"
+#include "report.h"
+#include "stat_cache.h"
+
+/*--------------------------------------
+ *  Filtered, interned compile databases
+ *------------------------------------- */
+
+// A compile command after flag filtering
+// Every view points into the InternPool the entry was built with, so
+// entries of different environments and outputs share storage.
+struct Entry {
+  std::string_view key{};  // make_dedup_key() of the command
+  std::string_view directory{};
+  std::string_view file{};
+  std::span<const std::string_view> arguments{};  // essential flags only
+  std::string_view output{};                      // empty if absent
+  std::string_view driver{};  // compiler, the command's first token
+};
+
+// All entries of one environment's compile_commands.json
+struct EnvDatabase {
+  std::string name{};
+  std::vector<Entry> entries{};
+  EnvReport stats{};
+};
+
+// Deduplicated database prioritized for one target environment
+struct TargetDatabase {
+  std::string env{};
+  std::vector<const Entry*> entries{};  // target's entries first
+  std::vector<size_t> won{};            // entries kept, per environment
+};
+
+// JSON shape of an output entry, views into Entry
+struct OutputCommand {
+  std::string_view directory{};
+  std::string_view file{};
+  std::span<const std::string_view> arguments{};
+  std::optional<std::string_view> output{};
+
+  struct glaze {
+    using T = OutputCommand;
+    static constexpr auto value = glz::object(
+      "directory", &T::directory,
+      "file", &T::file,
+      "arguments", &T::arguments,
+      "output", &T::output);
+  };
+};
+
+// Path of an environment's compile_commands.json inside the project
+std::filesystem::path env_database_path(const std::string& proj_path,
+                                        const std::string& env);
+
+// Reads a compile_commands.json as written by PlatformIO
+std::expected<std::vector<CompileCommand>, std::string> read_compile_commands(
+    const std::filesystem::path& path);
+
+// Parses the contents of a compile_commands.json
+// source names the input in error messages.
+std::expected<std::vector<CompileCommand>, std::string> parse_compile_commands(
+    std::string_view json,
+    std::string_view source);
+
+// Scratch buffers of make_entry(), reuse one across calls
+struct EntryScratch {
+  std::string key{};
+  std::vector<std::string_view> filtered{};
+  ArgCanonicalizer canonicalizer{};
+  PathFilter::Scratch path_filter{};
+  FlagOverrides::Scratch overrides{};
+};
+
+// Rules by path applied while entries are made, any may be null
+struct EntryRules {
+  const PathFilter* path_filter{};   // --include/--exclude
+  const FlagOverrides* overrides{};  // --overrides
+  const KeyRules* key_rules{};       // dedup_rules, else the defaults
+};
+
+struct TargetsStamp;
+
+// The rules of a project's entries, owned; see EntryRules
+struct ProjectRules {
+  PathFilter path_filter{};
+  FlagOverrides overrides{};
+  KeyRules key_rules{default_key_rules()};
+  std::filesystem::path overrides_file{};  // empty without overrides
+
+  EntryRules entry_rules() const {
+    return {.path_filter = &path_filter,
+            .overrides = &overrides,
+            .key_rules = &key_rules};
+  }
+};
+
+// Loads the rules every output of a project is made with: the include
+// and exclude globs of options followed by those of config, the override
+// file of options or else of config, and its dedup_rules. config may be
+// null.
+std::expected<ProjectRules, std::string> load_project_rules(
+    const PioConfig* config,
+    const GenOptions& options,
+    const std::string& proj_path);
+
+// Records what rules were loaded from in stamp, the override file
+// among its inputs, so outputs made with other rules are not current
+void stamp_project_rules(const ProjectRules& rules, TargetsStamp& stamp);
+
+// Filters, canonicalizes and interns one command, adding its flag
+// counts to stats
+// A command whose key the path filter rejects is only counted in
+// stats.entries_excluded; nothing else of it is processed.
+std::optional<Entry> make_entry(const CompileCommand& cmd,
+                                InternPool& pool,
+                                EnvReport& stats,
+                                EntryScratch& scratch,
+                                const EntryRules& rules = {});
+
+// Filters and interns the commands of one environment
+// Fills the entry and flag counts of the returned database's stats.
+EnvDatabase make_env_database(std::string env,
+                              const std::vector<CompileCommand>& commands,
+                              InternPool& pool,
+                              const EntryRules& rules = {});
+
+// Reads and filters the databases of all environments in parallel
+// The result's element i belongs to environments[i]. On failure the
+// error of every environment that could not be read is returned.
+std::expected<std::vector<EnvDatabase>, std::vector<std::string>>
+load_env_databases(const std::string& proj_path,
+                   const std::vector<std::string>& environments,
+                   InternPool& pool,
+                   Profiler& profiler,
+                   const EntryRules& rules = {});
+
+// Removes include directory flags naming a missing or empty directory
+// from the entries of every environment. Each distinct directory is
+// stat'ed once through cache; relative ones are resolved against the
+// entry's directory. Returns the number of distinct directories pruned.
+size_t prune_include_dirs(std::span<EnvDatabase> envs,
+                          InternPool& pool,
+                          StatCache& cache);
+
+// Removes the entries whose source file no longer exists, e.g. deleted
+// since the last compiledb run. Every distinct path is stat'ed once
+// through cache. Sets each environment's entries_missing and returns the
+// total removed.
+size_t drop_missing_sources(std::span<EnvDatabase> envs, StatCache& cache);
+
+// Deduplicates all environments for envs[target_idx]
+// The target's entries have the highest priority, the other environments
+// follow in order; the first entry seen for a dedup key wins.
+TargetDatabase resolve_target(std::span<const EnvDatabase> envs,
+                              size_t target_idx);
+
+// Directory PlatformIO installs a lib_deps item in, e.g. "ArduinoJson"
+// for "bblanchon/ArduinoJson @ ^6.21" or a repository URL's last segment
+std::string lib_dep_name(std::string_view dep);
+
+// Orders entries by relevance for --max-entries, keeping their order
+// within each tier: sources of the project's src/, lib/ and include/
+// first, then its other files, then the libraries of .pio/libdeps named
+// in lib_deps, the other ones there, and last everything else, such as
+// framework and toolchain sources.
+std::vector<const Entry*> rank_entries(std::span<const Entry* const> entries,
+                                       const std::string& proj_path,
+                                       std::span<const std::string> lib_deps);
+
+// JSON shape of one entry: the driver, then the filtered flags
+// clangd takes arguments[0] for the compiler, and with --query-driver
+// asks it for its builtin include directories. The returned command
+// views arguments, a buffer reused across calls.
+OutputCommand make_output_command(const Entry& entry,
+                                  std::vector<std::string_view>& arguments);
+
+// Serializes entries as the contents of a compile_commands.json
+std::expected<std::string, std::string> serialize_database(
+    std::span<const Entry* const> entries);
+
+// Serializes entries as a compile_commands.json to path
+// Returns the number of bytes written.
+std::expected<uint64_t, std::string> write_database(
+    std::span<const Entry* const> entries,
+    const std::filesystem::path& path);
@@ -0,0 +1,52 @@
+#pragma once
+#include <span>
+#include <string>
+#include <vector>
+#include "database.h"
+#include "intern.h"
+
+class PioConfig;
+
+/*--------------------------------------
+ *  Entries for sources not built yet (--infer-new)
+ *------------------------------------- */
+
+/*-------------------------------------------------------------------
+ *  scan_sources()
+ *
+ *  Lists the C and C++ sources PlatformIO would build from the
+ *  project's src_dir and lib_dir, by default src/ and lib/. A source of
+ *  src_dir is listed if the build_src_filter (or src_filter) of any
+ *  environment accepts it, by default all are. A library is left out if
+ *  every environment names it in lib_ignore; otherwise its library.json
+ *  build.srcDir and build.srcFilter select its sources, by default its
+ *  src/ directory if it has one and everything but its examples and
+ *  tests if not. Hidden directories are skipped. Directories are walked
+ *  in parallel.
+ *
+ *  Returns absolute, lexically normal paths with forward slashes, as
+ *  make_dedup_key() spells them, sorted.
+ *
+ *-----------------------------------------------------------------*/
+std::vector<std::string> scan_sources(const std::string& proj_path,
+                                      const PioConfig& config);
+
+/*-------------------------------------------------------------------
+ *  infer_new_sources()
+ *
+ *  Adds an entry to each environment for every source no environment
+ *  has an entry for, e.g. one created since the last compiledb run.
+ *  It copies the flags of the closest entry of that environment: one
+ *  in the same directory, else in the nearest directory above it up to
+ *  the project's. Entries of a source in the same language are
+ *  preferred. Environments without such an entry get none, and the
+ *  target's entry wins deduplication as always.
+ *
+ *  Sets each environment's entries_inferred and returns the number of
+ *  sources that got at least one entry.
+ *
+ *-----------------------------------------------------------------*/
+size_t infer_new_sources(std::span<EnvDatabase> envs,
+                         std::span<const std::string> sources,
+                         const std::string& proj_path,
+                         InternPool& pool);
@@ -0,0 +1,94 @@
+#pragma once
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*--------------------------------------
+ *  platformio.ini parsing
+ *------------------------------------- */
+
+// Parsed PlatformIO project configuration
+//
+// Follows PlatformIO's own semantics: options of later files override
+// earlier ones, "[env:NAME]" sections fall back to their "extends"
+// sections and then to the common "[env]" section, and "${section.option}"
+// references are interpolated on lookup.
+class PioConfig {
+ public:
+  // Parses ini text and merges it over what was parsed before
+  void merge(std::string_view text);
+
+  // Environment names of the [env:NAME] sections, in declaration order
+  const std::vector<std::string>& envs() const { return envs_; }
+
+  // Target environment used when none is requested: the first
+  // default_envs entry that names a declared environment, otherwise the
+  // first declared environment. Empty if there are no environments.
+  std::string default_env() const;
+
+  // Option value with inheritance and interpolation applied
+  // section is the full section name, e.g. "env:esp32" or "platformio"
+  std::optional<std::string> get(std::string_view section,
+                                 std::string_view option) const;
+
+  // Option value split into a list the way PlatformIO splits multi-value
+  // options: by line when it spans lines, otherwise by a comma followed
+  // by whitespace, so a comma within a flag does not split it
+  std::vector<std::string> get_list(std::string_view section,
+                                    std::string_view option) const;
+
+  // Section names in declaration order
+  const std::vector<std::string>& sections() const { return section_order_; }
+
+  // Files load_pio_config() read: platformio.ini, then its extra_configs
+  const std::vector<std::filesystem::path>& files() const { return files_; }
+
+  // Splits a raw multi-value option
+  static std::vector<std::string> split_list(std::string_view value);
+
+ private:
+  using Options = boost::unordered_flat_map<std::string, std::string>;
+
+  const std::string* find_raw(std::string_view section,
+                              std::string_view option,
+                              int depth) const;
+  std::string interpolate(std::string_view value,
+                          std::string_view section,
+                          int depth) const;
+
+  boost::unordered_flat_map<std::string, Options> sections_;
+  std::vector<std::string> section_order_;
+  std::vector<std::string> envs_;
+  std::vector<std::filesystem::path> files_;
+
+  friend std::expected<std::shared_ptr<const PioConfig>, std::string>
+  load_pio_config(const std::string& proj_path);
+};
+
+// Matches name against a pattern with '*' and '?' wildcards
+bool wildcard_match(std::string_view pattern, std::string_view name);
+
+/*-------------------------------------------------------------------
+ *  load_pio_config()
+ *
+ *  Parses <proj_path>/platformio.ini together with its extra_configs.
+ *  Results are cached per project by the size and modification time of
+ *  every file that was read, so repeated calls on an unchanged project
+ *  return the same parsed config without touching file contents. The
+ *  extra_configs patterns are expanded again on every call, so a new
+ *  file matching a wildcard is picked up as well.
+ *
+ *  Params:
+ *    proj_path  directory containing platformio.ini
+ *  Returns result wrapped in std::expected:
+ *    Success: shared parsed configuration
+ *    Error: error message as string
+ *
+ *-----------------------------------------------------------------*/
+std::expected<std::shared_ptr<const PioConfig>, std::string> load_pio_config(
+    const std::string& proj_path);
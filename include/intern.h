@@ -0,0 +1,53 @@
+#pragma once
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <string_view>
+
+// Thread-safe pool of immutable strings and string lists
+//
+// Equal contents are stored once and the returned views stay valid for
+// the lifetime of the pool. Because equal strings share storage, two
+// interned strings are equal exactly when their data() pointers are, and
+// lists of interned strings are compared element-wise by pointer.
+// The pool is sharded by hash so worker threads rarely contend.
+class InternPool {
+ public:
+  std::string_view intern(std::string_view str);
+
+  // Interns a list whose elements were themselves interned in this pool
+  std::span<const std::string_view> intern_list(
+      std::span<const std::string_view> list);
+
+ private:
+  static constexpr size_t NUM_SHARDS = 32;
+
+  // Hashes/compares lists of interned strings by element identity
+  struct ListHash {
+    size_t operator()(std::span<const std::string_view> list) const;
+  };
+  struct ListEqual {
+    bool operator()(std::span<const std::string_view> a,
+                    std::span<const std::string_view> b) const;
+  };
+
+  struct StringShard {
+    std::mutex mtx;
+    std::pmr::monotonic_buffer_resource arena;
+    boost::unordered_flat_set<std::string_view> strings;
+  };
+  struct ListShard {
+    std::mutex mtx;
+    std::pmr::monotonic_buffer_resource arena;
+    boost::unordered_flat_set<std::span<const std::string_view>,
+                              ListHash,
+                              ListEqual>
+        lists;
+  };
+
+  std::array<StringShard, NUM_SHARDS> string_shards_;
+  std::array<ListShard, NUM_SHARDS> list_shards_;
+};
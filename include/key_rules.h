@@ -0,0 +1,86 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class PioConfig;
+
+/*--------------------------------------
+ *  Dedup key normalization rules
+ *------------------------------------- */
+
+// Rules of every project, for the PlatformIO layouts whose paths differ
+// by environment or board only
+inline constexpr std::array<std::string_view, 3> DEFAULT_KEY_RULES = {
+    ".pio/libdeps/{env}",       // libraries installed per environment
+    ".pio/build/{env}",         // sources generated per environment
+    "packages/*/variants/{*}",  // framework variants, one per board
+};
+
+// Names the placeholders of key rules stand for; a placeholder without
+// names matches any segment
+struct KeyNames {
+  std::vector<std::string> envs{};
+  std::vector<std::string> boards{};
+};
+
+// Key rules compiled into one matcher over path segments
+//
+// A rule is a run of '/'-separated segments matched anywhere in a key's
+// directory: a literal segment matches itself, "*" any segment, "{env}"
+// an environment, "{board}" a board and "{*}" any segment. The segments
+// matched by the placeholders in braces are removed from the key, so
+// ".pio/libdeps/{env}" makes ".pio/libdeps/esp32/Foo/a.cpp"
+// ".pio/libdeps/Foo/a.cpp".
+//
+// All rules advance together in one pass over the segments, as a set of
+// bits of the pattern positions still matching; apply() allocates
+// nothing.
+class KeyRules {
+ public:
+  // Rules cover at most this many segments together
+  static constexpr size_t MAX_SEGMENTS = 64;
+  // A rule spans at most this many segments
+  static constexpr size_t MAX_RULE_SEGMENTS = 16;
+  // apply() removes at most this many segments of one key
+  static constexpr size_t MAX_DROPS = 16;
+
+  static std::expected<KeyRules, std::string> compile(
+      std::span<const std::string> rules,
+      KeyNames names = {});
+
+  // Removes the segments the rules match from key, a lexically normal
+  // path; never its file name
+  void apply(std::string& key) const;
+
+  // The rules as given, in order
+  const std::vector<std::string>& rules() const { return rules_; }
+
+ private:
+  enum class Kind : uint8_t { literal, any, env, board, drop_any };
+  struct Segment {
+    Kind kind{};
+    std::string text{};  // of a literal
+    uint8_t first{};     // index of the rule's first segment
+    bool last{};         // completes the rule
+  };
+
+  bool matches(const Segment& segment, std::string_view text) const;
+
+  std::vector<Segment> segments_{};
+  uint64_t starts_{};  // bits of every rule's first segment
+  KeyNames names_{};
+  std::vector<std::string> rules_{};
+};
+
+// DEFAULT_KEY_RULES for any environment or board
+const KeyRules& default_key_rules();
+
+// DEFAULT_KEY_RULES followed by the "dedup_rules" option of the
+// [pio-clangd] section of config, for its environments and their boards;
+// default_key_rules() without a config
+std::expected<KeyRules, std::string> load_key_rules(const PioConfig* config);
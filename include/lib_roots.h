@@ -0,0 +1,76 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <glaze/glaze.hpp>
+#include <span>
+#include <string>
+#include <string_view>
+#include "database.h"
+#include "intern.h"
+#include "key_rules.h"
+#include "stat_cache.h"
+
+/*--------------------------------------
+ *  Identical library copies (--dedup-content)
+ *------------------------------------- */
+
+// Files marking the root of a library or package
+inline constexpr std::array<std::string_view, 3> MANIFESTS = {
+    "library.json", "library.properties", "package.json"};
+
+// Cached digest of one root, keyed by its path and the stamps of its
+// files
+struct RootDigest {
+  std::string key{};
+  uint64_t digest{};
+
+  struct glaze {
+    using T = RootDigest;
+    static constexpr auto value = glz::object(
+      "key", &T::key,
+      "digest", &T::digest);
+  };
+};
+
+// Content digest of a library root: the relative path of every file
+// below it but in hidden directories, with the contents of manifests,
+// sources and headers and the size of other files, such as prebuilt
+// archives.
+uint64_t digest_root(const std::filesystem::path& root);
+
+// Outcome of merge_identical_roots()
+struct RootStats {
+  size_t roots{};    // distinct library roots of the entries
+  size_t hashed{};   // digests computed
+  size_t cached{};   // digests taken from the cache
+  size_t merged{};   // roots whose entries now use another root's keys
+};
+
+/*-------------------------------------------------------------------
+ *  merge_identical_roots()
+ *
+ *  Gives the entries of identical copies of a library or package the
+ *  same dedup keys, so resolve_target() keeps one of them: e.g. one
+ *  framework installed as framework-x and framework-x@1.2.3, or a
+ *  library both in lib/ and in .pio/libdeps. The root of a source is
+ *  the nearest directory above it holding a manifest, below the project
+ *  directory or outside it; the manifests of every candidate are
+ *  stat'ed once through stat_cache.
+ *
+ *  Roots are digested in parallel and the digests cached as JSON in
+ *  cache_dir until the size or modification time of one of their files
+ *  changes, so a cached root is listed but not read. Copies with equal
+ *  digests take the keys of one of them: the project's own copy if
+ *  there is one, else one in its .pio directory. Root keys are made
+ *  with the rules the entries' keys were made with.
+ *
+ *-----------------------------------------------------------------*/
+RootStats merge_identical_roots(
+    std::span<EnvDatabase> envs,
+    const std::string& proj_path,
+    InternPool& pool,
+    StatCache& stat_cache,
+    const std::filesystem::path& cache_dir,
+    const KeyRules& key_rules = default_key_rules());
@@ -0,0 +1,110 @@
+#pragma once
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <chrono>
+#include <expected>
+#include <glaze/glaze.hpp>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*--------------------------------------
+ *  LSP proxy in front of clangd (pio-clangd lsp)
+ *------------------------------------- */
+
+// Compile command of one file as clangd accepts it in
+// "compilationDatabaseChanges"
+struct FileSettings {
+  std::string workingDirectory{};
+  std::vector<std::string> compilationCommand{};
+
+  bool operator==(const FileSettings&) const = default;
+
+  struct glaze {
+    using T = FileSettings;
+    static constexpr auto value = glz::object(
+      "workingDirectory", &T::workingDirectory,
+      "compilationCommand", &T::compilationCommand);
+  };
+};
+
+// Settings of every file in a database, by absolute file path
+using FileSettingsMap = boost::unordered_flat_map<std::string, FileSettings>;
+
+// Settings of the database prioritized for env, as gen_cmds() would
+// write it. An empty env selects the default environment.
+std::expected<FileSettingsMap, std::string> compute_file_settings(
+    const std::string& proj_path,
+    const std::string& env);
+
+// Entries of after that are new or differ from before, sorted by path
+// clangd cannot forget a file's command, so removed files are skipped.
+std::map<std::string, FileSettings> settings_delta(
+    const FileSettingsMap& before,
+    const FileSettingsMap& after);
+
+// Buffered reader of Content-Length framed LSP messages from a fd
+class LspReader {
+ public:
+  // cancel_fd, if not -1, aborts a blocked next() once it is readable
+  explicit LspReader(int fd, int cancel_fd = -1)
+      : fd_{fd}, cancel_fd_{cancel_fd} {}
+
+  // Body of the next message
+  // std::nullopt at end of stream, on a malformed header or when
+  // cancelled.
+  std::optional<std::string> next();
+
+ private:
+  bool fill();
+
+  int fd_;
+  int cancel_fd_;
+  std::string buffer_{};  // bytes read past the last returned message
+};
+
+// Writes body to fd with a Content-Length header
+bool write_lsp_message(int fd, std::string_view body);
+
+// Client notification that retargets the proxy to params.env
+inline constexpr std::string_view SWITCH_ENV_METHOD =
+    "pio-clangd/switchEnvironment";
+
+struct LspOptions {
+  std::string proj_path{};
+  std::string environment{};  // empty for the default environment
+  std::chrono::milliseconds poll_interval{1000};  // input change checks
+};
+
+/*-------------------------------------------------------------------
+ *  run_lsp_proxy()
+ *
+ *  Relays LSP messages between a client and a server unchanged, and
+ *  feeds the server compile commands computed by the gen_cmds pipeline
+ *  through "workspace/didChangeConfiguration". After the client's
+ *  "initialized" notification every file's command is sent; later only
+ *  the files whose command changed, either because the client sent
+ *  pio-clangd/switchEnvironment or because an environment's
+ *  compile_commands.json changed on disk. A .clangd block left by
+ *  --clangd-config is removed first, since the commands sent are
+ *  complete.
+ *
+ *  Params:
+ *    options     project, initial environment and polling interval
+ *    client_in   messages from the client
+ *    client_out  messages to the client
+ *    server_in   messages to the server, closed when the client is done
+ *    server_out  messages from the server
+ *  Returns EXIT_SUCCESS once both streams have ended
+ *
+ *-----------------------------------------------------------------*/
+int run_lsp_proxy(const LspOptions& options,
+                  int client_in,
+                  int client_out,
+                  int server_in,
+                  int server_out);
+
+// Starts clangd_argv and proxies between it and stdin/stdout
+int run_lsp(const LspOptions& options,
+            const std::vector<std::string>& clangd_argv);
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole file
+// The file is memory-mapped on POSIX systems and read into memory
+// elsewhere. Move-only; the view is valid for the lifetime of the object.
+class MappedFile {
+ public:
+  static std::expected<MappedFile, std::string> open(
+      const std::filesystem::path& path);
+
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::string_view view() const { return {data_, size_}; }
+
+ private:
+  void release();
+
+  const char* data_{nullptr};
+  size_t size_{0};
+  bool mapped_{false};  // data_ came from mmap rather than buffer_
+  std::string buffer_{};
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <glaze/glaze.hpp>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class KeyRules;
+class PioConfig;
+
+/*--------------------------------------
+ *  Per-subtree flag overrides (--overrides)
+ *------------------------------------- */
+
+// One rule of an override file
+struct OverrideRule {
+  std::string path{};                 // directory or file the rule covers
+  std::vector<std::string> add{};     // appended to the entry's flags
+  std::vector<std::string> remove{};  // "-include", or "-D*" for a prefix
+
+  struct glaze {
+    using T = OverrideRule;
+    static constexpr auto value = glz::object(
+      "path", &T::path,
+      "add", &T::add,
+      "remove", &T::remove);
+  };
+};
+
+// JSON shape of an override file
+struct OverrideFile {
+  std::vector<OverrideRule> rules{};
+
+  struct glaze {
+    using T = OverrideFile;
+    static constexpr auto value = glz::object("rules", &T::rules);
+  };
+};
+
+/*-------------------------------------------------------------------
+ *  FlagOverrides
+ *
+ *  Override rules compiled into a radix trie of path components, so
+ *  the rules for an entry are found in one walk down its path however
+ *  many rules there are. Paths are matched like PathFilter's: relative
+ *  ones are anchored at the project, "~/" is the home directory, and
+ *  the key rules apply, so ".pio/libdeps/<env>/Foo" is
+ *  ".pio/libdeps/Foo".
+ *
+ *  The rules of every directory above an entry apply outermost first:
+ *  each removes the flags its patterns match, together with their
+ *  separate value, then appends its own. Applied after the STEMS filter
+ *  of process_tokens(), so added flags are kept even if the filter
+ *  would drop them, and before ArgCanonicalizer.
+ *
+ *-----------------------------------------------------------------*/
+class FlagOverrides {
+ public:
+  // Per-thread buffers of apply(), reuse one across calls
+  struct Scratch {
+    std::vector<uint32_t> rules{};
+    std::vector<std::string_view> args{};
+  };
+
+  // Compiles rules, relative paths against proj_path; paths are
+  // normalized with key_rules like the keys they are matched against
+  static FlagOverrides compile(std::span<const OverrideRule> rules,
+                               const std::string& proj_path,
+                               const KeyRules& key_rules);
+
+  // Reads and compiles an override file
+  static std::expected<FlagOverrides, std::string> load(
+      const std::filesystem::path& path,
+      const std::string& proj_path,
+      const KeyRules& key_rules);
+
+  bool empty() const { return rules_.empty(); }
+
+  // Indices of the rules covering path, outermost first
+  void match(std::string_view path, std::vector<uint32_t>& rules) const;
+
+  // Applies the rules covering path to the filtered args of its entry
+  // Added flags are views into this object. Returns false if no rule
+  // covers path.
+  bool apply(std::string_view path,
+             std::vector<std::string_view>& args,
+             Scratch& scratch) const;
+
+ private:
+  struct Node {
+    std::string label{};  // components from the parent, joined by '/'
+    // Children by the first component of their label, sorted
+    std::vector<std::pair<std::string, uint32_t>> children{};
+    std::vector<uint32_t> rules{};
+  };
+
+  const Node* child(const Node& node, std::string_view component) const;
+
+  std::vector<Node> nodes_{Node{}};  // nodes_[0] is the file system root
+  std::vector<OverrideRule> rules_{};
+};
+
+// Override file given on the command line, or else by the "overrides"
+// option of the [pio-clangd] section of config; relative to proj_path.
+// Empty if there is none.
+std::filesystem::path overrides_path(const PioConfig* config,
+                                     const std::string& path,
+                                     const std::string& proj_path);
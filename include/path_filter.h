@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class PioConfig;
+
+/*--------------------------------------
+ *  Include and exclude globs (--include, --exclude)
+ *------------------------------------- */
+
+// Globs compiled into one matcher over make_dedup_key() paths
+//
+// "*" and "?" match within a path segment, "[a-z]" and "[!a-z]" one
+// character of a set, "**" any number of segments. A glob that matches
+// a directory also matches everything below it. Relative globs are
+// anchored at the project, globs without a "/" match a name anywhere,
+// and "~/" is the home directory. Keys drop the environment of
+// ".pio/libdeps/<env>/", so library globs match "<proj>/.pio/libdeps/Foo".
+//
+// All globs form a single automaton that reads a path once, however
+// many globs there are; each step only visits the globs still matching.
+class PathFilter {
+ public:
+  // Per-thread match state, reuse one across calls
+  struct Scratch {
+    std::vector<uint32_t> current{};
+    std::vector<uint32_t> next{};
+    std::vector<uint32_t> marks{};
+    uint32_t generation{};
+  };
+
+  // Compiles the globs, relative ones against proj_path
+  static std::expected<PathFilter, std::string> compile(
+      std::span<const std::string> include,
+      std::span<const std::string> exclude,
+      const std::string& proj_path);
+
+  // True if nothing is filtered
+  bool empty() const { return states_.empty(); }
+
+  // True if path matches an include glob, or there are none, and no
+  // exclude glob
+  bool accepts(std::string_view path, Scratch& scratch) const;
+
+  // The globs as compiled, anchored; compared to tell filters apart
+  const std::vector<std::string>& include() const { return include_; }
+  const std::vector<std::string>& exclude() const { return exclude_; }
+
+ private:
+  enum class Op : uint8_t {
+    Char,       // c
+    Any,        // any character but '/'
+    Class,      // a character of classes_[arg]
+    Star,       // any run without '/'
+    AnyPath,    // any run
+    AnyDirs,    // "**/": nothing, or a run ending in '/'
+    InDirs,     // inside the run of the AnyDirs before it
+    Accept,     // arg is 1 for exclude globs
+  };
+  struct State {
+    Op op{};
+    char c{};
+    uint32_t arg{};
+  };
+  struct CharClass {
+    bool negated{};
+    std::vector<std::pair<char, char>> ranges{};
+  };
+
+  std::expected<void, std::string> add_glob(std::string_view anchor,
+                                            std::string_view glob,
+                                            bool exclude);
+  void add_state(uint32_t state, Scratch& scratch) const;
+  bool in_class(uint32_t idx, char c) const;
+
+  std::vector<State> states_{};
+  std::vector<uint32_t> starts_{};  // first state of every glob
+  std::vector<CharClass> classes_{};
+  std::vector<std::string> include_{};
+  std::vector<std::string> exclude_{};
+};
+
+// The globs given on the command line followed by the "include" and
+// "exclude" options of the [pio-clangd] section of config, if any
+std::expected<PathFilter, std::string> load_path_filter(
+    const PioConfig* config,
+    std::span<const std::string> include,
+    std::span<const std::string> exclude,
+    const std::string& proj_path);
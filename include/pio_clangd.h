@@ -0,0 +1,111 @@
+/*--------------------------------------
+ *  pio-clangd C API
+ *
+ *  Stable C interface of the library API in api.h, for embedding through
+ *  FFI (e.g. LuaJIT). Strings returned by the library are views that are
+ *  not null-terminated and stay valid until the database is freed.
+ *------------------------------------- */
+#ifndef PIO_CLANGD_H
+#define PIO_CLANGD_H
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#if defined(PIO_CLANGD_BUILD)
+#define PIO_CLANGD_API __declspec(dllexport)
+#else
+#define PIO_CLANGD_API __declspec(dllimport)
+#endif
+#else
+#define PIO_CLANGD_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Status codes, equal to the C++ ErrorCode values */
+enum {
+  PIO_CLANGD_OK = 0,
+  PIO_CLANGD_ERROR_CONFIG = 1,
+  PIO_CLANGD_ERROR_NO_ENVIRONMENTS = 2,
+  PIO_CLANGD_ERROR_UNKNOWN_ENVIRONMENT = 3,
+  PIO_CLANGD_ERROR_INPUT = 4,
+  PIO_CLANGD_ERROR_INVALID_ARGUMENT = 5,
+  PIO_CLANGD_ERROR_INTERNAL = 6,
+};
+
+typedef struct pio_clangd_str {
+  const char* data;
+  size_t size;
+} pio_clangd_str;
+
+/* One environment's compile_commands.json: contents if json is not NULL,
+ * otherwise the file at path (null-terminated) */
+typedef struct pio_clangd_env {
+  const char* name;
+  const char* json;
+  size_t json_size;
+  const char* path;
+} pio_clangd_env;
+
+/* Failure details; env is empty when no environment is at fault */
+typedef struct pio_clangd_error {
+  int code;
+  char* env;
+  char* message;
+} pio_clangd_error;
+
+typedef struct pio_clangd_db pio_clangd_db;
+
+/* Deduplicates the environments for target_env (the first one if NULL or
+ * empty). On success stores the database in *out and returns
+ * PIO_CLANGD_OK, otherwise returns a status code and, if error is not
+ * NULL, stores details in *error to be freed with
+ * pio_clangd_error_free(). */
+PIO_CLANGD_API int pio_clangd_generate(const pio_clangd_env* envs,
+                                       size_t env_count,
+                                       const char* target_env,
+                                       pio_clangd_db** out,
+                                       pio_clangd_error** error);
+
+/* Same for the environments of a PlatformIO project; environment NULL or
+ * empty selects its default environment */
+PIO_CLANGD_API int pio_clangd_generate_project(const char* proj_path,
+                                               const char* environment,
+                                               pio_clangd_db** out,
+                                               pio_clangd_error** error);
+
+PIO_CLANGD_API void pio_clangd_db_free(pio_clangd_db* db);
+PIO_CLANGD_API void pio_clangd_error_free(pio_clangd_error* error);
+
+PIO_CLANGD_API pio_clangd_str pio_clangd_db_target_env(const pio_clangd_db* db);
+PIO_CLANGD_API size_t pio_clangd_db_input_entries(const pio_clangd_db* db);
+
+/* Output entries; index must be below pio_clangd_db_size() */
+PIO_CLANGD_API size_t pio_clangd_db_size(const pio_clangd_db* db);
+PIO_CLANGD_API pio_clangd_str pio_clangd_db_directory(const pio_clangd_db* db,
+                                                      size_t index);
+PIO_CLANGD_API pio_clangd_str pio_clangd_db_file(const pio_clangd_db* db,
+                                                 size_t index);
+/* The compiler, which compile_commands.json puts before the arguments;
+ * empty if the input command had none */
+PIO_CLANGD_API pio_clangd_str pio_clangd_db_driver(const pio_clangd_db* db,
+                                                   size_t index);
+PIO_CLANGD_API size_t pio_clangd_db_argument_count(const pio_clangd_db* db,
+                                                   size_t index);
+PIO_CLANGD_API pio_clangd_str pio_clangd_db_argument(const pio_clangd_db* db,
+                                                     size_t index,
+                                                     size_t arg);
+
+/* Contents of the equivalent compile_commands.json, serialized on the
+ * first call and owned by db */
+PIO_CLANGD_API int pio_clangd_db_json(pio_clangd_db* db,
+                                      pio_clangd_str* out,
+                                      pio_clangd_error** error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PIO_CLANGD_H */
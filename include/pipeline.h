@@ -0,0 +1,112 @@
+#pragma once
+#include <fmt/core.h>
+#include <cstdint>
+#include <cstdio>
+#include <expected>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include "clangd.h"
+#include "database.h"
+#include "intern.h"
+#include "lib_roots.h"
+#include "profile.h"
+#include "stat_cache.h"
+#include "targets.h"
+#include "toolchain.h"
+
+class PioConfig;
+
+/*--------------------------------------
+ *  Stages of gen_cmds(), shared with the server
+ *------------------------------------- */
+
+// Status message, unless status is null
+template <typename... Args>
+void print_status(std::FILE* status,
+                  fmt::format_string<Args...> format,
+                  Args&&... args) {
+  if (status) {
+    fmt::println(status, format, std::forward<Args>(args)...);
+  }
+}
+
+// Stamp of everything the outputs of gen_cmds() depend on: the inputs of
+// every environment of config, the options changing the entries, the
+// project's rules and with --infer-new the sources scan_sources() finds
+// that the rules accept
+TargetsStamp make_gen_stamp(const std::string& proj_path,
+                            const PioConfig& config,
+                            const GenOptions& options,
+                            const ProjectRules& rules);
+
+// What run_entry_passes() did
+struct PassStats {
+  size_t entries_patched{};
+  ToolchainStats toolchains{};
+  size_t include_dirs_pruned{};
+  size_t sources_missing{};
+  size_t sources_inferred{};
+  RootStats roots{};
+};
+
+/*-------------------------------------------------------------------
+ *  run_entry_passes()
+ *
+ *  Applies the passes options enable to the loaded entries of every
+ *  environment, before deduplication: --patch-flags first, so every
+ *  pass sees the flags a compiledb run would have generated, then
+ *  --toolchain-builtins, --prune-includes, --drop-missing, --infer-new
+ *  and last --dedup-content, when every entry has its final key.
+ *  --infer-new adds entries for those of sources, the stamp's of
+ *  make_gen_stamp(), no environment has one for.
+ *
+ *  Warnings go to stderr, progress messages to status unless it is
+ *  null. Returns what the passes did, or the error that stopped one.
+ *
+ *-----------------------------------------------------------------*/
+std::expected<PassStats, std::string> run_entry_passes(
+    std::vector<EnvDatabase>& envs,
+    const std::string& proj_path,
+    const PioConfig& config,
+    const GenOptions& options,
+    const ProjectRules& rules,
+    std::span<const std::string> sources,
+    InternPool& pool,
+    StatCache& stat_cache,
+    Profiler& profiler,
+    std::FILE* status);
+
+// The max_entries most relevant entries of target, ranked with the
+// lib_deps of its environment
+std::vector<const Entry*> entries_within_budget(const TargetDatabase& target,
+                                                const PioConfig& config,
+                                                const std::string& proj_path,
+                                                size_t max_entries);
+
+// What write_root_outputs() wrote
+struct RootOutput {
+  uint64_t bytes{};  // of compile_commands.json
+  size_t flags_factored{};
+  size_t rsp_files{};
+  size_t rsp_flags{};
+};
+
+/*-------------------------------------------------------------------
+ *  write_root_outputs()
+ *
+ *  Writes the project's compile_commands.json with the entries kept,
+ *  the .clangd block and response files options ask for, and the query
+ *  index of all of the target's entries. Without --clangd-config or
+ *  --rsp-output the block and the files of an earlier run are removed.
+ *
+ *-----------------------------------------------------------------*/
+std::expected<RootOutput, std::string> write_root_outputs(
+    std::span<const Entry* const> kept,
+    std::span<const Entry* const> all,
+    const std::string& proj_path,
+    const GenOptions& options,
+    InternPool& pool,
+    Profiler& profiler,
+    std::FILE* status);
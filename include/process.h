@@ -0,0 +1,54 @@
+#pragma once
+#include <expected>
+#include <string>
+#include <vector>
+
+// A child process with pipes connected to its stdin and stdout
+// Move-only; destruction closes both pipes and reaps the child. Only
+// implemented on POSIX systems, spawn() fails elsewhere.
+class ChildProcess {
+ public:
+  // Starts argv[0], searched in PATH, with the remaining arguments
+  // With merge_stderr the child's stderr also goes to the stdout pipe.
+  static std::expected<ChildProcess, std::string> spawn(
+      const std::vector<std::string>& argv,
+      bool merge_stderr = false);
+
+  ChildProcess() = default;
+  ~ChildProcess();
+
+  ChildProcess(ChildProcess&& other) noexcept;
+  ChildProcess& operator=(ChildProcess&& other) noexcept;
+  ChildProcess(const ChildProcess&) = delete;
+  ChildProcess& operator=(const ChildProcess&) = delete;
+
+  int stdin_fd() const { return stdin_fd_; }
+  int stdout_fd() const { return stdout_fd_; }
+
+  // Closes the child's stdin, signalling the end of its input
+  void close_stdin();
+
+  // Reads the child's stdout until the child closes it
+  std::expected<std::string, std::string> read_stdout();
+
+  // Waits for the child to exit
+  // Returns its exit code, or -1 if it was terminated by a signal.
+  int wait();
+
+ private:
+  void release();
+
+  int pid_{-1};
+  int stdin_fd_{-1};   // write end of the child's stdin
+  int stdout_fd_{-1};  // read end of the child's stdout
+};
+
+// Descriptors no child of ChildProcess::spawn() may inherit, POSIX only
+//
+// Each is close-on-exec from the start, also for spawn() running on
+// another thread: set atomically with pipe2(), SOCK_CLOEXEC and
+// accept4() where the system has them, otherwise under the lock spawn()
+// forks under. Each returns false or -1 with errno set on failure.
+bool cloexec_pipe(int fds[2]);
+int cloexec_socket(int domain, int type);
+int cloexec_accept(int listen_fd);
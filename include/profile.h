@@ -0,0 +1,100 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*--------------------------------------
+ *  Hardware counter profiling (--profile)
+ *------------------------------------- */
+
+// Milliseconds elapsed since start
+inline double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Counter values for one measured phase
+// A counter is std::nullopt when the kernel refused to open it
+struct PerfSample {
+  double ms{};
+  std::optional<uint64_t> cycles{};
+  std::optional<uint64_t> instructions{};
+  std::optional<uint64_t> cache_misses{};
+  std::optional<uint64_t> branch_misses{};
+};
+
+// Per-thread hardware counters backed by perf_event_open on Linux
+// On other platforms, or when counters are restricted (for example by
+// perf_event_paranoid inside containers), open() fails and only wall time
+// is collected.
+class PerfCounters {
+ public:
+  PerfCounters() = default;
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  // Opens the counters for the calling thread
+  // Returns an empty string on success, otherwise the reason for failure
+  std::string open();
+  void start();
+  PerfSample stop();
+
+ private:
+  static constexpr size_t NUM_COUNTERS = 4;
+  std::array<int, NUM_COUNTERS> fds_{-1, -1, -1, -1};
+  std::chrono::steady_clock::time_point start_{};
+};
+
+// Collects per-phase, per-thread samples and prints an IPC/miss table
+// Every member is a no-op when constructed with enabled == false.
+class Profiler {
+ public:
+  explicit Profiler(bool enabled) : enabled_(enabled) {}
+
+  // RAII measurement of one phase on the calling thread
+  class Phase {
+   public:
+    Phase(Profiler* profiler, std::string name, std::string thread);
+    ~Phase();
+
+    Phase(const Phase&) = delete;
+    Phase& operator=(const Phase&) = delete;
+
+   private:
+    Profiler* profiler_;  // nullptr when profiling is disabled
+    std::string name_;
+    std::string thread_;
+    PerfCounters counters_;
+  };
+
+  Phase phase(std::string name, std::string thread = "main") {
+    return Phase(enabled_ ? this : nullptr, std::move(name),
+                 std::move(thread));
+  }
+
+  // Prints the collected samples to out
+  void print(std::FILE* out = stdout) const;
+
+ private:
+  struct Row {
+    std::string name;
+    std::string thread;
+    PerfSample sample;
+  };
+
+  void record(Row row);
+  void note_unavailable(const std::string& reason);
+
+  bool enabled_;
+  mutable std::mutex mtx_;
+  std::vector<Row> rows_;
+  std::string unavailable_reason_;
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include "database.h"
+#include "mapped_file.h"
+
+/*--------------------------------------
+ *  Per-file flag lookup index (pio-clangd query)
+ *------------------------------------- */
+
+// Binary index written next to every database
+//
+// Layout, all integers in host byte order:
+//   header     magic, version, slot count, list words, string bytes
+//   displace   int32[slots]: per hash bucket, a seed (> 0) for the
+//              second hash, or -(slot + 1) for a bucket with one key
+//   slots      {key, directory, driver, list} per entry, strings as
+//              {offset, length} into the string region
+//   lists      uint32 words: argument count, then {offset, length} per
+//              argument; equal lists are stored once
+//   strings    bytes of every distinct string
+//
+// The displacement table makes the hash perfect: every key of the
+// database maps to its own slot, so a lookup is two hashes and one
+// string compare.
+inline constexpr uint32_t QUERY_INDEX_VERSION = 2;
+
+// Serializes entries as a query index to path
+// Returns the number of bytes written.
+std::expected<uint64_t, std::string> write_query_index(
+    std::span<const Entry* const> entries,
+    const std::filesystem::path& path);
+
+// Memory-mapped query index
+class QueryIndex {
+ public:
+  // Flags of one indexed file, views into the mapped index
+  class Command {
+   public:
+    std::string_view directory() const { return directory_; }
+    // Compiler of the command, empty if the entry had none
+    std::string_view driver() const { return driver_; }
+    size_t size() const { return size_; }
+    std::string_view argument(size_t i) const;
+
+   private:
+    friend class QueryIndex;
+
+    std::string_view directory_{};
+    std::string_view driver_{};
+    const char* refs_{nullptr};  // {offset, length} pairs
+    size_t size_{0};
+    std::string_view strings_{};
+  };
+
+  static std::expected<QueryIndex, std::string> open(
+      const std::filesystem::path& path);
+
+  // Command of the file with this make_dedup_key() key
+  std::optional<Command> find(std::string_view key) const;
+
+  size_t size() const { return slot_count_; }
+
+ private:
+  MappedFile file_{};
+  size_t slot_count_{0};
+  const char* displace_{nullptr};
+  const char* slots_{nullptr};
+  std::string_view lists_{};
+  std::string_view strings_{};
+};
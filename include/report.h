@@ -0,0 +1,133 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <glaze/glaze.hpp>
+#include <string>
+#include <vector>
+
+/*--------------------------------------
+ *  Machine-readable run report (--report)
+ *------------------------------------- */
+
+// Statistics for a single environment's compile_commands.json
+struct EnvReport {
+  std::string name{};
+  std::string input_path{};
+  uint64_t input_bytes{};
+  size_t entries{};
+  double parse_ms{};
+  size_t entries_won{};         // entries that made it into the output
+  size_t entries_lost{};        // dropped as duplicates, missing, excluded
+  size_t entries_missing{};     // source file no longer exists
+  size_t entries_excluded{};    // rejected by --include/--exclude
+  size_t entries_overridden{};  // flags changed by --overrides rules
+  size_t entries_inferred{};    // added for new sources by --infer-new
+  size_t entries_patched{};     // build_flags edits applied by --patch-flags
+  size_t flags_kept{};          // flags that passed the filter
+  size_t flags_dropped{};
+  size_t flags_duplicate{};     // redundant include dirs and macros removed
+
+  struct glaze {
+    using T = EnvReport;
+    static constexpr auto value = glz::object(
+      "name", &T::name,
+      "input_path", &T::input_path,
+      "input_bytes", &T::input_bytes,
+      "entries", &T::entries,
+      "parse_ms", &T::parse_ms,
+      "entries_won", &T::entries_won,
+      "entries_lost", &T::entries_lost,
+      "entries_missing", &T::entries_missing,
+      "entries_excluded", &T::entries_excluded,
+      "entries_overridden", &T::entries_overridden,
+      "entries_inferred", &T::entries_inferred,
+      "entries_patched", &T::entries_patched,
+      "flags_kept", &T::flags_kept,
+      "flags_dropped", &T::flags_dropped,
+      "flags_duplicate", &T::flags_duplicate);
+  };
+};
+
+// An additional per-environment output written with --all-targets
+struct TargetReport {
+  std::string env{};
+  std::string output_path{};
+  uint64_t output_bytes{};
+  size_t output_entries{};
+
+  struct glaze {
+    using T = TargetReport;
+    static constexpr auto value = glz::object(
+      "env", &T::env,
+      "output_path", &T::output_path,
+      "output_bytes", &T::output_bytes,
+      "output_entries", &T::output_entries);
+  };
+};
+
+// Statistics for one gen_cmds() run
+struct RunReport {
+  std::string project{};
+  std::string target_env{};
+  std::string output_path{};
+  uint64_t output_bytes{};
+  size_t input_entries{};
+  size_t output_entries{};
+  size_t entries_over_budget{};  // --max-entries, entries left out
+  size_t include_dirs_pruned{};  // --prune-includes
+  size_t sources_missing{};      // --drop-missing
+  size_t entries_excluded{};     // --include/--exclude
+  size_t entries_overridden{};   // --overrides
+  size_t sources_inferred{};     // --infer-new
+  size_t entries_patched{};      // --patch-flags
+  size_t roots_merged{};         // --dedup-content, library copies merged
+  size_t toolchains_queried{};   // --toolchain-builtins, compilers run
+  size_t toolchains_cached{};    // --toolchain-builtins, cache hits
+  size_t flags_factored{};       // --clangd-config, tokens moved to .clangd
+  size_t rsp_files{};            // --rsp-output, response files referenced
+  size_t rsp_flags{};            // --rsp-output, tokens moved to them
+  uint64_t peak_rss_bytes{};
+  double wall_ms{};
+  std::vector<EnvReport> envs{};
+  std::vector<TargetReport> targets{};
+
+  struct glaze {
+    using T = RunReport;
+    static constexpr auto value = glz::object(
+      "project", &T::project,
+      "target_env", &T::target_env,
+      "output_path", &T::output_path,
+      "output_bytes", &T::output_bytes,
+      "input_entries", &T::input_entries,
+      "output_entries", &T::output_entries,
+      "entries_over_budget", &T::entries_over_budget,
+      "include_dirs_pruned", &T::include_dirs_pruned,
+      "sources_missing", &T::sources_missing,
+      "entries_excluded", &T::entries_excluded,
+      "entries_overridden", &T::entries_overridden,
+      "sources_inferred", &T::sources_inferred,
+      "entries_patched", &T::entries_patched,
+      "roots_merged", &T::roots_merged,
+      "toolchains_queried", &T::toolchains_queried,
+      "toolchains_cached", &T::toolchains_cached,
+      "flags_factored", &T::flags_factored,
+      "rsp_files", &T::rsp_files,
+      "rsp_flags", &T::rsp_flags,
+      "peak_rss_bytes", &T::peak_rss_bytes,
+      "wall_ms", &T::wall_ms,
+      "envs", &T::envs,
+      "targets", &T::targets);
+  };
+};
+
+// Size of a file in bytes, 0 if it cannot be determined
+uint64_t file_bytes(const std::filesystem::path& path);
+
+// Peak resident set size of this process in bytes, 0 if unavailable
+uint64_t peak_rss_bytes();
+
+// Serializes the report as JSON to report_path
+std::expected<void, std::string> write_report(const RunReport& report,
+                                              const std::string& report_path);
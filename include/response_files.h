@@ -0,0 +1,58 @@
+#pragma once
+#include <expected>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "database.h"
+#include "intern.h"
+
+/*--------------------------------------
+ *  Shared response files (--rsp-output)
+ *------------------------------------- */
+
+// Response files are only worth it for prefixes at least this long
+inline constexpr size_t MIN_RSP_PREFIX = 8;
+
+// One response file, <proj>/.pio/clangd/flags-<hash>.rsp
+struct ResponseFile {
+  std::string name{};     // named after a hash of its content
+  std::string content{};  // one argument per line
+};
+
+// A database whose shared argument lists moved into response files
+// clangd expands "@file" arguments itself, relative to the entry's
+// directory.
+struct RspDatabase {
+  std::vector<Entry> entries{};        // "@file" and the remaining flags
+  std::vector<const Entry*> output{};  // points into entries
+  std::vector<ResponseFile> files{};   // sorted by name
+  size_t flags_moved{};                // tokens replaced by "@file"
+};
+
+/*-------------------------------------------------------------------
+ *  make_response_files()
+ *
+ *  Moves argument lists into response files: a list used by several
+ *  entries as a whole, and otherwise the longest prefix the list shares
+ *  with another one; either only with at least MIN_RSP_PREFIX flags.
+ *  Such an entry's arguments become "@file" followed by the rest of its
+ *  list. A prefix never ends between a flag and its value.
+ *
+ *  The reference is relative to the project for entries run in the
+ *  project directory, as PlatformIO does, and absolute otherwise.
+ *
+ *-----------------------------------------------------------------*/
+RspDatabase make_response_files(std::span<const Entry* const> entries,
+                                const std::string& proj_path,
+                                InternPool& pool);
+
+// Writes the response files to <proj>/.pio/clangd that do not exist yet
+// and removes those of earlier runs no longer referenced; with no files
+// it only removes. Returns the number of files written.
+std::expected<size_t, std::string> write_response_files(
+    std::span<const ResponseFile> files,
+    const std::string& proj_path);
+
+// Quotes an argument for a response file as clang tokenizes it
+std::string rsp_quote(std::string_view arg);
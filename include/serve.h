@@ -0,0 +1,194 @@
+#pragma once
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <glaze/glaze.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "database.h"
+#include "intern.h"
+#include "targets.h"
+
+class PioConfig;
+
+/*--------------------------------------
+ *  Resident daemon (pio-clangd serve)
+ *------------------------------------- */
+
+// Requests and responses are single lines of JSON over a Unix socket:
+//   {"method":"regenerate","force":false}  reload changed inputs, write
+//                                          compile_commands.json
+//   {"method":"switch","env":"native"}     retarget, write the outputs
+//   {"method":"lookup","file":"src/a.cpp","directory":"/proj"}
+//                                          flags of one file; directory
+//                                          defaults to the project
+//   {"method":"stats"}                     counters of this server
+//   {"method":"shutdown"}                  stop the server
+// Every response has "ok", failed ones an "error" message.
+struct ServeRequest {
+  std::string method{};
+  std::optional<std::string> env{};
+  std::optional<std::string> file{};
+  std::optional<std::string> directory{};
+  bool force{false};
+
+  struct glaze {
+    using T = ServeRequest;
+    static constexpr auto value = glz::object(
+      "method", &T::method,
+      "env", &T::env,
+      "file", &T::file,
+      "directory", &T::directory,
+      "force", &T::force);
+  };
+};
+
+struct ServeStats {
+  std::string project{};
+  std::string target_env{};
+  size_t environments{};
+  size_t input_entries{};
+  size_t output_entries{};
+  uint64_t loads{};     // times the environment databases were parsed
+  double load_ms{};     // duration of the last load
+  uint64_t requests{};  // requests handled, including this one
+  uint64_t peak_rss_bytes{};
+  double uptime_s{};
+
+  struct glaze {
+    using T = ServeStats;
+    static constexpr auto value = glz::object(
+      "project", &T::project,
+      "target_env", &T::target_env,
+      "environments", &T::environments,
+      "input_entries", &T::input_entries,
+      "output_entries", &T::output_entries,
+      "loads", &T::loads,
+      "load_ms", &T::load_ms,
+      "requests", &T::requests,
+      "peak_rss_bytes", &T::peak_rss_bytes,
+      "uptime_s", &T::uptime_s);
+  };
+};
+
+// Views into the server's state, serialized before the lock is released
+struct ServeResponse {
+  bool ok{true};
+  std::optional<std::string> error{};
+  std::optional<std::string_view> env{};
+  std::optional<size_t> entries{};
+  std::optional<bool> reloaded{};
+  std::optional<std::string_view> directory{};
+  std::optional<std::string_view> driver{};
+  std::optional<std::span<const std::string_view>> arguments{};
+  std::optional<ServeStats> stats{};
+
+  struct glaze {
+    using T = ServeResponse;
+    static constexpr auto value = glz::object(
+      "ok", &T::ok,
+      "error", &T::error,
+      "env", &T::env,
+      "entries", &T::entries,
+      "reloaded", &T::reloaded,
+      "directory", &T::directory,
+      "driver", &T::driver,
+      "arguments", &T::arguments,
+      "stats", &T::stats);
+  };
+};
+
+struct ServeOptions {
+  std::string proj_path{};
+  std::string environment{};  // empty for the default environment
+  std::string socket_path{};  // empty for <proj>/.pio/clangd/serve.sock
+  GenOptions gen{};  // the entries and outputs are made like gen_cmds()'s
+};
+
+// Default socket of a project's server
+std::filesystem::path default_socket_path(const std::string& proj_path);
+
+// Warm gen_cmds() state of one project, shared by all connections
+//
+// The filtered databases of every environment stay in memory, after the
+// same passes gen_cmds() runs with options.gen. Each request first stats
+// the inputs and reparses only when one changed, so switching targets or
+// looking up a file costs a dedup pass or a hash lookup instead of a
+// cold parse.
+class ProjectServer {
+ public:
+  explicit ProjectServer(ServeOptions options);
+
+  // Parses the inputs of every environment and dedups for the initial
+  // environment without writing anything. Requests load lazily as well.
+  std::expected<void, std::string> load();
+
+  // Handles one request line and returns the response line
+  std::string handle(std::string_view request);
+
+  // Whether a shutdown request was handled
+  bool stop_requested() const;
+
+ private:
+  // Reparses the inputs if they changed since the last load, or always
+  // with force, and runs the passes of options_.gen on them. Returns
+  // whether they were reparsed. Caller holds mtx_.
+  std::expected<bool, std::string> refresh(bool force);
+
+  // Dedups for env. Caller holds mtx_.
+  std::expected<void, std::string> retarget(const std::string& env);
+
+  // Writes compile_commands.json and its query index like gen_cmds().
+  // Returns the number of entries written. Caller holds mtx_.
+  std::expected<size_t, std::string> write_outputs();
+
+  ServeResponse dispatch(const ServeRequest& request);
+
+  const ServeOptions options_;
+  const std::chrono::steady_clock::time_point start_time_;
+
+  mutable std::mutex mtx_;  // guards everything below
+  std::unique_ptr<InternPool> pool_{};
+  std::shared_ptr<const PioConfig> config_{};  // envs_ was loaded with it
+  std::vector<std::string> environments_{};
+  ProjectRules rules_{};  // envs_ was made with these
+  std::vector<EnvDatabase> envs_{};
+  std::optional<TargetsStamp> stamp_{};  // inputs envs_ was loaded from
+  std::string target_env_{};
+  TargetDatabase target_{};
+  boost::unordered_flat_map<std::string_view, const Entry*> by_key_{};
+  std::string key_{};  // scratch buffer for lookups
+  ServeStats stats_{};
+  bool stop_requested_{false};
+};
+
+/*-------------------------------------------------------------------
+ *  serve_project()
+ *
+ *  Answers requests on a Unix domain socket until a shutdown request
+ *  arrives or stop is requested. Every connection is served by its own
+ *  thread; requests are handled one at a time. A leftover socket file
+ *  of a server that is no longer running is replaced.
+ *
+ *  Params:
+ *    options  project, initial environment and socket path
+ *    stop     stops the server when requested
+ *  Returns EXIT_SUCCESS after a clean shutdown
+ *
+ *-----------------------------------------------------------------*/
+int serve_project(const ServeOptions& options, std::stop_token stop = {});
+
+// serve_project() until SIGINT or SIGTERM
+int run_serve(const ServeOptions& options);
+
+// Sends one request line to a running server and returns its response
+std::expected<std::string, std::string> serve_request(
+    const std::string& socket_path,
+    std::string_view request);
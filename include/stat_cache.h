@@ -0,0 +1,51 @@
+#pragma once
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <cstdint>
+#include <functional>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+
+/*--------------------------------------
+ *  Deduplicated, parallel stat cache
+ *------------------------------------- */
+
+// File system status of paths, each path stat'ed once
+//
+// Entries reference the same toolchain and framework directories
+// thousands of times. Callers collect the distinct paths first and stat
+// them in one parallel batch, afterwards lookups are hash lookups.
+// Calls may run concurrently, e.g. for the projects of a workspace.
+class StatCache {
+ public:
+  enum class Status : uint8_t {
+    missing,
+    file,
+    directory,
+    empty_directory,
+    other,  // exists, but neither a regular file nor a directory
+  };
+
+  // Stats the paths that are not cached yet, in parallel
+  void stat_all(std::span<const std::string> paths);
+
+  // Status of a path passed to stat_all(), missing if it never was
+  Status status(std::string_view path) const;
+
+  bool contains(std::string_view path) const;
+
+  size_t size() const;
+
+ private:
+  struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view str) const {
+      return std::hash<std::string_view>{}(str);
+    }
+  };
+
+  mutable std::shared_mutex mtx_;  // guards statuses_
+  boost::unordered_flat_map<std::string, Status, StringHash, std::equal_to<>>
+      statuses_;
+};
@@ -0,0 +1,118 @@
+#pragma once
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <expected>
+#include <glaze/glaze.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "clangd.h"
+#include "database.h"
+#include "intern.h"
+#include "report.h"
+
+/*--------------------------------------
+ *  Streaming compile databases (--stdin)
+ *------------------------------------- */
+
+// A compile command tagged with its environment, as read from a stream
+struct TaggedCommand : CompileCommand {
+  std::optional<std::string> env{};
+
+  struct glaze {
+    using T = TaggedCommand;
+    static constexpr auto value = glz::object(
+      "env", &T::env,
+      "directory", &T::directory,
+      "file", &T::file,
+      "command", &T::command,
+      "arguments", &T::arguments,
+      "output", &T::output);
+  };
+};
+
+// Deduplicates compile commands while they are read
+//
+// Input is any sequence of JSON arrays of compile commands and single
+// compile command objects, e.g. one per line. Every command names its
+// environment in "env"; untagged commands belong to the target.
+// Environments are prioritized like gen_cmds() does, the target first and
+// the others in order of their first command. A target entry is final as
+// soon as it is read, all other entries once the input ends.
+class CommandStream {
+ public:
+  // An empty target_env selects the environment of the first command
+  // Commands are made with rules: the ones its path filter rejects are
+  // dropped as they are read, the flags of the others changed by its
+  // overrides.
+  explicit CommandStream(std::string target_env, ProjectRules rules = {});
+
+  // Reads the next chunk of input, commands may span chunks
+  std::expected<void, std::string> feed(std::string_view chunk);
+
+  // Ends the input and finalizes the remaining entries
+  std::expected<void, std::string> finish();
+
+  // Entries finalized so far, in output order
+  const std::vector<const Entry*>& entries() const { return output_; }
+
+  const std::string& target_env() const { return target_env_; }
+
+  // Statistics per environment, in order of their first command
+  std::vector<EnvReport> env_reports() const;
+
+ private:
+  struct EnvState {
+    EnvReport stats{};
+    std::deque<Entry> entries{};  // stable addresses for output_
+  };
+
+  std::expected<void, std::string> add_command();
+
+  std::string target_env_;
+  ProjectRules rules_;
+  InternPool pool_{};
+  std::vector<EnvState> envs_{};
+  std::optional<size_t> target_idx_{};
+  boost::unordered_flat_set<const char*> seen_{};  // interned keys
+  std::vector<const Entry*> output_{};
+
+  // Scanner state
+  uint64_t offset_{};    // input bytes consumed, for error messages
+  std::string object_{};  // text of the command being read
+  int depth_{};           // nesting inside object_, 0 between commands
+  bool in_array_{false};
+  bool in_string_{false};
+  bool escaped_{false};
+
+  // Scratch buffers for make_entry()
+  TaggedCommand tagged_{};
+  EntryScratch scratch_{};
+};
+
+/*-------------------------------------------------------------------
+ *  stream_cmds()
+ *
+ *  gen_cmds() for compile databases read from in (--stdin). Entries are
+ *  written to out as a JSON array while they are finalized, or to the
+ *  project's compile_commands.json if out is null. Status messages go to
+ *  stderr when out is set.
+ *
+ *  Params:
+ *    proj_path    project root, only needed to write compile_commands.json
+ *                 or to look up default_envs
+ *    environment  target environment, empty for the project's default or
+ *                 else the environment of the first command
+ *    options      only report_path, include, exclude and overrides_path
+ *                 apply
+ *  Returns EXIT_SUCCESS or EXIT_FAILURE
+ *
+ *-----------------------------------------------------------------*/
+int stream_cmds(const std::string& proj_path,
+                const std::string& environment,
+                const GenOptions& options,
+                std::FILE* in,
+                std::FILE* out);
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <glaze/glaze.hpp>
+#include <string>
+#include <vector>
+
+/*--------------------------------------
+ *  Precomputed per-environment databases (--all-targets, --switch)
+ *------------------------------------- */
+
+// Bumped whenever the content of generated databases changes, so stale
+// precomputed outputs are regenerated after an upgrade
+inline constexpr uint32_t TARGETS_FORMAT_VERSION = 2;
+
+// Size and modification time of one input file
+struct FileStamp {
+  std::string path{};
+  uint64_t size{};
+  int64_t mtime{};  // file_time_type ticks, 0 if the file is missing
+
+  bool operator==(const FileStamp&) const = default;
+
+  struct glaze {
+    using T = FileStamp;
+    static constexpr auto value = glz::object(
+      "path", &T::path,
+      "size", &T::size,
+      "mtime", &T::mtime);
+  };
+};
+
+// Stamp of path as it is now
+FileStamp make_file_stamp(const std::filesystem::path& path);
+
+// Everything the precomputed databases were generated from
+// Every output depends on every environment's input, because each one
+// is deduplicated across all environments.
+struct TargetsStamp {
+  uint32_t version{TARGETS_FORMAT_VERSION};
+  std::vector<std::string> envs{};  // platformio.ini order sets priority
+  std::vector<FileStamp> inputs{};
+  // Outputs depend on the file system with these
+  bool prune_includes{false};
+  bool drop_missing{false};
+  bool add_builtins{false};
+  bool infer_new{false};
+  bool patch_flags{false};
+  bool dedup_content{false};
+  std::vector<std::string> include{};  // --include/--exclude globs
+  std::vector<std::string> exclude{};
+  std::vector<std::string> dedup_rules{};  // [pio-clangd] dedup_rules
+  size_t max_entries{};
+  std::vector<std::string> sources{};  // scanned by --infer-new
+
+  bool operator==(const TargetsStamp&) const = default;
+
+  struct glaze {
+    using T = TargetsStamp;
+    static constexpr auto value = glz::object(
+      "version", &T::version,
+      "envs", &T::envs,
+      "inputs", &T::inputs,
+      "prune_includes", &T::prune_includes,
+      "drop_missing", &T::drop_missing,
+      "add_builtins", &T::add_builtins,
+      "infer_new", &T::infer_new,
+      "patch_flags", &T::patch_flags,
+      "dedup_content", &T::dedup_content,
+      "include", &T::include,
+      "exclude", &T::exclude,
+      "dedup_rules", &T::dedup_rules,
+      "max_entries", &T::max_entries,
+      "sources", &T::sources);
+  };
+};
+
+// Directory holding the per-environment databases, <proj>/.pio/clangd
+std::filesystem::path targets_dir(const std::string& proj_path);
+
+// Database prioritized for env, <proj>/.pio/clangd/<env>/compile_commands.json
+std::filesystem::path target_database_path(const std::string& proj_path,
+                                           const std::string& env);
+
+// Query index of the root database, <proj>/.pio/clangd/compile_commands.idx
+std::filesystem::path root_index_path(const std::string& proj_path);
+
+// Query index of env's database, next to the database
+std::filesystem::path target_index_path(const std::string& proj_path,
+                                        const std::string& env);
+
+// Stamps the current inputs of all environments
+TargetsStamp make_targets_stamp(const std::string& proj_path,
+                                const std::vector<std::string>& envs);
+
+// Whether the precomputed databases were generated from exactly these
+// inputs and all of them and their indexes still exist
+bool targets_current(const std::string& proj_path,
+                     const TargetsStamp& stamp);
+
+// Records the inputs the precomputed databases were generated from
+std::expected<void, std::string> write_targets_stamp(
+    const std::string& proj_path,
+    const TargetsStamp& stamp);
+
+/*-------------------------------------------------------------------
+ *  link_database()
+ *
+ *  Points <proj>/compile_commands.json at the precomputed database of
+ *  env, and the root query index at env's index. A relative symlink is
+ *  created next to each destination and renamed over it, so the switch
+ *  is atomic and independent of the database size. Where symlinks are
+ *  unavailable (unprivileged Windows) the files are copied instead,
+ *  still replacing them atomically.
+ *
+ *  Params:
+ *    proj_path  directory containing platformio.ini
+ *    env        environment whose database to activate
+ *  Returns result wrapped in std::expected:
+ *    Success: void
+ *    Error: error message as string
+ *
+ *-----------------------------------------------------------------*/
+std::expected<void, std::string> link_database(const std::string& proj_path,
+                                               const std::string& env);
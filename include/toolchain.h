@@ -0,0 +1,108 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <expected>
+#include <filesystem>
+#include <glaze/glaze.hpp>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "database.h"
+#include "intern.h"
+
+/*--------------------------------------
+ *  Builtin include directories and macros of the compilers
+ *------------------------------------- */
+
+// What a compiler searches and predefines without being told
+// clangd only sees the filtered flags, so without these it misses the
+// cross compiler's own headers and target macros, or needs
+// --query-driver, which runs the compiler again on every clangd start.
+struct ToolchainBuiltins {
+  std::string key{};                       // see toolchain_key()
+  std::vector<std::string> system_dirs{};  // <...> search list, in order
+  std::vector<std::string> macros{};       // "-DNAME=VALUE", needed only
+
+  struct glaze {
+    using T = ToolchainBuiltins;
+    static constexpr auto value = glz::object(
+      "key", &T::key,
+      "system_dirs", &T::system_dirs,
+      "macros", &T::macros);
+  };
+};
+
+// Prefixes of the predefined macros passed on to clangd. clangd runs
+// with its host target, which defines none of these; the rest of the
+// compiler's predefined macros clangd defines itself.
+// Must be sorted for std::upper_bound.
+inline constexpr std::array<std::string_view, 11> BUILTIN_MACRO_STEMS = {
+    "__ARM",              // ARM architecture and features
+    "__AVR",              // AVR architecture
+    "__CHAR_UNSIGNED__",  // Plain char is unsigned (ARM)
+    "__SOFTFP__",         // ARM soft float ABI
+    "__VFP_FP__",         // ARM floating point format
+    "__XTENSA",           // Xtensa architecture and endianness
+    "__arm__",            // ARM architecture
+    "__avr",              // AVR architecture
+    "__riscv",            // RISC-V architecture and extensions
+    "__thumb",            // ARM Thumb instruction set
+    "__xtensa",           // Xtensa architecture
+};
+
+// Determines if a predefined macro is passed on to clangd
+constexpr bool builtin_macro_needed(std::string_view name) {
+  auto it = std::upper_bound(BUILTIN_MACRO_STEMS.begin(),
+                             BUILTIN_MACRO_STEMS.end(), name);
+  return it != BUILTIN_MACRO_STEMS.begin() &&
+         name.starts_with(*std::prev(it));
+}
+
+// Parses the output of "<driver> -E -v -dM -", stderr merged into stdout
+// Fails if the output has no include search list.
+std::expected<ToolchainBuiltins, std::string> parse_builtins(
+    std::string_view output);
+
+// Cache key of a driver queried for language ("c" or "c++") with the
+// target flags of a command: the driver, its modification time, the
+// language and the flags
+std::string toolchain_key(std::string_view driver,
+                          std::string_view language,
+                          std::span<const std::string> flags);
+
+// Runs the driver once with the target flags and parses its output
+std::expected<ToolchainBuiltins, std::string> query_builtins(
+    const std::string& driver,
+    std::string_view language,
+    std::span<const std::string> flags);
+
+// $XDG_CACHE_HOME/pio-clangd, or ~/.cache/pio-clangd
+std::filesystem::path default_cache_dir();
+
+// Outcome of inject_toolchain_builtins()
+struct ToolchainStats {
+  size_t queried{};                   // compilers run
+  size_t cached{};                    // taken from the cache
+  std::vector<std::string> errors{};  // compilers that could not be run
+};
+
+/*-------------------------------------------------------------------
+ *  inject_toolchain_builtins()
+ *
+ *  Adds the builtin macros and include directories of each entry's
+ *  compiler to its arguments: the macros first, as the compiler
+ *  predefines them before the command line, the directories as
+ *  -isystem flags last, as the compiler searches them after every
+ *  directory of the command line.
+ *
+ *  Each distinct driver, language and set of target flags (-m*,
+ *  --target, --sysroot) is queried once, in parallel, and the result is
+ *  cached as JSON in cache_dir. Entries whose compiler cannot be
+ *  queried are left as they are.
+ *
+ *-----------------------------------------------------------------*/
+ToolchainStats inject_toolchain_builtins(
+    std::span<EnvDatabase> envs,
+    InternPool& pool,
+    const std::filesystem::path& cache_dir);
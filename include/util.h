@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/*--------------------------------------
+ *  Helpers shared by the passes
+ *------------------------------------- */
+
+inline constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+
+// FNV-1a of str continuing from h; unlike std::hash it does not change
+// between runs, so it can name cache files and digest contents
+inline uint64_t fnv1a(std::string_view str, uint64_t h = FNV_OFFSET) {
+  for (unsigned char c : str) {
+    h ^= c;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+// Takes up to wanted threads from the process-wide budget of threads
+// beyond the main one, hardware_concurrency() - 1, and returns how many
+// it took; release_threads() gives them back
+size_t reserve_threads(size_t wanted);
+void release_threads(size_t count);
+
+/*-------------------------------------------------------------------
+ *  parallel_for()
+ *
+ *  Calls fn(i) for every i below count on the calling thread and the
+ *  workers it can reserve_threads(), and returns when all calls did.
+ *  Workers take batch indices at a time, so uneven items spread over
+ *  them; a larger batch suits many short calls.
+ *
+ *  Nested and concurrent calls share the budget: a call inside another
+ *  one's fn only starts the threads the outer call left spare, and
+ *  without any runs on its caller alone. The cores are never
+ *  oversubscribed, e.g. by the stages of the projects of a workspace,
+ *  and an outer call with few items leaves the rest to inner ones.
+ *
+ *-----------------------------------------------------------------*/
+template <typename Fn>
+void parallel_for(size_t count, Fn&& fn, size_t batch = 1) {
+  std::atomic<size_t> next{0};
+  auto worker = [&] {
+    for (size_t begin; (begin = next.fetch_add(batch)) < count;) {
+      for (size_t i = begin, end = std::min(begin + batch, count); i < end;
+           ++i) {
+        fn(i);
+      }
+    }
+  };
+  size_t batches = (count + batch - 1) / batch;
+  size_t reserved = reserve_threads(batches > 1 ? batches - 1 : 0);
+
+  // A worker out of items gives its thread back to calls still running
+  std::vector<std::jthread> workers;
+  for (size_t i = 0; i < reserved; ++i) {
+    workers.emplace_back([&] {
+      worker();
+      release_threads(1);
+    });
+  }
+  worker();
+}
+
+// Temporary path next to path, unique per process and thread, to stage
+// a file that is then renamed over path
+std::filesystem::path staging_path(const std::filesystem::path& path);
+
+/*-------------------------------------------------------------------
+ *  write_file_atomic()
+ *
+ *  Writes content to a temporary file next to path and renames it over
+ *  path, so readers such as clangd never see a partial file. The
+ *  temporary file is a staging_path(): concurrent writers of one path,
+ *  e.g. runs filling the same cache, each rename a complete file.
+ *
+ *  Returns nothing, or the error message; the temporary file is removed
+ *  on failure.
+ *
+ *-----------------------------------------------------------------*/
+std::expected<void, std::string> write_file_atomic(
+    const std::filesystem::path& path,
+    std::string_view content);
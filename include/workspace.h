@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "clangd.h"
+
+/*--------------------------------------
+ *  Many projects in one run (pio-clangd workspace)
+ *------------------------------------- */
+
+struct WorkspaceOptions {
+  std::string root{};
+  std::string environment{};  // target of the projects declaring it
+  GenOptions gen{};           // applied to every project
+  bool combined{false};       // also write <root>/compile_commands.json
+};
+
+// Project directories below root, root included: absolute, lexically
+// normal and sorted. Hidden directories and those below a project,
+// e.g. the examples of its libraries, are skipped; the directories of
+// root are walked in parallel.
+std::vector<std::string> find_projects(const std::string& root);
+
+/*-------------------------------------------------------------------
+ *  run_workspace()
+ *
+ *  Runs gen_cmds() for every project find_projects() finds below
+ *  options.root. Projects are generated concurrently by one set of
+ *  workers and share one InternPool and StatCache, so the toolchain
+ *  and framework paths all projects use are interned and stat'ed once.
+ *  The parallel stages of each project only use the threads the
+ *  projects leave spare, see parallel_for(), so the cores are never
+ *  oversubscribed.
+ *  Each project gets its own outputs as if pio-clangd ran in it; its
+ *  status messages are left out for one line per project.
+ *
+ *  With options.combined, the root databases of all projects are also
+ *  merged into <root>/compile_commands.json with a query index, the
+ *  project sorting first keeping a file several projects build.
+ *
+ *  Returns EXIT_SUCCESS if every project was generated
+ *
+ *-----------------------------------------------------------------*/
+int run_workspace(const WorkspaceOptions& options);
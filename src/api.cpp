@@ -0,0 +1,110 @@
+#include "api.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include "ini.h"
+#include "util.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+size_t CompileDatabase::input_entries() const {
+  size_t total = 0;
+  for (const auto& env : envs_) {
+    total += env.entries.size();
+  }
+  return total;
+}
+
+expected<string, string> CompileDatabase::to_json() const {
+  return serialize_database(target_.entries);
+}
+
+expected<CompileDatabase, GenError> generate(span<const EnvInput> inputs,
+                                             string_view target_env,
+                                             const EntryRules& rules) {
+  if (inputs.empty()) {
+    return unexpected(GenError{.code = ErrorCode::no_environments,
+                               .message = "No environments given"});
+  }
+  auto target = target_env.empty()
+                    ? inputs.begin()
+                    : std::ranges::find(inputs, target_env, &EnvInput::name);
+  if (target == inputs.end()) {
+    return unexpected(GenError{
+        .code = ErrorCode::unknown_environment,
+        .env = string{target_env},
+        .message = fmt::format("Environment '{}' not found", target_env),
+    });
+  }
+
+  CompileDatabase db;
+  db.pool_ = std::make_unique<InternPool>();
+  db.envs_.resize(inputs.size());
+
+  // Each worker only touches its own slot, like load_env_databases()
+  vector<std::optional<string>> errors(inputs.size());
+  auto thread_proc = [&](size_t idx) -> void {
+    const EnvInput& input = inputs[idx];
+    auto commands =
+        input.json ? parse_compile_commands(*input.json, input.name)
+                   : read_compile_commands(input.path);
+    if (!commands) {
+      errors[idx] = std::move(commands.error());
+      return;
+    }
+    db.envs_[idx] =
+        make_env_database(input.name, *commands, *db.pool_, rules);
+  };
+
+  parallel_for(inputs.size(), thread_proc);
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (errors[i]) {
+      return unexpected(GenError{.code = ErrorCode::input,
+                                 .env = inputs[i].name,
+                                 .message = std::move(*errors[i])});
+    }
+  }
+
+  db.target_ = resolve_target(db.envs_, target - inputs.begin());
+  return db;
+}
+
+expected<CompileDatabase, GenError> generate_project(
+    const string& proj_path,
+    const string& environment) {
+  auto config = load_pio_config(proj_path);
+  if (!config) {
+    return unexpected(
+        GenError{.code = ErrorCode::config, .message = config.error()});
+  }
+  const vector<string>& environments = (*config)->envs();
+  if (environments.empty()) {
+    return unexpected(
+        GenError{.code = ErrorCode::no_environments,
+                 .message = "No environments found in platformio.ini"});
+  }
+
+  auto rules = load_project_rules(config->get(), {}, proj_path);
+  if (!rules) {
+    return unexpected(
+        GenError{.code = ErrorCode::config, .message = rules.error()});
+  }
+
+  vector<EnvInput> inputs;
+  inputs.reserve(environments.size());
+  for (const auto& env : environments) {
+    inputs.push_back(
+        EnvInput{.name = env, .path = env_database_path(proj_path, env)});
+  }
+
+  // Unlike gen_cmds() there is no fallback for an unknown environment,
+  // a caller asking for one gets the error
+  auto target_env =
+      environment.empty() ? (*config)->default_env() : environment;
+  return generate(inputs, target_env, rules->entry_rules());
+}
@@ -0,0 +1,311 @@
+#include "build_flags.h"
+#include <fmt/core.h>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include "clangd.h"
+#include "ini.h"
+#include "key_rules.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// A flag with its separate value, if any, e.g. "-include" "cfg.h"
+struct Flag {
+  string_view flag{};
+  string_view value{};
+
+  string text() const { return string{flag}.append(value); }
+
+  // "-I inc" and "-Iinc" are the same flag
+  bool same(const Flag& other) const {
+    return flag.size() + value.size() ==
+               other.flag.size() + other.value.size() &&
+           text() == other.text();
+  }
+};
+
+// Groups arguments into flags the way process_tokens() does
+vector<Flag> group_flags(span<const string> args) {
+  vector<Flag> flags;
+  for (size_t i = 0; i < args.size(); ++i) {
+    Flag flag{.flag = args[i]};
+    if (std::ranges::binary_search(FLAGS_WITH_VALUES, flag.flag) &&
+        i + 1 < args.size() && !args[i + 1].starts_with('-')) {
+      flag.value = args[++i];
+    }
+    flags.push_back(flag);
+  }
+  return flags;
+}
+
+bool contains(span<const Flag> flags, const Flag& flag) {
+  return std::ranges::any_of(flags,
+                             [&](const Flag& f) { return f.same(flag); });
+}
+
+// "-DNAME" without a value, which PlatformIO unflags by name
+bool macro_name(const Flag& flag) {
+  return flag.value.empty() && flag.flag.size() > 2 &&
+         flag.flag.starts_with("-D") &&
+         flag.flag.find('=') == string_view::npos;
+}
+
+// True if unflag removes flag
+bool unflags(const Flag& unflag, const Flag& flag) {
+  return unflag.same(flag) ||
+         (macro_name(unflag) && flag.flag.starts_with(unflag.flag) &&
+          flag.flag.size() > unflag.flag.size() &&
+          flag.flag[unflag.flag.size()] == '=');
+}
+
+// Dynamic build flags, the output of a command
+bool dynamic(const Flag& flag) {
+  return flag.flag.starts_with('!');
+}
+
+fs::path baselines_path(const string& proj_path) {
+  return targets_dir(proj_path) / "build_flags.json";
+}
+
+}  // namespace
+
+vector<string> split_flags(string_view line) {
+  vector<string> args;
+  string arg;
+  bool in_arg = false;
+  char quote = 0;
+  for (size_t i = 0; i < line.size(); ++i) {
+    char ch = line[i];
+    if (quote == '\'') {
+      if (ch == '\'') {
+        quote = 0;
+      } else {
+        arg.push_back(ch);
+      }
+      continue;
+    }
+    if (ch == '\\' && i + 1 < line.size()) {
+      // Within double quotes only these lose their meaning
+      char next = line[i + 1];
+      if (quote == '"' && next != '"' && next != '\\' && next != '$' &&
+          next != '`') {
+        arg.push_back(ch);
+        continue;
+      }
+      arg.push_back(next);
+      in_arg = true;
+      ++i;
+      continue;
+    }
+    if (quote == '"') {
+      if (ch == '"') {
+        quote = 0;
+      } else {
+        arg.push_back(ch);
+      }
+      continue;
+    }
+    if (ch == '\'' || ch == '"') {
+      quote = ch;
+      in_arg = true;
+    } else if (std::isspace(static_cast<unsigned char>(ch))) {
+      if (in_arg) {
+        args.push_back(std::move(arg));
+        arg.clear();
+        in_arg = false;
+      }
+    } else {
+      arg.push_back(ch);
+      in_arg = true;
+    }
+  }
+  if (in_arg) {
+    args.push_back(std::move(arg));
+  }
+  return args;
+}
+
+BuildFlags read_build_flags(const PioConfig& config, const string& env) {
+  auto read = [&](string_view option) {
+    vector<string> args;
+    for (auto& line : config.get_list("env:" + env, option)) {
+      // A command's output is unknown, keep it whole to compare
+      if (line.starts_with('!')) {
+        args.push_back(std::move(line));
+        continue;
+      }
+      auto split = split_flags(line);
+      args.insert(args.end(), std::make_move_iterator(split.begin()),
+                  std::make_move_iterator(split.end()));
+    }
+    return args;
+  };
+  return {.flags = read("build_flags"), .unflags = read("build_unflags")};
+}
+
+expected<OverrideRule, string> diff_build_flags(const BuildFlags& built,
+                                                const BuildFlags& now) {
+  auto built_flags = group_flags(built.flags);
+  auto built_unflags = group_flags(built.unflags);
+  auto now_flags = group_flags(now.flags);
+  auto now_unflags = group_flags(now.unflags);
+
+  for (const auto& unflag : built_unflags) {
+    if (!contains(now_unflags, unflag)) {
+      return unexpected(
+          fmt::format("'{}' is no longer in build_unflags", unflag.text()));
+    }
+  }
+
+  OverrideRule rule{.path = "/"};
+  auto remove = [&](const Flag& flag) {
+    rule.remove.push_back(flag.text());
+    if (macro_name(flag)) {
+      rule.remove.push_back(flag.text() + "=*");
+    }
+  };
+  for (const auto& flag : built_flags) {
+    if (contains(now_flags, flag)) {
+      continue;
+    }
+    if (dynamic(flag)) {
+      return unexpected(
+          fmt::format("the output of '{}' is unknown", flag.flag.substr(1)));
+    }
+    // Removed from build_flags, not by name like an unflag
+    rule.remove.push_back(flag.text());
+  }
+  for (const auto& unflag : now_unflags) {
+    if (!contains(built_unflags, unflag)) {
+      remove(unflag);
+    }
+  }
+
+  vector<string_view> added{""};  // process_tokens() skips the driver
+  for (const auto& flag : now_flags) {
+    if (contains(built_flags, flag)) {
+      continue;
+    }
+    if (dynamic(flag)) {
+      return unexpected(
+          fmt::format("the output of '{}' is unknown", flag.flag.substr(1)));
+    }
+    bool unflagged = std::ranges::any_of(
+        now_unflags, [&](const Flag& unflag) { return unflags(unflag, flag); });
+    if (!unflagged) {
+      added.push_back(flag.flag);
+      if (!flag.value.empty()) {
+        added.push_back(flag.value);
+      }
+    }
+  }
+  vector<string_view> filtered;
+  process_tokens(added, filtered);
+  rule.add.assign(filtered.begin(), filtered.end());
+  return rule;
+}
+
+FlagPatches plan_flag_patches(const string& proj_path,
+                              const PioConfig& config,
+                              const vector<string>& environments) {
+  // A missing or outdated file leaves every environment without one
+  FlagBaselines recorded;
+  auto err = glz::read_file_json(recorded, baselines_path(proj_path).string(),
+                                 string{});
+  if (err || recorded.version != BASELINE_FORMAT_VERSION) {
+    recorded.envs.clear();
+  }
+
+  FlagPatches patches;
+  patches.deltas.resize(environments.size());
+  for (size_t i = 0; i < environments.size(); ++i) {
+    const string& env = environments[i];
+    auto database = make_file_stamp(env_database_path(proj_path, env));
+    auto now = read_build_flags(config, env);
+
+    auto it = std::ranges::find(recorded.envs, env, &FlagBaseline::env);
+    if (it == recorded.envs.end() || it->database != database) {
+      patches.baselines.envs.push_back(
+          {.env = env, .database = std::move(database), .build = now});
+      continue;
+    }
+    patches.baselines.envs.push_back(*it);
+
+    auto delta = diff_build_flags(it->build, now);
+    if (!delta) {
+      patches.warnings.push_back(fmt::format(
+          "build_flags of '{}' cannot be patched, {}; run pio run -t "
+          "compiledb -e {}",
+          env, delta.error(), env));
+      continue;
+    }
+    patches.deltas[i] = std::move(*delta);
+  }
+  return patches;
+}
+
+expected<void, string> write_flag_baselines(const string& proj_path,
+                                            const FlagBaselines& baselines) {
+  auto path = baselines_path(proj_path);
+  std::error_code ec;
+  fs::create_directories(path.parent_path(), ec);
+  auto err = glz::write_file_json(baselines, path.string(), string{});
+  if (err) {
+    return unexpected(fmt::format("Failed to write {}: {}", path.string(),
+                                  glz::format_error(err)));
+  }
+  return {};
+}
+
+size_t patch_build_flags(span<EnvDatabase> envs,
+                         span<const OverrideRule> deltas,
+                         const string& proj_path,
+                         InternPool& pool) {
+  FlagOverrides::Scratch scratch;
+  ArgCanonicalizer canonicalizer;
+  vector<string_view> args;
+  size_t patched = 0;
+
+  for (size_t i = 0; i < envs.size() && i < deltas.size(); ++i) {
+    if (deltas[i].add.empty() && deltas[i].remove.empty()) {
+      continue;
+    }
+    // The rule covers every file, so a list's patch does not depend on
+    // the entry it belongs to, nor on the key rules
+    auto overrides = FlagOverrides::compile(span{&deltas[i], 1}, proj_path,
+                                            default_key_rules());
+    boost::unordered_flat_map<const string_view*, span<const string_view>>
+        lists;
+
+    size_t env_patched = 0;
+    for (auto& entry : envs[i].entries) {
+      auto [it, inserted] = lists.try_emplace(entry.arguments.data());
+      if (inserted) {
+        args.assign(entry.arguments.begin(), entry.arguments.end());
+        overrides.apply(entry.key, args, scratch);
+        canonicalizer.canonicalize(args);
+        for (auto& arg : args) {
+          arg = pool.intern(arg);
+        }
+        it->second = pool.intern_list(args);
+      }
+      if (it->second.data() != entry.arguments.data()) {
+        entry.arguments = it->second;
+        ++env_patched;
+      }
+    }
+    envs[i].stats.entries_patched = env_patched;
+    patched += env_patched;
+  }
+  return patched;
+}
@@ -0,0 +1,188 @@
+#include "pio_clangd.h"
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "api.h"
+
+using std::string;
+using std::string_view;
+
+struct pio_clangd_db {
+  CompileDatabase db;
+  std::optional<string> json{};  // serialized on first request
+};
+
+static_assert(PIO_CLANGD_ERROR_CONFIG == int(ErrorCode::config));
+static_assert(PIO_CLANGD_ERROR_INPUT == int(ErrorCode::input));
+
+static pio_clangd_str make_str(string_view str) {
+  return pio_clangd_str{str.data(), str.size()};
+}
+
+static std::unique_ptr<char[]> copy_string(string_view str) {
+  auto copy = std::make_unique<char[]>(str.size() + 1);
+  std::memcpy(copy.get(), str.data(), str.size());
+  return copy;
+}
+
+// Fills *error if requested and returns the status code
+// No exception may cross the C boundary, so failing to allocate the error
+// itself leaves *error unset.
+static int fail(pio_clangd_error** error,
+                int code,
+                string_view env,
+                string_view message) {
+  if (error) {
+    *error = nullptr;
+    try {
+      auto details = std::make_unique<pio_clangd_error>();
+      auto env_copy = copy_string(env);
+      auto message_copy = copy_string(message);
+      details->code = code;
+      details->env = env_copy.release();
+      details->message = message_copy.release();
+      *error = details.release();
+    } catch (const std::bad_alloc&) {
+    }
+  }
+  return code;
+}
+
+static int finish(std::expected<CompileDatabase, GenError> result,
+                  pio_clangd_db** out,
+                  pio_clangd_error** error) {
+  if (!result) {
+    return fail(error, int(result.error().code), result.error().env,
+                result.error().message);
+  }
+  *out = new pio_clangd_db{.db = std::move(*result)};
+  return PIO_CLANGD_OK;
+}
+
+extern "C" {
+
+int pio_clangd_generate(const pio_clangd_env* envs,
+                        size_t env_count,
+                        const char* target_env,
+                        pio_clangd_db** out,
+                        pio_clangd_error** error) {
+  if (!out || (!envs && env_count > 0)) {
+    return fail(error, PIO_CLANGD_ERROR_INVALID_ARGUMENT, {},
+                "Invalid argument");
+  }
+
+  try {
+    std::vector<EnvInput> inputs;
+    inputs.reserve(env_count);
+    for (size_t i = 0; i < env_count; ++i) {
+      const pio_clangd_env& env = envs[i];
+      if (!env.name || (!env.json && !env.path)) {
+        return fail(error, PIO_CLANGD_ERROR_INVALID_ARGUMENT,
+                    env.name ? env.name : "",
+                    "Environment needs a name and either json or path");
+      }
+      EnvInput input{.name = env.name};
+      if (env.json) {
+        input.json = string_view{env.json, env.json_size};
+      } else {
+        input.path = env.path;
+      }
+      inputs.push_back(std::move(input));
+    }
+    return finish(generate(inputs, target_env ? target_env : ""), out, error);
+  } catch (const std::exception& e) {
+    return fail(error, PIO_CLANGD_ERROR_INTERNAL, {}, e.what());
+  }
+}
+
+int pio_clangd_generate_project(const char* proj_path,
+                                const char* environment,
+                                pio_clangd_db** out,
+                                pio_clangd_error** error) {
+  if (!proj_path || !out) {
+    return fail(error, PIO_CLANGD_ERROR_INVALID_ARGUMENT, {},
+                "Invalid argument");
+  }
+  try {
+    return finish(generate_project(proj_path, environment ? environment : ""),
+                  out, error);
+  } catch (const std::exception& e) {
+    return fail(error, PIO_CLANGD_ERROR_INTERNAL, {}, e.what());
+  }
+}
+
+void pio_clangd_db_free(pio_clangd_db* db) {
+  delete db;
+}
+
+void pio_clangd_error_free(pio_clangd_error* error) {
+  if (error) {
+    delete[] error->env;
+    delete[] error->message;
+    delete error;
+  }
+}
+
+pio_clangd_str pio_clangd_db_target_env(const pio_clangd_db* db) {
+  return make_str(db->db.target_env());
+}
+
+size_t pio_clangd_db_input_entries(const pio_clangd_db* db) {
+  return db->db.input_entries();
+}
+
+size_t pio_clangd_db_size(const pio_clangd_db* db) {
+  return db->db.entries().size();
+}
+
+pio_clangd_str pio_clangd_db_directory(const pio_clangd_db* db,
+                                       size_t index) {
+  return make_str(db->db.entries()[index]->directory);
+}
+
+pio_clangd_str pio_clangd_db_file(const pio_clangd_db* db, size_t index) {
+  return make_str(db->db.entries()[index]->file);
+}
+
+pio_clangd_str pio_clangd_db_driver(const pio_clangd_db* db, size_t index) {
+  return make_str(db->db.entries()[index]->driver);
+}
+
+size_t pio_clangd_db_argument_count(const pio_clangd_db* db, size_t index) {
+  return db->db.entries()[index]->arguments.size();
+}
+
+pio_clangd_str pio_clangd_db_argument(const pio_clangd_db* db,
+                                      size_t index,
+                                      size_t arg) {
+  const auto& arguments = db->db.entries()[index]->arguments;
+  return arg < arguments.size() ? make_str(arguments[arg])
+                                : pio_clangd_str{nullptr, 0};
+}
+
+int pio_clangd_db_json(pio_clangd_db* db,
+                       pio_clangd_str* out,
+                       pio_clangd_error** error) {
+  if (!db || !out) {
+    return fail(error, PIO_CLANGD_ERROR_INVALID_ARGUMENT, {},
+                "Invalid argument");
+  }
+  if (!db->json) {
+    try {
+      auto json = db->db.to_json();
+      if (!json) {
+        return fail(error, PIO_CLANGD_ERROR_INTERNAL, {}, json.error());
+      }
+      db->json = std::move(*json);
+    } catch (const std::exception& e) {
+      return fail(error, PIO_CLANGD_ERROR_INTERNAL, {}, e.what());
+    }
+  }
+  *out = make_str(*db->json);
+  return PIO_CLANGD_OK;
+}
+
+}  // extern "C"
@@ -1,15 +1,28 @@
 #include "clangd.h"
 #include <fmt/core.h>
-#include <boost/unordered/unordered_flat_map.hpp>
+#include <array>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <filesystem>
-#include <fstream>
 #include <mutex>
-#include <regex>
-#include <thread>
+#include <utility>
+#include "clangd_config.h"
+#include "database.h"
+#include "ini.h"
+#include "key_rules.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "query_index.h"
+#include "report.h"
+#include "stat_cache.h"
+#include "stream.h"
+#include "targets.h"
+#include "util.h"
 
 using std::expected;
 using std::string;
+using std::span;
 using std::string_view;
 using std::unexpected;
 using std::vector;
@@ -17,38 +30,200 @@ using std::vector;
 namespace fs = std::filesystem;
 
 expected<vector<string>, string> get_envs(const string& proj_path) {
-  auto ini_path = fs::path{proj_path} / "platformio.ini";
+  auto config = load_pio_config(proj_path);
+  if (!config) {
+    return unexpected(config.error());
+  }
 
-  if (!fs::exists(ini_path)) {
-    return unexpected(fmt::format("{} not found", ini_path.string()));
+  if ((*config)->envs().empty()) {
+    auto ini_path = fs::path{proj_path} / "platformio.ini";
+    return unexpected(
+        fmt::format("No environments found in {}", ini_path.string()));
   }
 
-  std::ifstream file(ini_path);
-  if (!file.is_open()) {
-    return unexpected(fmt::format("Failed to open {}", ini_path.string()));
+  return (*config)->envs();
+}
+
+IncludeDir include_dir(span<const string_view> args, size_t i) {
+  static constexpr std::array<std::pair<string_view, SearchChain>, 3> FLAGS{
+      {{"-isystem", SearchChain::system},
+       {"-iquote", SearchChain::quote},
+       {"-I", SearchChain::bracket}}};
+
+  string_view arg = args[i];
+  for (auto [flag, chain] : FLAGS) {
+    if (!arg.starts_with(flag)) {
+      continue;
+    }
+    string_view dir = arg.substr(flag.size());
+    size_t tokens = 1;
+    if (dir.empty() && i + 1 < args.size() && !args[i + 1].starts_with('-')) {
+      dir = args[i + 1];
+      tokens = 2;
+    }
+    // "-I-" splits the chains in old GCC, leave it alone
+    if (dir.empty() || dir == "-") {
+      return {};
+    }
+    // "dir/" and "dir" name the same directory
+    while (dir.size() > 1 && (dir.back() == '/' || dir.back() == '\\')) {
+      dir.remove_suffix(1);
+    }
+    return {.chain = chain, .dir = dir, .tokens = tokens};
   }
+  return {};
+}
 
-  // parse platformio.ini where regex matches [env:name]
-  // 'name' can contain alphanumeric, underscore, and hypens
-  std::regex env_pattern(R"(\[env:([a-zA-Z0-9_\-]+)\])");
+size_t ArgCanonicalizer::canonicalize(vector<string_view>& args) {
+  system_dirs_.clear();
+  seen_quote_.clear();
+  seen_bracket_.clear();
+  seen_system_.clear();
+  macros_.clear();
+
+  // System directories demote other occurrences wherever they appear
+  for (size_t i = 0; i < args.size(); ++i) {
+    auto include = include_dir(args, i);
+    if (include.chain == SearchChain::system) {
+      system_dirs_.insert(include.dir);
+    }
+    i += include.tokens - 1;
+  }
 
-  vector<string> environments;
-  string line;
+  size_t out = 0;
+  for (size_t i = 0; i < args.size();) {
+    string_view arg = args[i];
+    size_t tokens = 1;
+    bool keep = true;
+
+    if (auto include = include_dir(args, i);
+        include.chain != SearchChain::none) {
+      tokens = include.tokens;
+      switch (include.chain) {
+        case SearchChain::quote:
+          keep = !system_dirs_.contains(include.dir) &&
+                 seen_quote_.insert(include.dir).second;
+          break;
+        case SearchChain::bracket:
+          keep = !system_dirs_.contains(include.dir) &&
+                 seen_bracket_.insert(include.dir).second;
+          break;
+        default:
+          keep = seen_system_.insert(include.dir).second;
+          break;
+      }
+    } else if (arg.size() > 2 &&
+               (arg.starts_with("-D") || arg.starts_with("-U"))) {
+      // -DNAME, -DNAME=value, -DNAME(args)=value or -UNAME
+      string_view name = arg.substr(2);
+      name = name.substr(0, name.find_first_of("=("));
+      auto [it, inserted] = macros_.try_emplace(name, arg);
+      if (!inserted) {
+        keep = it->second != arg;
+        it->second = arg;
+      }
+    }
 
-  while (std::getline(file, line)) {
-    std::smatch match;
-    if (std::regex_search(line, match, env_pattern)) {
-      // match[1] contains the environment name in first capture group
-      environments.push_back(match[1].str());
+    if (keep) {
+      for (size_t t = 0; t < tokens; ++t) {
+        args[out++] = args[i + t];
+      }
     }
+    i += tokens;
   }
 
-  if (environments.empty()) {
-    return unexpected(
-        fmt::format("No environments found in {}", ini_path.string()));
+  size_t removed = args.size() - out;
+  args.resize(out);
+  return removed;
+}
+
+// True if path contains anything lexically_normal() would rewrite
+static bool needs_normalization(string_view path) {
+  if (path.find('\\') != string_view::npos ||
+      path.find("//") != string_view::npos) {
+    return true;
   }
+  // Look for "." and ".." segments
+  for (size_t pos = path.find('.'); pos != string_view::npos;
+       pos = path.find('.', pos + 1)) {
+    bool at_segment_start = pos == 0 || path[pos - 1] == '/';
+    if (!at_segment_start) {
+      continue;
+    }
+    size_t end = (pos + 1 < path.size() && path[pos + 1] == '.') ? pos + 2
+                                                                   : pos + 1;
+    if (end == path.size() || path[end] == '/') {
+      return true;
+    }
+  }
+  return false;
+}
 
-  return environments;
+void make_dedup_key(const CompileCommand& cmd,
+                    string& key,
+                    const KeyRules& rules) {
+  make_dedup_key(cmd.directory, cmd.file, key, rules);
+}
+
+void make_dedup_key(string_view directory,
+                    string_view file,
+                    string& key,
+                    const KeyRules& rules) {
+  if (is_absolute_path(file)) {
+    key.assign(file);
+  } else {
+    key.assign(directory);
+    if (!key.empty() && key.back() != '/' && key.back() != '\\') {
+      key.push_back('/');
+    }
+    key.append(file);
+  }
+
+  // Slow path, only taken for unusual paths
+  if (needs_normalization(key)) {
+    key = fs::path{key}.lexically_normal().string();
+  }
+
+  // Segments that differ by environment or board only, e.g.
+  // .pio/libdeps/ENV_NAME/LIBRARY/... -> .pio/libdeps/LIBRARY/...
+  rules.apply(key);
+}
+
+// Fast path of --switch when the precomputed databases are current:
+// nothing is read or processed, only the root link is replaced
+static int switch_target(const string& proj_path,
+                         const string& target_env,
+                         const GenOptions& options,
+                         std::chrono::steady_clock::time_point start_time) {
+  if (auto linked = link_database(proj_path, target_env); !linked) {
+    fmt::println(stderr, "{}", linked.error());
+    return EXIT_FAILURE;
+  }
+  // Factored flags of another target would be added to this one's
+  if (auto updated = update_clangd_config(proj_path, {}); !updated) {
+    fmt::println(stderr, "{}", updated.error());
+    return EXIT_FAILURE;
+  }
+  auto database_path = target_database_path(proj_path, target_env);
+  fmt::println("Switched compile_commands.json to '{}' (up to date)",
+               target_env);
+
+  if (!options.report_path.empty()) {
+    RunReport report{
+        .project = proj_path,
+        .target_env = target_env,
+        .output_path =
+            (fs::path{proj_path} / "compile_commands.json").string(),
+        .output_bytes = file_bytes(database_path),
+        .peak_rss_bytes = peak_rss_bytes(),
+        .wall_ms = elapsed_ms(start_time),
+    };
+    if (auto written = write_report(report, options.report_path); !written) {
+      fmt::println(stderr, "{}", written.error());
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
 }
 
 /*
@@ -62,180 +237,302 @@ expected<vector<string>, string> get_envs(const string& proj_path) {
  *
  * NOTE: Normalizing the .pio/libdep paths are the key to deduplication
  */
-int gen_cmds(const string& proj_path, const string& environment) {
-  auto environments = get_envs(proj_path);
+int gen_cmds(const string& proj_path,
+             const string& environment,
+             const GenOptions& options,
+             const GenShared& shared) {
+  if (options.read_stdin) {
+    return stream_cmds(proj_path, environment, options, stdin,
+                       options.write_stdout ? stdout : nullptr);
+  }
+
+  auto start_time = std::chrono::steady_clock::now();
+  Profiler profiler{options.profile};
 
-  if (!environments) {
-    fmt::println(stderr, "{}", environments.error());
+  // Keep stdout clean for the database with --stdout
+  std::FILE* status = options.write_stdout ? stderr : stdout;
+  if (shared.quiet) {
+    status = nullptr;
+  }
+
+  auto config = [&] {
+    auto phase = profiler.phase("ini parse");
+    return load_pio_config(proj_path);
+  }();
+
+  if (!config) {
+    fmt::println(stderr, "{}", config.error());
     return EXIT_FAILURE;
-  } else if (environments->empty()) {
+  } else if ((*config)->envs().empty()) {
     fmt::println(stderr, "No environments found in platformio.ini");
     return EXIT_FAILURE;
   }
+  const vector<string>& environments = (*config)->envs();
 
-  // If the target environment is not provided, set it to the first
-  // environment found
-  string target_env = environment.empty() ? (*environments)[0] : environment;
+  // If the target environment is not provided, use default_envs from
+  // platformio.ini, or the first environment found
+  string target_env =
+      environment.empty() ? (*config)->default_env() : environment;
 
   // Validate that target_env exists in the list of environments
   auto env_exists =
-      std::ranges::find(*environments, target_env) != environments->end();
-  if (!env_exists) {
+      std::ranges::find(environments, target_env) != environments.end();
+  if (!env_exists && options.switch_env) {
+    fmt::println(stderr, "Environment '{}' not found in platformio.ini",
+                 target_env);
+    return EXIT_FAILURE;
+  } else if (!env_exists) {
     fmt::println(stderr,
                  "Warning: Environment '{}' not found in platformio.ini",
                  target_env);
-    target_env = (*environments)[0];
+    target_env = (*config)->default_env();
     fmt::println(stderr, "Falling back to environment '{}'", target_env);
   }
 
-  boost::unordered_flat_map<string, vector<CompileCommand>> db;
-  std::mutex db_mtx;
-
-  vector<string> errors;
-  std::mutex error_mtx;
-
-  auto thread_proc = [&](string& env) -> void {
-    auto compile_commands_path =
-        fs::path{proj_path} / ".pio" / "build" / env / "compile_commands.json";
-    vector<CompileCommand> compile_commands;
-    auto err = glz::read_file_json(compile_commands,
-                                   compile_commands_path.string(), string{});
-    if (err) {
-      std::scoped_lock lock(error_mtx);
-      errors.push_back(fmt::format("Failed to read {}: {}",
-                                   compile_commands_path.string(),
-                                   glz::format_error(err)));
-      return;
-    }
-
-    std::scoped_lock lock(db_mtx);
-    db.emplace(env, std::move(compile_commands));
-  };  // end of thread_proc()
+  auto rules = load_project_rules(config->get(), options, proj_path);
+  if (!rules) {
+    fmt::println(stderr, "{}", rules.error());
+    return EXIT_FAILURE;
+  }
 
-  // scoped block provides implicit auto joins for worker threads
-  // when 'workers' goes out scope
-  {
-    vector<std::jthread> workers;
-    for (auto& env : *environments) {
-      workers.emplace_back(thread_proc, std::ref(env));
-    }
+  // Precomputed databases are current: switching only flips the link.
+  // The stamp also lists the sources --infer-new infers entries for.
+  bool write_targets = options.all_targets || options.switch_env;
+  auto stamp = make_gen_stamp(proj_path, **config, options, *rules);
+  if (options.switch_env && targets_current(proj_path, stamp)) {
+    return switch_target(proj_path, target_env, options, start_time);
   }
 
+  InternPool local_pool;
+  InternPool& pool = shared.pool ? *shared.pool : local_pool;
+  auto loaded = load_env_databases(proj_path, environments, pool, profiler,
+                                   rules->entry_rules());
+
   // Report any errors that occurred during processing
-  if (!errors.empty()) {
-    for (const auto& error : errors) {
+  if (!loaded) {
+    for (const auto& error : loaded.error()) {
       fmt::println(stderr, "{}", error);
     }
     fmt::println(stderr, "Failed to process {}/{} environment(s)",
-                 errors.size(), environments->size());
+                 loaded.error().size(), environments.size());
+    return EXIT_FAILURE;
+  }
+  vector<EnvDatabase>& envs = *loaded;
+
+  StatCache local_stat_cache;
+  StatCache& stat_cache =
+      shared.stat_cache ? *shared.stat_cache : local_stat_cache;
+  auto passes = run_entry_passes(envs, proj_path, **config, options, *rules,
+                                 stamp.sources, pool, stat_cache, profiler,
+                                 status);
+  if (!passes) {
+    fmt::println(stderr, "{}", passes.error());
     return EXIT_FAILURE;
   }
 
   // Calculate statistics
   size_t total_commands = 0;
-  for (const auto& [env_name, commands] : db) {
-    total_commands += commands.size();
+  size_t entries_excluded = 0;
+  size_t entries_overridden = 0;
+  for (const auto& env_db : envs) {
+    total_commands += env_db.stats.entries;
+    entries_excluded += env_db.stats.entries_excluded;
+    entries_overridden += env_db.stats.entries_overridden;
   }
 
-  auto target_it = db.find(target_env);
-  size_t target_env_commands =
-      (target_it != db.end()) ? target_it->second.size() : 0;
+  size_t target_idx =
+      std::ranges::find(environments, target_env) - environments.begin();
+  size_t target_env_commands = envs[target_idx].entries.size();
 
-  fmt::println("Loaded {} environment(s) with {} total compile commands",
-               db.size(), total_commands);
-  fmt::println("Target environment: '{}' ({} commands)", target_env,
+  print_status(status,
+               "Loaded {} environment(s) with {} total compile commands",
+               environments.size(), total_commands);
+  if (!rules->path_filter.empty()) {
+    print_status(status, "Excluded {} compile commands by path",
+                 entries_excluded);
+  }
+  if (!rules->overrides.empty()) {
+    print_status(status, "Overrode the flags of {} compile commands",
+                 entries_overridden);
+  }
+  print_status(status, "Target environment: '{}' ({} commands)", target_env,
                target_env_commands);
 
-  // Create filtered_commands map with normalized deduplication keys
-  boost::unordered_flat_map<string, CompileCommand> filtered_commands;
-
-  // Helper to create deduplication key - normalizes libdeps paths
-  // to handle environment-specific library directories
-  auto make_dedup_key = [](const CompileCommand& cmd) -> string {
-    auto fq_path = (fs::path{cmd.directory} / cmd.file).lexically_normal();
-    string path_str = fq_path.string();
-
-    // For libdeps paths, normalize by removing environment-specific segment
-    // Pattern: .pio/libdeps/ENV_NAME/LIBRARY/... -> .pio/libdeps/LIBRARY/...
-    static const string libdeps_marker = ".pio/libdeps/";
-    auto pos = path_str.find(libdeps_marker);
-    if (pos != string::npos) {
-      auto after_libdeps = pos + libdeps_marker.length();
-      auto next_slash = path_str.find('/', after_libdeps);
-      if (next_slash != string::npos) {
-        // Remove the env name segment
-        path_str.erase(after_libdeps, next_slash - after_libdeps + 1);
-      }
-    }
-
-    return path_str;
-  };
-
-  // Add target_env entries first (highest priority)
-  if (target_it != db.end()) {
-    // Reserve capacity: estimate 150% of target env size for all environments
-    filtered_commands.reserve(target_it->second.size() * 3 / 2);
+  auto target = [&] {
+    auto phase = profiler.phase("dedup");
+    return resolve_target(envs, target_idx);
+  }();
+
+  print_status(status, "Deduplicated to {} unique source files",
+               target.entries.size());
+
+  // Only the output is limited, queries answer for every file
+  vector<const Entry*> budget;
+  span<const Entry* const> kept = target.entries;
+  if (options.max_entries > 0 && kept.size() > options.max_entries) {
+    auto phase = profiler.phase("rank");
+    budget = entries_within_budget(target, **config, proj_path,
+                                   options.max_entries);
+    kept = budget;
+    print_status(status, "Kept the {} most relevant of {} entries",
+                 kept.size(), target.entries.size());
+  }
 
-    for (auto& cmd : target_it->second) {
-      filtered_commands.emplace(make_dedup_key(cmd), std::move(cmd));
+  // Write compile_commands.json to project root (or stdout), unless it is
+  // about to be linked to the target's precomputed database
+  auto output_path = fs::path{proj_path} / "compile_commands.json";
+  RootOutput root;
+  if (options.write_stdout) {
+    auto json = [&] {
+      auto phase = profiler.phase("write");
+      return serialize_database(kept);
+    }();
+    if (!json) {
+      fmt::println(stderr, "{}", json.error());
+      return EXIT_FAILURE;
+    }
+    if (std::fwrite(json->data(), 1, json->size(), stdout) != json->size() ||
+        std::fflush(stdout) != 0) {
+      fmt::println(stderr, "Failed to write to standard output");
+      return EXIT_FAILURE;
     }
+    root.bytes = json->size();
+  } else if (!options.switch_env) {
+    auto written = write_root_outputs(kept, target.entries, proj_path,
+                                      options, pool, profiler, status);
+    if (!written) {
+      fmt::println(stderr, "{}", written.error());
+      return EXIT_FAILURE;
+    }
+    root = *written;
+    print_status(status, "Successfully wrote {} with {} entries",
+                 output_path.filename().string(), kept.size());
   }
-
-  // Add other environment entries (only if file not already present)
-  for (auto& [env_name, commands] : db) {
-    if (env_name == target_env)
-      continue;  // Already processed
-
-    for (auto& cmd : commands) {
-      string dedup_key = make_dedup_key(cmd);
-      // Only insert if this file path doesn't exist yet
-      if (!filtered_commands.contains(dedup_key)) {
-        filtered_commands.emplace(std::move(dedup_key), std::move(cmd));
+  print_status(status, "Reduction: {} -> {} commands ({:.1f}%)",
+               total_commands, kept.size(),
+               (100 - (kept.size() * 100.0) / total_commands));
+
+  // Every environment as target: dedup and write in parallel, sharing the
+  // already filtered entries
+  vector<TargetReport> target_reports(environments.size());
+  if (write_targets) {
+    vector<string> errors;
+    std::mutex error_mtx;
+
+    auto target_proc = [&](size_t env_idx) -> void {
+      const string& env = environments[env_idx];
+      auto phase = profiler.phase("all-targets", env);
+
+      auto env_target = resolve_target(envs, env_idx);
+      vector<const Entry*> env_budget;
+      span<const Entry* const> env_kept = env_target.entries;
+      if (options.max_entries > 0 && env_kept.size() > options.max_entries) {
+        env_budget = entries_within_budget(env_target, **config, proj_path,
+                                           options.max_entries);
+        env_kept = env_budget;
       }
+      auto env_output = target_database_path(proj_path, env);
+      std::error_code ec;
+      fs::create_directories(env_output.parent_path(), ec);
+      auto bytes = write_database(env_kept, env_output);
+      if (!bytes) {
+        std::scoped_lock lock(error_mtx);
+        errors.push_back(bytes.error());
+        return;
+      }
+      auto indexed = write_query_index(env_target.entries,
+                                       target_index_path(proj_path, env));
+      if (!indexed) {
+        std::scoped_lock lock(error_mtx);
+        errors.push_back(indexed.error());
+        return;
+      }
+      target_reports[env_idx] = TargetReport{
+          .env = env,
+          .output_path = env_output.string(),
+          .output_bytes = *bytes,
+          .output_entries = env_kept.size(),
+      };
+    };
+
+    parallel_for(environments.size(), target_proc);
+
+    if (!errors.empty()) {
+      for (const auto& error : errors) {
+        fmt::println(stderr, "{}", error);
+      }
+      return EXIT_FAILURE;
     }
-  }
-
-  fmt::println("Deduplicated to {} unique source files",
-               filtered_commands.size());
 
-  // Filter flags for each entry
-  for (auto& [fq_path, cmd] : filtered_commands) {
-    vector<string> filtered;
-    filtered.reserve(cmd.arguments.empty() ? 20 : cmd.arguments.size());
-
-    // compile_commands.json may use either arguments array or command string
-    if (!cmd.arguments.empty()) {
-      process_tokens(cmd.arguments, filtered);
-    } else if (!cmd.command.empty()) {
-      process_tokens(tokenize_command(cmd.command), filtered);
+    // The stamp was taken before reading, so inputs modified during this
+    // run leave it stale and the next switch regenerates
+    if (auto stamped = write_targets_stamp(proj_path, stamp); !stamped) {
+      fmt::println(stderr, "{}", stamped.error());
+      return EXIT_FAILURE;
     }
-
-    cmd.arguments = std::move(filtered);
-    cmd.command.clear();  // Clear redundant command field
+    print_status(status, "Wrote {} per-environment databases to {}",
+                 environments.size(), targets_dir(proj_path).string());
   }
 
-  // Extract values into vector for JSON output
-  vector<CompileCommand> output_commands;
-  output_commands.reserve(filtered_commands.size());
-  for (auto& [_, cmd] : filtered_commands) {
-    output_commands.push_back(std::move(cmd));
+  if (options.switch_env) {
+    if (auto linked = link_database(proj_path, target_env); !linked) {
+      fmt::println(stderr, "{}", linked.error());
+      return EXIT_FAILURE;
+    }
+    root.bytes = target_reports[target_idx].output_bytes;
+    print_status(status, "Switched {} to '{}' with {} entries",
+                 output_path.filename().string(), target_env,
+                 target_reports[target_idx].output_entries);
   }
 
-  // Write compile_commands.json to project root
-  auto output_path = fs::path{proj_path} / "compile_commands.json";
-  auto write_err =
-      glz::write_file_json(output_commands, output_path.string(), string{});
-  if (write_err) {
-    fmt::println(stderr, "Failed to write {}: {}", output_path.string(),
-                 glz::format_error(write_err));
-    return EXIT_FAILURE;
+  if (status) {
+    profiler.print(status);
   }
+  if (shared.on_output) {
+    shared.on_output(kept);
+  }
+
+  if (!options.report_path.empty()) {
+    vector<EnvReport> env_stats;
+    for (size_t i = 0; i < envs.size(); ++i) {
+      EnvReport stats = envs[i].stats;
+      stats.entries_won = target.won[i];
+      stats.entries_lost =
+          stats.entries + stats.entries_inferred - target.won[i];
+      env_stats.push_back(std::move(stats));
+    }
 
-  fmt::println("Successfully wrote {} with {} entries",
-               output_path.filename().string(), output_commands.size());
-  fmt::println("Reduction: {} -> {} commands ({:.1f}%)", total_commands,
-               output_commands.size(),
-               (100 - (output_commands.size() * 100.0) / total_commands));
+    RunReport report{
+        .project = proj_path,
+        .target_env = target_env,
+        .output_path = options.write_stdout ? "-" : output_path.string(),
+        .output_bytes = root.bytes,
+        .input_entries = total_commands,
+        .output_entries = kept.size(),
+        .entries_over_budget = target.entries.size() - kept.size(),
+        .include_dirs_pruned = passes->include_dirs_pruned,
+        .sources_missing = passes->sources_missing,
+        .entries_excluded = entries_excluded,
+        .entries_overridden = entries_overridden,
+        .sources_inferred = passes->sources_inferred,
+        .entries_patched = passes->entries_patched,
+        .roots_merged = passes->roots.merged,
+        .toolchains_queried = passes->toolchains.queried,
+        .toolchains_cached = passes->toolchains.cached,
+        .flags_factored = root.flags_factored,
+        .rsp_files = root.rsp_files,
+        .rsp_flags = root.rsp_flags,
+        .peak_rss_bytes = peak_rss_bytes(),
+        .wall_ms = elapsed_ms(start_time),
+        .envs = std::move(env_stats),
+        .targets = write_targets ? std::move(target_reports)
+                                 : vector<TargetReport>{},
+    };
+    if (auto written = write_report(report, options.report_path); !written) {
+      fmt::println(stderr, "{}", written.error());
+      return EXIT_FAILURE;
+    }
+  }
 
   return EXIT_SUCCESS;
 }
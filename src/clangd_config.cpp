@@ -0,0 +1,275 @@
+#include "clangd_config.h"
+#include <fmt/core.h>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "util.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Path of the entry's file relative to root with forward slashes, empty
+// if the file is outside root
+string project_relative(const Entry& entry, const fs::path& root) {
+  fs::path file{entry.file};
+  if (file.is_relative()) {
+    file = fs::path{entry.directory} / file;
+  }
+  auto rel = file.lexically_normal().lexically_relative(root);
+  if (rel.empty() || *rel.begin() == "..") {
+    return {};
+  }
+  return rel.generic_string();
+}
+
+// Library the project relative path belongs to, as "lib/Foo/" or
+// ".pio/libdeps/<env>/Foo/"; empty for project sources
+string_view library_root(string_view rel) {
+  auto prefix_dirs = [&](string_view prefix, size_t dirs) -> string_view {
+    if (!rel.starts_with(prefix)) {
+      return {};
+    }
+    size_t pos = prefix.size();
+    for (size_t i = 0; i < dirs; ++i) {
+      pos = rel.find('/', pos);
+      if (pos == string_view::npos) {
+        return {};
+      }
+      ++pos;
+    }
+    return rel.substr(0, pos);
+  };
+  if (auto root = prefix_dirs(".pio/libdeps/", 2); !root.empty()) {
+    return root;
+  }
+  return prefix_dirs("lib/", 1);
+}
+
+// Longest run suffix also ends args with; the strings are interned, so
+// equal flags share their data
+span<const string_view> shared_suffix(span<const string_view> suffix,
+                                      span<const string_view> args) {
+  size_t n = 0;
+  while (n < suffix.size() && n < args.size() &&
+         suffix[suffix.size() - 1 - n].data() ==
+             args[args.size() - 1 - n].data()) {
+    ++n;
+  }
+  return suffix.last(n);
+}
+
+// The run without leading values of a flag before it, "-I" of "-I dir"
+// must stay with its directory
+span<const string_view> from_flag(span<const string_view> run) {
+  while (!run.empty() && !run.front().starts_with('-')) {
+    run = run.subspan(1);
+  }
+  return run;
+}
+
+// YAML double-quoted scalar
+string yaml_quoted(string_view str) {
+  string out{"\""};
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+    }
+    out.push_back(c);
+  }
+  out.push_back('"');
+  return out;
+}
+
+// PathMatch regex of every path under prefix
+string path_regex(string_view prefix) {
+  string regex;
+  for (char c : prefix) {
+    if (string_view{".^$|()[]{}*+?\\"}.find(c) != string_view::npos) {
+      regex.push_back('\\');
+    }
+    regex.push_back(c);
+  }
+  regex.append(".*");
+  return regex;
+}
+
+}  // namespace
+
+FactoredDatabase factor_common_flags(span<const Entry* const> entries,
+                                     const string& proj_path) {
+  FactoredDatabase factored;
+  factored.entries.reserve(entries.size());
+  for (const Entry* entry : entries) {
+    factored.entries.push_back(*entry);
+  }
+  auto point_output = [&] {
+    factored.output.reserve(factored.entries.size());
+    for (const auto& entry : factored.entries) {
+      factored.output.push_back(&entry);
+    }
+  };
+
+  auto root = fs::absolute(proj_path).lexically_normal();
+  if (!root.has_filename()) {
+    root = root.parent_path();
+  }
+  vector<string> paths(entries.size());
+  vector<size_t> in_project;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    paths[i] = project_relative(*entries[i], root);
+    if (!paths[i].empty()) {
+      in_project.push_back(i);
+    }
+  }
+
+  // Nothing is saved by moving the flags of a single entry
+  if (in_project.size() < 2) {
+    point_output();
+    return factored;
+  }
+
+  auto common = entries[in_project[0]]->arguments;
+  for (size_t i : in_project) {
+    common = shared_suffix(common, entries[i]->arguments);
+  }
+  factored.common = from_flag(common);
+
+  // Then per library, on what is left of its entries
+  struct GroupRun {
+    span<const string_view> flags;
+    size_t entries{};
+  };
+  boost::unordered_flat_map<string_view, GroupRun> runs;
+  auto rest = [&](size_t i) {
+    const auto& args = entries[i]->arguments;
+    return args.first(args.size() - factored.common.size());
+  };
+  for (size_t i : in_project) {
+    auto prefix = library_root(paths[i]);
+    if (prefix.empty()) {
+      continue;
+    }
+    auto [it, inserted] = runs.try_emplace(prefix, GroupRun{rest(i)});
+    it->second.flags = shared_suffix(it->second.flags, rest(i));
+    ++it->second.entries;
+  }
+  for (auto& [prefix, run] : runs) {
+    run.flags = run.entries < 2 ? span<const string_view>{}
+                                : from_flag(run.flags);
+    if (!run.flags.empty()) {
+      factored.groups.push_back(
+          {.prefix = string{prefix}, .flags = run.flags});
+    }
+  }
+  std::ranges::sort(factored.groups, {}, &FactoredDatabase::Group::prefix);
+
+  for (size_t i : in_project) {
+    size_t cut = factored.common.size();
+    if (auto prefix = library_root(paths[i]); !prefix.empty()) {
+      cut += runs.find(prefix)->second.flags.size();
+    }
+    auto& args = factored.entries[i].arguments;
+    args = args.first(args.size() - cut);
+    factored.flags_factored += cut;
+  }
+  point_output();
+  return factored;
+}
+
+string render_clangd_config(const FactoredDatabase& factored) {
+  string out;
+  auto add_fragment = [&](string_view prefix,
+                          span<const string_view> flags) {
+    if (flags.empty()) {
+      return;
+    }
+    out.append("---\n");
+    if (!prefix.empty()) {
+      out.append(fmt::format("If:\n  PathMatch: {}\n",
+                             yaml_quoted(path_regex(prefix))));
+    }
+    out.append("CompileFlags:\n  Add:\n");
+    for (auto flag : flags) {
+      out.append(fmt::format("    - {}\n", yaml_quoted(flag)));
+    }
+  };
+  for (const auto& group : factored.groups) {
+    add_fragment(group.prefix, group.flags);
+  }
+  add_fragment({}, factored.common);
+  return out;
+}
+
+expected<void, string> update_clangd_config(const string& proj_path,
+                                            string_view fragments) {
+  auto path = fs::path{proj_path} / ".clangd";
+  std::error_code ec;
+  string content;
+  if (fs::exists(path, ec)) {
+    std::ifstream file{path, std::ios::binary};
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    if (!file) {
+      return unexpected(fmt::format("Failed to read {}", path.string()));
+    }
+    content = std::move(buffer).str();
+  }
+
+  // The user's own fragments around the generated block are kept
+  string_view before{content};
+  string_view after{};
+  if (auto begin = content.find(CLANGD_CONFIG_BEGIN); begin != string::npos) {
+    auto end = content.find(CLANGD_CONFIG_END, begin);
+    if (end == string::npos) {
+      return unexpected(fmt::format(
+          "{}: generated block has no end marker \"{}\"", path.string(),
+          CLANGD_CONFIG_END));
+    }
+    end = std::min(content.find('\n', end), content.size() - 1) + 1;
+    before = string_view{content}.substr(0, begin);
+    after = string_view{content}.substr(end);
+  } else if (fragments.empty()) {
+    return {};
+  }
+
+  string updated{before};
+  if (!fragments.empty()) {
+    if (!updated.empty() && updated.back() != '\n') {
+      updated.push_back('\n');
+    }
+    updated.append(CLANGD_CONFIG_BEGIN);
+    updated.push_back('\n');
+    updated.append(fragments);
+    // Fragments of the user after the block start their own document
+    if (after.find_first_not_of(" \t\r\n") != string_view::npos) {
+      updated.append("---\n");
+    }
+    updated.append(CLANGD_CONFIG_END);
+    updated.push_back('\n');
+  }
+  updated.append(after);
+
+  // clangd reloads .clangd whenever it changes
+  if (updated == content) {
+    return {};
+  }
+  if (updated.find_first_not_of(" \t\r\n") == string::npos) {
+    fs::remove(path, ec);
+    if (ec) {
+      return unexpected(fmt::format("Failed to remove {}: {}", path.string(),
+                                    ec.message()));
+    }
+    return {};
+  }
+
+  return write_file_atomic(path, updated);
+}
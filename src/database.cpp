@@ -0,0 +1,499 @@
+#include "database.h"
+#include <fmt/core.h>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <mutex>
+#include "targets.h"
+#include "util.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+fs::path env_database_path(const string& proj_path, const string& env) {
+  return fs::path{proj_path} / ".pio" / "build" / env /
+         "compile_commands.json";
+}
+
+expected<vector<CompileCommand>, string> read_compile_commands(
+    const fs::path& path) {
+  vector<CompileCommand> commands;
+  auto err = glz::read_file_json(commands, path.string(), string{});
+  if (err) {
+    return unexpected(fmt::format("Failed to read {}: {}", path.string(),
+                                  glz::format_error(err)));
+  }
+  return commands;
+}
+
+expected<vector<CompileCommand>, string> parse_compile_commands(
+    string_view json,
+    string_view source) {
+  // glaze reads up to a null terminator, which a view does not guarantee
+  string buffer{json};
+  vector<CompileCommand> commands;
+  auto err = glz::read_json(commands, buffer);
+  if (err) {
+    return unexpected(fmt::format("Failed to parse {}: {}", source,
+                                  glz::format_error(err, buffer)));
+  }
+  return commands;
+}
+
+expected<ProjectRules, string> load_project_rules(const PioConfig* config,
+                                                  const GenOptions& options,
+                                                  const string& proj_path) {
+  ProjectRules rules;
+  auto path_filter =
+      load_path_filter(config, options.include, options.exclude, proj_path);
+  if (!path_filter) {
+    return unexpected(path_filter.error());
+  }
+  rules.path_filter = std::move(*path_filter);
+  auto key_rules = load_key_rules(config);
+  if (!key_rules) {
+    return unexpected(key_rules.error());
+  }
+  rules.key_rules = std::move(*key_rules);
+  // After the key rules, which spell the paths of the override rules
+  rules.overrides_file =
+      overrides_path(config, options.overrides_path, proj_path);
+  if (!rules.overrides_file.empty()) {
+    auto overrides =
+        FlagOverrides::load(rules.overrides_file, proj_path, rules.key_rules);
+    if (!overrides) {
+      return unexpected(overrides.error());
+    }
+    rules.overrides = std::move(*overrides);
+  }
+  return rules;
+}
+
+void stamp_project_rules(const ProjectRules& rules, TargetsStamp& stamp) {
+  stamp.include = rules.path_filter.include();
+  stamp.exclude = rules.path_filter.exclude();
+  stamp.dedup_rules = rules.key_rules.rules();
+  if (!rules.overrides_file.empty()) {
+    stamp.inputs.push_back(make_file_stamp(rules.overrides_file));
+  }
+}
+
+std::optional<Entry> make_entry(const CompileCommand& cmd,
+                                InternPool& pool,
+                                EnvReport& stats,
+                                EntryScratch& scratch,
+                                const EntryRules& rules) {
+  // Excluded before any of the flags are looked at
+  make_dedup_key(cmd, scratch.key,
+                 rules.key_rules ? *rules.key_rules : default_key_rules());
+  if (rules.path_filter &&
+      !rules.path_filter->accepts(scratch.key, scratch.path_filter)) {
+    ++stats.entries_excluded;
+    return std::nullopt;
+  }
+
+  auto& filtered = scratch.filtered;
+  filtered.clear();
+
+  // compile_commands.json may use either arguments array or command string
+  size_t examined = 0;
+  string_view driver;
+  if (!cmd.arguments.empty()) {
+    examined = process_tokens(cmd.arguments, filtered);
+    driver = cmd.arguments.front();
+  } else if (!cmd.command.empty()) {
+    auto tokens = tokenize_command(cmd.command);
+    examined = process_tokens(tokens, filtered);
+    if (auto first = tokens.begin(); first != tokens.end()) {
+      driver = *first;
+    }
+  }
+  stats.flags_dropped += examined - filtered.size();
+
+  // Overrides change what the filter passed, the canonicalizer cleans up
+  if (rules.overrides &&
+      rules.overrides->apply(scratch.key, filtered, scratch.overrides)) {
+    ++stats.entries_overridden;
+  }
+  size_t duplicates = scratch.canonicalizer.canonicalize(filtered);
+  stats.flags_kept += filtered.size();
+  stats.flags_duplicate += duplicates;
+
+  for (auto& flag : filtered) {
+    flag = pool.intern(flag);
+  }
+
+  return Entry{
+      .key = pool.intern(scratch.key),
+      .directory = pool.intern(cmd.directory),
+      .file = pool.intern(cmd.file),
+      .arguments = pool.intern_list(filtered),
+      .output = cmd.output ? pool.intern(*cmd.output) : string_view{},
+      .driver = pool.intern(driver),
+  };
+}
+
+EnvDatabase make_env_database(string env,
+                              const vector<CompileCommand>& commands,
+                              InternPool& pool,
+                              const EntryRules& rules) {
+  EnvDatabase db{.name = std::move(env)};
+  db.stats.name = db.name;
+  db.stats.entries = commands.size();
+  db.entries.reserve(commands.size());
+
+  // Scratch buffers reused for every command
+  EntryScratch scratch;
+  for (const auto& cmd : commands) {
+    if (auto entry = make_entry(cmd, pool, db.stats, scratch, rules)) {
+      db.entries.push_back(*entry);
+    }
+  }
+  return db;
+}
+
+expected<vector<EnvDatabase>, vector<string>> load_env_databases(
+    const string& proj_path,
+    const vector<string>& environments,
+    InternPool& pool,
+    Profiler& profiler,
+    const EntryRules& rules) {
+  // envs[i] belongs to environments[i]; each worker thread only touches
+  // its own slot. All entries share one intern pool.
+  vector<EnvDatabase> envs(environments.size());
+
+  vector<string> errors;
+  std::mutex error_mtx;
+
+  auto thread_proc = [&](size_t env_idx) -> void {
+    const string& env = environments[env_idx];
+    auto compile_commands_path = env_database_path(proj_path, env);
+
+    auto parse_start = std::chrono::steady_clock::now();
+    auto compile_commands = [&] {
+      auto phase = profiler.phase("json read", env);
+      return read_compile_commands(compile_commands_path);
+    }();
+    if (!compile_commands) {
+      std::scoped_lock lock(error_mtx);
+      errors.push_back(compile_commands.error());
+      return;
+    }
+    double parse_ms = elapsed_ms(parse_start);
+
+    // Filter flags of every entry once, outputs for any target reuse them
+    {
+      auto phase = profiler.phase("process_tokens", env);
+      envs[env_idx] =
+          make_env_database(env, *compile_commands, pool, rules);
+    }
+
+    EnvReport& stats = envs[env_idx].stats;
+    stats.input_path = compile_commands_path.string();
+    stats.input_bytes = file_bytes(compile_commands_path);
+    stats.parse_ms = parse_ms;
+  };  // end of thread_proc()
+
+  parallel_for(environments.size(), thread_proc);
+
+  if (!errors.empty()) {
+    return unexpected(std::move(errors));
+  }
+  return envs;
+}
+
+// Path of file as seen from directory
+static void resolve_path(string_view directory,
+                         string_view file,
+                         string& path) {
+  path.clear();
+  if (!is_absolute_path(file)) {
+    path.append(directory);
+    path.push_back('/');
+  }
+  path.append(file);
+}
+
+size_t prune_include_dirs(span<EnvDatabase> envs,
+                          InternPool& pool,
+                          StatCache& cache) {
+  // Argument lists are interned, so most entries share a handful of
+  // lists. Relative directories also depend on the entry's directory.
+  struct ListKey {
+    const string_view* arguments;
+    const char* directory;
+    bool operator==(const ListKey&) const = default;
+  };
+  struct ListKeyHash {
+    size_t operator()(const ListKey& key) const {
+      return std::hash<const void*>{}(key.arguments) * 31 +
+             std::hash<const void*>{}(key.directory);
+    }
+  };
+  struct List {
+    string_view directory;
+    span<const string_view> arguments;
+  };
+  boost::unordered_flat_map<ListKey, List, ListKeyHash> lists;
+
+  boost::unordered_flat_set<string> distinct;
+  string path;
+  for (const auto& env : envs) {
+    for (const auto& entry : env.entries) {
+      ListKey key{entry.arguments.data(), entry.directory.data()};
+      if (!lists.try_emplace(key, List{entry.directory, entry.arguments})
+               .second) {
+        continue;
+      }
+      for (size_t i = 0; i < entry.arguments.size(); ++i) {
+        auto include = include_dir(entry.arguments, i);
+        if (include.chain != SearchChain::none) {
+          resolve_path(entry.directory, include.dir, path);
+          distinct.insert(path);
+          i += include.tokens - 1;
+        }
+      }
+    }
+  }
+
+  vector<string> paths(distinct.begin(), distinct.end());
+  cache.stat_all(paths);
+
+  // Only a directory with something in it can contribute headers
+  auto dead = [&](string_view dir_path) {
+    return cache.status(dir_path) != StatCache::Status::directory;
+  };
+  size_t pruned = std::ranges::count_if(paths, dead);
+  if (pruned == 0) {
+    return 0;
+  }
+
+  // Rewrite each distinct list once
+  vector<string_view> kept;
+  for (auto& [key, list] : lists) {
+    kept.clear();
+    for (size_t i = 0; i < list.arguments.size(); ++i) {
+      auto include = include_dir(list.arguments, i);
+      if (include.chain == SearchChain::none) {
+        kept.push_back(list.arguments[i]);
+        continue;
+      }
+      resolve_path(list.directory, include.dir, path);
+      if (!dead(path)) {
+        kept.insert(kept.end(), list.arguments.begin() + i,
+                    list.arguments.begin() + i + include.tokens);
+      }
+      i += include.tokens - 1;
+    }
+    if (kept.size() != list.arguments.size()) {
+      list.arguments = pool.intern_list(kept);
+    }
+  }
+
+  for (auto& env : envs) {
+    for (auto& entry : env.entries) {
+      entry.arguments =
+          lists.find({entry.arguments.data(), entry.directory.data()})
+              ->second.arguments;
+    }
+  }
+  return pruned;
+}
+
+size_t drop_missing_sources(span<EnvDatabase> envs, StatCache& cache) {
+  vector<string> paths;
+  for (const auto& env : envs) {
+    for (const auto& entry : env.entries) {
+      resolve_path(entry.directory, entry.file, paths.emplace_back());
+    }
+  }
+  cache.stat_all(paths);
+
+  size_t dropped = 0;
+  size_t path_idx = 0;
+  for (auto& env : envs) {
+    size_t missing = std::erase_if(env.entries, [&](const Entry&) {
+      return cache.status(paths[path_idx++]) == StatCache::Status::missing;
+    });
+    env.stats.entries_missing = missing;
+    dropped += missing;
+  }
+  return dropped;
+}
+
+TargetDatabase resolve_target(span<const EnvDatabase> envs,
+                              size_t target_idx) {
+  TargetDatabase target{.env = envs[target_idx].name,
+                        .won = vector<size_t>(envs.size())};
+
+  // Keys are interned in a shared pool, so the key's address identifies it
+  boost::unordered_flat_set<const char*> seen;
+
+  // Reserve capacity: estimate 150% of target env size for all environments
+  seen.reserve(envs[target_idx].entries.size() * 3 / 2);
+  target.entries.reserve(envs[target_idx].entries.size() * 3 / 2);
+
+  auto add_env = [&](size_t env_idx) {
+    for (const auto& entry : envs[env_idx].entries) {
+      // Only insert if this file path doesn't exist yet
+      if (seen.insert(entry.key.data()).second) {
+        target.entries.push_back(&entry);
+        ++target.won[env_idx];
+      }
+    }
+  };
+
+  // Add target_env entries first (highest priority)
+  add_env(target_idx);
+  for (size_t i = 0; i < envs.size(); ++i) {
+    if (i != target_idx) {
+      add_env(i);
+    }
+  }
+  return target;
+}
+
+string lib_dep_name(string_view dep) {
+  auto trim = [](string_view str) {
+    auto begin = str.find_first_not_of(" \t");
+    auto end = str.find_last_not_of(" \t");
+    return begin == string_view::npos ? string_view{}
+                                      : str.substr(begin, end - begin + 1);
+  };
+  dep = trim(dep);
+
+  // "Name=<source>" names the library explicitly
+  auto scheme = dep.find("://");
+  if (auto eq = dep.find('='); eq != string_view::npos && eq < scheme) {
+    return string{trim(dep.substr(0, eq))};
+  }
+  if (scheme != string_view::npos) {
+    dep = dep.substr(0, dep.find('#'));
+    while (dep.ends_with('/')) {
+      dep.remove_suffix(1);
+    }
+    if (dep.ends_with(".git")) {
+      dep.remove_suffix(4);
+    }
+  } else {
+    dep = trim(dep.substr(0, dep.find('@')));
+  }
+  return string{dep.substr(dep.find_last_of('/') + 1)};
+}
+
+vector<const Entry*> rank_entries(span<const Entry* const> entries,
+                                  const string& proj_path,
+                                  span<const string> lib_deps) {
+  enum Tier : uint8_t { project, project_other, dependency, library, other };
+  constexpr size_t tiers = other + 1;
+
+  auto lower = [](string_view str) {
+    string out{str};
+    for (char& c : out) {
+      c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return out;
+  };
+  boost::unordered_flat_set<string> deps;
+  for (const auto& dep : lib_deps) {
+    deps.insert(lower(lib_dep_name(dep)));
+  }
+
+  auto root = fs::absolute(proj_path).lexically_normal().generic_string();
+  if (!root.ends_with('/')) {
+    root.push_back('/');
+  }
+  // Keys drop the environment of .pio/libdeps/<env>/
+  auto tier_of = [&](string_view key) {
+    if (!key.starts_with(root)) {
+      return other;
+    }
+    auto rel = key.substr(root.size());
+    constexpr string_view libdeps = ".pio/libdeps/";
+    if (rel.starts_with(libdeps)) {
+      auto name = rel.substr(libdeps.size());
+      name = name.substr(0, name.find('/'));
+      return deps.contains(lower(name)) ? dependency : library;
+    }
+    if (rel.starts_with("src/") || rel.starts_with("lib/") ||
+        rel.starts_with("include/")) {
+      return project;
+    }
+    return project_other;
+  };
+
+  // A stable counting sort, entries are already in priority order
+  vector<uint8_t> entry_tiers(entries.size());
+  std::array<size_t, tiers + 1> starts{};
+  for (size_t i = 0; i < entries.size(); ++i) {
+    entry_tiers[i] = tier_of(entries[i]->key);
+    ++starts[entry_tiers[i] + 1];
+  }
+  for (size_t t = 1; t <= tiers; ++t) {
+    starts[t] += starts[t - 1];
+  }
+  vector<const Entry*> ranked(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    ranked[starts[entry_tiers[i]]++] = entries[i];
+  }
+  return ranked;
+}
+
+OutputCommand make_output_command(const Entry& entry,
+                                  vector<string_view>& arguments) {
+  arguments.clear();
+  if (!entry.driver.empty()) {
+    arguments.push_back(entry.driver);
+  }
+  arguments.insert(arguments.end(), entry.arguments.begin(),
+                   entry.arguments.end());
+  return OutputCommand{
+      .directory = entry.directory,
+      .file = entry.file,
+      .arguments = arguments,
+      .output = entry.output.empty() ? std::nullopt
+                                     : std::optional<string_view>{entry.output},
+  };
+}
+
+expected<string, string> serialize_database(span<const Entry* const> entries) {
+  // One entry at a time, so a single argument buffer serves all of them
+  string buffer{"["};
+  string json;
+  vector<string_view> arguments;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (auto err = glz::write_json(make_output_command(*entries[i], arguments),
+                                   json)) {
+      return unexpected(fmt::format(
+          "Failed to serialize compile commands: {}", glz::format_error(err)));
+    }
+    if (i > 0) {
+      buffer.push_back(',');
+    }
+    buffer.append(json);
+  }
+  buffer.push_back(']');
+  return buffer;
+}
+
+expected<uint64_t, string> write_database(span<const Entry* const> entries,
+                                          const fs::path& path) {
+  auto json = serialize_database(entries);
+  if (!json) {
+    return unexpected(json.error());
+  }
+
+  // clangd never reads a partially written database
+  if (auto replaced = write_file_atomic(path, *json); !replaced) {
+    return unexpected(replaced.error());
+  }
+  return file_bytes(path);
+}
@@ -0,0 +1,410 @@
+#include "infer.h"
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <glaze/glaze.hpp>
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <list>
+#include <optional>
+#include <ranges>
+#include <variant>
+#include "ini.h"
+#include "util.h"
+
+using std::span;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+enum Language : uint8_t { c, cxx, none };
+
+Language language_of(string_view path) {
+  auto name = path.substr(path.find_last_of('/') + 1);
+  auto dot = name.find_last_of('.');
+  if (dot == string_view::npos) {
+    return none;
+  }
+  auto ext = name.substr(dot + 1);
+  if (ext == "c") {
+    return c;
+  }
+  if (ext == "cpp" || ext == "cc" || ext == "cxx" || ext == "c++" ||
+      ext == "C") {
+    return cxx;
+  }
+  return none;
+}
+
+// One "+<pattern>" or "-<pattern>" of a source filter, the pattern split
+// into its path segments
+struct FilterRule {
+  bool include{};
+  vector<string> segments;
+};
+using SrcFilter = vector<FilterRule>;
+
+// PlatformIO's defaults, libraries without src/ leave out their examples
+// and tests
+constexpr string_view DEFAULT_SRC_FILTER = "+<*> -<.git/> -<.svn/>";
+constexpr string_view LIBRARY_SRC_FILTER =
+    "+<*> -<.git/> -<.svn/> -<example/> -<examples/> -<test/> -<tests/>";
+
+SrcFilter parse_src_filter(string_view text) {
+  SrcFilter filter;
+  for (size_t pos = 0;
+       (pos = text.find_first_of("+-", pos)) != string_view::npos;) {
+    auto end = text.find('>', pos);
+    if (pos + 1 == text.size() || text[pos + 1] != '<' ||
+        end == string_view::npos) {
+      ++pos;
+      continue;
+    }
+    FilterRule rule{.include = text[pos] == '+'};
+    auto pattern = text.substr(pos + 2, end - pos - 2);
+    for (size_t begin = 0; begin <= pattern.size();) {
+      auto slash = std::min(pattern.find_first_of("/\\", begin),
+                            pattern.size());
+      auto segment = pattern.substr(begin, slash - begin);
+      if (!segment.empty() && segment != ".") {
+        rule.segments.emplace_back(segment);
+      }
+      begin = slash + 1;
+    }
+    if (!rule.segments.empty()) {
+      filter.push_back(std::move(rule));
+    }
+    pos = end + 1;
+  }
+  return filter;
+}
+
+// Whether rule matches path, or a directory above it, like a pattern
+// naming a directory covers everything below
+bool matches(const FilterRule& rule, span<const string_view> path) {
+  if (rule.segments.size() > path.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < rule.segments.size(); ++i) {
+    if (!wildcard_match(rule.segments[i], path[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The last rule matching path decides, paths no rule matches are left out
+bool accepts(const SrcFilter& filter, span<const string_view> path) {
+  bool accepted = false;
+  for (const auto& rule : filter) {
+    if (matches(rule, path)) {
+      accepted = rule.include;
+    }
+  }
+  return accepted;
+}
+
+// Whether the filter accepts nothing below directory dir: the last rule
+// matching it excludes, and no rule after that includes
+bool prunes(const SrcFilter& filter, span<const string_view> dir) {
+  for (const auto& rule : std::views::reverse(filter)) {
+    if (matches(rule, dir)) {
+      return !rule.include;
+    }
+    if (rule.include) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Base of segments_below(): dir without a trailing slash
+string base_of(const fs::path& dir) {
+  auto base = dir.lexically_normal().generic_string();
+  while (base.size() > 1 && base.ends_with('/')) {
+    base.pop_back();
+  }
+  return base;
+}
+
+// Path segments of path below base
+vector<string_view> segments_below(string_view base, string_view path) {
+  vector<string_view> segments;
+  for (size_t begin = base.size() + 1; begin < path.size();) {
+    auto slash = std::min(path.find('/', begin), path.size());
+    segments.push_back(path.substr(begin, slash - begin));
+    begin = slash + 1;
+  }
+  return segments;
+}
+
+// A directory to walk, and the filters relative to base of which a
+// source needs one to accept it
+struct Walk {
+  string base;
+  fs::path dir;
+  span<const SrcFilter> filters;
+};
+
+bool any_accepts(span<const SrcFilter> filters,
+                 span<const string_view> path) {
+  return std::ranges::any_of(
+      filters, [&](const SrcFilter& f) { return accepts(f, path); });
+}
+
+bool all_prune(span<const SrcFilter> filters, span<const string_view> dir) {
+  return std::ranges::all_of(
+      filters, [&](const SrcFilter& f) { return prunes(f, dir); });
+}
+
+void walk(const Walk& item, vector<string>& sources) {
+  std::error_code ec;
+  fs::recursive_directory_iterator it{
+      item.dir, fs::directory_options::skip_permission_denied, ec};
+  for (; !ec && it != fs::recursive_directory_iterator{}; it.increment(ec)) {
+    auto path = it->path().lexically_normal().generic_string();
+    auto name = it->path().filename().string();
+    if (it->is_directory(ec)) {
+      if (name.starts_with('.') ||
+          all_prune(item.filters, segments_below(item.base, path))) {
+        it.disable_recursion_pending();
+      }
+      continue;
+    }
+    if (language_of(name) != none && it->is_regular_file(ec) &&
+        any_accepts(item.filters, segments_below(item.base, path))) {
+      sources.push_back(std::move(path));
+    }
+  }
+}
+
+// The parts of library.json deciding what PlatformIO builds
+struct LibraryManifest {
+  struct Build {
+    std::optional<string> srcDir;
+    std::optional<std::variant<string, vector<string>>> srcFilter;
+
+    struct glaze {
+      using T = Build;
+      static constexpr auto value =
+          glz::object("srcDir", &T::srcDir, "srcFilter", &T::srcFilter);
+    };
+  };
+  string name;
+  Build build;
+
+  struct glaze {
+    using T = LibraryManifest;
+    static constexpr auto value =
+        glz::object("name", &T::name, "build", &T::build);
+  };
+};
+
+// Manifest of the library in dir, empty without a readable library.json
+LibraryManifest read_library_manifest(const fs::path& dir) {
+  LibraryManifest manifest;
+  auto err = glz::read_file_json<glz::opts{.error_on_unknown_keys = false}>(
+      manifest, (dir / "library.json").string(), string{});
+  return err ? LibraryManifest{} : manifest;
+}
+
+// Source filter text of the manifest, empty if it sets none
+string manifest_src_filter(const LibraryManifest& manifest) {
+  if (!manifest.build.srcFilter) {
+    return {};
+  }
+  if (const auto* text = std::get_if<string>(&*manifest.build.srcFilter)) {
+    return *text;
+  }
+  string text;
+  for (const auto& rule : std::get<vector<string>>(*manifest.build.srcFilter)) {
+    text += rule + " ";
+  }
+  return text;
+}
+
+// Parent directory of an absolute path, empty for the root
+string_view parent_of(string_view path) {
+  auto slash = path.find_last_of('/');
+  return slash == string_view::npos || slash == 0 ? string_view{}
+                                                  : path.substr(0, slash);
+}
+
+}  // namespace
+
+vector<string> scan_sources(const string& proj_path, const PioConfig& config) {
+  auto root = fs::absolute(proj_path).lexically_normal();
+  auto src_dir = root / config.get("platformio", "src_dir").value_or("src");
+  auto lib_dir = root / config.get("platformio", "lib_dir").value_or("lib");
+  const auto& env_names = config.envs();
+
+  // Every distinct filter of the environments, a source one of them
+  // builds is built
+  vector<string> filter_texts;
+  for (const auto& env : env_names) {
+    auto section = "env:" + env;
+    auto text = config.get(section, "build_src_filter")
+                    .or_else([&] { return config.get(section, "src_filter"); })
+                    .value_or(string{DEFAULT_SRC_FILTER});
+    if (std::ranges::find(filter_texts, text) == filter_texts.end()) {
+      filter_texts.push_back(std::move(text));
+    }
+  }
+  if (filter_texts.empty()) {
+    filter_texts.emplace_back(DEFAULT_SRC_FILTER);
+  }
+  vector<SrcFilter> src_filters;
+  for (const auto& text : filter_texts) {
+    src_filters.push_back(parse_src_filter(text));
+  }
+
+  // A library counts unless every environment ignores it by its directory
+  // or manifest name
+  auto ignored = [&](const string& dir_name, const string& name) {
+    return !env_names.empty() &&
+           std::ranges::all_of(env_names, [&](const string& env) {
+             auto ignores = config.get_list("env:" + env, "lib_ignore");
+             return std::ranges::find(ignores, dir_name) != ignores.end() ||
+                    (!name.empty() &&
+                     std::ranges::find(ignores, name) != ignores.end());
+           });
+  };
+
+  // Libraries and the directories of src_dir are walked in parallel
+  vector<Walk> items;
+  vector<string> sources;
+  auto src_base = base_of(src_dir);
+  std::error_code ec;
+  for (const auto& entry : fs::directory_iterator{src_dir, ec}) {
+    auto path = entry.path().lexically_normal().generic_string();
+    auto name = entry.path().filename().string();
+    auto below = segments_below(src_base, path);
+    if (entry.is_directory(ec)) {
+      if (!name.starts_with('.') && !all_prune(src_filters, below)) {
+        items.push_back(
+            {.base = src_base, .dir = entry.path(), .filters = src_filters});
+      }
+    } else if (language_of(name) != none && entry.is_regular_file(ec) &&
+               any_accepts(src_filters, below)) {
+      sources.push_back(std::move(path));
+    }
+  }
+
+  // Each library's own filter, stable while items point into it
+  std::list<SrcFilter> lib_filters;
+  for (const auto& entry : fs::directory_iterator{lib_dir, ec}) {
+    auto dir_name = entry.path().filename().string();
+    if (!entry.is_directory(ec) || dir_name.starts_with('.')) {
+      continue;
+    }
+    auto manifest = read_library_manifest(entry.path());
+    if (ignored(dir_name, manifest.name)) {
+      continue;
+    }
+    auto filter = manifest_src_filter(manifest);
+    fs::path dir = entry.path();
+    if (manifest.build.srcDir) {
+      dir /= *manifest.build.srcDir;
+    } else if (fs::is_directory(entry.path() / "src", ec)) {
+      dir /= "src";
+    } else if (filter.empty()) {
+      filter = LIBRARY_SRC_FILTER;
+    }
+    auto& parsed = lib_filters.emplace_back(
+        parse_src_filter(filter.empty() ? DEFAULT_SRC_FILTER : filter));
+    items.push_back({.base = base_of(dir),
+                     .dir = dir,
+                     .filters = span{&parsed, 1}});
+  }
+
+  vector<vector<string>> found(items.size());
+  parallel_for(items.size(), [&](size_t i) { walk(items[i], found[i]); });
+
+  for (auto& item_sources : found) {
+    sources.insert(sources.end(), std::make_move_iterator(item_sources.begin()),
+                   std::make_move_iterator(item_sources.end()));
+  }
+  std::ranges::sort(sources);
+  return sources;
+}
+
+size_t infer_new_sources(span<EnvDatabase> envs,
+                         span<const string> sources,
+                         const string& proj_path,
+                         InternPool& pool) {
+  boost::unordered_flat_set<string_view> known;
+  for (const auto& env : envs) {
+    for (const auto& entry : env.entries) {
+      known.insert(entry.key);
+    }
+  }
+  vector<string_view> fresh;
+  for (const auto& source : sources) {
+    if (!known.contains(source)) {
+      fresh.push_back(source);
+    }
+  }
+  if (fresh.empty()) {
+    return 0;
+  }
+
+  auto root = fs::absolute(proj_path).lexically_normal().generic_string();
+  while (root.size() > 1 && root.ends_with('/')) {
+    root.pop_back();
+  }
+
+  constexpr size_t NO_ENTRY = SIZE_MAX;
+  vector<bool> inferred(fresh.size());
+  for (auto& env : envs) {
+    // First entry per directory and language, in priority order
+    boost::unordered_flat_map<string_view, std::array<size_t, 2>> closest;
+    for (size_t i = 0; i < env.entries.size(); ++i) {
+      string_view key = env.entries[i].key;
+      auto language = language_of(key);
+      if (language == none) {
+        continue;
+      }
+      auto [it, inserted] =
+          closest.try_emplace(parent_of(key), std::array{NO_ENTRY, NO_ENTRY});
+      if (it->second[language] == NO_ENTRY) {
+        it->second[language] = i;
+      }
+    }
+
+    size_t added = 0;
+    for (size_t f = 0; f < fresh.size(); ++f) {
+      auto language = language_of(fresh[f]);
+      size_t sibling = NO_ENTRY;
+      for (string_view dir = parent_of(fresh[f]); !dir.empty();
+           dir = parent_of(dir)) {
+        if (auto it = closest.find(dir); it != closest.end()) {
+          auto [same, other] =
+              std::pair{it->second[language], it->second[1 - language]};
+          sibling = same != NO_ENTRY ? same : other;
+          break;
+        }
+        // Not above the project, flags of other projects do not fit
+        if (dir == root) {
+          break;
+        }
+      }
+      if (sibling == NO_ENTRY) {
+        continue;
+      }
+
+      Entry entry = env.entries[sibling];
+      entry.key = pool.intern(fresh[f]);
+      entry.file = entry.key;
+      entry.output = {};
+      env.entries.push_back(entry);
+      inferred[f] = true;
+      ++added;
+    }
+    env.stats.entries_inferred = added;
+  }
+  return std::ranges::count(inferred, true);
+}
@@ -0,0 +1,421 @@
+#include "ini.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <mutex>
+#include "mapped_file.h"
+
+using std::expected;
+using std::optional;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Guards against extends/interpolation cycles
+constexpr int MAX_DEPTH = 16;
+
+string_view trim(string_view s) {
+  auto first = s.find_first_not_of(" \t\r");
+  if (first == string_view::npos) {
+    return {};
+  }
+  auto last = s.find_last_not_of(" \t\r");
+  return s.substr(first, last - first + 1);
+}
+
+// Inline comments start with ';' or '#' preceded by whitespace
+string_view strip_inline_comment(string_view s) {
+  for (size_t i = 1; i < s.size(); ++i) {
+    if ((s[i] == ';' || s[i] == '#') && (s[i - 1] == ' ' || s[i - 1] == '\t')) {
+      return trim(s.substr(0, i));
+    }
+  }
+  return s;
+}
+
+string to_lower(string_view s) {
+  string lower(s);
+  std::ranges::transform(lower, lower.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return lower;
+}
+
+// Resolves an extra_configs entry to existing files
+// Wildcards are supported in the file name component.
+vector<fs::path> expand_config_pattern(const fs::path& proj_dir,
+                                       string_view pattern) {
+  string expanded(pattern);
+  if (expanded.starts_with('~')) {
+    if (const char* home = std::getenv("HOME")) {
+      expanded.replace(0, 1, home);
+    }
+  }
+  fs::path path{expanded};
+  if (path.is_relative()) {
+    path = proj_dir / path;
+  }
+
+  vector<fs::path> matches;
+  std::error_code ec;
+  auto file_pattern = path.filename().string();
+  if (file_pattern.find_first_of("*?") == string::npos) {
+    if (fs::is_regular_file(path, ec)) {
+      matches.push_back(path);
+    }
+    return matches;
+  }
+  for (const auto& entry : fs::directory_iterator(path.parent_path(), ec)) {
+    if (entry.is_regular_file(ec) &&
+        wildcard_match(file_pattern, entry.path().filename().string())) {
+      matches.push_back(entry.path());
+    }
+  }
+  std::ranges::sort(matches);
+  return matches;
+}
+
+// Size and modification time of a file that went into a parsed config
+struct FileStamp {
+  fs::path path;
+  uintmax_t size{};
+  fs::file_time_type mtime{};
+
+  static optional<FileStamp> of(const fs::path& path) {
+    std::error_code size_ec, time_ec;
+    auto size = fs::file_size(path, size_ec);
+    auto mtime = fs::last_write_time(path, time_ec);
+    if (size_ec || time_ec) {
+      return std::nullopt;
+    }
+    return FileStamp{path, size, mtime};
+  }
+
+  bool unchanged() const {
+    auto now = of(path);
+    return now && now->size == size && now->mtime == mtime;
+  }
+};
+
+struct CacheEntry {
+  vector<FileStamp> stamps;
+  std::shared_ptr<const PioConfig> config;
+};
+
+std::mutex cache_mtx;
+boost::unordered_flat_map<string, CacheEntry> config_cache;
+
+// Whether the extra_configs patterns of a cached config still match only
+// files it was read from; a file added where a wildcard expands leaves
+// every stamp unchanged
+bool extra_configs_unchanged(const fs::path& proj_dir,
+                             const CacheEntry& entry) {
+  for (const auto& pattern :
+       entry.config->get_list("platformio", "extra_configs")) {
+    for (const auto& path : expand_config_pattern(proj_dir, pattern)) {
+      bool read = std::ranges::any_of(
+          entry.stamps, [&](const FileStamp& s) { return s.path == path; });
+      if (!read) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool wildcard_match(string_view pattern, string_view name) {
+  size_t p = 0, n = 0;
+  size_t star = string_view::npos, resume = 0;
+  while (n < name.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+      ++p;
+      ++n;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      resume = n;
+    } else if (star != string_view::npos) {
+      p = star + 1;
+      n = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+void PioConfig::merge(string_view text) {
+  Options* current = nullptr;
+  string* last_value = nullptr;  // target of continuation lines
+
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t eol = text.find('\n', pos);
+    if (eol == string_view::npos) {
+      eol = text.size();
+    }
+    string_view line = text.substr(pos, eol - pos);
+    pos = eol + 1;
+
+    bool indented = !line.empty() && (line[0] == ' ' || line[0] == '\t');
+    string_view content = trim(line);
+    if (content.empty() || content[0] == ';' || content[0] == '#') {
+      continue;
+    }
+
+    // Indented lines continue the previous option's value. The newline
+    // is kept even after an empty first line, it marks a line list.
+    if (indented && last_value) {
+      last_value->push_back('\n');
+      last_value->append(strip_inline_comment(content));
+      continue;
+    }
+
+    if (content[0] == '[') {
+      auto close = content.find(']');
+      string name{trim(content.substr(1, close == string_view::npos
+                                             ? string_view::npos
+                                             : close - 1))};
+      auto [it, inserted] = sections_.try_emplace(name);
+      if (inserted) {
+        section_order_.push_back(name);
+        if (name.starts_with("env:")) {
+          envs_.push_back(name.substr(4));
+        }
+      }
+      current = &it->second;
+      last_value = nullptr;
+      continue;
+    }
+
+    if (!current) {
+      continue;  // options before the first section are ignored
+    }
+
+    auto delim = content.find_first_of("=:");
+    string key = to_lower(trim(content.substr(0, delim)));
+    string_view value =
+        delim == string_view::npos
+            ? string_view{}
+            : strip_inline_comment(trim(content.substr(delim + 1)));
+    last_value = &((*current)[key] = string(value));
+  }
+}
+
+const string* PioConfig::find_raw(string_view section,
+                                  string_view option,
+                                  int depth) const {
+  if (depth > MAX_DEPTH) {
+    return nullptr;
+  }
+
+  auto sec = sections_.find(string(section));
+  if (sec != sections_.end()) {
+    if (auto opt = sec->second.find(string(option)); opt != sec->second.end()) {
+      return &opt->second;
+    }
+  }
+
+  if (!section.starts_with("env:")) {
+    return nullptr;
+  }
+
+  // [env:NAME] falls back to its "extends" sections, in order...
+  if (sec != sections_.end()) {
+    if (auto ext = sec->second.find("extends"); ext != sec->second.end()) {
+      for (const auto& base : split_list(ext->second)) {
+        if (auto value = find_raw(base, option, depth + 1)) {
+          return value;
+        }
+      }
+    }
+  }
+
+  // ...and then to the common [env] section
+  auto common = sections_.find("env");
+  if (common != sections_.end()) {
+    if (auto opt = common->second.find(string(option));
+        opt != common->second.end()) {
+      return &opt->second;
+    }
+  }
+  return nullptr;
+}
+
+string PioConfig::interpolate(string_view value,
+                              string_view section,
+                              int depth) const {
+  string result;
+  result.reserve(value.size());
+
+  size_t pos = 0;
+  while (pos < value.size()) {
+    auto open = value.find("${", pos);
+    auto close = open == string_view::npos ? open : value.find('}', open);
+    if (close == string_view::npos) {
+      result.append(value.substr(pos));
+      break;
+    }
+    result.append(value.substr(pos, open - pos));
+    pos = close + 1;
+
+    // ${section.option}, where section may be "this" or "sysenv"
+    string_view ref = value.substr(open + 2, close - open - 2);
+    string_view literal = value.substr(open, close - open + 1);
+    auto dot = ref.find('.');
+    if (dot == string_view::npos || depth > MAX_DEPTH) {
+      result.append(literal);
+      continue;
+    }
+    string_view ref_section = ref.substr(0, dot);
+    string_view ref_option = ref.substr(dot + 1);
+
+    if (ref_section == "sysenv") {
+      if (const char* env_value = std::getenv(string(ref_option).c_str())) {
+        result.append(env_value);
+      }
+      continue;
+    }
+    if (ref_section == "this") {
+      if (ref_option == "__env__" && section.starts_with("env:")) {
+        result.append(section.substr(4));
+        continue;
+      }
+      ref_section = section;
+    }
+
+    if (auto raw = find_raw(ref_section, ref_option, 0)) {
+      result.append(interpolate(*raw, section, depth + 1));
+    } else {
+      result.append(literal);  // unknown references are kept verbatim
+    }
+  }
+  return result;
+}
+
+optional<string> PioConfig::get(string_view section,
+                                string_view option) const {
+  if (auto raw = find_raw(section, option, 0)) {
+    return interpolate(*raw, section, 0);
+  }
+  return std::nullopt;
+}
+
+vector<string> PioConfig::get_list(string_view section,
+                                   string_view option) const {
+  auto value = get(section, option);
+  return value ? split_list(*value) : vector<string>{};
+}
+
+vector<string> PioConfig::split_list(string_view value) {
+  // Like PlatformIO's parse_multi_values(): a comma only separates when
+  // whitespace follows, so "-DLIST={1,2}" stays one item
+  bool by_line = value.find('\n') != string_view::npos;
+  auto separator_at = [&](size_t pos) {
+    for (; pos < value.size(); ++pos) {
+      if (by_line ? value[pos] == '\n'
+                  : value[pos] == ',' && pos + 1 < value.size() &&
+                        (value[pos + 1] == ' ' || value[pos + 1] == '\t')) {
+        return pos;
+      }
+    }
+    return value.size();
+  };
+  vector<string> items;
+  size_t pos = 0;
+  while (pos <= value.size()) {
+    auto end = separator_at(pos);
+    auto item = trim(value.substr(pos, end - pos));
+    if (!item.empty() && item[0] != ';' && item[0] != '#') {
+      items.emplace_back(item);
+    }
+    pos = end + 1;
+  }
+  return items;
+}
+
+string PioConfig::default_env() const {
+  for (const auto& env : get_list("platformio", "default_envs")) {
+    if (std::ranges::find(envs_, env) != envs_.end()) {
+      return env;
+    }
+  }
+  return envs_.empty() ? string{} : envs_.front();
+}
+
+expected<std::shared_ptr<const PioConfig>, string> load_pio_config(
+    const string& proj_path) {
+  auto proj_dir = fs::path{proj_path};
+  auto ini_path = proj_dir / "platformio.ini";
+  if (!fs::exists(ini_path)) {
+    return unexpected(fmt::format("{} not found", ini_path.string()));
+  }
+
+  auto cache_key = ini_path.lexically_normal().string();
+  {
+    std::scoped_lock lock(cache_mtx);
+    if (auto it = config_cache.find(cache_key); it != config_cache.end()) {
+      if (std::ranges::all_of(it->second.stamps, &FileStamp::unchanged) &&
+          extra_configs_unchanged(proj_dir, it->second)) {
+        return it->second.config;
+      }
+    }
+  }
+
+  auto config = std::make_shared<PioConfig>();
+  vector<FileStamp> stamps;
+
+  auto read_into_config = [&](const fs::path& path) -> expected<void, string> {
+    auto stamp = FileStamp::of(path);
+    auto file = MappedFile::open(path);
+    if (!stamp || !file) {
+      return unexpected(
+          file ? fmt::format("Failed to open {}", path.string())
+               : file.error());
+    }
+    config->merge(file->view());
+    config->files_.push_back(path);
+    stamps.push_back(std::move(*stamp));
+    return {};
+  };
+
+  if (auto read = read_into_config(ini_path); !read) {
+    return unexpected(read.error());
+  }
+
+  // Extra configs may themselves add extra_configs, so keep expanding the
+  // merged list until no new files turn up
+  bool found_new = true;
+  while (found_new) {
+    found_new = false;
+    auto patterns = config->get_list("platformio", "extra_configs");
+    for (const auto& pattern : patterns) {
+      for (const auto& path : expand_config_pattern(proj_dir, pattern)) {
+        bool seen = std::ranges::any_of(
+            stamps, [&](const FileStamp& s) { return s.path == path; });
+        if (seen) {
+          continue;
+        }
+        if (auto read = read_into_config(path); !read) {
+          return unexpected(read.error());
+        }
+        found_new = true;
+      }
+    }
+  }
+
+  std::scoped_lock lock(cache_mtx);
+  config_cache.insert_or_assign(cache_key,
+                                CacheEntry{std::move(stamps), config});
+  return config;
+}
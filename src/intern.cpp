@@ -0,0 +1,62 @@
+#include "intern.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+using std::span;
+using std::string_view;
+
+string_view InternPool::intern(string_view str) {
+  if (str.empty()) {
+    return {};
+  }
+  size_t hash = std::hash<string_view>{}(str);
+  auto& shard = string_shards_[hash % NUM_SHARDS];
+
+  std::scoped_lock lock(shard.mtx);
+  if (auto it = shard.strings.find(str); it != shard.strings.end()) {
+    return *it;
+  }
+  auto* data = static_cast<char*>(shard.arena.allocate(str.size(), 1));
+  std::memcpy(data, str.data(), str.size());
+  string_view stored{data, str.size()};
+  shard.strings.insert(stored);
+  return stored;
+}
+
+span<const string_view> InternPool::intern_list(span<const string_view> list) {
+  if (list.empty()) {
+    return {};
+  }
+  size_t hash = ListHash{}(list);
+  auto& shard = list_shards_[hash % NUM_SHARDS];
+
+  std::scoped_lock lock(shard.mtx);
+  if (auto it = shard.lists.find(list); it != shard.lists.end()) {
+    return *it;
+  }
+  auto* data = static_cast<string_view*>(shard.arena.allocate(
+      list.size() * sizeof(string_view), alignof(string_view)));
+  std::uninitialized_copy(list.begin(), list.end(), data);
+  span<const string_view> stored{data, list.size()};
+  shard.lists.insert(stored);
+  return stored;
+}
+
+size_t InternPool::ListHash::operator()(span<const string_view> list) const {
+  size_t hash = list.size();
+  for (auto str : list) {
+    // boost::hash_combine
+    hash ^= std::hash<const void*>{}(str.data()) + 0x9e3779b9 + (hash << 6) +
+            (hash >> 2);
+  }
+  return hash;
+}
+
+bool InternPool::ListEqual::operator()(span<const string_view> a,
+                                       span<const string_view> b) const {
+  return std::ranges::equal(a, b, [](string_view x, string_view y) {
+    return x.data() == y.data() && x.size() == y.size();
+  });
+}
@@ -0,0 +1,181 @@
+#include "key_rules.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <bit>
+#include <utility>
+#include "ini.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+expected<KeyRules, string> KeyRules::compile(span<const string> rules,
+                                             KeyNames names) {
+  KeyRules compiled;
+  compiled.names_ = std::move(names);
+  for (const auto& raw : rules) {
+    string_view rule = raw;
+    while (rule.starts_with('/')) {
+      rule.remove_prefix(1);
+    }
+    while (rule.ends_with('/')) {
+      rule.remove_suffix(1);
+    }
+    if (rule.empty()) {
+      continue;
+    }
+
+    auto invalid = [&](string_view why) {
+      return unexpected(
+          fmt::format("Invalid dedup rule \"{}\": {}", raw, why));
+    };
+    auto first = compiled.segments_.size();
+    bool drops = false;
+    for (size_t pos = 0; pos <= rule.size();) {
+      auto end = std::min(rule.find('/', pos), rule.size());
+      auto text = rule.substr(pos, end - pos);
+      pos = end + 1;
+
+      Segment segment{.first = static_cast<uint8_t>(first)};
+      if (text.empty() || text == "." || text == "..") {
+        return invalid("empty, \".\" or \"..\" segment");
+      } else if (text == "*") {
+        segment.kind = Kind::any;
+      } else if (text == "{env}") {
+        segment.kind = Kind::env;
+      } else if (text == "{board}") {
+        segment.kind = Kind::board;
+      } else if (text == "{*}") {
+        segment.kind = Kind::drop_any;
+      } else if (text.starts_with('{') && text.ends_with('}')) {
+        return invalid(fmt::format("unknown placeholder {}", text));
+      } else {
+        segment.text = text;
+      }
+      drops |= segment.kind != Kind::literal && segment.kind != Kind::any;
+      compiled.segments_.push_back(std::move(segment));
+    }
+
+    auto length = compiled.segments_.size() - first;
+    if (!drops) {
+      return invalid("no {env}, {board} or {*} segment to remove");
+    } else if (length > MAX_RULE_SEGMENTS) {
+      return invalid(
+          fmt::format("more than {} segments", MAX_RULE_SEGMENTS));
+    } else if (compiled.segments_.size() > MAX_SEGMENTS) {
+      return unexpected(fmt::format(
+          "Dedup rules have more than {} segments together", MAX_SEGMENTS));
+    }
+    compiled.segments_.back().last = true;
+    compiled.starts_ |= uint64_t{1} << first;
+    compiled.rules_.push_back(raw);
+  }
+  return compiled;
+}
+
+bool KeyRules::matches(const Segment& segment, string_view text) const {
+  auto named = [&](const vector<string>& names) {
+    return names.empty() || std::ranges::find(names, text) != names.end();
+  };
+  switch (segment.kind) {
+    case Kind::literal:
+      return text == segment.text;
+    case Kind::env:
+      return named(names_.envs);
+    case Kind::board:
+      return named(names_.boards);
+    case Kind::any:
+    case Kind::drop_any:
+      return true;
+  }
+  return false;
+}
+
+void KeyRules::apply(string& key) const {
+  if (segments_.empty()) {
+    return;
+  }
+
+  // Bounds of the last MAX_RULE_SEGMENTS directory segments, the end
+  // including the '/' after them
+  using Bounds = std::pair<size_t, size_t>;
+  std::array<Bounds, MAX_RULE_SEGMENTS> recent;
+  std::array<Bounds, MAX_DROPS> drops;
+  size_t num_drops = 0;
+
+  uint64_t active = 0;  // positions the previous segment advanced to
+  size_t index = 0;
+  for (size_t pos = key.starts_with('/') ? 1 : 0;; ++index) {
+    auto slash = key.find('/', pos);
+    if (slash == string::npos) {
+      break;  // the file name
+    }
+    string_view text{key.data() + pos, slash - pos};
+    recent[index % recent.size()] = {pos, slash + 1};
+    pos = slash + 1;
+
+    uint64_t next = 0;
+    for (auto candidates = active | starts_; candidates != 0;
+         candidates &= candidates - 1) {
+      auto i = static_cast<size_t>(std::countr_zero(candidates));
+      const auto& segment = segments_[i];
+      if (!matches(segment, text)) {
+        continue;
+      }
+      if (!segment.last) {
+        next |= uint64_t{1} << (i + 1);
+        continue;
+      }
+      // Segment p of the rule was the one (i - p) segments back
+      for (size_t p = segment.first; p <= i; ++p) {
+        auto kind = segments_[p].kind;
+        if (kind != Kind::literal && kind != Kind::any &&
+            num_drops < drops.size()) {
+          drops[num_drops++] = recent[(index - (i - p)) % recent.size()];
+        }
+      }
+    }
+    active = next;
+  }
+
+  // Erased back to front, so the bounds before stay valid; rules that
+  // overlap may name a segment twice
+  std::sort(drops.begin(), drops.begin() + num_drops);
+  auto last = std::unique(drops.begin(), drops.begin() + num_drops);
+  for (auto it = last; it != drops.begin();) {
+    --it;
+    key.erase(it->first, it->second - it->first);
+  }
+}
+
+const KeyRules& default_key_rules() {
+  static const KeyRules rules = [] {
+    vector<string> defaults(DEFAULT_KEY_RULES.begin(),
+                            DEFAULT_KEY_RULES.end());
+    return *KeyRules::compile(defaults);
+  }();
+  return rules;
+}
+
+expected<KeyRules, string> load_key_rules(const PioConfig* config) {
+  if (!config) {
+    return default_key_rules();
+  }
+  vector<string> rules(DEFAULT_KEY_RULES.begin(), DEFAULT_KEY_RULES.end());
+  for (auto& rule : config->get_list("pio-clangd", "dedup_rules")) {
+    rules.push_back(std::move(rule));
+  }
+
+  KeyNames names{.envs = config->envs()};
+  for (const auto& env : config->envs()) {
+    auto board = config->get("env:" + env, "board");
+    if (board && !board->empty() &&
+        std::ranges::find(names.boards, *board) == names.boards.end()) {
+      names.boards.push_back(std::move(*board));
+    }
+  }
+  return KeyRules::compile(rules, std::move(names));
+}
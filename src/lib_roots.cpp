@@ -0,0 +1,307 @@
+#include "lib_roots.h"
+#include <fmt/core.h>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <vector>
+#include "clangd.h"
+#include "mapped_file.h"
+#include "util.h"
+
+using std::span;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Directory of an entry's source file, lexically normal
+string source_dir(const Entry& entry) {
+  fs::path file{entry.file};
+  if (file.is_relative()) {
+    file = fs::path{entry.directory} / file;
+  }
+  return file.lexically_normal().parent_path().generic_string();
+}
+
+string manifest_path(string_view dir, string_view name) {
+  string path{dir};
+  if (!path.ends_with('/')) {
+    path.push_back('/');
+  }
+  path.append(name);
+  return path;
+}
+
+// A file below a root, path relative to it
+struct RootFile {
+  string path;
+  uint64_t size{};
+  int64_t mtime{};
+};
+
+// Files of root but in hidden directories, by path: directory order
+// differs between file systems
+vector<RootFile> list_root(const fs::path& root) {
+  vector<RootFile> files;
+  std::error_code ec;
+  fs::recursive_directory_iterator it{
+      root, fs::directory_options::skip_permission_denied, ec};
+  for (; !ec && it != fs::recursive_directory_iterator{}; it.increment(ec)) {
+    if (it->is_directory(ec)) {
+      if (it->path().filename().string().starts_with('.')) {
+        it.disable_recursion_pending();
+      }
+      continue;
+    }
+    RootFile file{.path = it->path().lexically_relative(root).generic_string()};
+    if (it->is_regular_file(ec)) {
+      file.size = it->file_size(ec);
+      auto mtime = it->last_write_time(ec);
+      file.mtime = ec ? 0 : mtime.time_since_epoch().count();
+    }
+    files.push_back(std::move(file));
+  }
+  std::ranges::sort(files, {}, &RootFile::path);
+  return files;
+}
+
+// Manifests, sources and headers count by content; other files, such as
+// prebuilt archives and images, by size
+bool digested_by_content(string_view path) {
+  static constexpr std::array<string_view, 17> EXTENSIONS = {
+      "c",   "cc",  "cpp", "cxx", "c++", "C",   "h",  "hh", "hpp",
+      "hxx", "h++", "H",   "inc", "ipp", "tpp", "ino", "S"};
+  auto name = path.substr(path.find_last_of('/') + 1);
+  if (std::ranges::find(MANIFESTS, name) != MANIFESTS.end()) {
+    return true;
+  }
+  auto dot = name.find_last_of('.');
+  return dot != string_view::npos &&
+         std::ranges::find(EXTENSIONS, name.substr(dot + 1)) !=
+             EXTENSIONS.end();
+}
+
+uint64_t digest_files(const fs::path& root, span<const RootFile> files) {
+  uint64_t h = FNV_OFFSET;
+  for (const auto& file : files) {
+    h = fnv1a(file.path, h);
+    h = fnv1a("\n", h);
+    std::expected<MappedFile, string> mapped = std::unexpected(string{});
+    if (digested_by_content(file.path)) {
+      mapped = MappedFile::open(root / file.path);
+    }
+    h = mapped ? fnv1a(mapped->view(), h)
+               : fnv1a(fmt::format("{}", file.size), h);
+    h = fnv1a("\n", h);
+  }
+  return h;
+}
+
+// Cache key of a root: its path and the stamp of each of its files, so a
+// changed library is digested again
+string cache_key(const string& root, span<const RootFile> files) {
+  uint64_t h = FNV_OFFSET;
+  for (const auto& file : files) {
+    h = fnv1a(fmt::format("{}\n{} {}\n", file.path, file.size, file.mtime),
+              h);
+  }
+  return fmt::format("{}\n{:016x}", root, h);
+}
+
+}  // namespace
+
+uint64_t digest_root(const fs::path& root) {
+  return digest_files(root, list_root(root));
+}
+
+RootStats merge_identical_roots(span<EnvDatabase> envs,
+                                const string& proj_path,
+                                InternPool& pool,
+                                StatCache& stat_cache,
+                                const fs::path& cache_dir,
+                                const KeyRules& key_rules) {
+  RootStats stats;
+  auto project = fs::absolute(proj_path).lexically_normal().generic_string();
+  if (!project.ends_with('/')) {
+    project.push_back('/');
+  }
+
+  // Every directory that could hold the manifest of a source's root
+  boost::unordered_flat_set<string> source_dirs;
+  boost::unordered_flat_set<string> ancestors;
+  for (const auto& env : envs) {
+    for (const auto& entry : env.entries) {
+      auto dir = source_dir(entry);
+      if (!source_dirs.insert(dir).second) {
+        continue;
+      }
+      for (fs::path p{dir};; p = p.parent_path()) {
+        if (!ancestors.insert(p.generic_string()).second ||
+            !p.has_relative_path()) {
+          break;
+        }
+      }
+    }
+  }
+  vector<string> manifests;
+  for (const auto& dir : ancestors) {
+    for (auto name : MANIFESTS) {
+      manifests.push_back(manifest_path(dir, name));
+    }
+  }
+  stat_cache.stat_all(manifests);
+
+  // Nearest root of each directory, empty if there is none. The project
+  // and the directories above it are never one: a package.json there
+  // belongs to other tooling, and digesting it would read everything.
+  auto contains_project = [&](string_view dir) {
+    return project.starts_with(dir) &&
+           (dir.ends_with('/') || project[dir.size()] == '/');
+  };
+  boost::unordered_flat_map<string, string> root_of;
+  auto find_root = [&](const string& dir) -> string {
+    if (auto it = root_of.find(dir); it != root_of.end()) {
+      return it->second;
+    }
+    vector<string> below;
+    string root;
+    for (fs::path p{dir};; p = p.parent_path()) {
+      auto path = p.generic_string();
+      if (auto it = root_of.find(path); it != root_of.end()) {
+        root = it->second;
+        break;
+      }
+      if (contains_project(path)) {
+        break;
+      }
+      below.push_back(path);
+      bool has_manifest = std::ranges::any_of(MANIFESTS, [&](auto name) {
+        return stat_cache.status(manifest_path(path, name)) ==
+               StatCache::Status::file;
+      });
+      if (has_manifest) {
+        root = std::move(path);
+        break;
+      }
+      if (!p.has_relative_path()) {
+        break;
+      }
+    }
+    for (auto& path : below) {
+      root_of.try_emplace(std::move(path), root);
+    }
+    return root;
+  };
+
+  vector<string> roots;
+  {
+    boost::unordered_flat_set<string> distinct;
+    for (const auto& dir : source_dirs) {
+      if (auto root = find_root(dir); !root.empty()) {
+        distinct.insert(root);
+      }
+    }
+    roots.assign(distinct.begin(), distinct.end());
+  }
+  std::ranges::sort(roots);
+  stats.roots = roots.size();
+  if (roots.size() < 2) {
+    return stats;
+  }
+
+  // Digest each root once, in parallel. Listing a root is cheap next to
+  // reading it, so the cache is keyed by the stamps of its files.
+  vector<uint64_t> digests(roots.size());
+  std::atomic<size_t> cached{0};
+  parallel_for(roots.size(), [&](size_t i) {
+    auto files = list_root(roots[i]);
+    auto key = cache_key(roots[i], files);
+    auto path =
+        cache_dir / "roots" / fmt::format("{:016x}.json", fnv1a(roots[i]));
+    RootDigest digest;
+    if (!glz::read_file_json(digest, path.string(), string{}) &&
+        digest.key == key) {
+      digests[i] = digest.digest;
+      cached.fetch_add(1);
+      return;
+    }
+    digests[i] = digest_files(roots[i], files);
+
+    // Failing to cache only costs the next run a digest
+    auto json = glz::write_json(
+        RootDigest{.key = std::move(key), .digest = digests[i]});
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    if (json) {
+      (void)write_file_atomic(path, *json);
+    }
+  });
+  stats.cached = cached;
+  stats.hashed = roots.size() - stats.cached;
+
+  // Keys of a root's files start with its key, copies in .pio/libdeps of
+  // different environments already share one
+  vector<string> root_keys(roots.size());
+  for (size_t i = 0; i < roots.size(); ++i) {
+    make_dedup_key({}, roots[i] + "/", root_keys[i], key_rules);
+  }
+  boost::unordered_flat_map<uint64_t, vector<string_view>> copies;
+  for (size_t i = 0; i < roots.size(); ++i) {
+    auto& same = copies[digests[i]];
+    if (std::ranges::find(same, root_keys[i]) == same.end()) {
+      same.push_back(root_keys[i]);
+    }
+  }
+
+  boost::unordered_flat_map<string_view, string_view> merged_into;
+  for (auto& [digest, keys] : copies) {
+    if (keys.size() < 2) {
+      continue;
+    }
+    // The project's own copy is the one worked on, then an installed
+    // one, otherwise any stable choice does
+    auto rank = [&](string_view key) {
+      if (!key.starts_with(project)) {
+        return 2;
+      }
+      return key.substr(project.size()).starts_with(".pio/") ? 1 : 0;
+    };
+    auto kept = std::ranges::min(keys, {}, [&](string_view key) {
+      return std::pair{rank(key), key};
+    });
+    for (auto key : keys) {
+      if (key != kept) {
+        merged_into.emplace(key, kept);
+      }
+    }
+  }
+  stats.merged = merged_into.size();
+  if (merged_into.empty()) {
+    return stats;
+  }
+
+  string key;
+  for (auto& env : envs) {
+    for (auto& entry : env.entries) {
+      auto root = find_root(source_dir(entry));
+      if (root.empty()) {
+        continue;
+      }
+      string_view root_key =
+          root_keys[std::ranges::lower_bound(roots, root) - roots.begin()];
+      auto it = merged_into.find(root_key);
+      if (it == merged_into.end() || !entry.key.starts_with(root_key)) {
+        continue;
+      }
+      key.assign(it->second);
+      key.append(entry.key.substr(root_key.size()));
+      entry.key = pool.intern(key);
+    }
+  }
+  return stats;
+}
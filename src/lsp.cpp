@@ -0,0 +1,461 @@
+#include "lsp.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include "clangd_config.h"
+#include "database.h"
+#include "ini.h"
+#include "process.h"
+#include "targets.h"
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+using std::expected;
+using std::optional;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Client messages are only partially read, everything else is skipped
+constexpr auto PEEK_OPTS = glz::opts{.error_on_unknown_keys = false};
+
+struct MessageMethod {
+  optional<string> method{};
+
+  struct glaze {
+    using T = MessageMethod;
+    static constexpr auto value = glz::object("method", &T::method);
+  };
+};
+
+struct SwitchEnvParams {
+  string env{};
+
+  struct glaze {
+    using T = SwitchEnvParams;
+    static constexpr auto value = glz::object("env", &T::env);
+  };
+};
+
+struct SwitchEnvMessage {
+  SwitchEnvParams params{};
+
+  struct glaze {
+    using T = SwitchEnvMessage;
+    static constexpr auto value = glz::object("params", &T::params);
+  };
+};
+
+struct ConfigurationSettings {
+  std::map<string, FileSettings> compilationDatabaseChanges{};
+
+  struct glaze {
+    using T = ConfigurationSettings;
+    static constexpr auto value = glz::object(
+      "compilationDatabaseChanges", &T::compilationDatabaseChanges);
+  };
+};
+
+struct ConfigurationParams {
+  ConfigurationSettings settings{};
+
+  struct glaze {
+    using T = ConfigurationParams;
+    static constexpr auto value = glz::object("settings", &T::settings);
+  };
+};
+
+struct ConfigurationNotification {
+  string jsonrpc{"2.0"};
+  string method{"workspace/didChangeConfiguration"};
+  ConfigurationParams params{};
+
+  struct glaze {
+    using T = ConfigurationNotification;
+    static constexpr auto value = glz::object(
+      "jsonrpc", &T::jsonrpc,
+      "method", &T::method,
+      "params", &T::params);
+  };
+};
+
+// Stamp of the inputs of every environment and the project's rules,
+// std::nullopt without a readable platformio.ini
+optional<TargetsStamp> current_stamp(const string& proj_path) {
+  auto config = load_pio_config(proj_path);
+  if (!config) {
+    return std::nullopt;
+  }
+  auto stamp = make_targets_stamp(proj_path, (*config)->envs());
+  if (auto rules = load_project_rules(config->get(), {}, proj_path)) {
+    stamp_project_rules(*rules, stamp);
+  }
+  return stamp;
+}
+
+// Proxy state shared by the client reader and the input watcher
+class LspProxy {
+ public:
+  LspProxy(const LspOptions& options, int server_in)
+      : options_{options}, env_{options.environment}, server_in_{server_in} {}
+
+  // Forwards a client message to the server unless the proxy consumes it
+  // Returns false once the server can no longer be written to.
+  bool on_client_message(const string& body) {
+    // Responses carry no method and pass through like everything else
+    MessageMethod message;
+    std::ignore = glz::read<PEEK_OPTS>(message, body);
+
+    if (message.method == SWITCH_ENV_METHOD) {
+      SwitchEnvMessage switch_env;
+      if (auto err = glz::read<PEEK_OPTS>(switch_env, body)) {
+        fmt::println(stderr, "pio-clangd: Malformed {}: {}",
+                     SWITCH_ENV_METHOD, glz::format_error(err, body));
+        return true;
+      }
+      std::scoped_lock lock(state_mtx_);
+      return refresh(switch_env.params.env);
+    }
+
+    if (!send(body)) {
+      return false;
+    }
+    if (message.method == "initialized") {
+      std::scoped_lock lock(state_mtx_);
+      initialized_ = true;
+      return refresh(env_);
+    }
+    return true;
+  }
+
+  // Pushes changed commands if an input changed since the last refresh
+  bool poll() {
+    std::scoped_lock lock(state_mtx_);
+    if (!initialized_ || current_stamp(options_.proj_path) == stamp_) {
+      return true;
+    }
+    return refresh(env_);
+  }
+
+ private:
+  bool send(string_view body) {
+    std::scoped_lock lock(write_mtx_);
+    return write_lsp_message(server_in_, body);
+  }
+
+  // Recomputes the settings for env and sends what changed
+  // Caller holds state_mtx_.
+  bool refresh(const string& env) {
+    // Taken before reading, so inputs changing meanwhile are seen by the
+    // next poll. Also recorded on failure, to retry only after a change.
+    stamp_ = current_stamp(options_.proj_path);
+
+    auto settings = compute_file_settings(options_.proj_path, env);
+    if (!settings) {
+      fmt::println(stderr, "pio-clangd: {}", settings.error());
+      return true;
+    }
+    ConfigurationNotification notification;
+    notification.params.settings.compilationDatabaseChanges =
+        settings_delta(settings_, *settings);
+    settings_ = std::move(*settings);
+    env_ = env;
+
+    auto& changes = notification.params.settings.compilationDatabaseChanges;
+    if (changes.empty()) {
+      return true;
+    }
+    fmt::println(stderr, "pio-clangd: Sending {} changed compile commands",
+                 changes.size());
+    auto body = glz::write_json(notification);
+    return body && send(*body);
+  }
+
+  const LspOptions& options_;
+
+  std::mutex state_mtx_;  // guards the state below
+  bool initialized_{false};
+  string env_;
+  FileSettingsMap settings_{};  // what the server was sent so far
+  optional<TargetsStamp> stamp_{};
+
+  std::mutex write_mtx_;  // serializes messages to the server
+  int server_in_;
+};
+
+}  // namespace
+
+expected<FileSettingsMap, string> compute_file_settings(const string& proj_path,
+                                                        const string& env) {
+  auto config = load_pio_config(proj_path);
+  if (!config) {
+    return unexpected(config.error());
+  }
+  const vector<string>& environments = (*config)->envs();
+  string target_env = env.empty() ? (*config)->default_env() : env;
+  auto target_it = std::ranges::find(environments, target_env);
+  if (target_it == environments.end()) {
+    return unexpected(fmt::format(
+        "Environment '{}' not found in platformio.ini", target_env));
+  }
+
+  auto rules = load_project_rules(config->get(), {}, proj_path);
+  if (!rules) {
+    return unexpected(rules.error());
+  }
+
+  InternPool pool;
+  Profiler profiler{false};
+  auto envs = load_env_databases(proj_path, environments, pool, profiler,
+                                 rules->entry_rules());
+  if (!envs) {
+    string message;
+    for (const auto& error : envs.error()) {
+      message += message.empty() ? error : "\n" + error;
+    }
+    return unexpected(std::move(message));
+  }
+
+  auto target = resolve_target(*envs, target_it - environments.begin());
+  FileSettingsMap settings;
+  settings.reserve(target.entries.size());
+  for (const Entry* entry : target.entries) {
+    fs::path file{entry->file};
+    if (file.is_relative()) {
+      file = fs::path{entry->directory} / file;
+    }
+    // The driver comes first, as in compile_commands.json
+    FileSettings file_settings{.workingDirectory = string{entry->directory}};
+    auto& command = file_settings.compilationCommand;
+    if (!entry->driver.empty()) {
+      command.emplace_back(entry->driver);
+    }
+    command.insert(command.end(), entry->arguments.begin(),
+                   entry->arguments.end());
+    settings.try_emplace(file.lexically_normal().string(),
+                         std::move(file_settings));
+  }
+  return settings;
+}
+
+std::map<string, FileSettings> settings_delta(const FileSettingsMap& before,
+                                              const FileSettingsMap& after) {
+  std::map<string, FileSettings> delta;
+  for (const auto& [file, settings] : after) {
+    auto it = before.find(file);
+    if (it == before.end() || it->second != settings) {
+      delta.emplace(file, settings);
+    }
+  }
+  return delta;
+}
+
+#if !defined(_WIN32)
+
+optional<string> LspReader::next() {
+  constexpr string_view CONTENT_LENGTH = "Content-Length:";
+
+  size_t header_end;
+  while ((header_end = buffer_.find("\r\n\r\n")) == string::npos) {
+    if (!fill()) {
+      return std::nullopt;
+    }
+  }
+
+  // Content-Type is the only other header and can be ignored
+  optional<size_t> length;
+  string_view headers{buffer_.data(), header_end};
+  while (!headers.empty()) {
+    auto line = headers.substr(0, headers.find("\r\n"));
+    headers.remove_prefix(std::min(headers.size(), line.size() + 2));
+    if (line.starts_with(CONTENT_LENGTH)) {
+      auto value = line.substr(CONTENT_LENGTH.size());
+      value.remove_prefix(std::min(value.find_first_not_of(' '),
+                                   value.size()));
+      size_t parsed = 0;
+      auto [ptr, ec] =
+          std::from_chars(value.data(), value.data() + value.size(), parsed);
+      if (ec == std::errc{}) {
+        length = parsed;
+      }
+    }
+  }
+  if (!length) {
+    return std::nullopt;
+  }
+
+  size_t body_start = header_end + 4;
+  while (buffer_.size() - body_start < *length) {
+    if (!fill()) {
+      return std::nullopt;
+    }
+  }
+  string body = buffer_.substr(body_start, *length);
+  buffer_.erase(0, body_start + *length);
+  return body;
+}
+
+bool LspReader::fill() {
+  if (cancel_fd_ >= 0) {
+    pollfd fds[2] = {{.fd = fd_, .events = POLLIN, .revents = 0},
+                     {.fd = cancel_fd_, .events = POLLIN, .revents = 0}};
+    int ready;
+    while ((ready = ::poll(fds, 2, -1)) < 0 && errno == EINTR) {
+    }
+    if (ready < 0 || fds[1].revents != 0) {
+      return false;
+    }
+  }
+
+  char chunk[65536];
+  ssize_t n;
+  while ((n = ::read(fd_, chunk, sizeof(chunk))) < 0 && errno == EINTR) {
+  }
+  if (n <= 0) {
+    return false;
+  }
+  buffer_.append(chunk, static_cast<size_t>(n));
+  return true;
+}
+
+bool write_lsp_message(int fd, string_view body) {
+  string message = fmt::format("Content-Length: {}\r\n\r\n", body.size());
+  message.append(body);
+
+  string_view remaining{message};
+  while (!remaining.empty()) {
+    ssize_t n = ::write(fd, remaining.data(), remaining.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    remaining.remove_prefix(static_cast<size_t>(n));
+  }
+  return true;
+}
+
+int run_lsp_proxy(const LspOptions& options,
+                  int client_in,
+                  int client_out,
+                  int server_in,
+                  int server_out) {
+  // A generated .clangd block would add its flags to the commands sent
+  // here, which are complete
+  if (auto updated = update_clangd_config(options.proj_path, {}); !updated) {
+    fmt::println(stderr, "pio-clangd: {}", updated.error());
+    ::close(server_in);
+    return EXIT_FAILURE;
+  }
+
+  LspProxy proxy{options, server_in};
+
+  // Closed by the server relay when the server is gone, which wakes the
+  // client reader
+  int server_done[2];
+  if (!cloexec_pipe(server_done)) {
+    fmt::println(stderr, "pio-clangd: Failed to create pipe");
+    ::close(server_in);
+    return EXIT_FAILURE;
+  }
+
+  std::jthread server_relay([&] {
+    LspReader reader{server_out};
+    while (auto body = reader.next()) {
+      if (!write_lsp_message(client_out, *body)) {
+        break;
+      }
+    }
+    ::close(server_done[1]);
+  });
+
+  std::jthread watcher([&](std::stop_token stop) {
+    std::mutex mtx;
+    std::condition_variable_any cv;
+    std::unique_lock lock(mtx);
+    while (!cv.wait_for(lock, stop, options.poll_interval, [] {
+      return false;
+    })) {
+      if (stop.stop_requested() || !proxy.poll()) {
+        return;
+      }
+    }
+  });
+
+  LspReader reader{client_in, server_done[0]};
+  while (auto body = reader.next()) {
+    if (!proxy.on_client_message(*body)) {
+      break;
+    }
+  }
+
+  // Nothing writes to the server after the watcher stopped; closing its
+  // input lets it exit, which ends the relay
+  watcher.request_stop();
+  watcher.join();
+  ::close(server_in);
+  server_relay.join();
+  ::close(server_done[0]);
+  return EXIT_SUCCESS;
+}
+
+int run_lsp(const LspOptions& options, const vector<string>& clangd_argv) {
+  // A crashed server must surface as a failed write, not kill the proxy
+  std::signal(SIGPIPE, SIG_IGN);
+
+  auto clangd = ChildProcess::spawn(clangd_argv);
+  if (!clangd) {
+    fmt::println(stderr, "{}", clangd.error());
+    return EXIT_FAILURE;
+  }
+
+  // run_lsp_proxy() closes the server's stdin, the child must not again
+  int server_in = dup(clangd->stdin_fd());
+  clangd->close_stdin();
+  int result = run_lsp_proxy(options, STDIN_FILENO, STDOUT_FILENO, server_in,
+                             clangd->stdout_fd());
+  int status = clangd->wait();
+  return result == EXIT_SUCCESS && status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else
+
+optional<string> LspReader::next() {
+  return std::nullopt;
+}
+
+bool LspReader::fill() {
+  return false;
+}
+
+bool write_lsp_message(int, string_view) {
+  return false;
+}
+
+int run_lsp_proxy(const LspOptions&, int, int, int, int) {
+  fmt::println(stderr, "pio-clangd lsp is not supported on Windows");
+  return EXIT_FAILURE;
+}
+
+int run_lsp(const LspOptions&, const vector<string>&) {
+  fmt::println(stderr, "pio-clangd lsp is not supported on Windows");
+  return EXIT_FAILURE;
+}
+
+#endif
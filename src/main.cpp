@@ -1,11 +1,23 @@
 #include <fmt/core.h>
 #include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <filesystem>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
 #include "clangd.h"
+#include "ini.h"
+#include "key_rules.h"
+#include "lsp.h"
+#include "query_index.h"
+#include "serve.h"
+#include "targets.h"
+#include "workspace.h"
 
 using std::ostringstream;
 using std::string;
@@ -13,10 +25,329 @@ using std::string;
 namespace po = boost::program_options;
 namespace fs = std::filesystem;
 
+// pio-clangd lsp [options] [-- clangd arguments]
+static int lsp_command(int argc, char* argv[]) {
+  LspOptions options;
+  string clangd = "clangd";
+  int poll_ms = 1000;
+  std::vector<string> clangd_args;
+
+  po::options_description desc(
+      "Usage: pio-clangd lsp [options] [-- clangd arguments]\n"
+      "Runs clangd behind a proxy that feeds it compile commands directly");
+  desc.add_options()("help,h", "Help message")(
+      "path,p", po::value<string>(&options.proj_path),
+      "Optional. Directory containing platformio.ini. Defaults to working "
+      "directory.")("env,e", po::value<string>(&options.environment),
+                    "Optional. Initial environment. Defaults to "
+                    "default_envs, or the first environment, if omitted.")(
+      "clangd", po::value<string>(&clangd),
+      "Optional. clangd executable. Defaults to clangd in PATH.")(
+      "poll-ms", po::value<int>(&poll_ms),
+      "Optional. Interval in milliseconds between checks for changed "
+      "compile_commands.json inputs. Defaults to 1000.")(
+      "clangd-arg", po::value<std::vector<string>>(&clangd_args),
+      "Arguments passed to clangd");
+
+  po::positional_options_description positional;
+  positional.add("clangd-arg", -1);
+
+  po::variables_map var_map;
+  try {
+    po::store(po::command_line_parser(argc, argv)
+                  .options(desc)
+                  .positional(positional)
+                  .run(),
+              var_map);
+    if (var_map.count("help")) {
+      ostringstream ss;
+      ss << desc;
+      fmt::println("{}", ss.str());
+      return EXIT_SUCCESS;
+    }
+    po::notify(var_map);
+  } catch (const po::error& e) {
+    ostringstream ss;
+    ss << desc;
+    fmt::println(stderr, "Error: {}", e.what());
+    fmt::println(stderr, "{}", ss.str());
+    return EXIT_FAILURE;
+  }
+
+  options.proj_path =
+      options.proj_path.empty() ? fs::current_path().string()
+                                : fs::absolute(options.proj_path).string();
+  options.poll_interval = std::chrono::milliseconds{std::max(poll_ms, 10)};
+
+  clangd_args.insert(clangd_args.begin(), clangd);
+  return run_lsp(options, clangd_args);
+}
+
+// pio-clangd query [options] <file>
+static int query_command(int argc, char* argv[]) {
+  string proj_path;
+  string environment;
+  string file;
+
+  po::options_description desc(
+      "Usage: pio-clangd query [options] <file>\n"
+      "Prints the compiler and flags of one file, one per line, from the "
+      "query index written with compile_commands.json");
+  desc.add_options()("help,h", "Help message")(
+      "path,p", po::value<string>(&proj_path),
+      "Optional. Directory containing platformio.ini. Defaults to working "
+      "directory.")("env,e", po::value<string>(&environment),
+                    "Optional. Query the database of this environment "
+                    "written with --all-targets. Defaults to the root "
+                    "compile_commands.json.")(
+      "directory", "Optional. Print the file's working directory first.")(
+      "file", po::value<string>(&file)->required(),
+      "Source file, relative to the working directory");
+
+  po::positional_options_description positional;
+  positional.add("file", 1);
+
+  po::variables_map var_map;
+  try {
+    po::store(po::command_line_parser(argc, argv)
+                  .options(desc)
+                  .positional(positional)
+                  .run(),
+              var_map);
+    if (var_map.count("help")) {
+      ostringstream ss;
+      ss << desc;
+      fmt::println("{}", ss.str());
+      return EXIT_SUCCESS;
+    }
+    po::notify(var_map);
+  } catch (const po::error& e) {
+    ostringstream ss;
+    ss << desc;
+    fmt::println(stderr, "Error: {}", e.what());
+    fmt::println(stderr, "{}", ss.str());
+    return EXIT_FAILURE;
+  }
+
+  proj_path = proj_path.empty() ? fs::current_path().string()
+                                : fs::absolute(proj_path).string();
+  auto index_path = environment.empty()
+                        ? root_index_path(proj_path)
+                        : target_index_path(proj_path, environment);
+  auto index = QueryIndex::open(index_path);
+  if (!index) {
+    fmt::println(stderr, "{}", index.error());
+    return EXIT_FAILURE;
+  }
+
+  // Keys of the index were made with the project's dedup rules
+  std::shared_ptr<const PioConfig> config;
+  std::error_code ec;
+  if (fs::exists(fs::path{proj_path} / "platformio.ini", ec)) {
+    if (auto loaded = load_pio_config(proj_path)) {
+      config = *loaded;
+    }
+  }
+  auto key_rules = load_key_rules(config.get());
+  if (!key_rules) {
+    fmt::println(stderr, "{}", key_rules.error());
+    return EXIT_FAILURE;
+  }
+
+  string key;
+  make_dedup_key(fs::current_path().string(), file, key, *key_rules);
+  auto command = index->find(key);
+  if (!command) {
+    fmt::println(stderr, "No compile command for {}", key);
+    return EXIT_FAILURE;
+  }
+
+  // One buffered write, the lookup itself takes microseconds
+  string out;
+  if (var_map.count("directory")) {
+    out.append(command->directory()).push_back('\n');
+  }
+  if (!command->driver().empty()) {
+    out.append(command->driver()).push_back('\n');
+  }
+  for (size_t i = 0; i < command->size(); ++i) {
+    out.append(command->argument(i)).push_back('\n');
+  }
+  fmt::print("{}", out);
+  return EXIT_SUCCESS;
+}
+
+// pio-clangd serve [options]
+static int serve_command(int argc, char* argv[]) {
+  ServeOptions options;
+  GenOptions& gen = options.gen;
+
+  po::options_description desc(
+      "Usage: pio-clangd serve [options]\n"
+      "Keeps the project's databases warm and answers requests on a Unix "
+      "socket");
+  desc.add_options()("help,h", "Help message")(
+      "path,p", po::value<string>(&options.proj_path),
+      "Optional. Directory containing platformio.ini. Defaults to working "
+      "directory.")("env,e", po::value<string>(&options.environment),
+                    "Optional. Initial environment. Defaults to "
+                    "default_envs, or the first environment, if omitted.")(
+      "socket", po::value<string>(&options.socket_path),
+      "Optional. Socket path. Defaults to .pio/clangd/serve.sock in the "
+      "project.")(
+      "prune-includes", po::bool_switch(&gen.prune_includes),
+      "Optional. Drop include directories that are missing or empty.")(
+      "drop-missing", po::bool_switch(&gen.drop_missing),
+      "Optional. Drop entries whose source file no longer exists.")(
+      "infer-new", po::bool_switch(&gen.infer_new),
+      "Optional. Add entries for sources no environment has built yet, "
+      "rescanned on every regenerate.")(
+      "patch-flags", po::bool_switch(&gen.patch_flags),
+      "Optional. Apply edits of build_flags and build_unflags in "
+      "platformio.ini to the entries directly.")(
+      "dedup-content", po::bool_switch(&gen.dedup_content),
+      "Optional. Keep one copy of identical libraries and packages.")(
+      "toolchain-builtins", po::bool_switch(&gen.add_builtins),
+      "Optional. Add the builtin include directories and target macros "
+      "of each compiler.")(
+      "max-entries", po::value<size_t>(&gen.max_entries),
+      "Optional. Write at most this many entries.")(
+      "clangd-config", po::bool_switch(&gen.clangd_config),
+      "Optional. Move the flags shared by all entries, and by all entries "
+      "of a library, into a generated block of .clangd.")(
+      "rsp-output", po::bool_switch(&gen.rsp_output),
+      "Optional. Write shared flag lists once into response files in "
+      ".pio/clangd.")(
+      "include", po::value<std::vector<string>>(&gen.include),
+      "Optional, repeatable. Only keep entries of source files matching "
+      "this glob.")(
+      "exclude", po::value<std::vector<string>>(&gen.exclude),
+      "Optional, repeatable. Drop entries of source files matching this "
+      "glob.")(
+      "overrides", po::value<string>(&gen.overrides_path),
+      "Optional. JSON file of flags to add or remove per directory.");
+
+  po::variables_map var_map;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), var_map);
+    if (var_map.count("help")) {
+      ostringstream ss;
+      ss << desc;
+      fmt::println("{}", ss.str());
+      return EXIT_SUCCESS;
+    }
+    po::notify(var_map);
+  } catch (const po::error& e) {
+    ostringstream ss;
+    ss << desc;
+    fmt::println(stderr, "Error: {}", e.what());
+    fmt::println(stderr, "{}", ss.str());
+    return EXIT_FAILURE;
+  }
+
+  options.proj_path = options.proj_path.empty()
+                          ? fs::current_path().string()
+                          : fs::absolute(options.proj_path).string();
+  if (!options.socket_path.empty()) {
+    options.socket_path = fs::absolute(options.socket_path).string();
+  }
+  if (!gen.overrides_path.empty()) {
+    gen.overrides_path = fs::absolute(gen.overrides_path).string();
+  }
+  return run_serve(options);
+}
+
+// pio-clangd workspace [options] [root]
+static int workspace_command(int argc, char* argv[]) {
+  WorkspaceOptions options;
+  GenOptions& gen = options.gen;
+
+  po::options_description desc(
+      "Usage: pio-clangd workspace [options] [root]\n"
+      "Generates compile_commands.json for every PlatformIO project below "
+      "root in one run");
+  desc.add_options()("help,h", "Help message")(
+      "root", po::value<string>(&options.root),
+      "Optional. Directory searched for platformio.ini files. Defaults to "
+      "working directory.")(
+      "env,e", po::value<string>(&options.environment),
+      "Optional. Target environment of the projects declaring it, the "
+      "others use their default.")(
+      "combined", po::bool_switch(&options.combined),
+      "Optional. Also merge the databases of all projects into "
+      "compile_commands.json in root.")(
+      "all-targets", po::bool_switch(&gen.all_targets),
+      "Optional. Also write a database prioritized for every environment "
+      "of each project.")(
+      "prune-includes", po::bool_switch(&gen.prune_includes),
+      "Optional. Drop include directories that are missing or empty.")(
+      "drop-missing", po::bool_switch(&gen.drop_missing),
+      "Optional. Drop entries whose source file no longer exists.")(
+      "infer-new", po::bool_switch(&gen.infer_new),
+      "Optional. Add entries for sources no environment has built yet.")(
+      "dedup-content", po::bool_switch(&gen.dedup_content),
+      "Optional. Keep one copy of identical libraries and packages.")(
+      "toolchain-builtins", po::bool_switch(&gen.add_builtins),
+      "Optional. Add the builtin include directories and target macros "
+      "of each compiler.")(
+      "max-entries", po::value<size_t>(&gen.max_entries),
+      "Optional. Write at most this many entries per project.")(
+      "include", po::value<std::vector<string>>(&gen.include),
+      "Optional, repeatable. Only keep entries of source files matching "
+      "this glob, relative ones anchored at each project.")(
+      "exclude", po::value<std::vector<string>>(&gen.exclude),
+      "Optional, repeatable. Drop entries of source files matching this "
+      "glob, relative ones anchored at each project.");
+
+  po::positional_options_description positional;
+  positional.add("root", 1);
+
+  po::variables_map var_map;
+  try {
+    po::store(po::command_line_parser(argc, argv)
+                  .options(desc)
+                  .positional(positional)
+                  .run(),
+              var_map);
+    if (var_map.count("help")) {
+      ostringstream ss;
+      ss << desc;
+      fmt::println("{}", ss.str());
+      return EXIT_SUCCESS;
+    }
+    po::notify(var_map);
+  } catch (const po::error& e) {
+    ostringstream ss;
+    ss << desc;
+    fmt::println(stderr, "Error: {}", e.what());
+    fmt::println(stderr, "{}", ss.str());
+    return EXIT_FAILURE;
+  }
+
+  options.root = options.root.empty() ? fs::current_path().string()
+                                      : fs::absolute(options.root).string();
+  return run_workspace(options);
+}
+
 int main(int argc, char* argv[]) {
+  // Subcommands take over the whole command line
+  if (argc > 1 && std::string_view{argv[1]} == "lsp") {
+    return lsp_command(argc - 1, argv + 1);
+  }
+  if (argc > 1 && std::string_view{argv[1]} == "query") {
+    return query_command(argc - 1, argv + 1);
+  }
+  if (argc > 1 && std::string_view{argv[1]} == "serve") {
+    return serve_command(argc - 1, argv + 1);
+  }
+  if (argc > 1 && std::string_view{argv[1]} == "workspace") {
+    return workspace_command(argc - 1, argv + 1);
+  }
+
   // parse command line args
   string proj_path;
   string environment;
+  GenOptions options;
 
   po::options_description desc(
       "Optimizes PlatformIO compile_commands.json for clangd");
@@ -25,7 +356,68 @@ int main(int argc, char* argv[]) {
       "Optional. Directory containing platformio.ini. Defaults to working "
       "directory.")("env,e", po::value<string>(&environment),
                     "Optional. Configure clangd to this environment. Defaults "
-                    "to first environment if omitted.");
+                    "to default_envs, or the first environment, if omitted.")(
+      "report", po::value<string>(&options.report_path),
+      "Optional. Write a machine-readable JSON run report to this file.")(
+      "profile", po::bool_switch(&options.profile),
+      "Optional. Print hardware performance counters for each phase.")(
+      "all-targets", po::bool_switch(&options.all_targets),
+      "Optional. Also write a database prioritized for every environment "
+      "to .pio/clangd/<env>/compile_commands.json.")(
+      "switch", po::value<string>(&environment),
+      "Optional. Point compile_commands.json at the precomputed database "
+      "of this environment, regenerating the databases in .pio/clangd "
+      "only if their inputs changed.")(
+      "prune-includes", po::bool_switch(&options.prune_includes),
+      "Optional. Drop include directories that are missing or empty on "
+      "this machine, each checked once.")(
+      "drop-missing", po::bool_switch(&options.drop_missing),
+      "Optional. Drop entries whose source file no longer exists.")(
+      "clangd-config", po::bool_switch(&options.clangd_config),
+      "Optional. Move the flags shared by all entries, and by all entries "
+      "of a library, into a generated block of .clangd.")(
+      "rsp-output", po::bool_switch(&options.rsp_output),
+      "Optional. Write shared flag lists once into response files in "
+      ".pio/clangd, entries refer to them with @file.")(
+      "include", po::value<std::vector<string>>(&options.include),
+      "Optional, repeatable. Only keep entries of source files matching "
+      "this glob, e.g. 'src/**'. Also read from the include option of a "
+      "[pio-clangd] section in platformio.ini.")(
+      "exclude", po::value<std::vector<string>>(&options.exclude),
+      "Optional, repeatable. Drop entries of source files matching this "
+      "glob, e.g. '**/examples'. Also read from the exclude option of a "
+      "[pio-clangd] section in platformio.ini.")(
+      "overrides", po::value<string>(&options.overrides_path),
+      "Optional. JSON file of flags to add or remove per directory, "
+      "e.g. {\"rules\": [{\"path\": \"lib/legacy\", \"add\": "
+      "[\"-std=gnu++20\"]}]}. Also read from the overrides option of a "
+      "[pio-clangd] section in platformio.ini.")(
+      "infer-new", po::bool_switch(&options.infer_new),
+      "Optional. Add entries for sources in src_dir and lib_dir that no "
+      "environment has built yet, with the flags of the closest built "
+      "source.")(
+      "patch-flags", po::bool_switch(&options.patch_flags),
+      "Optional. Apply edits of build_flags and build_unflags in "
+      "platformio.ini to the entries directly, without rerunning pio run "
+      "-t compiledb. Compares with the flags recorded when each "
+      "environment's database was first seen.")(
+      "dedup-content", po::bool_switch(&options.dedup_content),
+      "Optional. Keep one copy of libraries and framework packages that "
+      "are installed several times with identical content, found by "
+      "their manifest and a digest cached in ~/.cache/pio-clangd.")(
+      "max-entries", po::value<size_t>(&options.max_entries),
+      "Optional. Write at most this many entries, the project's sources "
+      "first, then the libraries of lib_deps, then everything else.")(
+      "toolchain-builtins", po::bool_switch(&options.add_builtins),
+      "Optional. Add the builtin include directories and target macros "
+      "of each compiler, queried once and cached in ~/.cache/pio-clangd.")(
+      "stdin", po::bool_switch(&options.read_stdin),
+      "Optional. Read compile commands from standard input instead of "
+      ".pio/build: JSON arrays or one command per line, each tagged with "
+      "its environment in \"env\".")(
+      "stdout", po::bool_switch(&options.write_stdout),
+      "Optional. Write the database to standard output instead of "
+      "compile_commands.json. Status messages go to standard error.");
 
   // var map to store results
   po::variables_map var_map;
@@ -42,6 +434,37 @@ int main(int argc, char* argv[]) {
     }
     po::notify(var_map);
 
+    if (var_map.count("switch") && var_map.count("env")) {
+      throw po::error("--switch and --env cannot be combined");
+    }
+    options.switch_env = var_map.count("switch") > 0;
+    if ((options.read_stdin || options.write_stdout) &&
+        (options.switch_env || options.all_targets)) {
+      throw po::error(
+          "--stdin and --stdout cannot be combined with --switch or "
+          "--all-targets");
+    }
+    // Entries are written as they arrive, before any pass could see all
+    // of them
+    bool needs_all_entries = options.infer_new || options.patch_flags ||
+                             options.prune_includes || options.drop_missing ||
+                             options.add_builtins || options.dedup_content ||
+                             options.max_entries > 0;
+    if (needs_all_entries && options.read_stdin) {
+      throw po::error(
+          "--infer-new, --patch-flags, --prune-includes, --drop-missing, "
+          "--toolchain-builtins, --dedup-content and --max-entries cannot "
+          "be combined with --stdin");
+    }
+    if ((options.clangd_config || options.rsp_output) &&
+        (options.switch_env || options.all_targets || options.read_stdin ||
+         options.write_stdout)) {
+      throw po::error(
+          "--clangd-config and --rsp-output only apply to the root "
+          "compile_commands.json, they cannot be combined with --switch, "
+          "--all-targets, --stdin or --stdout");
+    }
+
   } catch (const po::error& e) {
     ostringstream ss;
     ss << desc;
@@ -53,5 +476,12 @@ int main(int argc, char* argv[]) {
   proj_path = proj_path.empty() ? fs::current_path().string() : proj_path;
   proj_path = fs::absolute(proj_path);
 
-  return gen_cmds(proj_path, environment);
+  if (!options.report_path.empty()) {
+    options.report_path = fs::absolute(options.report_path).string();
+  }
+  if (!options.overrides_path.empty()) {
+    options.overrides_path = fs::absolute(options.overrides_path).string();
+  }
+
+  return gen_cmds(proj_path, environment, options);
 }
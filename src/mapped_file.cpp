@@ -0,0 +1,94 @@
+#include "mapped_file.h"
+#include <fmt/core.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::expected;
+using std::string;
+using std::unexpected;
+
+namespace fs = std::filesystem;
+
+expected<MappedFile, string> MappedFile::open(const fs::path& path) {
+  MappedFile file;
+#if !defined(_WIN32)
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return unexpected(fmt::format("Failed to open {}: {}", path.string(),
+                                  std::strerror(errno)));
+  }
+  struct stat st{};
+  if (fstat(fd, &st) != 0) {
+    int err = errno;
+    ::close(fd);
+    return unexpected(fmt::format("Failed to stat {}: {}", path.string(),
+                                  std::strerror(err)));
+  }
+  if (st.st_size > 0) {
+    void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      int err = errno;
+      ::close(fd);
+      return unexpected(fmt::format("Failed to map {}: {}", path.string(),
+                                    std::strerror(err)));
+    }
+    file.data_ = static_cast<const char*>(addr);
+    file.size_ = static_cast<size_t>(st.st_size);
+    file.mapped_ = true;
+  }
+  ::close(fd);  // the mapping stays valid after close
+#else
+  std::ifstream stream(path, std::ios::binary | std::ios::ate);
+  if (!stream.is_open()) {
+    return unexpected(fmt::format("Failed to open {}", path.string()));
+  }
+  file.buffer_.resize(static_cast<size_t>(stream.tellg()));
+  stream.seekg(0);
+  stream.read(file.buffer_.data(),
+              static_cast<std::streamsize>(file.buffer_.size()));
+  file.data_ = file.buffer_.data();
+  file.size_ = file.buffer_.size();
+#endif
+  return file;
+}
+
+MappedFile::~MappedFile() {
+  release();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+  *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    release();
+    mapped_ = std::exchange(other.mapped_, false);
+    size_ = std::exchange(other.size_, 0);
+    buffer_ = std::move(other.buffer_);
+    data_ = mapped_ ? std::exchange(other.data_, nullptr) : buffer_.data();
+    other.data_ = nullptr;
+  }
+  return *this;
+}
+
+void MappedFile::release() {
+#if !defined(_WIN32)
+  if (mapped_ && data_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+}
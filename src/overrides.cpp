@@ -0,0 +1,237 @@
+#include "overrides.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <cstdlib>
+#include "clangd.h"
+#include "ini.h"
+#include "key_rules.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Components of an absolute path, without empty ones
+vector<string_view> components(string_view path) {
+  vector<string_view> parts;
+  while (!path.empty()) {
+    auto end = path.find('/');
+    auto part = path.substr(0, end);
+    if (!part.empty()) {
+      parts.push_back(part);
+    }
+    path = end == string_view::npos ? string_view{} : path.substr(end + 1);
+  }
+  return parts;
+}
+
+string join(span<const string_view> parts) {
+  string joined;
+  for (auto part : parts) {
+    if (!joined.empty()) {
+      joined.push_back('/');
+    }
+    joined.append(part);
+  }
+  return joined;
+}
+
+// Path of a rule as make_dedup_key() spells the paths it covers
+string rule_path(const string& path,
+                 const fs::path& root,
+                 const KeyRules& key_rules) {
+  fs::path resolved{path};
+  if (path == "~" || path.starts_with("~/")) {
+    if (const char* home = std::getenv("HOME"); home && *home) {
+      resolved = fs::path{home} / path.substr(1).insert(0, ".");
+    }
+  } else if (resolved.is_relative()) {
+    resolved = root / resolved;
+  }
+  auto normal = resolved.lexically_normal().generic_string();
+
+  // Keys drop the environment of .pio/libdeps/<env>/ and the like; the
+  // rules only look at directories, which all of the path is
+  normal.push_back('/');
+  key_rules.apply(normal);
+  normal.pop_back();
+  return normal;
+}
+
+// Text of pattern matches flag followed by value, the separate value of
+// the flag if any; a trailing '*' matches any rest
+bool flag_matches(string_view pattern, string_view flag, string_view value) {
+  bool prefix = pattern.ends_with('*');
+  if (prefix) {
+    pattern.remove_suffix(1);
+  }
+  if (!prefix && pattern.size() != flag.size() + value.size()) {
+    return false;
+  }
+  if (pattern.size() <= flag.size()) {
+    return flag.starts_with(pattern);
+  }
+  return pattern.starts_with(flag) &&
+         value.starts_with(pattern.substr(flag.size()));
+}
+
+}  // namespace
+
+FlagOverrides FlagOverrides::compile(span<const OverrideRule> rules,
+                                     const string& proj_path,
+                                     const KeyRules& key_rules) {
+  auto root = fs::absolute(proj_path).lexically_normal();
+  FlagOverrides overrides;
+  overrides.rules_.assign(rules.begin(), rules.end());
+
+  for (uint32_t rule = 0; rule < rules.size(); ++rule) {
+    auto path = rule_path(rules[rule].path, root, key_rules);
+    auto parts = components(path);
+
+    uint32_t node = 0;
+    size_t i = 0;
+    while (i < parts.size()) {
+      auto& children = overrides.nodes_[node].children;
+      auto it = std::ranges::lower_bound(
+          children, parts[i], {},
+          [](const auto& child) { return string_view{child.first}; });
+      auto pos = static_cast<size_t>(it - children.begin());
+      if (it == children.end() || it->first != parts[i]) {
+        // The rest of the path becomes one edge
+        auto leaf = static_cast<uint32_t>(overrides.nodes_.size());
+        children.insert(it, {string{parts[i]}, leaf});
+        overrides.nodes_.push_back({.label = join(span{parts}.subspan(i))});
+        node = leaf;
+        break;
+      }
+
+      uint32_t next = it->second;
+      auto label = components(overrides.nodes_[next].label);
+      size_t shared = 0;
+      while (shared < label.size() && i + shared < parts.size() &&
+             label[shared] == parts[i + shared]) {
+        ++shared;
+      }
+      if (shared < label.size()) {
+        // Split the edge where the paths part
+        Node mid{.label = join(span{label}.first(shared)),
+                 .children = {{string{label[shared]}, next}}};
+        overrides.nodes_[next].label = join(span{label}.subspan(shared));
+        auto mid_idx = static_cast<uint32_t>(overrides.nodes_.size());
+        overrides.nodes_.push_back(std::move(mid));
+        overrides.nodes_[node].children[pos].second = mid_idx;
+        next = mid_idx;
+      }
+      node = next;
+      i += shared;
+    }
+    overrides.nodes_[node].rules.push_back(rule);
+  }
+  return overrides;
+}
+
+expected<FlagOverrides, string> FlagOverrides::load(
+    const fs::path& path,
+    const string& proj_path,
+    const KeyRules& key_rules) {
+  OverrideFile file;
+  auto err = glz::read_file_json(file, path.string(), string{});
+  if (err) {
+    return unexpected(fmt::format("Failed to read {}: {}", path.string(),
+                                  glz::format_error(err)));
+  }
+  return compile(file.rules, proj_path, key_rules);
+}
+
+const FlagOverrides::Node* FlagOverrides::child(const Node& node,
+                                                string_view component) const {
+  auto it = std::ranges::lower_bound(
+      node.children, component, {},
+      [](const auto& child) { return string_view{child.first}; });
+  if (it == node.children.end() || it->first != component) {
+    return nullptr;
+  }
+  return &nodes_[it->second];
+}
+
+void FlagOverrides::match(string_view path, vector<uint32_t>& rules) const {
+  rules.clear();
+  const Node* node = &nodes_[0];
+  rules.insert(rules.end(), node->rules.begin(), node->rules.end());
+
+  string_view rest = path;
+  while (!rest.empty()) {
+    while (rest.starts_with('/')) {
+      rest.remove_prefix(1);
+    }
+    node = child(*node, rest.substr(0, rest.find('/')));
+    // A label of several components must match all of them
+    if (!node || !rest.starts_with(node->label) ||
+        (rest.size() > node->label.size() &&
+         rest[node->label.size()] != '/')) {
+      break;
+    }
+    rules.insert(rules.end(), node->rules.begin(), node->rules.end());
+    rest.remove_prefix(node->label.size());
+  }
+}
+
+bool FlagOverrides::apply(string_view path,
+                          vector<string_view>& args,
+                          Scratch& scratch) const {
+  if (empty()) {
+    return false;
+  }
+  match(path, scratch.rules);
+  if (scratch.rules.empty()) {
+    return false;
+  }
+
+  for (uint32_t idx : scratch.rules) {
+    const auto& rule = rules_[idx];
+    if (!rule.remove.empty()) {
+      auto& kept = scratch.args;
+      kept.clear();
+      for (size_t i = 0; i < args.size();) {
+        // "-include file" is removed as a whole, like process_tokens()
+        // kept it
+        size_t tokens =
+            std::ranges::binary_search(FLAGS_WITH_VALUES, args[i]) &&
+                    i + 1 < args.size() && !args[i + 1].starts_with('-')
+                ? 2
+                : 1;
+        string_view value = tokens == 2 ? args[i + 1] : string_view{};
+        bool removed = std::ranges::any_of(rule.remove, [&](const auto& p) {
+          return flag_matches(p, args[i], {}) ||
+                 (!value.empty() && flag_matches(p, args[i], value));
+        });
+        if (!removed) {
+          kept.insert(kept.end(), args.begin() + i, args.begin() + i + tokens);
+        }
+        i += tokens;
+      }
+      args.swap(kept);
+    }
+    args.insert(args.end(), rule.add.begin(), rule.add.end());
+  }
+  return true;
+}
+
+fs::path overrides_path(const PioConfig* config,
+                        const string& path,
+                        const string& proj_path) {
+  string file = path;
+  if (file.empty() && config) {
+    file = config->get("pio-clangd", "overrides").value_or("");
+  }
+  if (file.empty()) {
+    return {};
+  }
+  return fs::path{proj_path} / file;
+}
@@ -0,0 +1,276 @@
+#include "path_filter.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include "ini.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+string without_trailing_slashes(string path) {
+  while (path.size() > 1 && path.back() == '/') {
+    path.pop_back();
+  }
+  return path;
+}
+
+bool is_absolute_glob(string_view glob) {
+  return glob.starts_with('/') ||
+         (glob.size() > 2 && glob[1] == ':' && glob[2] == '/');
+}
+
+}  // namespace
+
+expected<PathFilter, string> PathFilter::compile(span<const string> include,
+                                                 span<const string> exclude,
+                                                 const string& proj_path) {
+  auto root = without_trailing_slashes(
+      fs::absolute(proj_path).lexically_normal().generic_string());
+  string home;
+  if (const char* dir = std::getenv("HOME"); dir && *dir) {
+    home = without_trailing_slashes(fs::path{dir}.generic_string());
+  }
+
+  PathFilter filter;
+  for (bool is_exclude : {false, true}) {
+    for (const auto& raw : is_exclude ? exclude : include) {
+      auto glob = without_trailing_slashes(raw);
+      if (glob.empty()) {
+        continue;
+      }
+
+      // The anchor is taken literally, the glob is not
+      string anchor;
+      if (glob == "~" || glob.starts_with("~/")) {
+        anchor = home;
+        glob.erase(0, 1);
+      } else if (glob.find('/') == string::npos) {
+        glob.insert(0, "**/");
+      } else if (!is_absolute_glob(glob) && !glob.starts_with("**")) {
+        while (glob.starts_with("./")) {
+          glob.erase(0, 2);
+        }
+        anchor = root + "/";
+      }
+
+      if (auto added = filter.add_glob(anchor, glob, is_exclude); !added) {
+        return unexpected(
+            fmt::format("Invalid glob \"{}\": {}", raw, added.error()));
+      }
+      (is_exclude ? filter.exclude_ : filter.include_)
+          .push_back(anchor + glob);
+    }
+  }
+  return filter;
+}
+
+expected<void, string> PathFilter::add_glob(string_view anchor,
+                                            string_view glob,
+                                            bool exclude) {
+  starts_.push_back(static_cast<uint32_t>(states_.size()));
+  for (char c : anchor) {
+    states_.push_back({.op = Op::Char, .c = c});
+  }
+
+  for (size_t i = 0; i < glob.size(); ++i) {
+    char c = glob[i];
+    if (c == '*') {
+      if (i + 1 < glob.size() && glob[i + 1] == '*') {
+        while (i + 1 < glob.size() && glob[i + 1] == '*') {
+          ++i;
+        }
+        if (i + 1 < glob.size() && glob[i + 1] == '/') {
+          ++i;
+          states_.push_back({.op = Op::AnyDirs});
+          states_.push_back({.op = Op::InDirs});
+        } else {
+          states_.push_back({.op = Op::AnyPath});
+        }
+      } else {
+        states_.push_back({.op = Op::Star});
+      }
+    } else if (c == '?') {
+      states_.push_back({.op = Op::Any});
+    } else if (c == '[') {
+      CharClass set;
+      size_t pos = i + 1;
+      if (pos < glob.size() && (glob[pos] == '!' || glob[pos] == '^')) {
+        set.negated = true;
+        ++pos;
+      }
+      // A ']' right after the opening bracket is a member
+      size_t first = pos;
+      while (pos < glob.size() && (glob[pos] != ']' || pos == first)) {
+        char lo = glob[pos];
+        char hi = lo;
+        if (pos + 2 < glob.size() && glob[pos + 1] == '-' &&
+            glob[pos + 2] != ']') {
+          hi = glob[pos + 2];
+          pos += 2;
+        }
+        set.ranges.emplace_back(lo, hi);
+        ++pos;
+      }
+      if (pos == glob.size()) {
+        return unexpected("unterminated \"[\"");
+      }
+      i = pos;
+      states_.push_back(
+          {.op = Op::Class, .arg = static_cast<uint32_t>(classes_.size())});
+      classes_.push_back(std::move(set));
+    } else if (c == '\\' && i + 1 < glob.size()) {
+      states_.push_back({.op = Op::Char, .c = glob[++i]});
+    } else {
+      states_.push_back({.op = Op::Char, .c = c});
+    }
+  }
+  states_.push_back({.op = Op::Accept, .arg = exclude ? 1u : 0u});
+  return {};
+}
+
+bool PathFilter::in_class(uint32_t idx, char c) const {
+  const auto& set = classes_[idx];
+  bool found = false;
+  for (auto [lo, hi] : set.ranges) {
+    if (lo <= c && c <= hi) {
+      found = true;
+      break;
+    }
+  }
+  return found != set.negated;
+}
+
+// Adds state and the states it reaches without reading a character to
+// the next step, once
+void PathFilter::add_state(uint32_t state, Scratch& scratch) const {
+  while (scratch.marks[state] != scratch.generation) {
+    scratch.marks[state] = scratch.generation;
+    scratch.next.push_back(state);
+    switch (states_[state].op) {
+      case Op::Star:
+      case Op::AnyPath:
+        ++state;
+        break;
+      case Op::AnyDirs:
+        state += 2;
+        break;
+      default:
+        return;
+    }
+  }
+}
+
+bool PathFilter::accepts(string_view path, Scratch& scratch) const {
+  if (empty()) {
+    return true;
+  }
+  if (scratch.marks.size() < states_.size()) {
+    scratch.marks.assign(states_.size(), 0);
+    scratch.generation = 0;
+  }
+  auto begin_step = [&] {
+    scratch.next.clear();
+    if (++scratch.generation == 0) {
+      std::ranges::fill(scratch.marks, 0);
+      scratch.generation = 1;
+    }
+  };
+
+  begin_step();
+  for (uint32_t start : starts_) {
+    add_state(start, scratch);
+  }
+  std::swap(scratch.current, scratch.next);
+
+  bool included = include_.empty();
+  for (size_t pos = 0;; ++pos) {
+    // Matches of the whole path or of a directory above it
+    if (pos == path.size() || path[pos] == '/') {
+      for (uint32_t state : scratch.current) {
+        if (states_[state].op != Op::Accept) {
+          continue;
+        }
+        if (states_[state].arg != 0) {
+          return false;
+        }
+        included = true;
+      }
+    }
+    if (pos == path.size() || scratch.current.empty()) {
+      break;
+    }
+
+    char c = path[pos];
+    begin_step();
+    for (uint32_t state : scratch.current) {
+      const State& s = states_[state];
+      switch (s.op) {
+        case Op::Char:
+          if (c == s.c) {
+            add_state(state + 1, scratch);
+          }
+          break;
+        case Op::Any:
+          if (c != '/') {
+            add_state(state + 1, scratch);
+          }
+          break;
+        case Op::Class:
+          if (c != '/' && in_class(s.arg, c)) {
+            add_state(state + 1, scratch);
+          }
+          break;
+        case Op::Star:
+          if (c != '/') {
+            add_state(state, scratch);
+          }
+          break;
+        case Op::AnyPath:
+          add_state(state, scratch);
+          break;
+        case Op::AnyDirs:
+          add_state(state + 1, scratch);
+          if (c == '/') {
+            add_state(state + 2, scratch);
+          }
+          break;
+        case Op::InDirs:
+          add_state(state, scratch);
+          if (c == '/') {
+            add_state(state + 1, scratch);
+          }
+          break;
+        case Op::Accept:
+          break;
+      }
+    }
+    std::swap(scratch.current, scratch.next);
+  }
+  return included;
+}
+
+expected<PathFilter, string> load_path_filter(const PioConfig* config,
+                                              span<const string> include,
+                                              span<const string> exclude,
+                                              const string& proj_path) {
+  vector<string> includes(include.begin(), include.end());
+  vector<string> excludes(exclude.begin(), exclude.end());
+  if (config) {
+    for (auto& glob : config->get_list("pio-clangd", "include")) {
+      includes.push_back(std::move(glob));
+    }
+    for (auto& glob : config->get_list("pio-clangd", "exclude")) {
+      excludes.push_back(std::move(glob));
+    }
+  }
+  return PathFilter::compile(includes, excludes, proj_path);
+}
@@ -0,0 +1,213 @@
+#include "pipeline.h"
+#include <algorithm>
+#include <filesystem>
+#include "build_flags.h"
+#include "clangd_config.h"
+#include "infer.h"
+#include "ini.h"
+#include "query_index.h"
+#include "response_files.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+TargetsStamp make_gen_stamp(const string& proj_path,
+                            const PioConfig& config,
+                            const GenOptions& options,
+                            const ProjectRules& rules) {
+  auto stamp = make_targets_stamp(proj_path, config.envs());
+  stamp.prune_includes = options.prune_includes;
+  stamp.drop_missing = options.drop_missing;
+  stamp.add_builtins = options.add_builtins;
+  stamp.infer_new = options.infer_new;
+  stamp.patch_flags = options.patch_flags;
+  stamp.dedup_content = options.dedup_content;
+  // build_flags may come from any of the config files
+  if (options.patch_flags) {
+    for (const auto& file : config.files()) {
+      stamp.inputs.push_back(make_file_stamp(file));
+    }
+  }
+  stamp.max_entries = options.max_entries;
+  stamp_project_rules(rules, stamp);
+
+  // A new source changes what --infer-new adds
+  if (options.infer_new) {
+    stamp.sources = scan_sources(proj_path, config);
+    PathFilter::Scratch scratch;
+    std::erase_if(stamp.sources, [&](const string& source) {
+      return !rules.path_filter.accepts(source, scratch);
+    });
+  }
+  return stamp;
+}
+
+expected<PassStats, string> run_entry_passes(vector<EnvDatabase>& envs,
+                                             const string& proj_path,
+                                             const PioConfig& config,
+                                             const GenOptions& options,
+                                             const ProjectRules& rules,
+                                             span<const string> sources,
+                                             InternPool& pool,
+                                             StatCache& stat_cache,
+                                             Profiler& profiler,
+                                             std::FILE* status) {
+  PassStats stats;
+
+  if (options.patch_flags) {
+    auto phase = profiler.phase("patch-flags");
+    auto patches = plan_flag_patches(proj_path, config, config.envs());
+    for (const auto& warning : patches.warnings) {
+      fmt::println(stderr, "Warning: {}", warning);
+    }
+    if (auto written = write_flag_baselines(proj_path, patches.baselines);
+        !written) {
+      return unexpected(written.error());
+    }
+    stats.entries_patched =
+        patch_build_flags(envs, patches.deltas, proj_path, pool);
+    print_status(status, "Patched build_flags changes into {} entries",
+                 stats.entries_patched);
+  }
+
+  // First, so pruning also sees the builtin directories
+  if (options.add_builtins) {
+    auto phase = profiler.phase("builtins");
+    stats.toolchains =
+        inject_toolchain_builtins(envs, pool, default_cache_dir());
+    for (const auto& error : stats.toolchains.errors) {
+      fmt::println(stderr, "Warning: {}", error);
+    }
+    print_status(status,
+                 "Toolchain builtins: {} compiler(s) queried, {} cached",
+                 stats.toolchains.queried, stats.toolchains.cached);
+  }
+
+  // Every target shares the pruned argument lists, and a deleted copy of
+  // a library source cannot shadow an existing one
+  if (options.prune_includes) {
+    auto phase = profiler.phase("prune");
+    stats.include_dirs_pruned = prune_include_dirs(envs, pool, stat_cache);
+    print_status(status, "Pruned {} missing or empty include directories",
+                 stats.include_dirs_pruned);
+  }
+  if (options.drop_missing) {
+    auto phase = profiler.phase("drop-missing");
+    stats.sources_missing = drop_missing_sources(envs, stat_cache);
+    print_status(status, "Dropped {} entries of missing source files",
+                 stats.sources_missing);
+  }
+
+  // The target's inferred entry wins dedup like any other
+  if (options.infer_new) {
+    auto phase = profiler.phase("infer");
+    stats.sources_inferred = infer_new_sources(envs, sources, proj_path, pool);
+    print_status(status, "Inferred entries for {} new source file(s)",
+                 stats.sources_inferred);
+  }
+
+  // Last, every entry has its final key
+  if (options.dedup_content) {
+    auto phase = profiler.phase("dedup-content");
+    stats.roots = merge_identical_roots(envs, proj_path, pool, stat_cache,
+                                        default_cache_dir(), rules.key_rules);
+    print_status(status,
+                 "Merged {} identical library copies ({} roots, {} "
+                 "digested, {} cached)",
+                 stats.roots.merged, stats.roots.roots, stats.roots.hashed,
+                 stats.roots.cached);
+  }
+  return stats;
+}
+
+vector<const Entry*> entries_within_budget(const TargetDatabase& target,
+                                           const PioConfig& config,
+                                           const string& proj_path,
+                                           size_t max_entries) {
+  auto ranked = rank_entries(target.entries, proj_path,
+                             config.get_list("env:" + target.env, "lib_deps"));
+  ranked.resize(std::min(ranked.size(), max_entries));
+  return ranked;
+}
+
+expected<RootOutput, string> write_root_outputs(span<const Entry* const> kept,
+                                                span<const Entry* const> all,
+                                                const string& proj_path,
+                                                const GenOptions& options,
+                                                InternPool& pool,
+                                                Profiler& profiler,
+                                                std::FILE* status) {
+  RootOutput output;
+
+  // Without --clangd-config a block left by an earlier run is removed,
+  // clangd would add its flags to every entry
+  FactoredDatabase factored;
+  span<const Entry* const> output_entries = kept;
+  if (options.clangd_config) {
+    auto phase = profiler.phase("factor");
+    factored = factor_common_flags(kept, proj_path);
+    output_entries = factored.output;
+    output.flags_factored = factored.flags_factored;
+  }
+  auto configured = update_clangd_config(
+      proj_path,
+      options.clangd_config ? render_clangd_config(factored) : string{});
+  if (!configured) {
+    return unexpected(configured.error());
+  }
+  if (options.clangd_config) {
+    print_status(status,
+                 "Factored {} flags into .clangd ({} common, {} "
+                 "library group(s))",
+                 output.flags_factored, factored.common.size(),
+                 factored.groups.size());
+  }
+
+  // Response files take what factoring left, and without --rsp-output
+  // the files of an earlier run are removed
+  RspDatabase rsp;
+  if (options.rsp_output) {
+    auto phase = profiler.phase("rsp");
+    rsp = make_response_files(output_entries, proj_path, pool);
+    output_entries = rsp.output;
+    output.rsp_files = rsp.files.size();
+    output.rsp_flags = rsp.flags_moved;
+  }
+  auto rsp_written = write_response_files(rsp.files, proj_path);
+  if (!rsp_written) {
+    return unexpected(rsp_written.error());
+  }
+  if (options.rsp_output) {
+    print_status(status,
+                 "Moved {} flags into {} response file(s), {} updated",
+                 output.rsp_flags, output.rsp_files, *rsp_written);
+  }
+
+  auto written = [&] {
+    auto phase = profiler.phase("write");
+    return write_database(output_entries,
+                          fs::path{proj_path} / "compile_commands.json");
+  }();
+  if (!written) {
+    return unexpected(written.error());
+  }
+  output.bytes = *written;
+
+  // Queries answer with the complete flags either way
+  auto index_path = root_index_path(proj_path);
+  auto indexed = [&] {
+    auto phase = profiler.phase("index");
+    std::error_code ec;
+    fs::create_directories(index_path.parent_path(), ec);
+    return write_query_index(all, index_path);
+  }();
+  if (!indexed) {
+    return unexpected(indexed.error());
+  }
+  return output;
+}
@@ -0,0 +1,257 @@
+#include "process.h"
+#include <fmt/core.h>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// pipe2(), accept4() and SOCK_CLOEXEC; macOS has none of them
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+    defined(__OpenBSD__) || defined(__DragonFly__)
+#define ATOMIC_CLOEXEC 1
+#endif
+
+using std::expected;
+using std::string;
+using std::unexpected;
+using std::vector;
+
+#if !defined(_WIN32)
+
+// Closes fd if it is open and marks it closed
+static void close_fd(int& fd) {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+// Without ATOMIC_CLOEXEC, held from creating a descriptor until it is
+// close-on-exec, and while forking, so no child inherits one in between
+static std::unique_lock<std::mutex> lock_cloexec() {
+#if defined(ATOMIC_CLOEXEC)
+  return {};
+#else
+  static std::mutex mtx;
+  return std::unique_lock{mtx};
+#endif
+}
+
+bool cloexec_pipe(int fds[2]) {
+#if defined(ATOMIC_CLOEXEC)
+  return pipe2(fds, O_CLOEXEC) == 0;
+#else
+  auto lock = lock_cloexec();
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
+#endif
+}
+
+int cloexec_socket(int domain, int type) {
+#if defined(ATOMIC_CLOEXEC)
+  return ::socket(domain, type | SOCK_CLOEXEC, 0);
+#else
+  auto lock = lock_cloexec();
+  int fd = ::socket(domain, type, 0);
+  if (fd >= 0) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+  return fd;
+#endif
+}
+
+int cloexec_accept(int listen_fd) {
+#if defined(ATOMIC_CLOEXEC)
+  return ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+#else
+  auto lock = lock_cloexec();
+  int fd = ::accept(listen_fd, nullptr, nullptr);
+  if (fd >= 0) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+  return fd;
+#endif
+}
+
+expected<ChildProcess, string> ChildProcess::spawn(
+    const vector<string>& argv,
+    bool merge_stderr) {
+  if (argv.empty()) {
+    return unexpected(string{"No program to start"});
+  }
+
+  // in/out pipes for the child, plus one that reports a failed exec: it
+  // is closed on a successful exec and carries errno otherwise
+  int in_pipe[2];
+  int out_pipe[2];
+  int exec_pipe[2];
+  if (!cloexec_pipe(in_pipe)) {
+    return unexpected(
+        fmt::format("Failed to start {}: {}", argv[0], std::strerror(errno)));
+  }
+  if (!cloexec_pipe(out_pipe)) {
+    int err = errno;
+    ::close(in_pipe[0]);
+    ::close(in_pipe[1]);
+    return unexpected(
+        fmt::format("Failed to start {}: {}", argv[0], std::strerror(err)));
+  }
+  if (!cloexec_pipe(exec_pipe)) {
+    int err = errno;
+    for (int fd : {in_pipe[0], in_pipe[1], out_pipe[0], out_pipe[1]}) {
+      ::close(fd);
+    }
+    return unexpected(
+        fmt::format("Failed to start {}: {}", argv[0], std::strerror(err)));
+  }
+
+  // Built before fork(), the child must not allocate
+  vector<char*> args;
+  args.reserve(argv.size() + 1);
+  for (const auto& arg : argv) {
+    args.push_back(const_cast<char*>(arg.c_str()));
+  }
+  args.push_back(nullptr);
+
+  auto fork_lock = lock_cloexec();
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(in_pipe[0], STDIN_FILENO);
+    dup2(out_pipe[1], STDOUT_FILENO);
+    if (merge_stderr) {
+      dup2(out_pipe[1], STDERR_FILENO);
+    }
+    execvp(args[0], args.data());
+    int err = errno;
+    [[maybe_unused]] auto written = ::write(exec_pipe[1], &err, sizeof(err));
+    _exit(127);
+  }
+
+  int fork_err = errno;
+  if (fork_lock) {
+    fork_lock.unlock();
+  }
+  ::close(in_pipe[0]);
+  ::close(out_pipe[1]);
+  ::close(exec_pipe[1]);
+
+  ChildProcess child;
+  child.pid_ = pid;
+  child.stdin_fd_ = in_pipe[1];
+  child.stdout_fd_ = out_pipe[0];
+  if (pid < 0) {
+    child.pid_ = -1;
+    ::close(exec_pipe[0]);
+    return unexpected(fmt::format("Failed to start {}: {}", argv[0],
+                                  std::strerror(fork_err)));
+  }
+
+  int exec_err = 0;
+  ssize_t n;
+  do {
+    n = ::read(exec_pipe[0], &exec_err, sizeof(exec_err));
+  } while (n < 0 && errno == EINTR);
+  ::close(exec_pipe[0]);
+  if (n > 0) {
+    child.wait();
+    return unexpected(fmt::format("Failed to start {}: {}", argv[0],
+                                  std::strerror(exec_err)));
+  }
+  return child;
+}
+
+void ChildProcess::close_stdin() {
+  close_fd(stdin_fd_);
+}
+
+expected<string, string> ChildProcess::read_stdout() {
+  string output;
+  char chunk[65536];
+  while (true) {
+    ssize_t n = ::read(stdout_fd_, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return unexpected(fmt::format("Failed to read child output: {}",
+                                    std::strerror(errno)));
+    }
+    if (n == 0) {
+      return output;
+    }
+    output.append(chunk, static_cast<size_t>(n));
+  }
+}
+
+int ChildProcess::wait() {
+  close_fd(stdin_fd_);
+  if (pid_ < 0) {
+    return -1;
+  }
+  int status = 0;
+  while (waitpid(pid_, &status, 0) < 0 && errno == EINTR) {
+  }
+  pid_ = -1;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void ChildProcess::release() {
+  close_fd(stdin_fd_);
+  close_fd(stdout_fd_);
+  if (pid_ >= 0) {
+    wait();
+  }
+}
+
+#else
+
+expected<ChildProcess, string> ChildProcess::spawn(
+    const vector<string>& argv,
+    bool) {
+  return unexpected(fmt::format(
+      "Failed to start {}: child processes are not supported on Windows",
+      argv.empty() ? string{} : argv[0]));
+}
+
+void ChildProcess::close_stdin() {}
+
+expected<string, string> ChildProcess::read_stdout() {
+  return unexpected(string{"No child process"});
+}
+
+int ChildProcess::wait() {
+  return -1;
+}
+
+void ChildProcess::release() {}
+
+#endif
+
+ChildProcess::~ChildProcess() {
+  release();
+}
+
+ChildProcess::ChildProcess(ChildProcess&& other) noexcept {
+  *this = std::move(other);
+}
+
+ChildProcess& ChildProcess::operator=(ChildProcess&& other) noexcept {
+  if (this != &other) {
+    release();
+    pid_ = std::exchange(other.pid_, -1);
+    stdin_fd_ = std::exchange(other.stdin_fd_, -1);
+    stdout_fd_ = std::exchange(other.stdout_fd_, -1);
+  }
+  return *this;
+}
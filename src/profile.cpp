@@ -0,0 +1,196 @@
+#include "profile.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+
+namespace {
+
+#if defined(__linux__)
+// Must match the order of the PerfSample counter members
+constexpr std::array<uint64_t, 4> HW_EVENTS = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+// Opens one user-space-only counter for the calling thread
+int open_counter(uint64_t config) {
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;  // permitted up to perf_event_paranoid=2
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+// Reads a counter, scaling for time lost to multiplexing
+std::optional<uint64_t> read_counter(int fd) {
+  struct {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+  } data{};
+  if (fd < 0 || ::read(fd, &data, sizeof(data)) != sizeof(data)) {
+    return std::nullopt;
+  }
+  if (data.time_running == 0) {
+    return std::nullopt;  // never scheduled on the PMU
+  }
+  if (data.time_running < data.time_enabled) {
+    return static_cast<uint64_t>(static_cast<double>(data.value) *
+                                 data.time_enabled / data.time_running);
+  }
+  return data.value;
+}
+
+string perf_event_paranoid() {
+  std::ifstream file("/proc/sys/kernel/perf_event_paranoid");
+  string level;
+  return (file >> level) ? level : string{"unknown"};
+}
+#endif
+
+// Formats an optional counter, "-" when it was unavailable
+string fmt_count(const std::optional<uint64_t>& value) {
+  return value ? fmt::format("{}", *value) : string{"-"};
+}
+
+// Formats events per thousand instructions
+string fmt_per_kilo(const std::optional<uint64_t>& events,
+                    const std::optional<uint64_t>& instructions) {
+  if (!events || !instructions || *instructions == 0) {
+    return "-";
+  }
+  return fmt::format("{:.2f}", *events * 1000.0 / *instructions);
+}
+
+}  // namespace
+
+PerfCounters::~PerfCounters() {
+#if defined(__linux__)
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+#endif
+}
+
+string PerfCounters::open() {
+#if defined(__linux__)
+  string reason;
+  for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+    fds_[i] = open_counter(HW_EVENTS[i]);
+    if (fds_[i] < 0 && reason.empty()) {
+      reason = fmt::format("{} (perf_event_paranoid={})",
+                           std::strerror(errno), perf_event_paranoid());
+    }
+  }
+  // Partial success is fine, missing counters are reported as "-"
+  bool any_open = std::ranges::any_of(fds_, [](int fd) { return fd >= 0; });
+  return any_open ? string{} : reason;
+#else
+  return "hardware counters are only supported on Linux";
+#endif
+}
+
+void PerfCounters::start() {
+#if defined(__linux__)
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+  start_ = std::chrono::steady_clock::now();
+}
+
+PerfSample PerfCounters::stop() {
+  PerfSample sample{.ms = elapsed_ms(start_)};
+#if defined(__linux__)
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  sample.cycles = read_counter(fds_[0]);
+  sample.instructions = read_counter(fds_[1]);
+  sample.cache_misses = read_counter(fds_[2]);
+  sample.branch_misses = read_counter(fds_[3]);
+#endif
+  return sample;
+}
+
+Profiler::Phase::Phase(Profiler* profiler, string name, string thread)
+    : profiler_(profiler), name_(std::move(name)), thread_(std::move(thread)) {
+  if (!profiler_) {
+    return;
+  }
+  if (auto reason = counters_.open(); !reason.empty()) {
+    profiler_->note_unavailable(reason);
+  }
+  counters_.start();
+}
+
+Profiler::Phase::~Phase() {
+  if (profiler_) {
+    profiler_->record({std::move(name_), std::move(thread_), counters_.stop()});
+  }
+}
+
+void Profiler::record(Row row) {
+  std::scoped_lock lock(mtx_);
+  rows_.push_back(std::move(row));
+}
+
+void Profiler::note_unavailable(const string& reason) {
+  std::scoped_lock lock(mtx_);
+  if (unavailable_reason_.empty()) {
+    unavailable_reason_ = reason;
+  }
+}
+
+void Profiler::print(std::FILE* out) const {
+  if (!enabled_) {
+    return;
+  }
+  std::scoped_lock lock(mtx_);
+
+  fmt::println(out, "");
+  fmt::println(out,
+               "{:<16} {:<16} {:>10} {:>14} {:>14} {:>6} {:>12} {:>12}",
+               "phase", "thread", "ms", "cycles", "instructions", "IPC",
+               "cache-MPKI", "branch-MPKI");
+  for (const auto& [name, thread, s] : rows_) {
+    string ipc =
+        (s.cycles && s.instructions && *s.cycles > 0)
+            ? fmt::format("{:.2f}", double(*s.instructions) / *s.cycles)
+            : string{"-"};
+    fmt::println(out,
+                 "{:<16} {:<16} {:>10.2f} {:>14} {:>14} {:>6} {:>12} {:>12}",
+                 name, thread, s.ms, fmt_count(s.cycles),
+                 fmt_count(s.instructions), ipc,
+                 fmt_per_kilo(s.cache_misses, s.instructions),
+                 fmt_per_kilo(s.branch_misses, s.instructions));
+  }
+
+  if (!unavailable_reason_.empty()) {
+    fmt::println(out, "Note: hardware counters unavailable: {}",
+                 unavailable_reason_);
+    fmt::println(out, "Only wall times were collected");
+  }
+}
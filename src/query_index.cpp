@@ -0,0 +1,318 @@
+#include "query_index.h"
+#include <fmt/core.h>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <numeric>
+#include <vector>
+#include "util.h"
+
+using std::expected;
+using std::optional;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::array<char, 8> MAGIC = {'P', 'I', 'O', 'Q', 'I', 'D', 'X', 0};
+constexpr size_t HEADER_BYTES = 24;  // magic and four uint32
+constexpr size_t SLOT_WORDS = 8;  // key, directory, driver, list, padding
+constexpr size_t SLOT_BYTES = SLOT_WORDS * sizeof(uint32_t);
+
+// Gives up on a bucket after this many seeds; with distinct keys the
+// expected number of tries is small
+constexpr uint32_t MAX_SEED = 1u << 20;
+
+// FNV-1a followed by a 64-bit finalizer, so that different seeds give
+// independent slot choices
+uint64_t seeded_hash(uint32_t seed, string_view key) {
+  uint64_t h = fnv1a(key, FNV_OFFSET ^ (seed * 0x9e3779b97f4a7c15ull));
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+// The index is only byte-aligned as far as the compiler knows
+uint32_t load_u32(const char* p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+void put_u32(string& out, uint32_t value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Slot of key given its bucket's displacement
+uint32_t slot_of(int32_t displace, string_view key, size_t slot_count) {
+  if (displace < 0) {
+    return static_cast<uint32_t>(-(displace + 1));
+  }
+  return static_cast<uint32_t>(
+      seeded_hash(static_cast<uint32_t>(displace), key) % slot_count);
+}
+
+}  // namespace
+
+expected<uint64_t, string> write_query_index(span<const Entry* const> entries,
+                                             const fs::path& path) {
+  size_t n = entries.size();
+  if (n > INT32_MAX) {
+    return unexpected(fmt::format("Failed to write {}: too many entries",
+                                  path.string()));
+  }
+
+  // Distinct strings and argument lists, each stored once
+  string strings;
+  vector<uint32_t> list_words;
+  boost::unordered_flat_map<string_view, uint32_t> string_offsets;
+  boost::unordered_flat_map<const string_view*, uint32_t> list_offsets;
+
+  auto add_string = [&](string_view str, uint32_t* ref) {
+    auto [it, inserted] =
+        string_offsets.try_emplace(str, static_cast<uint32_t>(strings.size()));
+    if (inserted) {
+      strings.append(str);
+    }
+    ref[0] = it->second;
+    ref[1] = static_cast<uint32_t>(str.size());
+  };
+  // Interned lists share their address; a reused address with another
+  // length is stored again
+  auto add_list = [&](span<const string_view> args) -> uint32_t {
+    auto it = list_offsets.find(args.data());
+    if (it != list_offsets.end() && list_words[it->second] == args.size()) {
+      return it->second;
+    }
+    auto offset = static_cast<uint32_t>(list_words.size());
+    list_words.push_back(static_cast<uint32_t>(args.size()));
+    for (auto arg : args) {
+      uint32_t ref[2];
+      add_string(arg, ref);
+      list_words.insert(list_words.end(), ref, ref + 2);
+    }
+    list_offsets.insert_or_assign(args.data(), offset);
+    return offset;
+  };
+
+  // Slot records by entry, placed into the table below
+  vector<std::array<uint32_t, SLOT_WORDS>> records(n);
+  for (size_t i = 0; i < n; ++i) {
+    add_string(entries[i]->key, &records[i][0]);
+    add_string(entries[i]->directory, &records[i][2]);
+    add_string(entries[i]->driver, &records[i][4]);
+    records[i][6] = add_list(entries[i]->arguments);
+    records[i][7] = 0;
+  }
+
+  // Hash and displace: bucket keys by the first hash, then find a seed
+  // per bucket that sends all its keys to free slots, largest first
+  constexpr uint32_t EMPTY = UINT32_MAX;
+  vector<int32_t> displace(n, 0);
+  vector<uint32_t> slot_entry(n, EMPTY);
+  vector<vector<uint32_t>> buckets(n);
+  for (size_t i = 0; i < n; ++i) {
+    buckets[seeded_hash(0, entries[i]->key) % n].push_back(
+        static_cast<uint32_t>(i));
+  }
+  vector<uint32_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::ranges::stable_sort(order, [&](uint32_t a, uint32_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+
+  size_t next_bucket = 0;
+  vector<uint32_t> placed;
+  for (; next_bucket < n && buckets[order[next_bucket]].size() > 1;
+       ++next_bucket) {
+    uint32_t bucket_idx = order[next_bucket];
+    const auto& bucket = buckets[bucket_idx];
+
+    // Equal keys collide under every seed
+    for (size_t a = 0; a < bucket.size(); ++a) {
+      for (size_t b = a + 1; b < bucket.size(); ++b) {
+        if (entries[bucket[a]]->key == entries[bucket[b]]->key) {
+          return unexpected(fmt::format("Failed to write {}: duplicate file {}",
+                                        path.string(),
+                                        entries[bucket[a]]->key));
+        }
+      }
+    }
+
+    uint32_t seed = 1;
+    for (; seed < MAX_SEED; ++seed) {
+      placed.clear();
+      for (uint32_t entry_idx : bucket) {
+        auto slot = static_cast<uint32_t>(
+            seeded_hash(seed, entries[entry_idx]->key) % n);
+        if (slot_entry[slot] != EMPTY ||
+            std::ranges::find(placed, slot) != placed.end()) {
+          break;
+        }
+        placed.push_back(slot);
+      }
+      if (placed.size() == bucket.size()) {
+        break;
+      }
+    }
+    if (seed == MAX_SEED) {
+      return unexpected(fmt::format(
+          "Failed to write {}: no perfect hash found", path.string()));
+    }
+    for (size_t k = 0; k < bucket.size(); ++k) {
+      slot_entry[placed[k]] = bucket[k];
+    }
+    displace[bucket_idx] = static_cast<int32_t>(seed);
+  }
+
+  // Buckets of one key take any free slot, no second hash needed
+  uint32_t free_slot = 0;
+  for (; next_bucket < n && buckets[order[next_bucket]].size() == 1;
+       ++next_bucket) {
+    while (slot_entry[free_slot] != EMPTY) {
+      ++free_slot;
+    }
+    uint32_t bucket_idx = order[next_bucket];
+    slot_entry[free_slot] = buckets[bucket_idx].front();
+    displace[bucket_idx] = -static_cast<int32_t>(free_slot) - 1;
+  }
+
+  string out;
+  out.reserve(HEADER_BYTES + n * (sizeof(int32_t) + SLOT_BYTES) +
+              list_words.size() * sizeof(uint32_t) + strings.size());
+  out.append(MAGIC.data(), MAGIC.size());
+  put_u32(out, QUERY_INDEX_VERSION);
+  put_u32(out, static_cast<uint32_t>(n));
+  put_u32(out, static_cast<uint32_t>(list_words.size()));
+  put_u32(out, static_cast<uint32_t>(strings.size()));
+  for (int32_t d : displace) {
+    put_u32(out, std::bit_cast<uint32_t>(d));
+  }
+  for (uint32_t entry_idx : slot_entry) {
+    for (uint32_t word : records[entry_idx]) {
+      put_u32(out, word);
+    }
+  }
+  for (uint32_t word : list_words) {
+    put_u32(out, word);
+  }
+  out.append(strings);
+
+  if (auto replaced = write_file_atomic(path, out); !replaced) {
+    return unexpected(replaced.error());
+  }
+  return out.size();
+}
+
+expected<QueryIndex, string> QueryIndex::open(const fs::path& path) {
+  auto file = MappedFile::open(path);
+  if (!file) {
+    return unexpected(file.error());
+  }
+
+  // Views below point into the mapping (or, on Windows, a heap buffer),
+  // neither moves when the QueryIndex does
+  QueryIndex index;
+  index.file_ = std::move(*file);
+  string_view data = index.file_.view();
+  if (data.size() < HEADER_BYTES ||
+      std::memcmp(data.data(), MAGIC.data(), MAGIC.size()) != 0) {
+    return unexpected(
+        fmt::format("{} is not a pio-clangd query index", path.string()));
+  }
+  if (load_u32(data.data() + 8) != QUERY_INDEX_VERSION) {
+    return unexpected(fmt::format(
+        "{} was written by another version of pio-clangd, regenerate it",
+        path.string()));
+  }
+
+  uint64_t slot_count = load_u32(data.data() + 12);
+  uint64_t list_bytes = uint64_t{load_u32(data.data() + 16)} * 4;
+  uint64_t string_bytes = load_u32(data.data() + 20);
+  uint64_t displace_bytes = slot_count * sizeof(int32_t);
+  uint64_t slot_bytes = slot_count * SLOT_BYTES;
+  if (data.size() != HEADER_BYTES + displace_bytes + slot_bytes +
+                         list_bytes + string_bytes) {
+    return unexpected(fmt::format("{} is truncated", path.string()));
+  }
+
+  index.slot_count_ = slot_count;
+  index.displace_ = data.data() + HEADER_BYTES;
+  index.slots_ = index.displace_ + displace_bytes;
+  index.lists_ = data.substr(HEADER_BYTES + displace_bytes + slot_bytes,
+                             list_bytes);
+  index.strings_ = data.substr(data.size() - string_bytes);
+  return index;
+}
+
+optional<QueryIndex::Command> QueryIndex::find(string_view key) const {
+  if (slot_count_ == 0) {
+    return std::nullopt;
+  }
+
+  // Every lookup reads offsets from the file, bounds-check them all so a
+  // corrupt index cannot read past the mapping
+  auto str = [&](const char* ref) -> optional<string_view> {
+    uint64_t offset = load_u32(ref);
+    uint64_t length = load_u32(ref + 4);
+    if (offset + length > strings_.size()) {
+      return std::nullopt;
+    }
+    return strings_.substr(offset, length);
+  };
+
+  size_t bucket = seeded_hash(0, key) % slot_count_;
+  auto displace =
+      std::bit_cast<int32_t>(load_u32(displace_ + bucket * sizeof(int32_t)));
+  uint32_t slot = slot_of(displace, key, slot_count_);
+  if (slot >= slot_count_) {
+    return std::nullopt;
+  }
+
+  const char* record = slots_ + slot * SLOT_BYTES;
+  auto slot_key = str(record);
+  auto directory = str(record + 8);
+  auto driver = str(record + 16);
+  if (!slot_key || *slot_key != key || !directory || !driver) {
+    return std::nullopt;
+  }
+
+  uint64_t list_offset = uint64_t{load_u32(record + 24)} * 4;
+  if (list_offset + 4 > lists_.size()) {
+    return std::nullopt;
+  }
+  uint64_t count = load_u32(lists_.data() + list_offset);
+  if (list_offset + 4 + count * 8 > lists_.size()) {
+    return std::nullopt;
+  }
+
+  Command command;
+  command.directory_ = *directory;
+  command.driver_ = *driver;
+  command.refs_ = lists_.data() + list_offset + 4;
+  command.size_ = count;
+  command.strings_ = strings_;
+  return command;
+}
+
+string_view QueryIndex::Command::argument(size_t i) const {
+  if (i >= size_) {
+    return {};
+  }
+  uint64_t offset = load_u32(refs_ + i * 8);
+  uint64_t length = load_u32(refs_ + i * 8 + 4);
+  if (offset + length > strings_.size()) {
+    return {};
+  }
+  return strings_.substr(offset, length);
+}
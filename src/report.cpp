@@ -0,0 +1,51 @@
+#include "report.h"
+#include <fmt/core.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using std::expected;
+using std::string;
+using std::unexpected;
+
+uint64_t file_bytes(const std::filesystem::path& path) {
+  std::error_code ec;
+  auto size = std::filesystem::file_size(path, ec);
+  return ec ? 0 : size;
+}
+
+uint64_t peak_rss_bytes() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters{};
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.PeakWorkingSetSize;
+  }
+  return 0;
+#else
+  rusage usage{};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  // macOS reports ru_maxrss in bytes
+  return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+  // Linux and the BSDs report ru_maxrss in kilobytes
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+expected<void, string> write_report(const RunReport& report,
+                                    const string& report_path) {
+  auto err = glz::write_file_json(report, report_path, string{});
+  if (err) {
+    return unexpected(fmt::format("Failed to write {}: {}", report_path,
+                                  glz::format_error(err)));
+  }
+  return {};
+}
@@ -0,0 +1,243 @@
+#include "response_files.h"
+#include <fmt/core.h>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <algorithm>
+#include <filesystem>
+#include "targets.h"
+#include "util.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Number of leading flags a and b share; the strings are interned, so
+// equal flags share their data
+size_t shared_prefix(span<const string_view> a, span<const string_view> b) {
+  size_t n = 0;
+  while (n < a.size() && n < b.size() && a[n].data() == b[n].data()) {
+    ++n;
+  }
+  return n;
+}
+
+bool is_rsp_name(const string& name) {
+  return name.starts_with("flags-") && name.ends_with(".rsp");
+}
+
+}  // namespace
+
+string rsp_quote(string_view arg) {
+#if defined(_WIN32)
+  // Windows rules: backslashes are literal unless they precede a quote
+  if (!arg.empty() && arg.find_first_of(" \t\"") == string_view::npos) {
+    return string{arg};
+  }
+  string out{"\""};
+  size_t backslashes = 0;
+  for (char c : arg) {
+    if (c == '\\') {
+      ++backslashes;
+    } else if (c == '"') {
+      out.append(backslashes + 1, '\\');
+      backslashes = 0;
+    } else {
+      backslashes = 0;
+    }
+    out.push_back(c);
+  }
+  out.append(backslashes, '\\');
+  out.push_back('"');
+  return out;
+#else
+  // GNU rules: a backslash escapes the next character, also in quotes
+  if (!arg.empty() &&
+      arg.find_first_of(" \t\r\n\"'\\") == string_view::npos) {
+    return string{arg};
+  }
+  string out{"\""};
+  for (char c : arg) {
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+    }
+    out.push_back(c);
+  }
+  out.push_back('"');
+  return out;
+#endif
+}
+
+RspDatabase make_response_files(span<const Entry* const> entries,
+                                const string& proj_path,
+                                InternPool& pool) {
+  // Distinct lists by identity, with the number of entries using each
+  struct ListKey {
+    const string_view* data;
+    size_t size;
+    bool operator==(const ListKey&) const = default;
+  };
+  struct ListKeyHash {
+    size_t operator()(const ListKey& key) const {
+      return std::hash<const void*>{}(key.data) * 31 + key.size;
+    }
+  };
+  struct List {
+    span<const string_view> arguments;
+    size_t uses{};
+    size_t moved{};  // leading flags moved into a response file
+  };
+  boost::unordered_flat_map<ListKey, size_t, ListKeyHash> list_ids;
+  vector<List> lists;
+  for (const Entry* entry : entries) {
+    ListKey key{entry->arguments.data(), entry->arguments.size()};
+    auto [it, inserted] = list_ids.try_emplace(key, lists.size());
+    if (inserted) {
+      lists.push_back({.arguments = entry->arguments});
+    }
+    ++lists[it->second].uses;
+  }
+
+  // Lists sharing a prefix sort next to each other, so the longest
+  // prefix a list shares with any other is shared with a neighbour
+  vector<size_t> order(lists.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::ranges::sort(order, [&](size_t a, size_t b) {
+    return std::ranges::lexicographical_compare(
+        lists[a].arguments, lists[b].arguments, std::less<>{},
+        &string_view::data, &string_view::data);
+  });
+  for (size_t pos = 0; pos < order.size(); ++pos) {
+    List& list = lists[order[pos]];
+    const auto& args = list.arguments;
+    size_t moved = args.size();
+    if (list.uses < 2) {
+      moved = 0;
+      if (pos > 0) {
+        moved = shared_prefix(args, lists[order[pos - 1]].arguments);
+      }
+      if (pos + 1 < order.size()) {
+        moved = std::max(
+            moved, shared_prefix(args, lists[order[pos + 1]].arguments));
+      }
+      // "-I" of "-I dir" stays with its directory
+      while (moved > 0 && moved < args.size() &&
+             !args[moved].starts_with('-')) {
+        --moved;
+      }
+    }
+    list.moved = moved < MIN_RSP_PREFIX ? 0 : moved;
+  }
+
+  // One file per distinct content, named after it
+  RspDatabase rsp;
+  boost::unordered_flat_map<ListKey, string_view, ListKeyHash> file_names;
+  boost::unordered_flat_set<string> names;
+  for (const auto& list : lists) {
+    if (list.moved == 0) {
+      continue;
+    }
+    ListKey prefix{list.arguments.data(), list.moved};
+    if (file_names.contains(prefix)) {
+      continue;
+    }
+    string content;
+    for (auto arg : list.arguments.first(list.moved)) {
+      content.append(rsp_quote(arg));
+      content.push_back('\n');
+    }
+    auto name = fmt::format("flags-{:016x}.rsp", fnv1a(content));
+    file_names.emplace(prefix, pool.intern(name));
+    if (names.insert(name).second) {
+      rsp.files.push_back({.name = name, .content = std::move(content)});
+    }
+  }
+  std::ranges::sort(rsp.files, {}, &ResponseFile::name);
+
+  auto root = fs::absolute(proj_path).lexically_normal();
+  if (!root.has_filename()) {
+    root = root.parent_path();
+  }
+  auto root_str = root.generic_string();
+  auto rsp_dir = targets_dir(root.string());
+
+  rsp.entries.reserve(entries.size());
+  vector<string_view> args;
+  for (const Entry* entry : entries) {
+    Entry& out = rsp.entries.emplace_back(*entry);
+    const List& list = lists[list_ids.find({entry->arguments.data(),
+                                            entry->arguments.size()})
+                                 ->second];
+    if (list.moved == 0) {
+      continue;
+    }
+    string_view name =
+        file_names.find({list.arguments.data(), list.moved})->second;
+    string_view dir = entry->directory;
+    while (dir.size() > 1 && (dir.ends_with('/') || dir.ends_with('\\'))) {
+      dir.remove_suffix(1);
+    }
+    auto ref = dir == root_str || dir == root.string()
+                   ? fmt::format("@.pio/clangd/{}", name)
+                   : fmt::format("@{}", (rsp_dir / name).generic_string());
+
+    args.clear();
+    args.push_back(pool.intern(ref));
+    args.insert(args.end(), list.arguments.begin() + list.moved,
+                list.arguments.end());
+    out.arguments = pool.intern_list(args);
+    rsp.flags_moved += list.moved;
+  }
+
+  rsp.output.reserve(rsp.entries.size());
+  for (const auto& entry : rsp.entries) {
+    rsp.output.push_back(&entry);
+  }
+  return rsp;
+}
+
+expected<size_t, string> write_response_files(span<const ResponseFile> files,
+                                              const string& proj_path) {
+  auto dir = targets_dir(proj_path);
+  std::error_code ec;
+
+  // Files of earlier runs with other flags
+  boost::unordered_flat_set<string> keep;
+  for (const auto& file : files) {
+    keep.insert(file.name);
+  }
+  if (fs::is_directory(dir, ec)) {
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+      auto name = entry.path().filename().string();
+      if (is_rsp_name(name) && !keep.contains(name)) {
+        fs::remove(entry.path(), ec);
+      }
+    }
+  }
+  if (files.empty()) {
+    return 0;
+  }
+
+  fs::create_directories(dir, ec);
+  size_t written = 0;
+  for (const auto& file : files) {
+    // Named after their content, an existing file is up to date
+    auto path = dir / file.name;
+    if (fs::file_size(path, ec) == file.content.size() && !ec) {
+      continue;
+    }
+    if (auto replaced = write_file_atomic(path, file.content); !replaced) {
+      return unexpected(replaced.error());
+    }
+    ++written;
+  }
+  return written;
+}
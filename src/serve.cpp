@@ -0,0 +1,543 @@
+#include "serve.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "clangd.h"
+#include "ini.h"
+#include "pipeline.h"
+#include "process.h"
+#include "profile.h"
+#include "report.h"
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+fs::path default_socket_path(const string& proj_path) {
+  return targets_dir(proj_path) / "serve.sock";
+}
+
+ProjectServer::ProjectServer(ServeOptions options)
+    : options_{std::move(options)},
+      start_time_{std::chrono::steady_clock::now()},
+      target_env_{options_.environment} {
+  stats_.project = options_.proj_path;
+}
+
+expected<void, string> ProjectServer::load() {
+  std::scoped_lock lock(mtx_);
+  auto loaded = refresh(true);
+  if (!loaded) {
+    return unexpected(loaded.error());
+  }
+  return {};
+}
+
+bool ProjectServer::stop_requested() const {
+  std::scoped_lock lock(mtx_);
+  return stop_requested_;
+}
+
+expected<bool, string> ProjectServer::refresh(bool force) {
+  auto config = load_pio_config(options_.proj_path);
+  if (!config) {
+    return unexpected(config.error());
+  }
+  auto rules =
+      load_project_rules(config->get(), options_.gen, options_.proj_path);
+  if (!rules) {
+    return unexpected(rules.error());
+  }
+  auto stamp =
+      make_gen_stamp(options_.proj_path, **config, options_.gen, *rules);
+  if (!force && stamp_ == stamp) {
+    return false;
+  }
+
+  // A fresh pool, so strings of replaced databases are released
+  auto load_start = std::chrono::steady_clock::now();
+  auto pool = std::make_unique<InternPool>();
+  Profiler profiler{false};
+  auto envs = load_env_databases(options_.proj_path, (*config)->envs(), *pool,
+                                 profiler, rules->entry_rules());
+  if (!envs) {
+    string message;
+    for (const auto& error : envs.error()) {
+      message += message.empty() ? error : "\n" + error;
+    }
+    return unexpected(std::move(message));
+  }
+  // A fresh cache too, files may have come and gone since the last load
+  StatCache stat_cache;
+  auto passes = run_entry_passes(*envs, options_.proj_path, **config,
+                                 options_.gen, *rules, stamp.sources, *pool,
+                                 stat_cache, profiler, nullptr);
+  if (!passes) {
+    return unexpected(passes.error());
+  }
+
+  // Views into the old pool go before the pool itself
+  by_key_.clear();
+  target_ = {};
+  envs_ = std::move(*envs);
+  pool_ = std::move(pool);
+  config_ = *config;
+  environments_ = (*config)->envs();
+  rules_ = std::move(*rules);
+  stamp_ = std::move(stamp);
+
+  stats_.environments = envs_.size();
+  stats_.input_entries = 0;
+  for (const auto& env_db : envs_) {
+    stats_.input_entries += env_db.entries.size();
+  }
+  ++stats_.loads;
+  stats_.load_ms = elapsed_ms(load_start);
+
+  if (auto resolved = retarget(target_env_); !resolved) {
+    return unexpected(resolved.error());
+  }
+  return true;
+}
+
+expected<void, string> ProjectServer::retarget(const string& env) {
+  auto config = load_pio_config(options_.proj_path);
+  if (!config) {
+    return unexpected(config.error());
+  }
+  string target_env = env.empty() ? (*config)->default_env() : env;
+  auto target_it = std::ranges::find(environments_, target_env);
+  if (target_it == environments_.end()) {
+    return unexpected(fmt::format(
+        "Environment '{}' not found in platformio.ini", target_env));
+  }
+
+  target_ = resolve_target(envs_, target_it - environments_.begin());
+  by_key_.clear();
+  by_key_.reserve(target_.entries.size());
+  for (const Entry* entry : target_.entries) {
+    by_key_.emplace(entry->key, entry);
+  }
+  target_env_ = env;
+  stats_.target_env = target_.env;
+  stats_.output_entries = target_.entries.size();
+  return {};
+}
+
+expected<size_t, string> ProjectServer::write_outputs() {
+  // Only the output is limited, lookups answer for every file
+  vector<const Entry*> budget;
+  span<const Entry* const> kept = target_.entries;
+  size_t max_entries = options_.gen.max_entries;
+  if (max_entries > 0 && kept.size() > max_entries) {
+    budget = entries_within_budget(target_, *config_, options_.proj_path,
+                                   max_entries);
+    kept = budget;
+  }
+  Profiler profiler{false};
+  auto written = write_root_outputs(kept, target_.entries, options_.proj_path,
+                                    options_.gen, *pool_, profiler, nullptr);
+  if (!written) {
+    return unexpected(written.error());
+  }
+  return kept.size();
+}
+
+string ProjectServer::handle(string_view request_line) {
+  // glaze reads up to a null terminator, which a view into the connection
+  // buffer does not guarantee: it would run on into the next request
+  string line{request_line};
+
+  // Unknown keys are ignored, so clients may send newer requests
+  ServeRequest request;
+  auto err = glz::read<glz::opts{.error_on_unknown_keys = false}>(request,
+                                                                  line);
+
+  std::scoped_lock lock(mtx_);
+  ++stats_.requests;
+  ServeResponse response =
+      err ? ServeResponse{.ok = false,
+                          .error = fmt::format("Malformed request: {}",
+                                               glz::format_error(err, line))}
+          : dispatch(request);
+
+  // Serialized under the lock, the response views the server's state
+  string out;
+  if (glz::write_json(response, out)) {
+    return R"({"ok":false,"error":"Failed to serialize response"})";
+  }
+  return out;
+}
+
+ServeResponse ProjectServer::dispatch(const ServeRequest& request) {
+  auto failure = [](string message) {
+    return ServeResponse{.ok = false, .error = std::move(message)};
+  };
+
+  if (request.method == "shutdown") {
+    stop_requested_ = true;
+    return {};
+  }
+  if (request.method == "stats") {
+    ServeStats stats = stats_;
+    stats.peak_rss_bytes = peak_rss_bytes();
+    stats.uptime_s = elapsed_ms(start_time_) / 1000;
+    return {.stats = std::move(stats)};
+  }
+
+  bool is_regenerate = request.method == "regenerate";
+  bool is_switch = request.method == "switch";
+  bool is_lookup = request.method == "lookup";
+  if (!is_regenerate && !is_switch && !is_lookup) {
+    return failure(fmt::format("Unknown method '{}'", request.method));
+  }
+  if (is_switch && !request.env) {
+    return failure("switch needs an env");
+  }
+  if (is_lookup && !request.file) {
+    return failure("lookup needs a file");
+  }
+
+  auto reloaded = refresh(is_regenerate && request.force);
+  if (!reloaded) {
+    return failure(reloaded.error());
+  }
+  if (is_switch) {
+    if (auto resolved = retarget(*request.env); !resolved) {
+      return failure(resolved.error());
+    }
+  }
+
+  if (is_lookup) {
+    make_dedup_key(request.directory.value_or(options_.proj_path),
+                   *request.file, key_, rules_.key_rules);
+    auto it = by_key_.find(string_view{key_});
+    if (it == by_key_.end()) {
+      return failure(fmt::format("No compile command for {}", key_));
+    }
+    return {.directory = it->second->directory,
+            .driver = it->second->driver,
+            .arguments = it->second->arguments};
+  }
+
+  auto written = write_outputs();
+  if (!written) {
+    return failure(written.error());
+  }
+  return {.env = target_.env, .entries = *written, .reloaded = *reloaded};
+}
+
+#if !defined(_WIN32)
+
+namespace {
+
+// Longest request line accepted, anything longer drops the connection
+constexpr size_t MAX_REQUEST_BYTES = 1 << 20;
+
+// Writes all of data to a socket without raising SIGPIPE
+bool send_all(int fd, string_view data) {
+#if defined(MSG_NOSIGNAL)
+  constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+  constexpr int SEND_FLAGS = 0;  // SO_NOSIGPIPE is set on the socket
+#endif
+  while (!data.empty()) {
+    ssize_t n = ::send(fd, data.data(), data.size(), SEND_FLAGS);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data.remove_prefix(static_cast<size_t>(n));
+  }
+  return true;
+}
+
+// No SIGPIPE where MSG_NOSIGNAL is missing; close-on-exec comes from
+// cloexec_socket() and cloexec_accept(), so compilers the server queries
+// never hold a connection open
+void prepare_socket(int fd) {
+#if defined(SO_NOSIGPIPE)
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+expected<sockaddr_un, string> socket_address(const string& path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return unexpected(fmt::format(
+        "Socket path {} is too long, pass a shorter one with --socket",
+        path));
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return addr;
+}
+
+// Connects to a server socket, -1 with errno set on failure
+int connect_socket(const sockaddr_un& addr) {
+  int fd = cloexec_socket(AF_UNIX, SOCK_STREAM);
+  if (fd < 0) {
+    return -1;
+  }
+  prepare_socket(fd);
+  if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) !=
+      0) {
+    int err = errno;
+    ::close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+// Tracks connection threads so shutdown can end and await them
+class Connections {
+ public:
+  void add(int fd) {
+    std::scoped_lock lock(mtx_);
+    fds_.push_back(fd);
+  }
+
+  void remove(int fd) {
+    std::scoped_lock lock(mtx_);
+    std::erase(fds_, fd);
+    ::close(fd);
+    cv_.notify_all();
+  }
+
+  // Unblocks every connection's read and waits for its thread to finish
+  void close_all() {
+    std::unique_lock lock(mtx_);
+    for (int fd : fds_) {
+      ::shutdown(fd, SHUT_RDWR);
+    }
+    cv_.wait(lock, [&] { return fds_.empty(); });
+  }
+
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  vector<int> fds_;
+};
+
+void serve_connection(ProjectServer& server,
+                      Connections& connections,
+                      int fd,
+                      int wake_fd) {
+  string buffer;
+  char chunk[4096];
+  bool open = true;
+  while (open) {
+    ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    buffer.append(chunk, static_cast<size_t>(n));
+
+    size_t newline;
+    while (open && (newline = buffer.find('\n')) != string::npos) {
+      string response = server.handle(string_view{buffer}.substr(0, newline));
+      buffer.erase(0, newline + 1);
+      response.push_back('\n');
+      open = send_all(fd, response);
+      if (server.stop_requested()) {
+        [[maybe_unused]] auto woken = ::write(wake_fd, "x", 1);
+        open = false;
+      }
+    }
+    open = open && buffer.size() <= MAX_REQUEST_BYTES;
+  }
+  connections.remove(fd);
+}
+
+}  // namespace
+
+int serve_project(const ServeOptions& options, std::stop_token stop) {
+  string socket_path = options.socket_path.empty()
+                           ? default_socket_path(options.proj_path).string()
+                           : options.socket_path;
+  auto addr = socket_address(socket_path);
+  if (!addr) {
+    fmt::println(stderr, "{}", addr.error());
+    return EXIT_FAILURE;
+  }
+
+  // A socket that still accepts belongs to a live server
+  if (int fd = connect_socket(*addr); fd >= 0) {
+    ::close(fd);
+    fmt::println(stderr, "A server is already listening on {}", socket_path);
+    return EXIT_FAILURE;
+  }
+  std::error_code ec;
+  fs::remove(socket_path, ec);
+  fs::create_directories(fs::path{socket_path}.parent_path(), ec);
+
+  int listen_fd = cloexec_socket(AF_UNIX, SOCK_STREAM);
+  if (listen_fd < 0) {
+    fmt::println(stderr, "Failed to create socket: {}", std::strerror(errno));
+    return EXIT_FAILURE;
+  }
+  prepare_socket(listen_fd);
+  if (::bind(listen_fd, reinterpret_cast<const sockaddr*>(&*addr),
+             sizeof(*addr)) != 0 ||
+      ::listen(listen_fd, SOMAXCONN) != 0) {
+    fmt::println(stderr, "Failed to listen on {}: {}", socket_path,
+                 std::strerror(errno));
+    ::close(listen_fd);
+    return EXIT_FAILURE;
+  }
+  // Only the owner may drive a server that writes into the project
+  ::chmod(socket_path.c_str(), S_IRUSR | S_IWUSR);
+
+  int wake[2];
+  if (!cloexec_pipe(wake)) {
+    fmt::println(stderr, "Failed to create pipe: {}", std::strerror(errno));
+    ::close(listen_fd);
+    return EXIT_FAILURE;
+  }
+
+  // Scoped so that nothing writes to the wake pipe once it is closed
+  {
+    std::stop_callback on_stop(stop, [&] {
+      [[maybe_unused]] auto woken = ::write(wake[1], "x", 1);
+    });
+
+    // Load up front so the first request is already warm; a project that
+    // has not been built yet is loaded by a later request
+    ProjectServer server{options};
+    if (auto loaded = server.load(); !loaded) {
+      fmt::println(stderr, "{}", loaded.error());
+    }
+    fmt::println("Serving {} on {}", options.proj_path, socket_path);
+
+    Connections connections;
+    while (true) {
+      pollfd fds[2] = {{.fd = listen_fd, .events = POLLIN, .revents = 0},
+                       {.fd = wake[0], .events = POLLIN, .revents = 0}};
+      if (::poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      if (fds[1].revents != 0) {
+        break;
+      }
+      int fd = cloexec_accept(listen_fd);
+      if (fd < 0) {
+        continue;
+      }
+      prepare_socket(fd);
+      connections.add(fd);
+      std::thread(serve_connection, std::ref(server), std::ref(connections),
+                  fd, wake[1])
+          .detach();
+    }
+
+    ::close(listen_fd);
+    fs::remove(socket_path, ec);
+    connections.close_all();
+  }
+  ::close(wake[0]);
+  ::close(wake[1]);
+  return EXIT_SUCCESS;
+}
+
+int run_serve(const ServeOptions& options) {
+  // Signals are taken by a dedicated thread, so the others never see them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  // Outlives the signal thread, which stays blocked until process exit
+  static std::stop_source stop;
+  std::thread([signals] {
+    int sig;
+    sigwait(&signals, &sig);
+    stop.request_stop();
+  }).detach();
+
+  return serve_project(options, stop.get_token());
+}
+
+expected<string, string> serve_request(const string& socket_path,
+                                       string_view request) {
+  auto addr = socket_address(socket_path);
+  if (!addr) {
+    return unexpected(addr.error());
+  }
+  int fd = connect_socket(*addr);
+  if (fd < 0) {
+    return unexpected(fmt::format("Failed to connect to {}: {}", socket_path,
+                                  std::strerror(errno)));
+  }
+
+  string line{request};
+  line.push_back('\n');
+  string response;
+  bool sent = send_all(fd, line);
+  char chunk[4096];
+  while (sent && response.find('\n') == string::npos) {
+    ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    response.append(chunk, static_cast<size_t>(n));
+  }
+  ::close(fd);
+
+  auto newline = response.find('\n');
+  if (newline == string::npos) {
+    return unexpected(
+        fmt::format("No response from the server on {}", socket_path));
+  }
+  response.resize(newline);
+  return response;
+}
+
+#else
+
+int serve_project(const ServeOptions&, std::stop_token) {
+  fmt::println(stderr, "pio-clangd serve is not supported on Windows");
+  return EXIT_FAILURE;
+}
+
+int run_serve(const ServeOptions& options) {
+  return serve_project(options);
+}
+
+expected<string, string> serve_request(const string&, string_view) {
+  return unexpected(string{"pio-clangd serve is not supported on Windows"});
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include "stat_cache.h"
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+#include "util.h"
+
+using std::span;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+static StatCache::Status stat_path(const string& path) {
+  std::error_code ec;
+  auto status = fs::status(path, ec);
+  if (ec || !fs::exists(status)) {
+    return StatCache::Status::missing;
+  }
+  if (fs::is_regular_file(status)) {
+    return StatCache::Status::file;
+  }
+  if (!fs::is_directory(status)) {
+    return StatCache::Status::other;
+  }
+
+  // An unreadable directory may still hold something, count it as such
+  fs::directory_iterator it{path, ec};
+  return !ec && it == fs::directory_iterator{}
+             ? StatCache::Status::empty_directory
+             : StatCache::Status::directory;
+}
+
+void StatCache::stat_all(span<const string> paths) {
+  vector<const string*> pending;
+  {
+    std::shared_lock lock(mtx_);
+    for (const auto& path : paths) {
+      if (!statuses_.contains(path)) {
+        pending.push_back(&path);
+      }
+    }
+  }
+  auto view = [](const string* path) { return string_view{*path}; };
+  std::ranges::sort(pending, {}, view);
+  auto duplicates = std::ranges::unique(pending, {}, view);
+  pending.erase(duplicates.begin(), duplicates.end());
+
+  // Workers take batches, stat() latency dominates on network and
+  // container file systems
+  static constexpr size_t BATCH = 32;
+  vector<Status> results(pending.size());
+  parallel_for(
+      pending.size(), [&](size_t i) { results[i] = stat_path(*pending[i]); },
+      BATCH);
+
+  // A concurrent call may have added some of them meanwhile, emplace()
+  // keeps the first
+  std::unique_lock lock(mtx_);
+  statuses_.reserve(statuses_.size() + pending.size());
+  for (size_t i = 0; i < pending.size(); ++i) {
+    statuses_.emplace(*pending[i], results[i]);
+  }
+}
+
+StatCache::Status StatCache::status(string_view path) const {
+  std::shared_lock lock(mtx_);
+  auto it = statuses_.find(path);
+  return it == statuses_.end() ? Status::missing : it->second;
+}
+
+bool StatCache::contains(string_view path) const {
+  std::shared_lock lock(mtx_);
+  return statuses_.contains(path);
+}
+
+size_t StatCache::size() const {
+  std::shared_lock lock(mtx_);
+  return statuses_.size();
+}
@@ -0,0 +1,352 @@
+#include "stream.h"
+#include <fmt/core.h>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include "clangd_config.h"
+#include "ini.h"
+#include "profile.h"
+#include "query_index.h"
+#include "targets.h"
+
+using std::expected;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+CommandStream::CommandStream(string target_env, ProjectRules rules)
+    : target_env_(std::move(target_env)), rules_(std::move(rules)) {}
+
+expected<void, string> CommandStream::feed(string_view chunk) {
+  for (char c : chunk) {
+    ++offset_;
+
+    // Inside a command: collect its text until the closing brace
+    if (depth_ > 0) {
+      object_.push_back(c);
+      if (in_string_) {
+        if (escaped_) {
+          escaped_ = false;
+        } else if (c == '\\') {
+          escaped_ = true;
+        } else if (c == '"') {
+          in_string_ = false;
+        }
+      } else if (c == '"') {
+        in_string_ = true;
+      } else if (c == '{' || c == '[') {
+        ++depth_;
+      } else if ((c == '}' || c == ']') && --depth_ == 0) {
+        if (auto added = add_command(); !added) {
+          return added;
+        }
+        object_.clear();
+      }
+      continue;
+    }
+
+    // Between commands
+    switch (c) {
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+      case ',':
+        break;
+      case '{':
+        object_.push_back(c);
+        depth_ = 1;
+        break;
+      case '[':
+        if (in_array_) {
+          return unexpected(
+              fmt::format("Nested array at input offset {}", offset_));
+        }
+        in_array_ = true;
+        break;
+      case ']':
+        if (!in_array_) {
+          return unexpected(
+              fmt::format("Unexpected ']' at input offset {}", offset_));
+        }
+        in_array_ = false;
+        break;
+      default:
+        return unexpected(fmt::format(
+            "Expected a compile command at input offset {}", offset_));
+    }
+  }
+  return {};
+}
+
+expected<void, string> CommandStream::add_command() {
+  // Reused across commands, so fields absent from this one must be reset
+  tagged_.directory.clear();
+  tagged_.file.clear();
+  tagged_.command.clear();
+  tagged_.arguments.clear();
+  tagged_.output.reset();
+  tagged_.env.reset();
+
+  auto err =
+      glz::read<glz::opts{.error_on_unknown_keys = false}>(tagged_, object_);
+  if (err) {
+    return unexpected(fmt::format(
+        "Invalid compile command ending at input offset {}: {}", offset_,
+        glz::format_error(err, object_)));
+  }
+
+  if (target_env_.empty()) {
+    if (!tagged_.env) {
+      return unexpected(fmt::format(
+          "Compile command without \"env\" at input offset {}, pass the "
+          "target environment to accept untagged commands",
+          offset_));
+    }
+    target_env_ = *tagged_.env;
+  }
+  const string& env = tagged_.env ? *tagged_.env : target_env_;
+
+  // Consecutive commands usually share an environment
+  size_t env_idx = envs_.size();
+  if (!envs_.empty() && envs_.back().stats.name == env) {
+    env_idx = envs_.size() - 1;
+  } else {
+    for (size_t i = 0; i < envs_.size(); ++i) {
+      if (envs_[i].stats.name == env) {
+        env_idx = i;
+        break;
+      }
+    }
+  }
+  if (env_idx == envs_.size()) {
+    envs_.emplace_back().stats.name = env;
+    if (env == target_env_) {
+      target_idx_ = env_idx;
+    }
+  }
+
+  EnvState& state = envs_[env_idx];
+  ++state.stats.entries;
+  auto made =
+      make_entry(tagged_, pool_, state.stats, scratch_, rules_.entry_rules());
+  if (!made) {
+    return {};
+  }
+  const Entry& entry = state.entries.emplace_back(*made);
+
+  // The target has the highest priority, its first entry for a key wins
+  if (target_idx_ == env_idx && seen_.insert(entry.key.data()).second) {
+    output_.push_back(&entry);
+    ++state.stats.entries_won;
+  }
+  return {};
+}
+
+expected<void, string> CommandStream::finish() {
+  if (depth_ > 0 || in_array_) {
+    return unexpected(
+        fmt::format("Unexpected end of input at offset {}", offset_));
+  }
+  if (!target_idx_) {
+    return unexpected(fmt::format("Environment '{}' not found in input",
+                                  target_env_));
+  }
+
+  for (size_t i = 0; i < envs_.size(); ++i) {
+    if (i == *target_idx_) {
+      continue;
+    }
+    for (const auto& entry : envs_[i].entries) {
+      if (seen_.insert(entry.key.data()).second) {
+        output_.push_back(&entry);
+        ++envs_[i].stats.entries_won;
+      }
+    }
+  }
+  return {};
+}
+
+vector<EnvReport> CommandStream::env_reports() const {
+  vector<EnvReport> reports;
+  reports.reserve(envs_.size());
+  for (const auto& env : envs_) {
+    EnvReport stats = env.stats;
+    stats.entries_lost = stats.entries - stats.entries_won;
+    reports.push_back(std::move(stats));
+  }
+  return reports;
+}
+
+namespace {
+
+// Writes entries as a JSON array, a batch at a time
+class JsonArrayWriter {
+ public:
+  explicit JsonArrayWriter(std::FILE* out) : out_(out) {}
+
+  // Buffers entries[written_..] and writes them out
+  bool write(const vector<const Entry*>& entries) {
+    for (; written_ < entries.size(); ++written_) {
+      buffer_ += written_ == 0 ? "[\n" : ",\n";
+      if (glz::write_json(make_output_command(*entries[written_], arguments_),
+                          json_)) {
+        return false;
+      }
+      buffer_ += json_;
+    }
+    return flush();
+  }
+
+  bool close() {
+    buffer_ += written_ == 0 ? "[]\n" : "\n]\n";
+    return flush();
+  }
+
+  uint64_t bytes() const { return bytes_; }
+
+ private:
+  bool flush() {
+    if (buffer_.empty()) {
+      return true;
+    }
+    bool ok = std::fwrite(buffer_.data(), 1, buffer_.size(), out_) ==
+                  buffer_.size() &&
+              std::fflush(out_) == 0;
+    bytes_ += buffer_.size();
+    buffer_.clear();
+    return ok;
+  }
+
+  std::FILE* out_;
+  size_t written_{};
+  uint64_t bytes_{};
+  string buffer_{};
+  string json_{};
+  vector<string_view> arguments_{};
+};
+
+}  // namespace
+
+int stream_cmds(const string& proj_path,
+                const string& environment,
+                const GenOptions& options,
+                std::FILE* in,
+                std::FILE* out) {
+  auto start_time = std::chrono::steady_clock::now();
+  std::FILE* status = out ? stderr : stdout;
+
+  // The project is optional here, it only provides default_envs and the
+  // [pio-clangd] options
+  string target_env = environment;
+  std::shared_ptr<const PioConfig> config;
+  std::error_code ec;
+  if (fs::exists(fs::path{proj_path} / "platformio.ini", ec)) {
+    if (auto loaded = load_pio_config(proj_path)) {
+      config = *loaded;
+    }
+  }
+  if (target_env.empty() && config) {
+    target_env = config->default_env();
+  }
+  auto rules = load_project_rules(config.get(), options, proj_path);
+  if (!rules) {
+    fmt::println(stderr, "{}", rules.error());
+    return EXIT_FAILURE;
+  }
+
+  CommandStream stream{target_env, std::move(*rules)};
+  std::optional<JsonArrayWriter> writer;
+  if (out) {
+    writer.emplace(out);
+  }
+
+  std::array<char, 64 * 1024> chunk;
+  size_t read = 0;
+  while ((read = std::fread(chunk.data(), 1, chunk.size(), in)) > 0) {
+    if (auto fed = stream.feed({chunk.data(), read}); !fed) {
+      fmt::println(stderr, "{}", fed.error());
+      return EXIT_FAILURE;
+    }
+    if (writer && !writer->write(stream.entries())) {
+      fmt::println(stderr, "Failed to write to standard output");
+      return EXIT_FAILURE;
+    }
+  }
+  if (std::ferror(in)) {
+    fmt::println(stderr, "Failed to read standard input");
+    return EXIT_FAILURE;
+  }
+  if (auto finished = stream.finish(); !finished) {
+    fmt::println(stderr, "{}", finished.error());
+    return EXIT_FAILURE;
+  }
+
+  auto output_path = fs::path{proj_path} / "compile_commands.json";
+  uint64_t output_bytes = 0;
+  if (writer) {
+    if (!writer->write(stream.entries()) || !writer->close()) {
+      fmt::println(stderr, "Failed to write to standard output");
+      return EXIT_FAILURE;
+    }
+    output_bytes = writer->bytes();
+  } else {
+    auto written = write_database(stream.entries(), output_path);
+    if (!written) {
+      fmt::println(stderr, "{}", written.error());
+      return EXIT_FAILURE;
+    }
+    output_bytes = *written;
+
+    // A generated .clangd block belongs to the database replaced here
+    if (auto updated = update_clangd_config(proj_path, {}); !updated) {
+      fmt::println(stderr, "{}", updated.error());
+      return EXIT_FAILURE;
+    }
+
+    auto index_path = root_index_path(proj_path);
+    fs::create_directories(index_path.parent_path(), ec);
+    if (auto indexed = write_query_index(stream.entries(), index_path);
+        !indexed) {
+      fmt::println(stderr, "{}", indexed.error());
+      return EXIT_FAILURE;
+    }
+  }
+
+  auto env_stats = stream.env_reports();
+  size_t total_commands = 0;
+  for (const auto& stats : env_stats) {
+    total_commands += stats.entries;
+  }
+  fmt::println(status,
+               "Streamed {} environment(s) with {} total compile commands, "
+               "target '{}'",
+               env_stats.size(), total_commands, stream.target_env());
+  fmt::println(status, "Wrote {} with {} entries",
+               out ? "standard output" : output_path.filename().string(),
+               stream.entries().size());
+
+  if (!options.report_path.empty()) {
+    RunReport report{
+        .project = proj_path,
+        .target_env = stream.target_env(),
+        .output_path = out ? "-" : output_path.string(),
+        .output_bytes = output_bytes,
+        .input_entries = total_commands,
+        .output_entries = stream.entries().size(),
+        .peak_rss_bytes = peak_rss_bytes(),
+        .wall_ms = elapsed_ms(start_time),
+        .envs = std::move(env_stats),
+    };
+    if (auto written = write_report(report, options.report_path); !written) {
+      fmt::println(stderr, "{}", written.error());
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+#include "targets.h"
+#include <fmt/core.h>
+#include "database.h"
+#include "util.h"
+
+using std::expected;
+using std::string;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+fs::path targets_dir(const string& proj_path) {
+  return fs::path{proj_path} / ".pio" / "clangd";
+}
+
+fs::path target_database_path(const string& proj_path, const string& env) {
+  return targets_dir(proj_path) / env / "compile_commands.json";
+}
+
+fs::path root_index_path(const string& proj_path) {
+  return targets_dir(proj_path) / "compile_commands.idx";
+}
+
+fs::path target_index_path(const string& proj_path, const string& env) {
+  return targets_dir(proj_path) / env / "compile_commands.idx";
+}
+
+static fs::path stamp_path(const string& proj_path) {
+  return targets_dir(proj_path) / "stamp.json";
+}
+
+FileStamp make_file_stamp(const fs::path& path) {
+  FileStamp file{.path = path.string()};
+  std::error_code ec;
+  auto size = fs::file_size(path, ec);
+  if (!ec) {
+    auto mtime = fs::last_write_time(path, ec);
+    if (!ec) {
+      file.size = size;
+      file.mtime = mtime.time_since_epoch().count();
+    }
+  }
+  return file;
+}
+
+TargetsStamp make_targets_stamp(const string& proj_path,
+                                const vector<string>& envs) {
+  TargetsStamp stamp{.envs = envs};
+  stamp.inputs.reserve(envs.size());
+  for (const auto& env : envs) {
+    stamp.inputs.push_back(
+        make_file_stamp(env_database_path(proj_path, env)));
+  }
+  return stamp;
+}
+
+bool targets_current(const string& proj_path, const TargetsStamp& stamp) {
+  TargetsStamp recorded;
+  auto err = glz::read_file_json(recorded, stamp_path(proj_path).string(),
+                                 string{});
+  if (err || recorded != stamp) {
+    return false;
+  }
+  for (const auto& env : stamp.envs) {
+    std::error_code ec;
+    if (!fs::is_regular_file(target_database_path(proj_path, env), ec) ||
+        !fs::is_regular_file(target_index_path(proj_path, env), ec)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+expected<void, string> write_targets_stamp(const string& proj_path,
+                                           const TargetsStamp& stamp) {
+  // Renamed into place, so a concurrent run never reads a torn stamp
+  auto path = stamp_path(proj_path);
+  auto json = glz::write_json(stamp);
+  if (!json) {
+    return unexpected(fmt::format("Failed to write {}: {}", path.string(),
+                                  glz::format_error(json.error())));
+  }
+  return write_file_atomic(path, *json);
+}
+
+// Atomically replaces path with a symlink to target, which is relative to
+// path's directory. Copies target where symlinks are unavailable. The
+// link is staged under a staging_path(), so concurrent switches each
+// rename their own.
+static expected<void, string> replace_with_link(const fs::path& path,
+                                                const fs::path& target) {
+  auto tmp_path = staging_path(path);
+
+  std::error_code ec;
+  fs::remove(tmp_path, ec);
+  fs::create_symlink(target, tmp_path, ec);
+  if (ec) {
+    fs::copy_file(path.parent_path() / target, tmp_path,
+                  fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+      return unexpected(fmt::format("Failed to link {}: {}", path.string(),
+                                    ec.message()));
+    }
+  }
+
+  fs::rename(tmp_path, path, ec);
+  if (ec) {
+    auto message = ec.message();
+    fs::remove(tmp_path, ec);
+    return unexpected(
+        fmt::format("Failed to link {}: {}", path.string(), message));
+  }
+  return {};
+}
+
+expected<void, string> link_database(const string& proj_path,
+                                     const string& env) {
+  // Relative, so the project directory stays relocatable
+  auto index = replace_with_link(root_index_path(proj_path),
+                                 fs::path{env} / "compile_commands.idx");
+  if (!index) {
+    return index;
+  }
+  return replace_with_link(
+      fs::path{proj_path} / "compile_commands.json",
+      fs::path{".pio"} / "clangd" / env / "compile_commands.json");
+}
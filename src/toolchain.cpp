@@ -0,0 +1,352 @@
+#include "toolchain.h"
+#include <fmt/core.h>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <cstdlib>
+#include <functional>
+#include <ranges>
+#include <thread>
+#include "process.h"
+#include "util.h"
+
+using std::expected;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unexpected;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+expected<ToolchainBuiltins, string> parse_builtins(string_view output) {
+  ToolchainBuiltins builtins;
+  bool found_list = false;
+  bool in_list = false;
+  for (auto range : output | std::views::split('\n')) {
+    string_view line{range};
+    if (line.ends_with('\r')) {
+      line.remove_suffix(1);
+    }
+
+    // gcc -v prints the search list to stderr:
+    //   #include <...> search starts here:
+    //    /path/to/dir
+    //   End of search list.
+    if (line.starts_with("#include <...> search starts here:")) {
+      found_list = in_list = true;
+    } else if (in_list && line.starts_with("End of search list.")) {
+      in_list = false;
+    } else if (in_list && line.starts_with(' ')) {
+      line.remove_prefix(line.find_first_not_of(' '));
+      if (line.ends_with(" (framework directory)")) {
+        line.remove_suffix(string_view{" (framework directory)"}.size());
+      }
+      auto dir = fs::path{line}.lexically_normal().generic_string();
+      while (dir.size() > 1 && dir.ends_with('/')) {
+        dir.pop_back();
+      }
+      builtins.system_dirs.push_back(std::move(dir));
+    } else if (line.starts_with("#define ")) {
+      // "#define NAME VALUE"; function-like macros are never needed
+      line.remove_prefix(string_view{"#define "}.size());
+      auto name = line.substr(0, line.find(' '));
+      if (name.find('(') != string_view::npos ||
+          !builtin_macro_needed(name)) {
+        continue;
+      }
+      auto value = name.size() < line.size() ? line.substr(name.size() + 1)
+                                              : string_view{};
+      builtins.macros.push_back(
+          value.empty() ? fmt::format("-D{}", name)
+                        : fmt::format("-D{}={}", name, value));
+    }
+  }
+
+  if (!found_list) {
+    return unexpected(string{"No include search list in compiler output"});
+  }
+  return builtins;
+}
+
+// Path of the program a command runs, searched in PATH like execvp()
+static fs::path find_program(string_view driver) {
+  fs::path program{driver};
+  if (driver.find_first_of("/\\") != string_view::npos) {
+    return program;
+  }
+  const char* search_path = std::getenv("PATH");
+  if (!search_path) {
+    return program;
+  }
+#if defined(_WIN32)
+  constexpr char PATH_SEPARATOR = ';';
+#else
+  constexpr char PATH_SEPARATOR = ':';
+#endif
+  std::error_code ec;
+  for (auto range : string_view{search_path} |
+                        std::views::split(PATH_SEPARATOR)) {
+    string_view dir{range};
+    auto candidate = fs::path{dir.empty() ? "." : dir} / program;
+    if (fs::is_regular_file(candidate, ec)) {
+      return candidate;
+    }
+  }
+  return program;
+}
+
+string toolchain_key(string_view driver,
+                     string_view language,
+                     span<const string> flags) {
+  // An updated or reinstalled compiler invalidates its cached builtins
+  std::error_code ec;
+  auto mtime = fs::last_write_time(find_program(driver), ec);
+  int64_t ticks = ec ? 0 : mtime.time_since_epoch().count();
+
+  string key = fmt::format("{}\n{}\n{}", driver, ticks, language);
+  for (const auto& flag : flags) {
+    key.push_back('\n');
+    key.append(flag);
+  }
+  return key;
+}
+
+expected<ToolchainBuiltins, string> query_builtins(const string& driver,
+                                                   string_view language,
+                                                   span<const string> flags) {
+  vector<string> argv{driver};
+  argv.insert(argv.end(), flags.begin(), flags.end());
+  argv.emplace_back("-x");
+  argv.emplace_back(language);
+  for (string_view arg : {"-E", "-v", "-dM", "-"}) {
+    argv.emplace_back(arg);
+  }
+
+  // The search list goes to stderr and the macros to stdout, and the
+  // compiler prints the list before it preprocesses the empty input
+  auto child = ChildProcess::spawn(argv, true);
+  if (!child) {
+    return unexpected(child.error());
+  }
+  child->close_stdin();
+  auto output = child->read_stdout();
+  int exit_code = child->wait();
+  if (!output) {
+    return unexpected(fmt::format("{}: {}", driver, output.error()));
+  }
+  if (exit_code != 0) {
+    return unexpected(
+        fmt::format("{} exited with code {}", driver, exit_code));
+  }
+
+  auto builtins = parse_builtins(*output);
+  if (!builtins) {
+    return unexpected(fmt::format("{}: {}", driver, builtins.error()));
+  }
+  return builtins;
+}
+
+fs::path default_cache_dir() {
+  for (const char* var : {"XDG_CACHE_HOME", "LOCALAPPDATA"}) {
+    if (const char* dir = std::getenv(var); dir && *dir) {
+      return fs::path{dir} / "pio-clangd";
+    }
+  }
+  if (const char* home = std::getenv("HOME"); home && *home) {
+    return fs::path{home} / ".cache" / "pio-clangd";
+  }
+  return fs::temp_directory_path() / "pio-clangd";
+}
+
+namespace {
+
+// Language the compiler preprocesses a source file as; assembler
+// sources are preprocessed like C
+string_view source_language(string_view file) {
+  auto ext = file.substr(std::min(file.rfind('.'), file.size()));
+  for (string_view c_ext : {".c", ".s", ".S", ".sx"}) {
+    if (ext == c_ext) {
+      return "c";
+    }
+  }
+  return "c++";
+}
+
+// Flags of args that change the compiler's target, and with it its
+// builtins
+void target_flags(span<const string_view> args, vector<string>& flags) {
+  flags.clear();
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--sysroot" && i + 1 < args.size()) {
+      flags.emplace_back(args[i]);
+      flags.emplace_back(args[++i]);
+    } else if (args[i].starts_with("-m") || args[i].starts_with("--target") ||
+               args[i].starts_with("--sysroot=")) {
+      flags.emplace_back(args[i]);
+    }
+  }
+}
+
+enum class QueryState { failed, queried, cached };
+
+// One compiler invocation, shared by every entry with the same driver,
+// language and target flags
+struct Query {
+  string driver{};
+  string_view language{};
+  vector<string> flags{};
+  string key{};
+  QueryState state{QueryState::failed};
+  ToolchainBuiltins builtins{};
+  string error{};
+};
+
+// Cached builtins of key, a hash collision or unreadable file is a miss
+bool read_cache(const fs::path& path, Query& query) {
+  ToolchainBuiltins cached;
+  if (glz::read_file_json(cached, path.string(), string{}) ||
+      cached.key != query.key) {
+    return false;
+  }
+  query.builtins = std::move(cached);
+  return true;
+}
+
+void run_query(const fs::path& cache_dir, Query& query) {
+  auto cache_path = cache_dir / fmt::format("{:016x}.json", fnv1a(query.key));
+  if (read_cache(cache_path, query)) {
+    query.state = QueryState::cached;
+    return;
+  }
+
+  auto builtins = query_builtins(query.driver, query.language, query.flags);
+  if (!builtins) {
+    query.error = std::move(builtins.error());
+    return;
+  }
+  query.builtins = std::move(*builtins);
+  query.builtins.key = query.key;
+  query.state = QueryState::queried;
+
+  // Failing to cache only costs the next run a query
+  std::error_code ec;
+  fs::create_directories(cache_dir, ec);
+  if (auto json = glz::write_json(query.builtins)) {
+    (void)write_file_atomic(cache_path, *json);
+  }
+}
+
+}  // namespace
+
+ToolchainStats inject_toolchain_builtins(span<EnvDatabase> envs,
+                                         InternPool& pool,
+                                         const fs::path& cache_dir) {
+  // Entries share a handful of interned drivers and argument lists
+  struct ListKey {
+    const char* driver;
+    const string_view* arguments;
+    bool c;  // source_language() is "c"
+    bool operator==(const ListKey&) const = default;
+  };
+  struct ListKeyHash {
+    size_t operator()(const ListKey& key) const {
+      return (std::hash<const void*>{}(key.driver) * 31 +
+              std::hash<const void*>{}(key.arguments)) *
+                 2 +
+             key.c;
+    }
+  };
+  struct List {
+    size_t query;
+    span<const string_view> arguments;
+  };
+  boost::unordered_flat_map<ListKey, List, ListKeyHash> lists;
+
+  // Queries by driver, language and flags; the key adds the driver's
+  // modification time, which takes a stat
+  boost::unordered_flat_map<string, size_t> query_ids;
+  vector<Query> queries;
+  vector<string> flags;
+  for (const auto& env : envs) {
+    for (const auto& entry : env.entries) {
+      if (entry.driver.empty()) {
+        continue;
+      }
+      auto language = source_language(entry.file);
+      ListKey key{entry.driver.data(), entry.arguments.data(),
+                  language == "c"};
+      if (lists.contains(key)) {
+        continue;
+      }
+      target_flags(entry.arguments, flags);
+      string spec = fmt::format("{}\n{}", entry.driver, language);
+      for (const auto& flag : flags) {
+        spec.push_back('\n');
+        spec.append(flag);
+      }
+      auto [it, inserted] = query_ids.try_emplace(spec, queries.size());
+      if (inserted) {
+        queries.push_back(Query{
+            .driver = string{entry.driver},
+            .language = language,
+            .flags = flags,
+            .key = toolchain_key(entry.driver, language, flags),
+        });
+      }
+      lists.emplace(key, List{it->second, entry.arguments});
+    }
+  }
+
+  // Compilers start slowly, run them all at once
+  {
+    vector<std::jthread> workers;
+    for (auto& query : queries) {
+      workers.emplace_back(run_query, std::cref(cache_dir), std::ref(query));
+    }
+  }
+
+  ToolchainStats stats;
+  for (auto& query : queries) {
+    if (query.state == QueryState::queried) {
+      ++stats.queried;
+    } else if (query.state == QueryState::cached) {
+      ++stats.cached;
+    } else {
+      stats.errors.push_back(std::move(query.error));
+    }
+  }
+
+  // Rewrite each distinct list once
+  vector<string_view> args;
+  ArgCanonicalizer canonicalizer;
+  for (auto& [key, list] : lists) {
+    const Query& query = queries[list.query];
+    if (query.state == QueryState::failed) {
+      continue;
+    }
+    args.clear();
+    for (const auto& macro : query.builtins.macros) {
+      args.push_back(pool.intern(macro));
+    }
+    args.insert(args.end(), list.arguments.begin(), list.arguments.end());
+    for (const auto& dir : query.builtins.system_dirs) {
+      args.push_back(pool.intern("-isystem"));
+      args.push_back(pool.intern(dir));
+    }
+    // The compiler skips a builtin directory the command already names,
+    // and an -I directory that is a builtin one
+    canonicalizer.canonicalize(args);
+    list.arguments = pool.intern_list(args);
+  }
+
+  for (auto& env : envs) {
+    for (auto& entry : env.entries) {
+      if (!entry.driver.empty()) {
+        entry.arguments =
+            lists.find({entry.driver.data(), entry.arguments.data(),
+                        source_language(entry.file) == "c"})
+                ->second.arguments;
+      }
+    }
+  }
+  return stats;
+}
@@ -0,0 +1,70 @@
+#include "util.h"
+#include <fmt/core.h>
+#include <fstream>
+#include <functional>
+#include <random>
+
+using std::expected;
+using std::string;
+using std::string_view;
+using std::unexpected;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Threads parallel_for() may still start
+std::atomic<size_t>& spare_threads() {
+  static std::atomic<size_t> spare{
+      std::max(1u, std::thread::hardware_concurrency()) - 1};
+  return spare;
+}
+
+}  // namespace
+
+size_t reserve_threads(size_t wanted) {
+  auto& spare = spare_threads();
+  size_t available = spare.load();
+  size_t taken = 0;
+  do {
+    taken = std::min(wanted, available);
+  } while (!spare.compare_exchange_weak(available, available - taken));
+  return taken;
+}
+
+void release_threads(size_t count) {
+  spare_threads().fetch_add(count);
+}
+
+fs::path staging_path(const fs::path& path) {
+  // Thread ids alone may repeat in another process
+  static const auto process = std::random_device{}();
+  auto tmp_path = path;
+  tmp_path += fmt::format(
+      ".{:x}.{:x}.tmp", process,
+      std::hash<std::thread::id>{}(std::this_thread::get_id()));
+  return tmp_path;
+}
+
+expected<void, string> write_file_atomic(const fs::path& path,
+                                         string_view content) {
+  auto tmp_path = staging_path(path);
+  std::error_code ec;
+  {
+    std::ofstream stream(tmp_path, std::ios::binary | std::ios::trunc);
+    stream.write(content.data(), static_cast<std::streamsize>(content.size()));
+    if (!stream.flush()) {
+      stream.close();
+      fs::remove(tmp_path, ec);
+      return unexpected(fmt::format("Failed to write {}", path.string()));
+    }
+  }
+  fs::rename(tmp_path, path, ec);
+  if (ec) {
+    auto message = ec.message();
+    fs::remove(tmp_path, ec);
+    return unexpected(
+        fmt::format("Failed to write {}: {}", path.string(), message));
+  }
+  return {};
+}
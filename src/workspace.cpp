@@ -0,0 +1,178 @@
+#include "workspace.h"
+#include <fmt/core.h>
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include "database.h"
+#include "ini.h"
+#include "intern.h"
+#include "profile.h"
+#include "query_index.h"
+#include "stat_cache.h"
+#include "targets.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr const char* PIO_INI = "platformio.ini";
+
+// Nothing below a project is walked: its platformio.ini files belong to
+// library examples and the like, not to projects of their own
+void walk(const fs::path& dir, vector<string>& projects) {
+  std::error_code ec;
+  if (fs::is_regular_file(dir / PIO_INI, ec)) {
+    projects.push_back(dir.generic_string());
+    return;
+  }
+  fs::recursive_directory_iterator it{
+      dir, fs::directory_options::skip_permission_denied, ec};
+  for (; !ec && it != fs::recursive_directory_iterator{}; it.increment(ec)) {
+    if (!it->is_directory(ec)) {
+      continue;
+    }
+    if (it->path().filename().string().starts_with('.')) {
+      it.disable_recursion_pending();
+    } else if (fs::is_regular_file(it->path() / PIO_INI, ec)) {
+      projects.push_back(it->path().generic_string());
+      it.disable_recursion_pending();
+    }
+  }
+}
+
+}  // namespace
+
+vector<string> find_projects(const string& root) {
+  auto dir = fs::absolute(root).lexically_normal();
+  if (!dir.has_filename()) {
+    dir = dir.parent_path();
+  }
+
+  // A project root is walked no further, see walk()
+  vector<string> projects;
+  std::error_code ec;
+  if (fs::is_regular_file(dir / PIO_INI, ec)) {
+    projects.push_back(dir.generic_string());
+    return projects;
+  }
+
+  // Each directory below root is walked in parallel
+  vector<fs::path> items;
+  for (const auto& entry : fs::directory_iterator{dir, ec}) {
+    if (entry.is_directory(ec) &&
+        !entry.path().filename().string().starts_with('.')) {
+      items.push_back(entry.path());
+    }
+  }
+
+  vector<vector<string>> found(items.size());
+  parallel_for(items.size(), [&](size_t i) { walk(items[i], found[i]); });
+
+  for (auto& item_projects : found) {
+    projects.insert(projects.end(),
+                    std::make_move_iterator(item_projects.begin()),
+                    std::make_move_iterator(item_projects.end()));
+  }
+  std::ranges::sort(projects);
+  return projects;
+}
+
+int run_workspace(const WorkspaceOptions& options) {
+  auto start_time = std::chrono::steady_clock::now();
+  auto root = fs::absolute(options.root).lexically_normal().generic_string();
+  if (root.size() > 1 && root.ends_with('/')) {
+    root.pop_back();
+  }
+
+  auto projects = find_projects(root);
+  if (projects.empty()) {
+    fmt::println(stderr, "No {} found below {}", PIO_INI, root);
+    return EXIT_FAILURE;
+  }
+  if (options.combined && projects.front() == root) {
+    fmt::println(stderr,
+                 "{} is a project itself, its compile_commands.json cannot "
+                 "hold the combined database",
+                 root);
+    return EXIT_FAILURE;
+  }
+  fmt::println("Found {} project(s) below {}", projects.size(), root);
+
+  // Entries view into the shared pool, so they outlive their project's
+  // run for the combined database
+  InternPool pool;
+  StatCache stat_cache;
+  vector<vector<Entry>> outputs(projects.size());
+  vector<int> results(projects.size(), EXIT_FAILURE);
+
+  parallel_for(projects.size(), [&](size_t i) {
+    // Projects without the environment use their default one
+    string environment;
+    if (auto config = load_pio_config(projects[i]);
+        config && std::ranges::find((*config)->envs(), options.environment) !=
+                      (*config)->envs().end()) {
+      environment = options.environment;
+    }
+    GenShared shared{
+        .pool = &pool,
+        .stat_cache = &stat_cache,
+        .quiet = true,
+        .on_output =
+            [&](std::span<const Entry* const> entries) {
+              for (const Entry* entry : entries) {
+                outputs[i].push_back(*entry);
+              }
+            },
+    };
+    results[i] = gen_cmds(projects[i], environment, options.gen, shared);
+  });
+
+  size_t failed = 0;
+  for (size_t i = 0; i < projects.size(); ++i) {
+    auto name = fs::path{projects[i]}.lexically_relative(root).string();
+    if (results[i] != EXIT_SUCCESS) {
+      ++failed;
+      fmt::println("  {}: failed", name);
+    } else {
+      fmt::println("  {}: {} entries", name, outputs[i].size());
+    }
+  }
+
+  if (options.combined) {
+    // Keys are interned in the shared pool, equal keys are one pointer
+    vector<const Entry*> combined;
+    boost::unordered_flat_set<const char*> seen;
+    for (const auto& entries : outputs) {
+      for (const auto& entry : entries) {
+        if (seen.insert(entry.key.data()).second) {
+          combined.push_back(&entry);
+        }
+      }
+    }
+    auto output_path = fs::path{root} / "compile_commands.json";
+    if (auto written = write_database(combined, output_path); !written) {
+      fmt::println(stderr, "{}", written.error());
+      return EXIT_FAILURE;
+    }
+    auto index_path = root_index_path(root);
+    std::error_code ec;
+    fs::create_directories(index_path.parent_path(), ec);
+    if (auto indexed = write_query_index(combined, index_path); !indexed) {
+      fmt::println(stderr, "{}", indexed.error());
+      return EXIT_FAILURE;
+    }
+    fmt::println("Wrote the combined {} with {} entries",
+                 output_path.filename().string(), combined.size());
+  }
+
+  fmt::println("Generated {}/{} project(s) in {:.0f} ms",
+               projects.size() - failed, projects.size(),
+               elapsed_ms(start_time));
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,121 @@
+#include "alloc_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// Replacement global allocation functions for the test executable.
+// Plain forms forward to malloc/free, over-aligned forms to the platform's
+// aligned allocator.
+
+namespace {
+
+std::atomic<size_t> total_allocations{0};
+std::atomic<size_t> total_bytes{0};
+
+void* counted_alloc(size_t size, size_t alignment = 0) {
+  total_allocations.fetch_add(1, std::memory_order_relaxed);
+  total_bytes.fetch_add(size, std::memory_order_relaxed);
+
+  if (size == 0) {
+    size = 1;  // operator new must return a unique pointer
+  }
+  if (alignment == 0) {
+    return std::malloc(size);
+  }
+#if defined(_WIN32)
+  return _aligned_malloc(size, alignment);
+#else
+  // aligned_alloc requires size to be a multiple of alignment
+  size = (size + alignment - 1) / alignment * alignment;
+  return std::aligned_alloc(alignment, size);
+#endif
+}
+
+void aligned_free(void* ptr) {
+#if defined(_WIN32)
+  _aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+
+void* counted_alloc_or_throw(size_t size, size_t alignment = 0) {
+  void* ptr = counted_alloc(size, alignment);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+}  // namespace
+
+AllocScope::AllocScope()
+    : start_{total_allocations.load(std::memory_order_relaxed),
+             total_bytes.load(std::memory_order_relaxed)} {}
+
+AllocStats AllocScope::stats() const {
+  return {total_allocations.load(std::memory_order_relaxed) -
+              start_.allocations,
+          total_bytes.load(std::memory_order_relaxed) - start_.bytes};
+}
+
+void* operator new(size_t size) {
+  return counted_alloc_or_throw(size);
+}
+
+void* operator new[](size_t size) {
+  return counted_alloc_or_throw(size);
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+  return counted_alloc_or_throw(size, static_cast<size_t>(align));
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+  return counted_alloc_or_throw(size, static_cast<size_t>(align));
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return counted_alloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return counted_alloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+  aligned_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  aligned_free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+  aligned_free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+  aligned_free(ptr);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+// Allocation totals recorded by the replaced global operator new
+struct AllocStats {
+  size_t allocations = 0;
+  size_t bytes = 0;
+};
+
+// Counts global operator new calls, from any thread, made while alive
+//
+// Only available when linked against the alloc-counter library, which
+// replaces the global allocation functions for the test executable.
+class AllocScope {
+ public:
+  AllocScope();
+
+  AllocScope(const AllocScope&) = delete;
+  AllocScope& operator=(const AllocScope&) = delete;
+
+  // Allocations made since this scope was created
+  AllocStats stats() const;
+
+ private:
+  AllocStats start_;
+};
@@ -0,0 +1,121 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "alloc_counter.hpp"
+#include "clangd.h"
+#include "test_fixtures.hpp"
+
+TEST_CASE("process_tokens allocation budget", "[allocations]") {
+  std::vector<std::string> args = {
+      "xtensa-esp32-elf-g++",
+      "-DARDUINO=10819",
+      "-DESP32",
+      "-I/home/user/project/include",
+      "-I", "/home/user/.platformio/packages/framework-arduinoespressif32",
+      "-Os",
+      "-Wall",
+      "-std=gnu++17",
+      "-mlongcalls",
+      "-c",
+      "src/main.cpp"};
+
+  std::vector<std::string> filtered;
+  filtered.reserve(args.size());
+
+  AllocScope scope;
+  process_tokens(args, filtered);
+  auto stats = scope.stats();
+
+  // At most one heap buffer per kept flag (short flags fit in SSO)
+  REQUIRE(filtered.size() == 6);
+  REQUIRE(stats.allocations <= filtered.size());
+}
+
+TEST_CASE("ArgCanonicalizer reuses its capacity", "[allocations]") {
+  std::vector<std::string_view> args = {
+      "-DARDUINO=10819", "-DESP32",  "-Iinclude",    "-I",
+      "include",         "-Isrc",    "-isystem",     "/sdk",
+      "-I/sdk",          "-DESP32",  "-std=gnu++17"};
+  auto copy = args;
+
+  ArgCanonicalizer canonicalizer;
+  canonicalizer.canonicalize(copy);
+
+  AllocScope scope;
+  canonicalizer.canonicalize(args);
+  auto stats = scope.stats();
+
+  REQUIRE(args.size() == 7);
+  REQUIRE(stats.allocations == 0);
+}
+
+TEST_CASE("make_dedup_key fast path does not allocate", "[allocations]") {
+  CompileCommand cmd{
+      .directory = "/home/user/project",
+      .file = ".pio/libdeps/esp32dev/ArduinoJson/src/ArduinoJson.cpp"};
+
+  std::string key;
+  key.reserve(256);
+  // Compiled once, on first use
+  default_key_rules();
+
+  AllocScope scope;
+  make_dedup_key(cmd, key);
+  auto stats = scope.stats();
+
+  REQUIRE(key ==
+          "/home/user/project/.pio/libdeps/ArduinoJson/src/ArduinoJson.cpp");
+  REQUIRE(stats.allocations == 0);
+}
+
+TEST_CASE("gen_cmds 10k-entry run stays within byte budget",
+          "[allocations][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32", "esp32s3"});
+  auto dir = fixture.get_path_string();
+
+  // 5000 entries per env, half of the second env duplicates the first
+  auto make_db = [&](int first, int last, const std::string& define) {
+    std::string json = "[";
+    for (int i = first; i < last; ++i) {
+      if (i != first) {
+        json += ",";
+      }
+      auto file = "src/module_" + std::to_string(i) + ".cpp";
+      json += R"({"directory":")" + dir + R"(","file":")" + file +
+              R"(","arguments":["xtensa-esp32-elf-g++","-D)" + define +
+              R"(","-DARDUINO=10819","-I)" + dir +
+              R"(/include","-I/home/user/.platformio/framework/cores",)"
+              R"("-Os","-Wall","-std=gnu++17","-c",")" + file + R"("]})";
+    }
+    return json + "]";
+  };
+  auto esp32_db = make_db(0, 5000, "ESP32");
+  auto esp32s3_db = make_db(2500, 7500, "ESP32S3");
+  fixture.create_compile_commands("esp32", esp32_db);
+  fixture.create_compile_commands("esp32s3", esp32s3_db);
+  size_t input_bytes = esp32_db.size() + esp32s3_db.size();
+
+  // What the JSON library alone needs to load both databases
+  size_t json_read_bytes = 0;
+  {
+    AllocScope scope;
+    for (const auto& env : {"esp32", "esp32s3"}) {
+      std::vector<CompileCommand> commands;
+      auto path = fixture.get_path() / ".pio" / "build" / env /
+                  "compile_commands.json";
+      REQUIRE_FALSE(glz::read_file_json(commands, path.string(),
+                                        std::string{}));
+    }
+    json_read_bytes = scope.stats().bytes;
+  }
+
+  AllocScope scope;
+  REQUIRE(gen_cmds(dir, "esp32") == EXIT_SUCCESS);
+  auto stats = scope.stats();
+
+  // Deduplicating, filtering and writing should stay linear in the input;
+  // catch anything that copies it many times over
+  REQUIRE(stats.bytes <= json_read_bytes + 6 * input_bytes);
+}
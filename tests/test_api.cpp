@@ -0,0 +1,147 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "api.h"
+#include "pio_clangd.h"
+#include "test_fixtures.hpp"
+
+static constexpr std::string_view ESP32_JSON =
+    R"([{"directory":"/proj","file":"src/main.cpp",)"
+    R"("arguments":["g++","-DESP32","-O2","-c","src/main.cpp"]}])";
+static constexpr std::string_view NATIVE_JSON =
+    R"([{"directory":"/proj","file":"src/main.cpp",)"
+    R"("command":"g++ -DNATIVE -c src/main.cpp"},)"
+    R"({"directory":"/proj","file":"src/lib.cpp",)"
+    R"("command":"g++ -DNATIVE -c src/lib.cpp"}])";
+
+using Args = std::vector<std::string_view>;
+
+TEST_CASE("generate deduplicates in-memory inputs", "[api]") {
+  std::vector<EnvInput> inputs{{.name = "esp32", .json = ESP32_JSON},
+                               {.name = "native", .json = NATIVE_JSON}};
+
+  SECTION("First input is the default target") {
+    auto db = generate(inputs);
+    REQUIRE(db);
+    REQUIRE(db->target_env() == "esp32");
+    REQUIRE(db->input_entries() == 3);
+    REQUIRE(db->entries().size() == 2);
+    REQUIRE(db->entries()[0]->file == "src/main.cpp");
+    REQUIRE(arguments(*db->entries()[0]) == Args{"-DESP32"});
+    REQUIRE(db->entries()[1]->file == "src/lib.cpp");
+  }
+
+  SECTION("Named target wins") {
+    auto db = generate(inputs, "native");
+    REQUIRE(db);
+    REQUIRE(arguments(*db->entries()[0]) == Args{"-DNATIVE"});
+
+    auto json = db->to_json();
+    REQUIRE(json);
+    std::vector<CompileCommand> commands;
+    REQUIRE_FALSE(glz::read_json(commands, *json));
+    REQUIRE(commands.size() == 2);
+    REQUIRE(commands[0].arguments ==
+            std::vector<std::string>{"g++", "-DNATIVE"});
+  }
+
+  SECTION("Errors are structured") {
+    auto db = generate(inputs, "avr");
+    REQUIRE_FALSE(db);
+    REQUIRE(db.error().code == ErrorCode::unknown_environment);
+    REQUIRE(db.error().env == "avr");
+
+    inputs[1].json = "[{";
+    db = generate(inputs);
+    REQUIRE_FALSE(db);
+    REQUIRE(db.error().code == ErrorCode::input);
+    REQUIRE(db.error().env == "native");
+
+    db = generate({});
+    REQUIRE_FALSE(db);
+    REQUIRE(db.error().code == ErrorCode::no_environments);
+  }
+}
+
+TEST_CASE("generate_project reads a PlatformIO project", "[api]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32", "native"});
+  fixture.create_compile_commands("esp32", std::string{ESP32_JSON});
+  fixture.create_compile_commands("native", std::string{NATIVE_JSON});
+  auto dir = fixture.get_path_string();
+
+  auto db = generate_project(dir);
+  REQUIRE(db);
+  REQUIRE(db->target_env() == "esp32");
+  REQUIRE(db->entries().size() == 2);
+
+  // Nothing is written to the project
+  REQUIRE_FALSE(fs::exists(fixture.get_path() / "compile_commands.json"));
+
+  // The [pio-clangd] rules apply like in gen_cmds
+  fixture.write_file("platformio.ini",
+                     "[env:esp32]\n"
+                     "[env:native]\n"
+                     "[pio-clangd]\n"
+                     "exclude = /proj/src/lib.cpp\n");
+  db = generate_project(dir);
+  REQUIRE(db);
+  REQUIRE(db->entries().size() == 1);
+  REQUIRE(db->entries()[0]->file == "src/main.cpp");
+
+  db = generate_project(dir, "avr");
+  REQUIRE_FALSE(db);
+  REQUIRE(db.error().code == ErrorCode::unknown_environment);
+
+  db = generate_project((fixture.get_path() / "missing").string());
+  REQUIRE_FALSE(db);
+  REQUIRE(db.error().code == ErrorCode::config);
+}
+
+TEST_CASE("C API exposes the database", "[api]") {
+  auto str = [](pio_clangd_str s) { return std::string_view{s.data, s.size}; };
+
+  pio_clangd_env envs[] = {
+      {"esp32", ESP32_JSON.data(), ESP32_JSON.size(), nullptr},
+      {"native", NATIVE_JSON.data(), NATIVE_JSON.size(), nullptr},
+  };
+  pio_clangd_db* db = nullptr;
+  pio_clangd_error* error = nullptr;
+  REQUIRE(pio_clangd_generate(envs, 2, "native", &db, &error) ==
+          PIO_CLANGD_OK);
+  REQUIRE(error == nullptr);
+
+  REQUIRE(str(pio_clangd_db_target_env(db)) == "native");
+  REQUIRE(pio_clangd_db_input_entries(db) == 3);
+  REQUIRE(pio_clangd_db_size(db) == 2);
+  REQUIRE(str(pio_clangd_db_directory(db, 0)) == "/proj");
+  REQUIRE(str(pio_clangd_db_file(db, 0)) == "src/main.cpp");
+  REQUIRE(str(pio_clangd_db_driver(db, 0)) == "g++");
+  REQUIRE(pio_clangd_db_argument_count(db, 0) == 1);
+  REQUIRE(str(pio_clangd_db_argument(db, 0, 0)) == "-DNATIVE");
+  REQUIRE(pio_clangd_db_argument(db, 0, 1).data == nullptr);
+
+  pio_clangd_str json{};
+  REQUIRE(pio_clangd_db_json(db, &json, nullptr) == PIO_CLANGD_OK);
+  REQUIRE_THAT(std::string{str(json)},
+               Catch::Matchers::ContainsSubstring("src/lib.cpp"));
+  pio_clangd_db_free(db);
+
+  db = nullptr;
+  envs[1].json = "[{";
+  envs[1].json_size = 2;
+  REQUIRE(pio_clangd_generate(envs, 2, nullptr, &db, &error) ==
+          PIO_CLANGD_ERROR_INPUT);
+  REQUIRE(db == nullptr);
+  REQUIRE(error != nullptr);
+  REQUIRE(error->code == PIO_CLANGD_ERROR_INPUT);
+  REQUIRE(std::string_view{error->env} == "native");
+  REQUIRE(std::string_view{error->message}.find("native") !=
+          std::string_view::npos);
+  pio_clangd_error_free(error);
+
+  REQUIRE(pio_clangd_generate(envs, 2, nullptr, nullptr, nullptr) ==
+          PIO_CLANGD_ERROR_INVALID_ARGUMENT);
+}
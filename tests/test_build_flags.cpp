@@ -0,0 +1,161 @@
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "build_flags.h"
+#include "clangd.h"
+#include "database.h"
+#include "ini.h"
+#include "pipeline.h"
+#include "report.h"
+#include "test_fixtures.hpp"
+
+using Args = std::vector<std::string>;
+
+TEST_CASE("split_flags splits like a shell", "[build_flags]") {
+  REQUIRE(split_flags("  -DA=1\t-Iinc  ") == Args{"-DA=1", "-Iinc"});
+  REQUIRE(split_flags(R"(-DNAME=\"value\" '-DS="a b"' "-DQ=\"x\"")") ==
+          Args{R"(-DNAME="value")", R"(-DS="a b")", R"(-DQ="x")"});
+  REQUIRE(split_flags(R"(-DP="a\b" -DE="")") == Args{R"(-DP=a\b)", "-DE="});
+  REQUIRE(split_flags("").empty());
+}
+
+TEST_CASE("read_build_flags follows extends", "[build_flags]") {
+  PioConfig config;
+  config.merge(
+      "[common]\n"
+      "build_flags =\n"
+      "  -DCOMMON\n"
+      "  -include cfg.h -Wall\n"
+      "  !python version.py\n"
+      "[env:esp32]\n"
+      "extends = common\n"
+      "build_unflags = -Os\n");
+  auto build = read_build_flags(config, "esp32");
+  REQUIRE(build.flags ==
+          Args{"-DCOMMON", "-include", "cfg.h", "-Wall", "!python version.py"});
+  REQUIRE(build.unflags == Args{"-Os"});
+}
+
+TEST_CASE("diff_build_flags turns an edit into a rule", "[build_flags]") {
+  BuildFlags built{.flags = {"-DVER=1", "-DKEEP", "-I", "old", "-Wall"},
+                   .unflags = {"-DGONE"}};
+
+  SECTION("changed and new flags") {
+    BuildFlags now{.flags = {"-DVER=2", "-DKEEP", "-Wextra", "-Inew"},
+                   .unflags = {"-DGONE", "-DKEEP", "-std=gnu++11"}};
+    auto rule = diff_build_flags(built, now);
+    REQUIRE(rule);
+    REQUIRE(rule->path == "/");
+    // "-DKEEP" is unflagged by name, with any value
+    REQUIRE(rule->remove ==
+            Args{"-DVER=1", "-Iold", "-Wall", "-DKEEP", "-DKEEP=*",
+                 "-std=gnu++11"});
+    // Only what the clangd filter keeps
+    REQUIRE(rule->add == Args{"-DVER=2", "-Inew"});
+  }
+
+  SECTION("unflagged additions are not added") {
+    BuildFlags now = built;
+    now.flags.push_back("-DGONE=1");
+    auto rule = diff_build_flags(built, now);
+    REQUIRE(rule);
+    REQUIRE(rule->add.empty());
+    REQUIRE(rule->remove.empty());
+  }
+
+  SECTION("changes a compiledb run has to make") {
+    BuildFlags now = built;
+    now.unflags.clear();
+    REQUIRE_FALSE(diff_build_flags(built, now));
+
+    now = built;
+    now.flags.push_back("!echo -DX");
+    REQUIRE_FALSE(diff_build_flags(built, now));
+  }
+}
+
+TEST_CASE("gen_cmds --patch-flags", "[build_flags][gen_cmds]") {
+  TempProjectFixture fixture;
+  auto write_ini = [&](std::string_view flags) {
+    fixture.write_file("platformio.ini", "[env:esp32]\n"
+                                         "platform = espressif32\n"
+                                         "build_flags = " +
+                                             std::string{flags} + "\n");
+  };
+  auto dir = fixture.get_path_string();
+  auto write_database = [&](std::string_view flags) {
+    fixture.create_compile_commands(
+        "esp32", R"([{"directory":")" + dir +
+                     R"(","file":"src/main.cpp","arguments":["g++",)" +
+                     std::string{flags} + R"(,"-c","src/main.cpp"]}])");
+  };
+  auto arguments = [&] {
+    std::vector<CompileCommand> commands;
+    auto path = (fixture.get_path() / "compile_commands.json").string();
+    REQUIRE_FALSE(glz::read_file_json(commands, path, std::string{}));
+    REQUIRE(commands.size() == 1);
+    return commands[0].arguments;
+  };
+  auto report_path = (fixture.get_path() / "report.json").string();
+  GenOptions options{.report_path = report_path, .patch_flags = true};
+
+  // The first run records the flags the database was built with
+  write_ini("-DVER=1 -DBOARD");
+  write_database(R"("-DVER=1","-DBOARD","-DFRAMEWORK")");
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_SUCCESS);
+  REQUIRE(arguments() == Args{"g++", "-DVER=1", "-DBOARD", "-DFRAMEWORK"});
+
+  write_ini("-DVER=2 -DBOARD -Iextra");
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_SUCCESS);
+  REQUIRE(arguments() ==
+          Args{"g++", "-DBOARD", "-DFRAMEWORK", "-DVER=2", "-Iextra"});
+
+  RunReport report;
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.entries_patched == 1);
+  REQUIRE(report.envs[0].entries_patched == 1);
+
+  // A new database comes with the current flags
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  write_database(R"("-DVER=2","-DBOARD","-Iextra","-DFRAMEWORK")");
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_SUCCESS);
+  REQUIRE(arguments() ==
+          Args{"g++", "-DVER=2", "-DBOARD", "-Iextra", "-DFRAMEWORK"});
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.entries_patched == 0);
+}
+
+TEST_CASE("--patch-flags stamps the extra configs", "[build_flags][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.write_file("platformio.ini", "[platformio]\n"
+                                       "extra_configs = flags.ini\n"
+                                       "[env:esp32]\n"
+                                       "platform = espressif32\n");
+  fixture.write_file("flags.ini", "[env:esp32]\n"
+                                  "build_flags = -DVER=1\n");
+  auto dir = fixture.get_path_string();
+  fixture.create_compile_commands(
+      "esp32", R"([{"directory":")" + dir +
+                   R"(","file":"src/main.cpp","arguments":["g++","-DVER=1",)"
+                   R"("-c","src/main.cpp"]}])");
+  GenOptions options{.patch_flags = true};
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_SUCCESS);
+
+  auto current = [&] {
+    auto config = load_pio_config(dir);
+    REQUIRE(config);
+    auto rules = load_project_rules(config->get(), options, dir);
+    REQUIRE(rules);
+    return targets_current(dir,
+                           make_gen_stamp(dir, **config, options, *rules));
+  };
+  REQUIRE(current());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  fixture.write_file("flags.ini", "[env:esp32]\n"
+                                  "build_flags = -DVER=2\n");
+  REQUIRE_FALSE(current());
+}
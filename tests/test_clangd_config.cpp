@@ -0,0 +1,165 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "clangd.h"
+#include "clangd_config.h"
+#include "database.h"
+#include "report.h"
+#include "test_fixtures.hpp"
+
+using Args = std::vector<std::string_view>;
+
+TEST_CASE("factor_common_flags moves shared trailing flags",
+          "[clangd_config]") {
+  TempProjectFixture fixture;
+  auto dir = fixture.get_path_string();
+
+  // PlatformIO puts the framework directories last
+  std::vector<std::string> framework{"-I", "/fw/cores", "-I/fw/variant",
+                                     "-DARDUINO=10812"};
+  auto command = [&](std::string file, std::vector<std::string> own) {
+    CompileCommand cmd{.directory = dir, .file = std::move(file)};
+    cmd.arguments.push_back("g++");
+    cmd.arguments.insert(cmd.arguments.end(), own.begin(), own.end());
+    cmd.arguments.insert(cmd.arguments.end(), framework.begin(),
+                         framework.end());
+    return cmd;
+  };
+  std::vector<CompileCommand> commands{
+      command("src/main.cpp", {"-DMAIN"}),
+      command("src/other.cpp", {"-DO"}),
+      command("lib/Foo/a.cpp", {"-DA", "-Ilib/Foo/src"}),
+      command("lib/Foo/b.cpp", {"-DB", "-Ilib/Foo/src"}),
+      command("lib/Bar/c.cpp", {"-Ilib/Bar"}),
+      command("/outside/d.cpp", {"-DD"}),
+  };
+  // Shared from "/fw/cores" on, but a run cannot start with the
+  // directory of "-isystem /fw/cores"
+  commands[1].arguments[2] = "-isystem";
+
+  InternPool pool;
+  auto db = make_env_database("uno", commands, pool);
+  std::vector<const Entry*> entries;
+  for (const auto& entry : db.entries) {
+    entries.push_back(&entry);
+  }
+  auto factored = factor_common_flags(entries, dir);
+
+  REQUIRE(Args(factored.common.begin(), factored.common.end()) ==
+          Args{"-I/fw/variant", "-DARDUINO=10812"});
+  REQUIRE(factored.groups.size() == 1);
+  REQUIRE(factored.groups[0].prefix == "lib/Foo/");
+  REQUIRE(Args(factored.groups[0].flags.begin(),
+               factored.groups[0].flags.end()) ==
+          Args{"-Ilib/Foo/src", "-I", "/fw/cores"});
+
+  const auto& out = factored.output;
+  REQUIRE(out.size() == 6);
+  REQUIRE(arguments(*out[0]) == Args{"-DMAIN", "-I", "/fw/cores"});
+  REQUIRE(arguments(*out[1]) == Args{"-DO", "-isystem", "/fw/cores"});
+  REQUIRE(arguments(*out[2]) == Args{"-DA"});
+  REQUIRE(arguments(*out[3]) == Args{"-DB"});
+  REQUIRE(arguments(*out[4]) == Args{"-Ilib/Bar", "-I", "/fw/cores"});
+  // .clangd does not apply outside the project
+  REQUIRE(arguments(*out[5]) == arguments(db.entries[5]));
+  REQUIRE(factored.flags_factored == 2 * 5 + 3 * 2);
+
+  auto fragments = render_clangd_config(factored);
+  REQUIRE(fragments ==
+          "---\n"
+          "If:\n"
+          "  PathMatch: \"lib/Foo/.*\"\n"
+          "CompileFlags:\n"
+          "  Add:\n"
+          "    - \"-Ilib/Foo/src\"\n"
+          "    - \"-I\"\n"
+          "    - \"/fw/cores\"\n"
+          "---\n"
+          "CompileFlags:\n"
+          "  Add:\n"
+          "    - \"-I/fw/variant\"\n"
+          "    - \"-DARDUINO=10812\"\n");
+}
+
+TEST_CASE("update_clangd_config keeps the user's fragments",
+          "[clangd_config]") {
+  TempProjectFixture fixture;
+  auto dir = fixture.get_path_string();
+  auto path = fixture.get_path() / ".clangd";
+  std::string fragments = "---\nCompileFlags:\n  Add:\n    - \"-DA\"\n";
+
+  // A new file holds only the block, and goes away with it
+  REQUIRE(update_clangd_config(dir, fragments));
+  REQUIRE(read_file(path) == std::string{CLANGD_CONFIG_BEGIN} + "\n" +
+                                 fragments + std::string{CLANGD_CONFIG_END} +
+                                 "\n");
+  REQUIRE(update_clangd_config(dir, {}));
+  REQUIRE_FALSE(fs::exists(path));
+
+  // Nothing to remove
+  REQUIRE(update_clangd_config(dir, {}));
+  REQUIRE_FALSE(fs::exists(path));
+
+  std::string user = "Diagnostics:\n  UnusedIncludes: None";
+  fixture.write_file(".clangd", user);
+  REQUIRE(update_clangd_config(dir, fragments));
+  auto content = read_file(path);
+  REQUIRE(content == user + "\n" + std::string{CLANGD_CONFIG_BEGIN} + "\n" +
+                         fragments + std::string{CLANGD_CONFIG_END} + "\n");
+
+  // Fragments after the block start a document of their own
+  fixture.write_file(".clangd", content + "Index:\n  Background: Skip\n");
+  REQUIRE(update_clangd_config(dir, "---\nCompileFlags: {}\n"));
+  REQUIRE(read_file(path) == user + "\n" +
+                                 std::string{CLANGD_CONFIG_BEGIN} + "\n" +
+                                 "---\nCompileFlags: {}\n---\n" +
+                                 std::string{CLANGD_CONFIG_END} + "\n" +
+                                 "Index:\n  Background: Skip\n");
+
+  REQUIRE(update_clangd_config(dir, {}));
+  REQUIRE(read_file(path) == user + "\nIndex:\n  Background: Skip\n");
+
+  // A block without its end is left for the user to fix
+  fixture.write_file(".clangd", std::string{CLANGD_CONFIG_BEGIN} + "\n");
+  REQUIRE_FALSE(update_clangd_config(dir, fragments));
+}
+
+TEST_CASE("gen_cmds --clangd-config", "[clangd_config][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"uno"});
+  auto dir = fixture.get_path_string();
+  auto command = [&](std::string_view file, std::string_view own) {
+    return R"({"directory":")" + dir + R"(","file":")" + std::string{file} +
+           R"(","arguments":["g++",)" + std::string{own} +
+           R"("-I/fw/cores","-DARDUINO=10812","-c","x.cpp"]})";
+  };
+  fixture.create_compile_commands(
+      "uno", "[" + command("src/a.cpp", R"("-DA",)") + "," +
+                 command("src/b.cpp", "") + "]");
+  auto report_path = (fixture.get_path() / "report.json").string();
+
+  GenOptions options{.report_path = report_path, .clangd_config = true};
+  REQUIRE(gen_cmds(dir, "uno", options) == EXIT_SUCCESS);
+
+  std::vector<CompileCommand> commands;
+  auto database_path = (fixture.get_path() / "compile_commands.json").string();
+  REQUIRE_FALSE(glz::read_file_json(commands, database_path, std::string{}));
+  REQUIRE(commands.size() == 2);
+  REQUIRE(commands[0].arguments == std::vector<std::string>{"g++", "-DA"});
+  REQUIRE(commands[1].arguments == std::vector<std::string>{"g++"});
+  auto config = read_file(fixture.get_path() / ".clangd");
+  REQUIRE(config.find("    - \"-I/fw/cores\"\n"
+                      "    - \"-DARDUINO=10812\"\n") != std::string::npos);
+
+  RunReport report;
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.flags_factored == 4);
+
+  // Without the option the database is complete again
+  REQUIRE(gen_cmds(dir, "uno") == EXIT_SUCCESS);
+  REQUIRE_FALSE(glz::read_file_json(commands, database_path, std::string{}));
+  REQUIRE(commands[1].arguments ==
+          std::vector<std::string>{"g++", "-I/fw/cores", "-DARDUINO=10812"});
+  REQUIRE_FALSE(fs::exists(fixture.get_path() / ".clangd"));
+}
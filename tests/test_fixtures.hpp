@@ -2,11 +2,27 @@
 
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "database.h"
 
 namespace fs = std::filesystem;
 
+// Flags of an entry, comparable with a vector of literals
+inline std::vector<std::string_view> arguments(const Entry& entry) {
+  return {entry.arguments.begin(), entry.arguments.end()};
+}
+
+// Whole content of a file, empty if it cannot be read
+inline std::string read_file(const fs::path& path) {
+  std::ifstream file{path};
+  std::ostringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
 // Fixture for creating temporary test directories with platformio.ini
 class TempProjectFixture {
  public:
@@ -54,6 +70,23 @@ class TempProjectFixture {
     file << "default_envs = none\n";
   }
 
+  // Write a file relative to the project root, creating parent directories
+  void write_file(const std::string& rel_path, const std::string& content) {
+    auto path = temp_dir / rel_path;
+    fs::create_directories(path.parent_path());
+    std::ofstream file(path);
+    file << content;
+  }
+
+  // Write .pio/build/<env>/compile_commands.json with the given JSON content
+  void create_compile_commands(const std::string& env,
+                               const std::string& json) {
+    auto build_dir = temp_dir / ".pio" / "build" / env;
+    fs::create_directories(build_dir);
+    std::ofstream file(build_dir / "compile_commands.json");
+    file << json;
+  }
+
   fs::path get_path() const { return temp_dir; }
   std::string get_path_string() const { return temp_dir.string(); }
 
@@ -0,0 +1,221 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <string>
+#include "clangd.h"
+#include "report.h"
+#include "targets.h"
+#include "test_fixtures.hpp"
+
+// Two envs sharing src/main.cpp; lib.cpp only exists in the second env
+static void create_two_env_project(TempProjectFixture& fixture) {
+  fixture.create_platformio_ini({"esp32", "native"});
+  auto dir = fixture.get_path_string();
+  fixture.create_compile_commands(
+      "esp32",
+      R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+      R"("arguments":["g++","-DESP32","-O2","-Iinclude","-c",)"
+      R"("src/main.cpp"]}])");
+  fixture.create_compile_commands(
+      "native",
+      R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+      R"("command":"g++ -DNATIVE -c src/main.cpp"},)"
+      R"({"directory":")" + dir + R"(","file":"src/lib.cpp",)"
+      R"("command":"g++ -DNATIVE -Wall -c src/lib.cpp"}])");
+}
+
+TEST_CASE("gen_cmds writes a run report", "[gen_cmds][report]") {
+  TempProjectFixture fixture;
+  create_two_env_project(fixture);
+  auto report_path = (fixture.get_path() / "report.json").string();
+
+  GenOptions options{.report_path = report_path};
+  REQUIRE(gen_cmds(fixture.get_path_string(), "esp32", options) ==
+          EXIT_SUCCESS);
+
+  RunReport report;
+  auto err = glz::read_file_json(report, report_path, std::string{});
+  REQUIRE_FALSE(err);
+
+  REQUIRE(report.target_env == "esp32");
+  REQUIRE(report.input_entries == 3);
+  REQUIRE(report.output_entries == 2);
+  REQUIRE(report.output_bytes > 0);
+  REQUIRE(report.envs.size() == 2);
+
+  const auto& esp32 = report.envs[0];
+  REQUIRE(esp32.name == "esp32");
+  REQUIRE(esp32.entries == 1);
+  REQUIRE(esp32.input_bytes > 0);
+  REQUIRE(esp32.entries_won == 1);
+  REQUIRE(esp32.entries_lost == 0);
+  REQUIRE(esp32.flags_kept == 2);     // -DESP32 -Iinclude
+  REQUIRE(esp32.flags_dropped == 3);  // -O2 -c src/main.cpp
+
+  const auto& native = report.envs[1];
+  REQUIRE(native.name == "native");
+  REQUIRE(native.entries == 2);
+  REQUIRE(native.entries_won == 1);
+  REQUIRE(native.entries_lost == 1);
+  REQUIRE(native.flags_kept == 2);     // -DNATIVE, for both entries
+  REQUIRE(native.flags_dropped == 5);  // -c src/main.cpp -Wall -c src/lib.cpp
+}
+
+// Reads a written compile_commands.json back
+static std::vector<CompileCommand> read_output(const fs::path& path) {
+  std::vector<CompileCommand> commands;
+  auto err = glz::read_file_json(commands, path.string(), std::string{});
+  REQUIRE_FALSE(err);
+  return commands;
+}
+
+// Flags of the entry for file after its driver, empty if there is none
+static std::vector<std::string> args_for(
+    const std::vector<CompileCommand>& commands,
+    const std::string& file) {
+  for (const auto& cmd : commands) {
+    if (cmd.file == file) {
+      REQUIRE(cmd.arguments.front() == "g++");
+      return {cmd.arguments.begin() + 1, cmd.arguments.end()};
+    }
+  }
+  return {};
+}
+
+TEST_CASE("gen_cmds --all-targets writes one database per environment",
+          "[gen_cmds]") {
+  TempProjectFixture fixture;
+  create_two_env_project(fixture);
+  auto clangd_dir = fixture.get_path() / ".pio" / "clangd";
+
+  GenOptions options{.all_targets = true};
+  REQUIRE(gen_cmds(fixture.get_path_string(), "esp32", options) ==
+          EXIT_SUCCESS);
+
+  auto root = read_output(fixture.get_path() / "compile_commands.json");
+  auto esp32 = read_output(clangd_dir / "esp32" / "compile_commands.json");
+  auto native = read_output(clangd_dir / "native" / "compile_commands.json");
+
+  REQUIRE(root.size() == 2);
+  REQUIRE(esp32.size() == 2);
+  REQUIRE(native.size() == 2);
+
+  // Each database prefers its own environment's flags for shared files
+  using Args = std::vector<std::string>;
+  REQUIRE(args_for(root, "src/main.cpp") == Args{"-DESP32", "-Iinclude"});
+  REQUIRE(args_for(esp32, "src/main.cpp") == Args{"-DESP32", "-Iinclude"});
+  REQUIRE(args_for(native, "src/main.cpp") == Args{"-DNATIVE"});
+  REQUIRE(args_for(esp32, "src/lib.cpp") == Args{"-DNATIVE"});
+  REQUIRE(args_for(native, "src/lib.cpp") == Args{"-DNATIVE"});
+}
+
+TEST_CASE("gen_cmds --switch links precomputed databases", "[gen_cmds]") {
+  TempProjectFixture fixture;
+  create_two_env_project(fixture);
+  auto proj = fixture.get_path_string();
+  auto root = fixture.get_path() / "compile_commands.json";
+  std::vector<std::string> envs{"esp32", "native"};
+  using Args = std::vector<std::string>;
+
+  GenOptions options{.switch_env = true};
+  REQUIRE_FALSE(targets_current(proj, make_targets_stamp(proj, envs)));
+  REQUIRE(gen_cmds(proj, "native", options) == EXIT_SUCCESS);
+  REQUIRE(targets_current(proj, make_targets_stamp(proj, envs)));
+
+  REQUIRE(fs::is_symlink(root));
+  REQUIRE(args_for(read_output(root), "src/main.cpp") == Args{"-DNATIVE"});
+
+  SECTION("Switching with current inputs only flips the link") {
+    auto esp32_db = target_database_path(proj, "esp32");
+    auto before = fs::last_write_time(esp32_db);
+
+    REQUIRE(gen_cmds(proj, "esp32", options) == EXIT_SUCCESS);
+    REQUIRE(fs::is_symlink(root));
+    REQUIRE(fs::read_symlink(root) ==
+            fs::path{".pio"} / "clangd" / "esp32" / "compile_commands.json");
+    REQUIRE(fs::last_write_time(esp32_db) == before);
+    REQUIRE(args_for(read_output(root), "src/main.cpp") ==
+            Args{"-DESP32", "-Iinclude"});
+  }
+
+  SECTION("Changed inputs regenerate the databases") {
+    auto dir = fixture.get_path_string();
+    fixture.create_compile_commands(
+        "esp32",
+        R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+        R"("arguments":["g++","-DESP32","-DREV2","-c","src/main.cpp"]}])");
+    REQUIRE_FALSE(targets_current(proj, make_targets_stamp(proj, envs)));
+
+    REQUIRE(gen_cmds(proj, "esp32", options) == EXIT_SUCCESS);
+    REQUIRE(targets_current(proj, make_targets_stamp(proj, envs)));
+    REQUIRE(args_for(read_output(root), "src/main.cpp") ==
+            Args{"-DESP32", "-DREV2"});
+  }
+
+  SECTION("Unknown environments are rejected") {
+    REQUIRE(gen_cmds(proj, "missing", options) == EXIT_FAILURE);
+    REQUIRE(fs::read_symlink(root) ==
+            fs::path{".pio"} / "clangd" / "native" / "compile_commands.json");
+  }
+
+  SECTION("A regular run replaces the link with a file") {
+    REQUIRE(gen_cmds(proj, "esp32") == EXIT_SUCCESS);
+    REQUIRE_FALSE(fs::is_symlink(root));
+    REQUIRE(args_for(read_output(target_database_path(proj, "native")),
+                     "src/main.cpp") == Args{"-DNATIVE"});
+  }
+}
+
+TEST_CASE("gen_cmds without --report writes no report", "[gen_cmds][report]") {
+  TempProjectFixture fixture;
+  create_two_env_project(fixture);
+
+  REQUIRE(gen_cmds(fixture.get_path_string(), "") == EXIT_SUCCESS);
+  REQUIRE(fs::exists(fixture.get_path() / "compile_commands.json"));
+  REQUIRE_FALSE(fs::exists(fixture.get_path() / "report.json"));
+}
+
+TEST_CASE("gen_cmds --profile degrades without hardware counters",
+          "[gen_cmds][profile]") {
+  TempProjectFixture fixture;
+  create_two_env_project(fixture);
+
+  // Counters are often restricted in containers; the run must still succeed
+  GenOptions options{.profile = true};
+  REQUIRE(gen_cmds(fixture.get_path_string(), "esp32", options) ==
+          EXIT_SUCCESS);
+  REQUIRE(fs::exists(fixture.get_path() / "compile_commands.json"));
+}
+
+TEST_CASE("gen_cmds --max-entries keeps the most relevant entries",
+          "[gen_cmds][report]") {
+  TempProjectFixture fixture;
+  create_two_env_project(fixture);
+  auto proj = fixture.get_path_string();
+  auto report_path = (fixture.get_path() / "report.json").string();
+
+  // The framework's entry goes first in the input, but last in rank
+  fixture.create_compile_commands(
+      "esp32",
+      R"([{"directory":")" + proj + R"(","file":"/pkg/core/core.cpp",)"
+      R"("arguments":["g++","-DCORE","-c","core.cpp"]},)"
+      R"({"directory":")" + proj + R"(","file":"src/main.cpp",)"
+      R"("arguments":["g++","-DESP32","-c","src/main.cpp"]}])");
+
+  GenOptions options{.report_path = report_path, .max_entries = 2};
+  REQUIRE(gen_cmds(proj, "esp32", options) == EXIT_SUCCESS);
+  auto root = read_output(fixture.get_path() / "compile_commands.json");
+  REQUIRE(root.size() == 2);
+  REQUIRE(root[0].file == "src/main.cpp");
+  REQUIRE(root[1].file == "src/lib.cpp");
+
+  RunReport report;
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.output_entries == 2);
+  REQUIRE(report.entries_over_budget == 1);
+
+  // A budget that fits changes nothing
+  options.max_entries = 3;
+  REQUIRE(gen_cmds(proj, "esp32", options) == EXIT_SUCCESS);
+  REQUIRE(read_output(fixture.get_path() / "compile_commands.json").size() ==
+          3);
+}
@@ -0,0 +1,210 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "clangd.h"
+#include "database.h"
+#include "infer.h"
+#include "ini.h"
+#include "report.h"
+#include "targets.h"
+#include "test_fixtures.hpp"
+
+namespace fs = std::filesystem;
+
+using Sources = std::vector<std::string>;
+
+TEST_CASE("scan_sources lists what PlatformIO would build", "[infer]") {
+  TempProjectFixture fixture;
+  fixture.write_file("src/main.cpp", "");
+  fixture.write_file("src/drivers/uart.c", "");
+  fixture.write_file("src/drivers/uart.h", "");
+  fixture.write_file("src/.hidden/skip.cpp", "");
+  fixture.write_file("lib/WithSrc/src/a.cc", "");
+  fixture.write_file("lib/WithSrc/examples/ex.cpp", "");
+  fixture.write_file("lib/Flat/flat.cpp", "");
+  fixture.write_file("lib/Flat/util/util.cxx", "");
+  fixture.write_file("lib/Flat/examples/ex.cpp", "");
+  fixture.write_file("lib/Flat/test/t.cpp", "");
+  fixture.write_file("lib/README.cpp", "");
+  fixture.write_file("other/o.cpp", "");
+
+  PioConfig config;
+  auto dir = fixture.get_path().lexically_normal().generic_string();
+  REQUIRE(scan_sources(dir, config) == Sources{
+                                           dir + "/lib/Flat/flat.cpp",
+                                           dir + "/lib/Flat/util/util.cxx",
+                                           dir + "/lib/WithSrc/src/a.cc",
+                                           dir + "/src/drivers/uart.c",
+                                           dir + "/src/main.cpp",
+                                       });
+
+  config.merge("[platformio]\nsrc_dir = other\nlib_dir = none\n");
+  REQUIRE(scan_sources(dir, config) == Sources{dir + "/other/o.cpp"});
+}
+
+TEST_CASE("scan_sources applies source filters and lib_ignore", "[infer]") {
+  TempProjectFixture fixture;
+  fixture.write_file("src/main.cpp", "");
+  fixture.write_file("src/board_a/a.cpp", "");
+  fixture.write_file("src/board_b/b.cpp", "");
+  fixture.write_file("src/test/keep.cpp", "");
+  fixture.write_file("src/test/skip.cpp", "");
+  fixture.write_file("lib/Ignored/src/i.cpp", "");
+  fixture.write_file("lib/Renamed/library.json", R"({"name": "Fancy"})");
+  fixture.write_file("lib/Renamed/r.cpp", "");
+  fixture.write_file("lib/Half/h.cpp", "");
+  fixture.write_file("lib/Custom/library.json",
+                     R"({"version": "1.0", "build": {"srcDir": "source",)"
+                     R"( "srcFilter": ["+<*>", "-<skip.cpp>"]}})");
+  fixture.write_file("lib/Custom/source/n.cpp", "");
+  fixture.write_file("lib/Custom/source/skip.cpp", "");
+  fixture.write_file("lib/Custom/src/unused.cpp", "");
+
+  PioConfig config;
+  config.merge(
+      "[env:a]\n"
+      "build_src_filter = +<*> -<board_b/> -<test/> +<test/keep.cpp>\n"
+      "lib_ignore = Ignored, Half, Fancy\n"
+      "[env:b]\n"
+      "src_filter =\n"
+      "  +<main.cpp>\n"
+      "  +<board_*/>\n"
+      "  -<board_a/>\n"
+      "lib_ignore = Ignored, Fancy\n");
+  auto dir = fixture.get_path().lexically_normal().generic_string();
+  // A source any environment builds counts, a library only every
+  // environment ignores does not
+  REQUIRE(scan_sources(dir, config) == Sources{
+                                           dir + "/lib/Custom/source/n.cpp",
+                                           dir + "/lib/Half/h.cpp",
+                                           dir + "/src/board_a/a.cpp",
+                                           dir + "/src/board_b/b.cpp",
+                                           dir + "/src/main.cpp",
+                                           dir + "/src/test/keep.cpp",
+                                       });
+}
+
+TEST_CASE("infer_new_sources copies the closest entry's flags", "[infer]") {
+  InternPool pool;
+  auto entry = [&](std::string_view key, std::string_view flag) {
+    std::vector<std::string_view> args{pool.intern(flag)};
+    return Entry{.key = pool.intern(key),
+                 .directory = "/proj",
+                 .file = pool.intern(key),
+                 .arguments = pool.intern_list(args),
+                 .output = "x.o",
+                 .driver = "g++"};
+  };
+  std::vector<EnvDatabase> envs(2);
+  envs[0].entries = {
+      entry("/proj/src/main.cpp", "-DMAIN"),
+      entry("/proj/src/start.c", "-DC"),
+      entry("/proj/lib/Foo/src/foo.cpp", "-DFOO"),
+  };
+  envs[1].entries = {entry("/proj/src/main.cpp", "-DOTHER")};
+
+  Sources sources{
+      "/proj/src/main.cpp",        // built already
+      "/proj/src/new.cpp",         // same directory, C++ preferred
+      "/proj/src/new.c",           // same directory, C preferred
+      "/proj/src/deep/dir/x.cpp",  // closest directory above
+      "/proj/lib/Foo/src/bar.cc",
+      "/proj/lib/Bar/bar.cpp",     // no sibling, lib/ has no entries
+  };
+  REQUIRE(infer_new_sources(envs, sources, "/proj", pool) == 4);
+
+  auto flags = [&](size_t env, std::string_view key) -> std::string_view {
+    for (const auto& e : envs[env].entries) {
+      if (e.key == key) {
+        REQUIRE(e.file == key);
+        REQUIRE(e.output.empty());
+        return e.arguments[0];
+      }
+    }
+    return {};
+  };
+  REQUIRE(flags(0, "/proj/src/new.cpp") == "-DMAIN");
+  REQUIRE(flags(0, "/proj/src/new.c") == "-DC");
+  REQUIRE(flags(0, "/proj/src/deep/dir/x.cpp") == "-DMAIN");
+  REQUIRE(flags(0, "/proj/lib/Foo/src/bar.cc") == "-DFOO");
+  REQUIRE(flags(0, "/proj/lib/Bar/bar.cpp").empty());
+  REQUIRE(envs[0].stats.entries_inferred == 4);
+
+  // Every environment infers from its own entries, C falls back to C++
+  REQUIRE(flags(1, "/proj/src/new.c") == "-DOTHER");
+  REQUIRE(flags(1, "/proj/lib/Foo/src/bar.cc").empty());
+  REQUIRE(envs[1].stats.entries_inferred == 3);
+
+  // Sources inferred once are known the next time
+  REQUIRE(infer_new_sources(envs, sources, "/proj", pool) == 0);
+}
+
+TEST_CASE("gen_cmds --infer-new", "[infer][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32", "native"});
+  fixture.write_file("src/main.cpp", "");
+  fixture.write_file("src/added.cpp", "");
+  fixture.write_file("test/t.cpp", "");
+  auto dir = fixture.get_path_string();
+  auto command = [&](std::string_view flag) {
+    return R"([{"directory":")" + dir +
+           R"(","file":"src/main.cpp","arguments":["g++",")" +
+           std::string{flag} + R"(","-c","src/main.cpp"]}])";
+  };
+  fixture.create_compile_commands("esp32", command("-DESP32"));
+  fixture.create_compile_commands("native", command("-DNATIVE"));
+  auto report_path = (fixture.get_path() / "report.json").string();
+
+  GenOptions options{.report_path = report_path, .infer_new = true};
+  REQUIRE(gen_cmds(dir, "native", options) == EXIT_SUCCESS);
+
+  std::vector<CompileCommand> commands;
+  auto database_path = (fixture.get_path() / "compile_commands.json").string();
+  REQUIRE_FALSE(glz::read_file_json(commands, database_path, std::string{}));
+  REQUIRE(commands.size() == 2);
+  REQUIRE(commands[1].file.ends_with("/src/added.cpp"));
+  REQUIRE(commands[1].arguments ==
+          std::vector<std::string>{"g++", "-DNATIVE"});
+  REQUIRE_FALSE(commands[1].output);
+
+  RunReport report;
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.sources_inferred == 1);
+  REQUIRE(report.envs[0].entries_inferred == 1);
+  REQUIRE(report.envs[0].entries_lost == 2);
+  REQUIRE(report.envs[1].entries_won == 2);
+}
+
+TEST_CASE("gen_cmds --switch --infer-new reruns for new sources only",
+          "[infer][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32", "native"});
+  fixture.write_file("src/main.cpp", "");
+  auto dir = fixture.get_path_string();
+  auto command = [&](std::string_view flag) {
+    return R"([{"directory":")" + dir +
+           R"(","file":"src/main.cpp","arguments":["g++",")" +
+           std::string{flag} + R"(","-c","src/main.cpp"]}])";
+  };
+  fixture.create_compile_commands("esp32", command("-DESP32"));
+  fixture.create_compile_commands("native", command("-DNATIVE"));
+  auto root = (fixture.get_path() / "compile_commands.json").string();
+  auto native_db = target_database_path(dir, "native");
+
+  GenOptions options{.switch_env = true, .infer_new = true};
+  REQUIRE(gen_cmds(dir, "native", options) == EXIT_SUCCESS);
+  auto before = fs::last_write_time(native_db);
+
+  // Unchanged sources leave the databases current
+  REQUIRE(gen_cmds(dir, "native", options) == EXIT_SUCCESS);
+  REQUIRE(fs::last_write_time(native_db) == before);
+
+  fixture.write_file("src/added.cpp", "");
+  REQUIRE(gen_cmds(dir, "native", options) == EXIT_SUCCESS);
+  std::vector<CompileCommand> commands;
+  REQUIRE_FALSE(glz::read_file_json(commands, root, std::string{}));
+  REQUIRE(commands.size() == 2);
+  REQUIRE(commands[1].file.ends_with("/src/added.cpp"));
+}
@@ -0,0 +1,149 @@
+#include <catch2/catch_test_macros.hpp>
+#include <glaze/glaze.hpp>
+#include <string>
+#include <vector>
+#include "clangd.h"
+#include "ini.h"
+#include "key_rules.h"
+#include "test_fixtures.hpp"
+
+namespace {
+
+std::string applied(const KeyRules& rules, std::string key) {
+  rules.apply(key);
+  return key;
+}
+
+}  // namespace
+
+TEST_CASE("default key rules", "[key_rules]") {
+  const auto& rules = default_key_rules();
+  REQUIRE(applied(rules, "/p/.pio/libdeps/esp32/Foo/src/foo.cpp") ==
+          "/p/.pio/libdeps/Foo/src/foo.cpp");
+  REQUIRE(applied(rules, "/p/.pio/build/native/proto/a.pb.c") ==
+          "/p/.pio/build/proto/a.pb.c");
+  REQUIRE(applied(rules,
+                  "/h/.platformio/packages/framework-arduinoespressif32/"
+                  "variants/esp32s3/variant.cpp") ==
+          "/h/.platformio/packages/framework-arduinoespressif32/variants/"
+          "variant.cpp");
+
+  // Only whole directory segments, never the file name
+  REQUIRE(applied(rules, "/p/.pio/libdeps/esp32") == "/p/.pio/libdeps/esp32");
+  REQUIRE(applied(rules, "/p/src/variants/a/b.cpp") ==
+          "/p/src/variants/a/b.cpp");
+  REQUIRE(applied(rules, "/p/my.pio/libdeps/esp32/a.cpp") ==
+          "/p/my.pio/libdeps/esp32/a.cpp");
+  REQUIRE(applied(rules, "relative/.pio/build/esp32/a.cpp") ==
+          "relative/.pio/build/a.cpp");
+}
+
+TEST_CASE("KeyRules placeholders", "[key_rules]") {
+  std::vector<std::string> patterns{"vendor/{board}/{env}", "x/*/{*}/y"};
+  auto rules = KeyRules::compile(
+      patterns, {.envs = {"esp32", "native"}, .boards = {"esp32dev"}});
+  REQUIRE(rules);
+  REQUIRE(rules->rules() == patterns);
+
+  REQUIRE(applied(*rules, "/p/vendor/esp32dev/native/a.c") == "/p/vendor/a.c");
+  // Names restrict the placeholders
+  REQUIRE(applied(*rules, "/p/vendor/uno/native/a.c") ==
+          "/p/vendor/uno/native/a.c");
+  REQUIRE(applied(*rules, "/p/vendor/esp32dev/test/a.c") ==
+          "/p/vendor/esp32dev/test/a.c");
+  // "*" is kept, "{*}" removed, and rules match at any depth, also more
+  // than once
+  REQUIRE(applied(*rules, "/x/a/b/y/x/c/d/y/f.c") == "/x/a/y/x/c/y/f.c");
+  REQUIRE(applied(*rules, "/x/a/b/f.c") == "/x/a/b/f.c");
+
+  // No rules leave keys alone
+  auto none = KeyRules::compile({});
+  REQUIRE(none);
+  REQUIRE(applied(*none, "/p/.pio/libdeps/esp32/a.c") ==
+          "/p/.pio/libdeps/esp32/a.c");
+}
+
+TEST_CASE("KeyRules rejects invalid rules", "[key_rules]") {
+  auto compile = [](std::string rule) {
+    return KeyRules::compile(std::vector{rule}).has_value();
+  };
+  REQUIRE(compile("/lib/{env}/"));
+  REQUIRE_FALSE(compile("lib/foo"));
+  REQUIRE_FALSE(compile("lib/*"));
+  REQUIRE_FALSE(compile("lib//{env}"));
+  REQUIRE_FALSE(compile("../{env}"));
+  REQUIRE_FALSE(compile("lib/{name}"));
+
+  std::string long_rule = "{*}";
+  for (int i = 0; i < 16; ++i) {
+    long_rule += "/a";
+  }
+  REQUIRE_FALSE(compile(long_rule));
+
+  // 64 segments between all rules
+  std::vector<std::string> many(22, "a/b/{env}");
+  REQUIRE_FALSE(KeyRules::compile(many));
+  many.pop_back();
+  REQUIRE(KeyRules::compile(many));
+}
+
+TEST_CASE("load_key_rules reads dedup_rules", "[key_rules]") {
+  PioConfig config;
+  config.merge(
+      "[pio-clangd]\n"
+      "dedup_rules = boards/{board}\n"
+      "[env:esp32]\n"
+      "board = esp32dev\n"
+      "[env:uno]\n"
+      "board = uno\n");
+  auto rules = load_key_rules(&config);
+  REQUIRE(rules);
+  REQUIRE(rules->rules().size() == DEFAULT_KEY_RULES.size() + 1);
+  REQUIRE(applied(*rules, "/p/boards/uno/pins.c") == "/p/boards/pins.c");
+  REQUIRE(applied(*rules, "/p/boards/mega/pins.c") == "/p/boards/mega/pins.c");
+  REQUIRE(applied(*rules, "/p/.pio/libdeps/uno/Foo/a.c") ==
+          "/p/.pio/libdeps/Foo/a.c");
+  REQUIRE(applied(*rules, "/p/.pio/libdeps/gone/Foo/a.c") ==
+          "/p/.pio/libdeps/gone/Foo/a.c");
+
+  config.merge("[pio-clangd]\ndedup_rules = boards/{bord}\n");
+  REQUIRE_FALSE(load_key_rules(&config));
+  REQUIRE(load_key_rules(nullptr)->rules().size() == DEFAULT_KEY_RULES.size());
+}
+
+TEST_CASE("gen_cmds merges generated sources of environments",
+          "[key_rules][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.write_file("platformio.ini",
+                     "[platformio]\n"
+                     "default_envs = esp32\n"
+                     "[pio-clangd]\n"
+                     "dedup_rules = boards/{board}\n"
+                     "[env:esp32]\n"
+                     "board = esp32dev\n"
+                     "[env:native]\n"
+                     "board = native\n");
+  auto dir = fixture.get_path_string();
+  auto command = [&](const std::string& env, const std::string& board) {
+    auto entry = [&](const std::string& file) {
+      return R"({"directory":")" + dir + R"(","file":")" + file +
+             R"(","arguments":["g++","-D)" + env + R"(","-c",")" + file +
+             R"("]})";
+    };
+    return "[" + entry(".pio/build/" + env + "/proto/a.pb.c") + "," +
+           entry("boards/" + board + "/pins.c") + "]";
+  };
+  fixture.create_compile_commands("esp32", command("esp32", "esp32dev"));
+  fixture.create_compile_commands("native", command("native", "native"));
+
+  REQUIRE(gen_cmds(dir, "native", {}) == EXIT_SUCCESS);
+
+  std::vector<CompileCommand> commands;
+  auto database_path = (fixture.get_path() / "compile_commands.json").string();
+  REQUIRE_FALSE(glz::read_file_json(commands, database_path, std::string{}));
+  REQUIRE(commands.size() == 2);
+  REQUIRE(commands[0].file == ".pio/build/native/proto/a.pb.c");
+  REQUIRE(commands[0].arguments ==
+          std::vector<std::string>{"g++", "-Dnative"});
+  REQUIRE(commands[1].file == "boards/native/pins.c");
+}
@@ -0,0 +1,114 @@
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <vector>
+#include "database.h"
+#include "lib_roots.h"
+#include "stat_cache.h"
+#include "test_fixtures.hpp"
+
+TEST_CASE("digest_root identifies identical copies", "[lib_roots]") {
+  TempProjectFixture fixture;
+  for (std::string root : {"a", "b", "c"}) {
+    fixture.write_file(root + "/library.json", R"({"version": "1.0"})");
+    fixture.write_file(root + "/src/foo.cpp", "int foo();");
+  }
+  fixture.write_file("b/.git/HEAD", "ref: refs/heads/main");
+  fixture.write_file("c/src/foo.cpp", "int bar();");
+  auto digest = [&](std::string_view root) {
+    return digest_root(fixture.get_path() / root);
+  };
+
+  // Hidden directories do not count, contents of equal size do
+  REQUIRE(digest("a") == digest("b"));
+  REQUIRE(digest("a") != digest("c"));
+
+  fixture.write_file("b/library.json", R"({"version": "1.1"})");
+  REQUIRE(digest("a") != digest("b"));
+}
+
+TEST_CASE("merge_identical_roots gives copies the same keys",
+          "[lib_roots]") {
+  TempProjectFixture fixture;
+  auto dir = fixture.get_path_string();
+  auto proj = dir + "/proj";
+  auto package = [&](const std::string& root, std::string_view manifest) {
+    fixture.write_file(root + "/package.json", std::string{manifest});
+    fixture.write_file(root + "/cores/main.cpp", "");
+    fixture.write_file(root + "/libraries/Wire/library.properties", "");
+    fixture.write_file(root + "/libraries/Wire/src/Wire.cpp", "");
+  };
+  package("pkgs/framework-x", R"({"version": "1.0"})");
+  package("pkgs/framework-x@1.0", R"({"version": "1.0"})");
+  package("pkgs/framework-x@2.0", R"({"version": "2.0"})");
+  fixture.write_file("proj/platformio.ini", "");
+  fixture.write_file("proj/lib/Foo/library.json", "{}");
+  fixture.write_file("proj/lib/Foo/foo.cpp", "");
+  fixture.write_file("proj/.pio/libdeps/esp32/Foo/library.json", "{}");
+  fixture.write_file("proj/.pio/libdeps/esp32/Foo/foo.cpp", "");
+  fixture.write_file("proj/src/main.cpp", "");
+
+  auto command = [&](const std::string& file) {
+    return CompileCommand{.directory = proj,
+                          .file = file,
+                          .arguments = {"g++", "-c", file}};
+  };
+  std::vector<CompileCommand> esp32{
+      command("src/main.cpp"),
+      command(dir + "/pkgs/framework-x/cores/main.cpp"),
+      command(dir + "/pkgs/framework-x/libraries/Wire/src/Wire.cpp"),
+      command(".pio/libdeps/esp32/Foo/foo.cpp"),
+  };
+  std::vector<CompileCommand> other{
+      command(dir + "/pkgs/framework-x@1.0/cores/main.cpp"),
+      command(dir + "/pkgs/framework-x@1.0/libraries/Wire/src/Wire.cpp"),
+      command(dir + "/pkgs/framework-x@2.0/cores/main.cpp"),
+      command("lib/Foo/foo.cpp"),
+  };
+
+  InternPool pool;
+  std::vector<EnvDatabase> envs;
+  envs.push_back(make_env_database("esp32", esp32, pool));
+  envs.push_back(make_env_database("other", other, pool));
+  StatCache stat_cache;
+  auto cache_dir = fixture.get_path() / "cache";
+  auto stats =
+      merge_identical_roots(envs, proj, pool, stat_cache, cache_dir);
+
+  // framework-x and its Wire, both again in @1.0, @2.0, and two Foo
+  REQUIRE(stats.roots == 7);
+  REQUIRE(stats.hashed == 7);
+  REQUIRE(stats.merged == 3);
+
+  auto& a = envs[0].entries;
+  auto& b = envs[1].entries;
+  REQUIRE(a[0].key == proj + "/src/main.cpp");
+  REQUIRE(b[0].key.data() == a[1].key.data());
+  REQUIRE(b[1].key.data() == a[2].key.data());
+  REQUIRE(b[2].key == dir + "/pkgs/framework-x@2.0/cores/main.cpp");
+  // The project's copy is kept
+  REQUIRE(a[3].key == proj + "/lib/Foo/foo.cpp");
+  REQUIRE(b[3].key.data() == a[3].key.data());
+  // Files stay where they are
+  REQUIRE(b[0].file == dir + "/pkgs/framework-x@1.0/cores/main.cpp");
+
+  auto resolved = resolve_target(envs, 1);
+  REQUIRE(resolved.entries.size() == 5);
+  REQUIRE(resolved.won == std::vector<size_t>{1, 4});
+
+  // Unchanged roots take the cache
+  auto merge_again = [&] {
+    std::vector<EnvDatabase> again;
+    again.push_back(make_env_database("esp32", esp32, pool));
+    again.push_back(make_env_database("other", other, pool));
+    return merge_identical_roots(again, proj, pool, stat_cache, cache_dir);
+  };
+  stats = merge_again();
+  REQUIRE(stats.cached == 7);
+  REQUIRE(stats.merged == 3);
+
+  // An edited source is digested again, the Foo copies differ now
+  fixture.write_file("proj/.pio/libdeps/esp32/Foo/foo.cpp", "int foo;");
+  stats = merge_again();
+  REQUIRE(stats.hashed == 1);
+  REQUIRE(stats.merged == 2);
+}
@@ -0,0 +1,239 @@
+#if !defined(_WIN32)
+
+#include <catch2/catch_test_macros.hpp>
+#include <unistd.h>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <thread>
+#include "clangd_config.h"
+#include "lsp.h"
+#include "test_fixtures.hpp"
+
+// A pipe whose ends are closed on destruction unless released
+struct Pipe {
+  int read_fd{-1};
+  int write_fd{-1};
+
+  Pipe() {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    read_fd = fds[0];
+    write_fd = fds[1];
+  }
+  ~Pipe() {
+    close_read();
+    close_write();
+  }
+  void close_read() {
+    if (read_fd >= 0) {
+      ::close(std::exchange(read_fd, -1));
+    }
+  }
+  void close_write() {
+    if (write_fd >= 0) {
+      ::close(std::exchange(write_fd, -1));
+    }
+  }
+};
+
+// The parts of workspace/didChangeConfiguration the tests look at
+struct DatabaseChanges {
+  std::map<std::string, FileSettings> compilationDatabaseChanges{};
+
+  struct glaze {
+    using T = DatabaseChanges;
+    static constexpr auto value = glz::object(
+      "compilationDatabaseChanges", &T::compilationDatabaseChanges);
+  };
+};
+
+struct ChangeParams {
+  DatabaseChanges settings{};
+
+  struct glaze {
+    using T = ChangeParams;
+    static constexpr auto value = glz::object("settings", &T::settings);
+  };
+};
+
+struct ChangeNotification {
+  std::string method{};
+  ChangeParams params{};
+
+  struct glaze {
+    using T = ChangeNotification;
+    static constexpr auto value = glz::object(
+      "method", &T::method,
+      "params", &T::params);
+  };
+};
+
+// Compile database changes in the next message the stub server receives
+static std::map<std::string, FileSettings> next_changes(LspReader& server) {
+  auto body = server.next();
+  REQUIRE(body);
+  ChangeNotification notification;
+  auto err = glz::read<glz::opts{.error_on_unknown_keys = false}>(
+      notification, *body);
+  REQUIRE_FALSE(err);
+  REQUIRE(notification.method == "workspace/didChangeConfiguration");
+  return notification.params.settings.compilationDatabaseChanges;
+}
+
+static void write_commands(TempProjectFixture& fixture,
+                           const std::string& env,
+                           const std::string& lib_flag) {
+  auto dir = fixture.get_path_string();
+  fixture.create_compile_commands(
+      env,
+      R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+      R"("arguments":["g++","-D)" + env + R"(","-c","src/main.cpp"]},)"
+      R"({"directory":")" + dir + R"(","file":"src/)" + env + R"(.cpp",)"
+      R"("arguments":["g++",")" + lib_flag + R"(","-c","src/x.cpp"]}])");
+}
+
+TEST_CASE("LspReader splits framed messages", "[lsp]") {
+  Pipe pipe;
+  std::string stream =
+      "Content-Length: 2\r\n"
+      "Content-Type: application/vscode-jsonrpc; charset=utf-8\r\n"
+      "\r\n"
+      "{}"
+      "Content-Length: 7\r\n\r\n"
+      "[1,2,3]";
+  REQUIRE(::write(pipe.write_fd, stream.data(), stream.size()) ==
+          static_cast<ssize_t>(stream.size()));
+  REQUIRE(write_lsp_message(pipe.write_fd, "null"));
+  pipe.close_write();
+
+  LspReader reader{pipe.read_fd};
+  REQUIRE(reader.next() == "{}");
+  REQUIRE(reader.next() == "[1,2,3]");
+  REQUIRE(reader.next() == "null");
+  REQUIRE_FALSE(reader.next());
+}
+
+TEST_CASE("lsp proxy pushes compile command deltas to the server",
+          "[lsp]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32", "native"});
+  write_commands(fixture, "esp32", "-DESP_LIB");
+  write_commands(fixture, "native", "-DNATIVE_LIB");
+  auto dir = fixture.get_path_string();
+  auto main_cpp = (fixture.get_path() / "src" / "main.cpp").string();
+  auto native_cpp = (fixture.get_path() / "src" / "native.cpp").string();
+  fixture.write_file(".clangd", std::string{CLANGD_CONFIG_BEGIN} +
+                                    "\nCompileFlags: {}\n" +
+                                    std::string{CLANGD_CONFIG_END} + "\n");
+
+  Pipe client_to_proxy, proxy_to_client, proxy_to_server, server_to_proxy;
+  LspOptions options{.proj_path = dir,
+                     .environment = "esp32",
+                     .poll_interval = std::chrono::milliseconds{10}};
+  int result = EXIT_FAILURE;
+  std::jthread proxy([&] {
+    result = run_lsp_proxy(options, client_to_proxy.read_fd,
+                           proxy_to_client.write_fd,
+                           proxy_to_server.write_fd, server_to_proxy.read_fd);
+  });
+
+  LspReader client{proxy_to_client.read_fd};
+  LspReader server{proxy_to_server.read_fd};
+  auto send = [&](const std::string& body) {
+    REQUIRE(write_lsp_message(client_to_proxy.write_fd, body));
+  };
+
+  // Regular traffic passes through unchanged in both directions
+  std::string initialize =
+      R"({"jsonrpc":"2.0","id":1,"method":"initialize","params":{}})";
+  send(initialize);
+  REQUIRE(server.next() == initialize);
+  REQUIRE_FALSE(fs::exists(fixture.get_path() / ".clangd"));
+  std::string response = R"({"jsonrpc":"2.0","id":1,"result":{}})";
+  REQUIRE(write_lsp_message(server_to_proxy.write_fd, response));
+  REQUIRE(client.next() == response);
+
+  // After initialized, every file's command is sent
+  std::string initialized =
+      R"({"jsonrpc":"2.0","method":"initialized","params":{}})";
+  send(initialized);
+  REQUIRE(server.next() == initialized);
+  auto changes = next_changes(server);
+  REQUIRE(changes.size() == 3);
+  REQUIRE(changes[main_cpp].workingDirectory == dir);
+  REQUIRE(changes[main_cpp].compilationCommand ==
+          std::vector<std::string>{"g++", "-Desp32"});
+  REQUIRE(changes[native_cpp].compilationCommand ==
+          std::vector<std::string>{"g++", "-DNATIVE_LIB"});
+
+  // Switching only sends the files whose command changed
+  send(R"({"jsonrpc":"2.0","method":"pio-clangd/switchEnvironment",)"
+       R"("params":{"env":"native"}})");
+  changes = next_changes(server);
+  REQUIRE(changes.size() == 1);
+  REQUIRE(changes[main_cpp].compilationCommand ==
+          std::vector<std::string>{"g++", "-Dnative"});
+
+  // Neither an unchanged nor an unknown environment sends anything
+  send(R"({"jsonrpc":"2.0","method":"pio-clangd/switchEnvironment",)"
+       R"("params":{"env":"native"}})");
+  send(R"({"jsonrpc":"2.0","method":"pio-clangd/switchEnvironment",)"
+       R"("params":{"env":"missing"}})");
+  std::string shutdown = R"({"jsonrpc":"2.0","id":2,"method":"shutdown"})";
+  send(shutdown);
+  REQUIRE(server.next() == shutdown);
+
+  // A rewritten input is picked up by polling
+  write_commands(fixture, "native", "-DNATIVE_LIB_V2");
+  changes = next_changes(server);
+  REQUIRE(changes.size() == 1);
+  REQUIRE(changes[native_cpp].compilationCommand ==
+          std::vector<std::string>{"g++", "-DNATIVE_LIB_V2"});
+
+  // The client going away closes the server's input, then the server's
+  // exit ends the proxy
+  client_to_proxy.close_write();
+  REQUIRE_FALSE(server.next());
+  proxy_to_server.write_fd = -1;  // closed by the proxy
+  server_to_proxy.close_write();
+  proxy.join();
+  REQUIRE(result == EXIT_SUCCESS);
+}
+
+TEST_CASE("compute_file_settings applies the project's rules", "[lsp]") {
+  TempProjectFixture fixture;
+  fixture.write_file("platformio.ini",
+                     "[pio-clangd]\n"
+                     "dedup_rules = boards/{board}\n"
+                     "exclude = test\n"
+                     "overrides = overrides.json\n"
+                     "[env:esp32]\n"
+                     "board = esp32dev\n"
+                     "[env:native]\n"
+                     "board = native\n");
+  fixture.write_file(
+      "overrides.json",
+      R"({"rules": [{"path": "boards/native", "add": ["-DP"]}]})");
+  auto dir = fixture.get_path_string();
+  auto command = [&](const std::string& env, const std::string& file) {
+    return R"({"directory":")" + dir + R"(","file":")" + file +
+           R"(","arguments":["g++","-D)" + env + R"(","-c","x.c"]})";
+  };
+  fixture.create_compile_commands(
+      "esp32", "[" + command("esp32", "boards/esp32dev/pins.c") + "]");
+  fixture.create_compile_commands(
+      "native", "[" + command("native", "boards/native/pins.c") + "," +
+                    command("native", "test/t.c") + "]");
+
+  // The copies of both boards are one file, the tests are excluded and
+  // the overrides apply
+  auto settings = compute_file_settings(dir, "native");
+  REQUIRE(settings);
+  REQUIRE(settings->size() == 1);
+  auto pins = (fixture.get_path() / "boards" / "native" / "pins.c").string();
+  REQUIRE(settings->at(pins).compilationCommand ==
+          std::vector<std::string>{"g++", "-Dnative", "-DP"});
+}
+
+#endif
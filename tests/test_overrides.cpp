@@ -0,0 +1,132 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "clangd.h"
+#include "key_rules.h"
+#include "overrides.h"
+#include "report.h"
+#include "test_fixtures.hpp"
+
+using Args = std::vector<std::string_view>;
+using Rules = std::vector<uint32_t>;
+
+static Args apply(const FlagOverrides& overrides,
+                  std::string_view path,
+                  Args args) {
+  FlagOverrides::Scratch scratch;
+  overrides.apply(path, args, scratch);
+  return args;
+}
+
+TEST_CASE("FlagOverrides finds the rules of every directory above a path",
+          "[overrides]") {
+  std::vector<OverrideRule> rules{
+      {.path = "lib/legacy"},         // 0
+      {.path = "lib"},                // 1
+      {.path = "lib/legacy/old/v1"},  // 2
+      {.path = "lib/libfoo/"},        // 3, splits the edge of 0
+      {.path = "/"},                  // 4, everything
+      {.path = "/pkg/sdk"},           // 5
+      {.path = "lib/legacy"},         // 6, same path as 0
+  };
+  auto overrides = FlagOverrides::compile(rules, "/proj", default_key_rules());
+  Rules matched;
+
+  overrides.match("/proj/lib/legacy/old/v1/a.cpp", matched);
+  REQUIRE(matched == Rules{4, 1, 0, 6, 2});
+  overrides.match("/proj/lib/legacy/old/a.cpp", matched);
+  REQUIRE(matched == Rules{4, 1, 0, 6});
+  overrides.match("/proj/lib/libfoo/a.cpp", matched);
+  REQUIRE(matched == Rules{4, 1, 3});
+  // Components match whole, not as prefixes
+  overrides.match("/proj/lib/legacyX/a.cpp", matched);
+  REQUIRE(matched == Rules{4, 1});
+  overrides.match("/proj/src/main.cpp", matched);
+  REQUIRE(matched == Rules{4});
+  overrides.match("/pkg/sdk/core.c", matched);
+  REQUIRE(matched == Rules{4, 5});
+
+  // Rule paths are spelled like the keys of the project's key rules
+  auto key_rules = KeyRules::compile(std::vector<std::string>{"boards/{board}"},
+                                     {.boards = {"uno"}});
+  REQUIRE(key_rules);
+  std::vector<OverrideRule> board{{.path = "boards/uno/pins"}};
+  FlagOverrides::compile(board, "/proj", *key_rules)
+      .match("/proj/boards/pins/a.c", matched);
+  REQUIRE(matched == Rules{0});
+}
+
+TEST_CASE("FlagOverrides removes and adds flags", "[overrides]") {
+  std::vector<OverrideRule> rules{
+      {.path = "lib/legacy",
+       .add = {"-std=gnu++20"},
+       .remove = {"-std=*"}},
+      {.path = "vendor", .remove = {"-include", "-I/vendor/*"}},
+      {.path = "test", .add = {"-DUNIT_TEST"}, .remove = {"-DNDEBUG"}},
+      {.path = "test/unit", .remove = {"-D*"}},
+  };
+  auto overrides = FlagOverrides::compile(rules, "/proj", default_key_rules());
+
+  REQUIRE(apply(overrides, "/proj/lib/legacy/a.cpp",
+                {"-DA", "-std=gnu++17", "-Iinc"}) ==
+          Args{"-DA", "-Iinc", "-std=gnu++20"});
+
+  // Separate values go with their flag, also when matching the pair
+  REQUIRE(apply(overrides, "/proj/vendor/x.c",
+                {"-include", "cfg.h", "-I", "/vendor/inc", "-I/vendor/b",
+                 "-I", "/own", "-includeother.h"}) ==
+          Args{"-I", "/own", "-includeother.h"});
+
+  // Outer rules first, inner ones see what they added
+  REQUIRE(apply(overrides, "/proj/test/t.cpp", {"-DNDEBUG", "-DX"}) ==
+          Args{"-DX", "-DUNIT_TEST"});
+  REQUIRE(apply(overrides, "/proj/test/unit/t.cpp",
+                {"-DNDEBUG", "-DX", "-Iinc"}) == Args{"-Iinc"});
+
+  FlagOverrides::Scratch scratch;
+  Args args{"-DA"};
+  REQUIRE_FALSE(overrides.apply("/proj/src/main.cpp", args, scratch));
+  REQUIRE(args == Args{"-DA"});
+}
+
+TEST_CASE("gen_cmds --overrides", "[overrides][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.write_file("platformio.ini",
+                     "[env:esp32]\n"
+                     "platform = espressif32\n"
+                     "[pio-clangd]\n"
+                     "overrides = overrides.json\n");
+  fixture.write_file("overrides.json", R"({"rules": [
+    {"path": ".pio/libdeps/esp32/Legacy", "add": ["-std=gnu++20", "-DL"],
+     "remove": ["-std=*"]}
+  ]})");
+  auto dir = fixture.get_path_string();
+  auto command = [&](std::string_view file) {
+    return R"({"directory":")" + dir + R"(","file":")" + std::string{file} +
+           R"(","arguments":["g++","-std=gnu++17","-O2","-c","x.cpp"]})";
+  };
+  fixture.create_compile_commands(
+      "esp32", "[" + command("src/main.cpp") + "," +
+                   command(".pio/libdeps/esp32/Legacy/src/l.cpp") + "]");
+  auto report_path = (fixture.get_path() / "report.json").string();
+
+  GenOptions options{.report_path = report_path};
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_SUCCESS);
+
+  std::vector<CompileCommand> commands;
+  auto database_path = (fixture.get_path() / "compile_commands.json").string();
+  REQUIRE_FALSE(glz::read_file_json(commands, database_path, std::string{}));
+  REQUIRE(commands.size() == 2);
+  REQUIRE(commands[0].arguments ==
+          std::vector<std::string>{"g++", "-std=gnu++17"});
+  REQUIRE(commands[1].arguments ==
+          std::vector<std::string>{"g++", "-std=gnu++20", "-DL"});
+
+  RunReport report;
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.entries_overridden == 1);
+
+  fixture.write_file("overrides.json", "{\"rules\": [");
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_FAILURE);
+}
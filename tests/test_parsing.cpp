@@ -2,6 +2,7 @@
 #include <catch2/matchers/catch_matchers_string.hpp>
 #include <catch2/matchers/catch_matchers_vector.hpp>
 #include "clangd.h"
+#include "ini.h"
 #include <vector>
 #include <string>
 #include "test_fixtures.hpp"
@@ -130,3 +131,159 @@ TEST_CASE("get_envs parses platformio.ini correctly", "[parsing][file-io]") {
     REQUIRE(result->at(2) == "third");
   }
 }
+
+TEST_CASE("load_pio_config understands PlatformIO ini semantics",
+          "[parsing][file-io]") {
+
+  SECTION("default_envs selects the default environment") {
+    TempProjectFixture fixture;
+    fixture.write_file("platformio.ini",
+                       "[platformio]\n"
+                       "default_envs = release, debug\n"
+                       "[env:debug]\n"
+                       "[env:release]\n");
+
+    auto config = load_pio_config(fixture.get_path_string());
+
+    REQUIRE(config.has_value());
+    REQUIRE((*config)->envs() == std::vector<std::string>{"debug", "release"});
+    REQUIRE((*config)->default_env() == "release");
+  }
+
+  SECTION("Unknown default_envs falls back to the first environment") {
+    TempProjectFixture fixture;
+    fixture.write_file("platformio.ini",
+                       "[platformio]\n"
+                       "default_envs = missing\n"
+                       "[env:first]\n"
+                       "[env:second]\n");
+
+    auto config = load_pio_config(fixture.get_path_string());
+
+    REQUIRE(config.has_value());
+    REQUIRE((*config)->default_env() == "first");
+  }
+
+  SECTION("extends and the common [env] section are inherited") {
+    TempProjectFixture fixture;
+    fixture.write_file("platformio.ini",
+                       "[env]\n"
+                       "framework = arduino\n"
+                       "[common]\n"
+                       "board = esp32dev\n"
+                       "[env:base]\n"
+                       "platform = espressif32\n"
+                       "[env:app]\n"
+                       "extends = env:base, common\n"
+                       "board = esp32-s3\n");
+
+    auto config = load_pio_config(fixture.get_path_string());
+
+    REQUIRE(config.has_value());
+    REQUIRE((*config)->get("env:app", "board") == "esp32-s3");
+    REQUIRE((*config)->get("env:app", "platform") == "espressif32");
+    REQUIRE((*config)->get("env:app", "framework") == "arduino");
+    REQUIRE_FALSE((*config)->get("env:app", "upload_port").has_value());
+  }
+
+  SECTION("Multi-line values, comments and interpolation") {
+    TempProjectFixture fixture;
+    fixture.write_file("platformio.ini",
+                       "; leading comment\n"
+                       "[common]\n"
+                       "flags = -DCOMMON ; inline comment\n"
+                       "[env:app]\n"
+                       "build_flags =\n"
+                       "    ${common.flags}\n"
+                       "    # commented out\n"
+                       "    -DENV=${this.__env__}\n"
+                       "    -DUNKNOWN=${nowhere.flags}\n");
+
+    auto config = load_pio_config(fixture.get_path_string());
+
+    REQUIRE(config.has_value());
+    auto flags = (*config)->get_list("env:app", "build_flags");
+    REQUIRE(flags == std::vector<std::string>{"-DCOMMON", "-DENV=app",
+                                              "-DUNKNOWN=${nowhere.flags}"});
+  }
+
+  SECTION("Commas only separate items when whitespace follows") {
+    TempProjectFixture fixture;
+    fixture.write_file("platformio.ini",
+                       "[env:app]\n"
+                       "build_flags = -DLIST={1,2}, -DONE\n"
+                       "build_unflags =\n"
+                       "    -DFOO=1,2\n"
+                       "lib_deps =\n"
+                       "    Foo, Bar\n"
+                       "    Baz\n");
+
+    auto config = load_pio_config(fixture.get_path_string());
+
+    REQUIRE(config.has_value());
+    using List = std::vector<std::string>;
+    REQUIRE((*config)->get_list("env:app", "build_flags") ==
+            List{"-DLIST={1,2}", "-DONE"});
+    // A continued value is a line list, even with a single line
+    REQUIRE((*config)->get_list("env:app", "build_unflags") ==
+            List{"-DFOO=1,2"});
+    REQUIRE((*config)->get_list("env:app", "lib_deps") ==
+            List{"Foo, Bar", "Baz"});
+  }
+
+  SECTION("extra_configs contribute environments and overrides") {
+    TempProjectFixture fixture;
+    fixture.write_file("platformio.ini",
+                       "[platformio]\n"
+                       "extra_configs = configs/*.ini\n"
+                       "[env:main]\n"
+                       "board = uno\n");
+    fixture.write_file("configs/boards.ini",
+                       "[env:extra]\n"
+                       "board = esp32dev\n"
+                       "[env:main]\n"
+                       "board = nano\n");
+    fixture.write_file("configs/ignored.txt", "[env:ignored]\n");
+
+    auto config = load_pio_config(fixture.get_path_string());
+
+    REQUIRE(config.has_value());
+    REQUIRE((*config)->envs() == std::vector<std::string>{"main", "extra"});
+    REQUIRE((*config)->get("env:main", "board") == "nano");
+  }
+
+  SECTION("Parsed config is cached until the file changes") {
+    TempProjectFixture fixture;
+    fixture.write_file("platformio.ini", "[env:one]\n");
+
+    auto first = load_pio_config(fixture.get_path_string());
+    auto second = load_pio_config(fixture.get_path_string());
+    REQUIRE(first.has_value());
+    REQUIRE(second.has_value());
+    REQUIRE(first->get() == second->get());
+
+    fixture.write_file("platformio.ini", "[env:one]\n[env:two]\n");
+    auto third = load_pio_config(fixture.get_path_string());
+    REQUIRE(third.has_value());
+    REQUIRE((*third)->envs().size() == 2);
+  }
+
+  SECTION("A new file matching extra_configs invalidates the cache") {
+    TempProjectFixture fixture;
+    fixture.write_file("platformio.ini",
+                       "[platformio]\n"
+                       "extra_configs = configs/*.ini\n"
+                       "[env:main]\n");
+    fixture.write_file("configs/a.ini", "[env:a]\n");
+
+    auto first = load_pio_config(fixture.get_path_string());
+    REQUIRE(first.has_value());
+    REQUIRE((*first)->envs().size() == 2);
+
+    fixture.write_file("configs/b.ini", "[env:b]\n");
+    auto second = load_pio_config(fixture.get_path_string());
+    REQUIRE(second.has_value());
+    REQUIRE((*second)->envs() ==
+            std::vector<std::string>{"main", "a", "b"});
+  }
+}
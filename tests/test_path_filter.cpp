@@ -0,0 +1,139 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "clangd.h"
+#include "path_filter.h"
+#include "report.h"
+#include "stream.h"
+#include "test_fixtures.hpp"
+
+using Globs = std::vector<std::string>;
+
+static bool accepts(const Globs& include,
+                    const Globs& exclude,
+                    std::string_view path) {
+  auto filter = PathFilter::compile(include, exclude, "/proj");
+  REQUIRE(filter);
+  PathFilter::Scratch scratch;
+  return filter->accepts(path, scratch);
+}
+
+TEST_CASE("PathFilter matches globs against paths", "[path_filter]") {
+  SECTION("no globs") {
+    REQUIRE(accepts({}, {}, "/proj/src/main.cpp"));
+  }
+
+  SECTION("names without a slash match anywhere") {
+    REQUIRE_FALSE(accepts({}, {"*.c"}, "/proj/src/a.c"));
+    REQUIRE(accepts({}, {"*.c"}, "/proj/src/a.cpp"));
+    REQUIRE_FALSE(accepts({}, {"examples"}, "/proj/lib/Foo/examples/a.cpp"));
+    REQUIRE(accepts({}, {"examples"}, "/proj/lib/Foo/examples2/a.cpp"));
+  }
+
+  SECTION("relative globs are anchored at the project") {
+    REQUIRE(accepts({"src/**"}, {}, "/proj/src/deep/dir/a.cpp"));
+    REQUIRE_FALSE(accepts({"src/**"}, {}, "/proj/lib/src/a.cpp"));
+    REQUIRE_FALSE(accepts({"./src"}, {}, "/other/src/a.cpp"));
+    // A directory matches what is below it
+    REQUIRE(accepts({"./src"}, {}, "/proj/src/a.cpp"));
+    REQUIRE_FALSE(accepts({"./src"}, {}, "/proj/srcs/a.cpp"));
+  }
+
+  SECTION("* and ? stay within a segment") {
+    REQUIRE_FALSE(accepts({}, {"lib/*/test"}, "/proj/lib/Foo/test/t.cpp"));
+    REQUIRE(accepts({}, {"lib/*/test"}, "/proj/lib/Foo/sub/test/t.cpp"));
+    REQUIRE_FALSE(accepts({}, {"/proj/?.cpp"}, "/proj/a.cpp"));
+    REQUIRE(accepts({}, {"/proj/?.cpp"}, "/proj/ab.cpp"));
+  }
+
+  SECTION("**/ matches any number of directories, also none") {
+    Globs glob{"a/**/b.cpp"};
+    REQUIRE_FALSE(accepts({}, glob, "/proj/a/b.cpp"));
+    REQUIRE_FALSE(accepts({}, glob, "/proj/a/x/y/b.cpp"));
+    REQUIRE(accepts({}, glob, "/proj/a/xb.cpp"));
+  }
+
+  SECTION("character classes") {
+    REQUIRE_FALSE(accepts({}, {"src/[ab]*.cpp"}, "/proj/src/b1.cpp"));
+    REQUIRE(accepts({}, {"src/[ab]*.cpp"}, "/proj/src/c1.cpp"));
+    REQUIRE_FALSE(accepts({}, {"src/[!a-m]*"}, "/proj/src/x.cpp"));
+    REQUIRE(accepts({}, {"src/[!a-m]*"}, "/proj/src/c.cpp"));
+    REQUIRE_FALSE(PathFilter::compile(Globs{}, Globs{"src/[ab"}, "/proj"));
+  }
+
+  SECTION("exclude globs win over include globs") {
+    Globs include{"src", "lib"};
+    Globs exclude{"**/test"};
+    REQUIRE(accepts(include, exclude, "/proj/lib/Foo/a.cpp"));
+    REQUIRE_FALSE(accepts(include, exclude, "/proj/lib/Foo/test/a.cpp"));
+    REQUIRE_FALSE(accepts(include, exclude, "/pkg/framework/core.cpp"));
+  }
+
+  SECTION("~ is the home directory") {
+    const char* home = std::getenv("HOME");
+    if (home && *home && home[0] == '/') {
+      std::string cores = std::string{home} +
+                          "/.platformio/packages/framework-x/cores/a.cpp";
+      Globs glob{"~/.platformio/packages/framework-*/cores"};
+      REQUIRE_FALSE(accepts({}, glob, cores));
+      REQUIRE(accepts({}, glob, "/proj/src/a.cpp"));
+    }
+  }
+}
+
+TEST_CASE("gen_cmds --include and --exclude", "[path_filter][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32"});
+  fixture.write_file("platformio.ini",
+                     "[env:esp32]\n"
+                     "platform = espressif32\n"
+                     "[pio-clangd]\n"
+                     "exclude =\n"
+                     "  **/examples\n");
+  auto dir = fixture.get_path_string();
+  auto command = [&](std::string_view file) {
+    return R"({"directory":")" + dir + R"(","file":")" + std::string{file} +
+           R"(","arguments":["g++","-DX","-c","x.cpp"]})";
+  };
+  fixture.create_compile_commands(
+      "esp32", "[" + command("src/main.cpp") + "," +
+                   command(".pio/libdeps/esp32/Foo/examples/ex.cpp") + "," +
+                   command(".pio/libdeps/esp32/Foo/src/foo.cpp") + "," +
+                   command("/pkg/framework/cores/core.cpp") + "]");
+  auto report_path = (fixture.get_path() / "report.json").string();
+
+  GenOptions options{.report_path = report_path,
+                     .include = {"src", ".pio/libdeps"}};
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_SUCCESS);
+
+  std::vector<CompileCommand> commands;
+  auto database_path = (fixture.get_path() / "compile_commands.json").string();
+  REQUIRE_FALSE(glz::read_file_json(commands, database_path, std::string{}));
+  REQUIRE(commands.size() == 2);
+  REQUIRE(commands[0].file == "src/main.cpp");
+  REQUIRE(commands[1].file == ".pio/libdeps/esp32/Foo/src/foo.cpp");
+
+  RunReport report;
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.entries_excluded == 2);
+  REQUIRE(report.envs[0].entries_excluded == 2);
+  REQUIRE(report.envs[0].entries_lost == 2);
+
+  options.include = {"[src"};
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_FAILURE);
+}
+
+TEST_CASE("CommandStream drops excluded commands", "[path_filter][stream]") {
+  auto filter = PathFilter::compile(Globs{}, Globs{"test"}, "/proj");
+  REQUIRE(filter);
+  CommandStream stream{"native",
+                       ProjectRules{.path_filter = std::move(*filter)}};
+  REQUIRE(stream.feed(
+      R"([{"directory":"/proj","file":"test/t.cpp","arguments":["g++"]},)"
+      R"({"directory":"/proj","file":"src/a.cpp","arguments":["g++"]}])"));
+  REQUIRE(stream.finish());
+  REQUIRE(stream.entries().size() == 1);
+  REQUIRE(stream.entries()[0]->file == "src/a.cpp");
+  REQUIRE(stream.env_reports()[0].entries_excluded == 1);
+}
@@ -0,0 +1,144 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "clangd.h"
+#include "query_index.h"
+#include "targets.h"
+#include "test_fixtures.hpp"
+
+// Entries for src/file<i>.cpp, every third one sharing an argument list
+static std::vector<Entry> make_entries(InternPool& pool, size_t count) {
+  std::vector<Entry> entries;
+  for (size_t i = 0; i < count; ++i) {
+    auto file = "src/file" + std::to_string(i) + ".cpp";
+    std::vector<std::string_view> args{
+        pool.intern("-DBOARD=" + std::to_string(i % 3)),
+        pool.intern("-Iinclude")};
+    entries.push_back(Entry{
+        .key = pool.intern("/proj/" + file),
+        .directory = pool.intern("/proj"),
+        .file = pool.intern(file),
+        .arguments = pool.intern_list(args),
+        .driver = pool.intern("g++"),
+    });
+  }
+  return entries;
+}
+
+static std::vector<const Entry*> pointers(const std::vector<Entry>& entries) {
+  std::vector<const Entry*> result;
+  for (const auto& entry : entries) {
+    result.push_back(&entry);
+  }
+  return result;
+}
+
+TEST_CASE("QueryIndex finds every written entry", "[query]") {
+  TempProjectFixture fixture;
+  auto path = fixture.get_path() / "test.idx";
+  InternPool pool;
+
+  for (size_t count : {0, 1, 2, 7, 5000}) {
+    auto entries = make_entries(pool, count);
+    auto bytes = write_query_index(pointers(entries), path);
+    REQUIRE(bytes);
+    REQUIRE(*bytes == fs::file_size(path));
+
+    auto index = QueryIndex::open(path);
+    REQUIRE(index);
+    REQUIRE(index->size() == count);
+    for (size_t i = 0; i < count; ++i) {
+      auto command = index->find(entries[i].key);
+      REQUIRE(command);
+      REQUIRE(command->directory() == "/proj");
+      REQUIRE(command->driver() == "g++");
+      REQUIRE(command->size() == 2);
+      REQUIRE(command->argument(0) == "-DBOARD=" + std::to_string(i % 3));
+      REQUIRE(command->argument(1) == "-Iinclude");
+      REQUIRE(command->argument(2).empty());
+    }
+    REQUIRE_FALSE(index->find("/proj/src/missing.cpp"));
+    REQUIRE_FALSE(index->find(""));
+  }
+}
+
+TEST_CASE("QueryIndex rejects invalid files", "[query]") {
+  TempProjectFixture fixture;
+  auto path = fixture.get_path() / "test.idx";
+  InternPool pool;
+  auto entries = make_entries(pool, 10);
+  REQUIRE(write_query_index(pointers(entries), path));
+
+  SECTION("Missing") {
+    REQUIRE_FALSE(QueryIndex::open(fixture.get_path() / "missing.idx"));
+  }
+
+  SECTION("Truncated") {
+    fs::resize_file(path, fs::file_size(path) - 1);
+    auto index = QueryIndex::open(path);
+    REQUIRE_FALSE(index);
+    REQUIRE_THAT(index.error(),
+                 Catch::Matchers::ContainsSubstring("truncated"));
+  }
+
+  SECTION("Not an index") {
+    fixture.write_file("test.idx", std::string(64, 'x'));
+    auto index = QueryIndex::open(path);
+    REQUIRE_FALSE(index);
+    REQUIRE_THAT(index.error(),
+                 Catch::Matchers::ContainsSubstring("not a pio-clangd"));
+  }
+
+  SECTION("Duplicate keys") {
+    entries[3].key = entries[4].key;
+    REQUIRE_FALSE(write_query_index(pointers(entries), path));
+  }
+}
+
+TEST_CASE("gen_cmds writes a query index with the database", "[query]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32", "native"});
+  auto dir = fixture.get_path_string();
+  fixture.create_compile_commands(
+      "esp32",
+      R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+      R"("arguments":["g++","-DESP32","-Iinclude","-c","src/main.cpp"]},)"
+      R"({"directory":")" + dir + R"(",)"
+      R"("file":".pio/libdeps/esp32/Lib/lib.cpp",)"
+      R"("arguments":["g++","-DLIB","-c","lib.cpp"]}])");
+  fixture.create_compile_commands(
+      "native",
+      R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+      R"("arguments":["g++","-DNATIVE","-c","src/main.cpp"]}])");
+
+  GenOptions options{.all_targets = true};
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_SUCCESS);
+
+  auto lookup = [&](const fs::path& index_path, const std::string& file) {
+    auto index = QueryIndex::open(index_path);
+    REQUIRE(index);
+    std::string key;
+    make_dedup_key(dir, file, key);
+    auto command = index->find(key);
+    std::vector<std::string> args;
+    if (command) {
+      for (size_t i = 0; i < command->size(); ++i) {
+        args.emplace_back(command->argument(i));
+      }
+    }
+    return args;
+  };
+
+  using Args = std::vector<std::string>;
+  auto root = root_index_path(dir);
+  REQUIRE(lookup(root, "src/main.cpp") == Args{"-DESP32", "-Iinclude"});
+  REQUIRE(lookup(target_index_path(dir, "native"), "src/main.cpp") ==
+          Args{"-DNATIVE"});
+
+  // Keys are normalized like the dedup keys, so any environment's copy
+  // of a library source finds the entry
+  REQUIRE(lookup(root, "./.pio/libdeps/native/Lib/lib.cpp") == Args{"-DLIB"});
+  REQUIRE(lookup(root, "src/other.cpp").empty());
+}
@@ -0,0 +1,160 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "clangd.h"
+#include "database.h"
+#include "report.h"
+#include "response_files.h"
+#include "test_fixtures.hpp"
+
+using Args = std::vector<std::string_view>;
+
+TEST_CASE("rsp_quote quotes like clang tokenizes", "[rsp]") {
+  REQUIRE(rsp_quote("-DFOO=1") == "-DFOO=1");
+  REQUIRE(rsp_quote("") == "\"\"");
+  REQUIRE(rsp_quote("-I/my dir") == "\"-I/my dir\"");
+  REQUIRE(rsp_quote(R"(-DS="a")") == R"("-DS=\"a\"")");
+  REQUIRE(rsp_quote(R"(-Ic:\sdk)") == R"("-Ic:\\sdk")");
+}
+
+TEST_CASE("make_response_files moves shared lists and prefixes", "[rsp]") {
+  TempProjectFixture fixture;
+  auto dir = fixture.get_path_string();
+
+  std::vector<std::string> framework{"-DF1", "-DF2", "-DF3", "-DF4",
+                                     "-DF5", "-DF6", "-DF7", "-DF8"};
+  auto command = [&](std::string file, std::vector<std::string> own,
+                     std::string directory) {
+    CompileCommand cmd{.directory = std::move(directory),
+                       .file = std::move(file)};
+    cmd.arguments.push_back("g++");
+    cmd.arguments.insert(cmd.arguments.end(), framework.begin(),
+                         framework.end());
+    cmd.arguments.insert(cmd.arguments.end(), own.begin(), own.end());
+    return cmd;
+  };
+  std::vector<CompileCommand> commands{
+      // The same list for several entries goes as a whole
+      command("src/a.cpp", {"-I", "/fw/cores", "-DX"}, dir),
+      command("src/b.cpp", {"-I", "/fw/cores", "-DX"}, dir),
+      command("sub/g.cpp", {"-I", "/fw/cores", "-DX"}, dir + "/sub"),
+      // Otherwise the prefix shared with another list
+      command("src/c.cpp", {"-I", "/fw/cores", "-DC"}, dir),
+      command("src/d.cpp", {"-I", "/fw/cores", "-DD"}, dir),
+      // "-I" stays with "/other"
+      command("src/e.cpp", {"-I", "/other"}, dir),
+  };
+  // Too short to be worth a file
+  commands.push_back({.directory = dir,
+                      .file = "src/f.cpp",
+                      .arguments = {"g++", "-DF1", "-DF2", "-DS"}});
+
+  InternPool pool;
+  auto db = make_env_database("uno", commands, pool);
+  std::vector<const Entry*> entries;
+  for (const auto& entry : db.entries) {
+    entries.push_back(&entry);
+  }
+  auto rsp = make_response_files(entries, dir, pool);
+
+  std::string fw_content = "-DF1\n-DF2\n-DF3\n-DF4\n-DF5\n-DF6\n-DF7\n-DF8\n";
+  auto file_of = [&](const std::string& content) -> std::string {
+    for (const auto& file : rsp.files) {
+      if (file.content == content) {
+        return file.name;
+      }
+    }
+    return {};
+  };
+  auto whole = file_of(fw_content + "-I\n/fw/cores\n-DX\n");
+  auto cores = file_of(fw_content + "-I\n/fw/cores\n");
+  auto fw = file_of(fw_content);
+  REQUIRE(rsp.files.size() == 3);
+  REQUIRE(whole.starts_with("flags-"));
+  REQUIRE(cores.starts_with("flags-"));
+  REQUIRE(fw.starts_with("flags-"));
+
+  const auto& out = rsp.output;
+  REQUIRE(out.size() == 7);
+  auto ref = [](const std::string& name) { return "@.pio/clangd/" + name; };
+  REQUIRE(arguments(*out[0]) == Args{ref(whole)});
+  REQUIRE(arguments(*out[1]) == Args{ref(whole)});
+  // clangd resolves the reference against the entry's directory
+  auto absolute = "@" + (fixture.get_path() / ".pio/clangd" / whole)
+                            .lexically_normal()
+                            .generic_string();
+  REQUIRE(arguments(*out[2]) == Args{absolute});
+  REQUIRE(arguments(*out[3]) == Args{ref(cores), "-DC"});
+  REQUIRE(arguments(*out[4]) == Args{ref(cores), "-DD"});
+  REQUIRE(arguments(*out[5]) == Args{ref(fw), "-I", "/other"});
+  REQUIRE(arguments(*out[6]) == arguments(db.entries[6]));
+  REQUIRE(rsp.flags_moved == 3 * 11 + 2 * 10 + 8);
+}
+
+TEST_CASE("write_response_files replaces the files of earlier runs",
+          "[rsp]") {
+  TempProjectFixture fixture;
+  auto dir = fixture.get_path_string();
+  auto rsp_dir = fixture.get_path() / ".pio" / "clangd";
+  std::vector<ResponseFile> files{{"flags-a.rsp", "-DA\n"},
+                                  {"flags-b.rsp", "-DB\n"}};
+
+  REQUIRE(write_response_files(files, dir) == 2);
+  REQUIRE(read_file(rsp_dir / "flags-a.rsp") == "-DA\n");
+  REQUIRE(read_file(rsp_dir / "flags-b.rsp") == "-DB\n");
+
+  // Named after their content, existing files are left alone
+  REQUIRE(write_response_files(files, dir) == 0);
+
+  fixture.write_file(".pio/clangd/targets.json", "{}");
+  files.erase(files.begin());
+  REQUIRE(write_response_files(files, dir) == 0);
+  REQUIRE_FALSE(fs::exists(rsp_dir / "flags-a.rsp"));
+  REQUIRE(fs::exists(rsp_dir / "flags-b.rsp"));
+
+  REQUIRE(write_response_files({}, dir) == 0);
+  REQUIRE_FALSE(fs::exists(rsp_dir / "flags-b.rsp"));
+  REQUIRE(fs::exists(rsp_dir / "targets.json"));
+}
+
+TEST_CASE("gen_cmds --rsp-output", "[rsp][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"uno"});
+  auto dir = fixture.get_path_string();
+  std::string framework =
+      R"("-DF1","-DF2","-DF3","-DF4","-DF5","-DF6","-DF7","-DF8")";
+  auto command = [&](std::string_view file) {
+    return R"({"directory":")" + dir + R"(","file":")" + std::string{file} +
+           R"(","arguments":["g++",)" + framework + R"(,"-c","x.cpp"]})";
+  };
+  fixture.create_compile_commands(
+      "uno", "[" + command("src/a.cpp") + "," + command("src/b.cpp") + "]");
+  auto report_path = (fixture.get_path() / "report.json").string();
+
+  GenOptions options{.report_path = report_path, .rsp_output = true};
+  REQUIRE(gen_cmds(dir, "uno", options) == EXIT_SUCCESS);
+
+  std::vector<CompileCommand> commands;
+  auto database_path = (fixture.get_path() / "compile_commands.json").string();
+  REQUIRE_FALSE(glz::read_file_json(commands, database_path, std::string{}));
+  REQUIRE(commands.size() == 2);
+  REQUIRE(commands[0].arguments.size() == 2);
+  REQUIRE(commands[0].arguments == commands[1].arguments);
+  const auto& ref = commands[0].arguments[1];
+  REQUIRE(ref.starts_with("@.pio/clangd/flags-"));
+  auto rsp_path = fixture.get_path() / ref.substr(1);
+  REQUIRE(read_file(rsp_path) ==
+          "-DF1\n-DF2\n-DF3\n-DF4\n-DF5\n-DF6\n-DF7\n-DF8\n");
+
+  RunReport report;
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.rsp_files == 1);
+  REQUIRE(report.rsp_flags == 16);
+
+  // Without the option the flags are back inline, the file is gone
+  REQUIRE(gen_cmds(dir, "uno") == EXIT_SUCCESS);
+  REQUIRE_FALSE(glz::read_file_json(commands, database_path, std::string{}));
+  REQUIRE(commands[0].arguments.size() == 9);
+  REQUIRE_FALSE(fs::exists(rsp_path));
+}
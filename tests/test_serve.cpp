@@ -0,0 +1,243 @@
+#if !defined(_WIN32)
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "serve.h"
+#include "test_fixtures.hpp"
+
+// Owning counterpart of ServeResponse for reading responses back
+struct Response {
+  bool ok{};
+  std::optional<std::string> error{};
+  std::optional<std::string> env{};
+  std::optional<size_t> entries{};
+  std::optional<bool> reloaded{};
+  std::optional<std::string> directory{};
+  std::optional<std::string> driver{};
+  std::optional<std::vector<std::string>> arguments{};
+  std::optional<ServeStats> stats{};
+
+  struct glaze {
+    using T = Response;
+    static constexpr auto value = glz::object(
+      "ok", &T::ok,
+      "error", &T::error,
+      "env", &T::env,
+      "entries", &T::entries,
+      "reloaded", &T::reloaded,
+      "directory", &T::directory,
+      "driver", &T::driver,
+      "arguments", &T::arguments,
+      "stats", &T::stats);
+  };
+};
+
+static Response parse(const std::string& line) {
+  Response response;
+  REQUIRE_FALSE(glz::read_json(response, line));
+  return response;
+}
+
+static void write_commands(TempProjectFixture& fixture,
+                           const std::string& env,
+                           const std::string& flag) {
+  auto dir = fixture.get_path_string();
+  fixture.create_compile_commands(
+      env,
+      R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+      R"("arguments":["g++",")" + flag + R"(","-c","src/main.cpp"]}])");
+}
+
+using Args = std::vector<std::string>;
+
+TEST_CASE("ProjectServer answers requests from warm state", "[serve]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32", "native"});
+  write_commands(fixture, "esp32", "-DESP32");
+  write_commands(fixture, "native", "-DNATIVE");
+  auto dir = fixture.get_path_string();
+  auto output = fixture.get_path() / "compile_commands.json";
+
+  ProjectServer server{ServeOptions{.proj_path = dir}};
+  REQUIRE(server.load());
+  REQUIRE_FALSE(fs::exists(output));
+
+  auto lookup = parse(
+      server.handle(R"({"method":"lookup","file":"src/main.cpp"})"));
+  REQUIRE(lookup.ok);
+  REQUIRE(lookup.directory == dir);
+  REQUIRE(lookup.driver == "g++");
+  REQUIRE(lookup.arguments == Args{"-DESP32"});
+
+  SECTION("Regenerate writes the outputs without reparsing") {
+    auto response = parse(server.handle(R"({"method":"regenerate"})"));
+    REQUIRE(response.ok);
+    REQUIRE(response.env == "esp32");
+    REQUIRE(response.entries == 1);
+    REQUIRE(response.reloaded == false);
+    REQUIRE(fs::exists(output));
+
+    response = parse(server.handle(R"({"method":"stats"})"));
+    REQUIRE(response.stats);
+    REQUIRE(response.stats->loads == 1);
+    REQUIRE(response.stats->environments == 2);
+    REQUIRE(response.stats->input_entries == 2);
+    REQUIRE(response.stats->requests == 3);
+  }
+
+  SECTION("Switch retargets and writes the outputs") {
+    auto response =
+        parse(server.handle(R"({"method":"switch","env":"native"})"));
+    REQUIRE(response.ok);
+    REQUIRE(response.env == "native");
+    REQUIRE(fs::exists(output));
+
+    response = parse(
+        server.handle(R"({"method":"lookup","file":"src/main.cpp"})"));
+    REQUIRE(response.arguments == Args{"-DNATIVE"});
+  }
+
+  SECTION("Changed inputs are reparsed on the next request") {
+    write_commands(fixture, "esp32", "-DESP32_REV2");
+    auto response = parse(
+        server.handle(R"({"method":"lookup","file":"src/main.cpp"})"));
+    REQUIRE(response.arguments == Args{"-DESP32_REV2"});
+
+    response = parse(server.handle(R"({"method":"stats"})"));
+    REQUIRE(response.stats->loads == 2);
+  }
+
+  SECTION("Errors are reported in the response") {
+    auto response = parse(
+        server.handle(R"({"method":"lookup","file":"src/other.cpp"})"));
+    REQUIRE_FALSE(response.ok);
+    REQUIRE_THAT(*response.error,
+                 Catch::Matchers::ContainsSubstring("No compile command"));
+
+    response = parse(server.handle(R"({"method":"switch","env":"nope"})"));
+    REQUIRE_FALSE(response.ok);
+    REQUIRE_THAT(*response.error,
+                 Catch::Matchers::ContainsSubstring("'nope' not found"));
+
+    response = parse(server.handle(R"({"method":"fly"})"));
+    REQUIRE_FALSE(response.ok);
+
+    response = parse(server.handle("not json"));
+    REQUIRE_FALSE(response.ok);
+
+    // A truncated line is not completed by the bytes following it
+    std::string buffer = R"({"method":"shutdown"})";
+    response = parse(server.handle(std::string_view{buffer}.substr(0, 12)));
+    REQUIRE_FALSE(response.ok);
+    REQUIRE_FALSE(server.stop_requested());
+  }
+}
+
+TEST_CASE("ProjectServer writes the outputs like gen_cmds", "[serve]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32"});
+  write_commands(fixture, "esp32", "-DESP32");
+  fixture.write_file("overrides.json",
+                     R"({"rules": [{"path": "src", "add": ["-DO"]}]})");
+  auto dir = fixture.get_path_string();
+  auto output = (fixture.get_path() / "compile_commands.json").string();
+
+  ProjectServer server{ServeOptions{
+      .proj_path = dir,
+      .gen = {.overrides_path = (fixture.get_path() / "overrides.json")
+                                    .string()}}};
+  auto response = parse(server.handle(R"({"method":"regenerate"})"));
+  REQUIRE(response.ok);
+
+  std::vector<CompileCommand> commands;
+  REQUIRE_FALSE(glz::read_file_json(commands, output, std::string{}));
+  REQUIRE(commands.size() == 1);
+  REQUIRE(commands[0].arguments == Args{"g++", "-DESP32", "-DO"});
+
+  // An edited override file reloads like a changed input
+  fixture.write_file("overrides.json",
+                     R"({"rules": [{"path": "src", "add": ["-DO2"]}]})");
+  response = parse(
+      server.handle(R"({"method":"lookup","file":"src/main.cpp"})"));
+  REQUIRE(response.arguments == Args{"-DESP32", "-DO2"});
+
+  // Excluded entries are neither written nor looked up
+  fixture.write_file("platformio.ini",
+                     "[env:esp32]\n[pio-clangd]\nexclude = src\n");
+  response = parse(server.handle(R"({"method":"regenerate"})"));
+  REQUIRE(response.entries == 0);
+  response = parse(
+      server.handle(R"({"method":"lookup","file":"src/main.cpp"})"));
+  REQUIRE_FALSE(response.ok);
+}
+
+TEST_CASE("serve_project answers requests on a Unix socket", "[serve]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32"});
+  write_commands(fixture, "esp32", "-DESP32");
+  auto dir = fixture.get_path_string();
+  auto socket = default_socket_path(dir).string();
+
+  int result = EXIT_FAILURE;
+  std::jthread server([&] {
+    result = serve_project(ServeOptions{.proj_path = dir});
+  });
+
+  // The socket appears once the server listens
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+  while (!fs::exists(socket) && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{5});
+  }
+
+  auto response =
+      serve_request(socket, R"({"method":"lookup","file":"src/main.cpp"})");
+  REQUIRE(response);
+  REQUIRE(parse(*response).arguments == Args{"-DESP32"});
+
+  // A second server for the same socket refuses to start
+  REQUIRE(serve_project(ServeOptions{.proj_path = dir}) == EXIT_FAILURE);
+
+  response = serve_request(socket, R"({"method":"shutdown"})");
+  REQUIRE(response);
+  REQUIRE(parse(*response).ok);
+  server.join();
+  REQUIRE(result == EXIT_SUCCESS);
+  REQUIRE_FALSE(fs::exists(socket));
+  REQUIRE_FALSE(serve_request(socket, R"({"method":"stats"})"));
+}
+
+TEST_CASE("serve_project stops when requested", "[serve]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32"});
+  auto dir = fixture.get_path_string();
+  auto socket = default_socket_path(dir).string();
+
+  // Loading fails before the project is built, the server still runs
+  std::stop_source stop;
+  int result = EXIT_FAILURE;
+  std::jthread server([&] {
+    result = serve_project(ServeOptions{.proj_path = dir}, stop.get_token());
+  });
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+  while (!fs::exists(socket) && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{5});
+  }
+
+  // An idle connection does not keep the server alive
+  auto response = serve_request(socket, R"({"method":"stats"})");
+  REQUIRE(response);
+  REQUIRE(parse(*response).stats->loads == 0);
+
+  stop.request_stop();
+  server.join();
+  REQUIRE(result == EXIT_SUCCESS);
+  REQUIRE_FALSE(fs::exists(socket));
+}
+
+#endif
@@ -0,0 +1,192 @@
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/core.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "clangd.h"
+#include "database.h"
+#include "report.h"
+#include "stat_cache.h"
+#include "test_fixtures.hpp"
+
+TEST_CASE("StatCache stats each path once", "[stat_cache]") {
+  TempProjectFixture fixture;
+  auto dir = fixture.get_path();
+  fixture.write_file("full/a.h", "");
+  fixture.write_file("file.h", "");
+  fs::create_directories(dir / "empty");
+
+  std::vector<std::string> paths{
+      (dir / "full").string(), (dir / "file.h").string(),
+      (dir / "empty").string(), (dir / "missing").string(),
+      (dir / "full").string()};
+
+  StatCache cache;
+  cache.stat_all(paths);
+  REQUIRE(cache.size() == 4);
+  REQUIRE(cache.status(paths[0]) == StatCache::Status::directory);
+  REQUIRE(cache.status(paths[1]) == StatCache::Status::file);
+  REQUIRE(cache.status(paths[2]) == StatCache::Status::empty_directory);
+  REQUIRE(cache.status(paths[3]) == StatCache::Status::missing);
+  REQUIRE(cache.contains(paths[3]));
+  REQUIRE_FALSE(cache.contains((dir / "other").string()));
+
+  // Cached results are kept, even when the file system changes
+  fixture.write_file("empty/b.h", "");
+  cache.stat_all(paths);
+  REQUIRE(cache.status(paths[2]) == StatCache::Status::empty_directory);
+
+  // Many paths are spread over several workers
+  std::vector<std::string> many;
+  for (int i = 0; i < 1000; ++i) {
+    many.push_back((dir / ("missing" + std::to_string(i % 500))).string());
+  }
+  many.push_back((dir / "full").string());
+  cache.stat_all(many);
+  REQUIRE(cache.size() == 4 + 500);
+  REQUIRE(cache.status(many.back()) == StatCache::Status::directory);
+}
+
+TEST_CASE("prune_include_dirs drops dead include directories",
+          "[stat_cache]") {
+  TempProjectFixture fixture;
+  auto dir = fixture.get_path_string();
+  fixture.write_file("include/a.h", "");
+  fixture.write_file("sdk/b.h", "");
+  fs::create_directories(fixture.get_path() / "empty");
+
+  std::vector<CompileCommand> commands{
+      {.directory = dir,
+       .file = "src/a.cpp",
+       .arguments = {"g++", "-Iinclude", "-I", "missing", "-isystem",
+                     dir + "/sdk/", "-iquote" + dir + "/empty", "-DA"}},
+      {.directory = dir,
+       .file = "src/b.cpp",
+       .arguments = {"g++", "-Iinclude", "-I", "missing", "-isystem",
+                     dir + "/sdk/", "-iquote" + dir + "/empty", "-DA"}},
+      {.directory = dir, .file = "src/c.cpp", .arguments = {"g++", "-DC"}},
+  };
+
+  InternPool pool;
+  std::vector<EnvDatabase> envs;
+  envs.push_back(make_env_database("esp32", commands, pool));
+
+  StatCache cache;
+  REQUIRE(prune_include_dirs(envs, pool, cache) == 2);
+  REQUIRE(cache.size() == 4);
+
+  using Args = std::vector<std::string_view>;
+  const auto& entries = envs[0].entries;
+  auto sdk = dir + "/sdk/";
+  Args expected{"-Iinclude", "-isystem", sdk, "-DA"};
+  REQUIRE(arguments(entries[0]) == expected);
+  // Lists stay interned and shared
+  REQUIRE(entries[1].arguments.data() == entries[0].arguments.data());
+  REQUIRE(arguments(entries[2]) == Args{"-DC"});
+
+  // Nothing left to prune
+  REQUIRE(prune_include_dirs(envs, pool, cache) == 0);
+}
+
+TEST_CASE("gen_cmds --prune-includes", "[stat_cache][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32"});
+  fixture.write_file("include/a.h", "");
+  auto dir = fixture.get_path_string();
+  fixture.create_compile_commands(
+      "esp32",
+      R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+      R"("arguments":["g++","-Iinclude","-I/nonexistent/toolchain",)"
+      R"("-c","src/main.cpp"]}])");
+  auto report_path = (fixture.get_path() / "report.json").string();
+
+  GenOptions options{.report_path = report_path, .prune_includes = true};
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_SUCCESS);
+
+  std::vector<CompileCommand> commands;
+  REQUIRE_FALSE(glz::read_file_json(
+      commands, (fixture.get_path() / "compile_commands.json").string(),
+      std::string{}));
+  REQUIRE(commands.size() == 1);
+  REQUIRE(commands[0].arguments ==
+          std::vector<std::string>{"g++", "-Iinclude"});
+
+  RunReport report;
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.include_dirs_pruned == 1);
+}
+
+TEST_CASE("drop_missing_sources drops entries of deleted files",
+          "[stat_cache]") {
+  TempProjectFixture fixture;
+  auto dir = fixture.get_path_string();
+  fixture.write_file("src/a.cpp", "");
+  fixture.write_file("lib/c.cpp", "");
+
+  std::vector<CompileCommand> commands{
+      {.directory = dir, .file = "src/a.cpp", .arguments = {"g++", "-DA"}},
+      {.directory = dir, .file = "src/b.cpp", .arguments = {"g++", "-DA"}},
+      {.directory = dir + "/lib",
+       .file = dir + "/lib/c.cpp",
+       .arguments = {"g++", "-DC"}},
+  };
+
+  InternPool pool;
+  std::vector<EnvDatabase> envs;
+  envs.push_back(make_env_database("esp32", commands, pool));
+  envs.push_back(make_env_database(
+      "native", {commands.begin(), commands.begin() + 2}, pool));
+
+  StatCache cache;
+  REQUIRE(drop_missing_sources(envs, cache) == 2);
+  // src/b.cpp is stat'ed once for both environments
+  REQUIRE(cache.size() == 3);
+
+  REQUIRE(envs[0].entries.size() == 2);
+  REQUIRE(envs[0].entries[0].file == "src/a.cpp");
+  REQUIRE(envs[0].entries[1].file == dir + "/lib/c.cpp");
+  REQUIRE(envs[0].stats.entries_missing == 1);
+  REQUIRE(envs[1].entries.size() == 1);
+  REQUIRE(envs[1].stats.entries_missing == 1);
+}
+
+TEST_CASE("gen_cmds --drop-missing", "[stat_cache][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32", "native"});
+  auto dir = fixture.get_path_string();
+  // The library was removed from esp32's libdeps since its last build,
+  // native has a current copy
+  fixture.write_file(".pio/libdeps/native/Lib/new.cpp", "");
+  auto command = [&](std::string_view env, std::string_view file) {
+    return fmt::format(
+        R"({{"directory":"{}","file":".pio/libdeps/{}/Lib/{}",)"
+        R"("arguments":["g++","-D{}","-c","x.cpp"]}})",
+        dir, env, file, env);
+  };
+  fixture.create_compile_commands(
+      "esp32", "[" + command("esp32", "old.cpp") + "," +
+                   command("esp32", "new.cpp") + "]");
+  fixture.create_compile_commands(
+      "native", "[" + command("native", "new.cpp") + "]");
+  auto report_path = (fixture.get_path() / "report.json").string();
+
+  GenOptions options{.report_path = report_path, .drop_missing = true};
+  REQUIRE(gen_cmds(dir, "esp32", options) == EXIT_SUCCESS);
+
+  std::vector<CompileCommand> commands;
+  REQUIRE_FALSE(glz::read_file_json(
+      commands, (fixture.get_path() / "compile_commands.json").string(),
+      std::string{}));
+  // The esp32 copy is gone, native's existing copy takes its place
+  REQUIRE(commands.size() == 1);
+  REQUIRE(commands[0].file == ".pio/libdeps/native/Lib/new.cpp");
+  REQUIRE(commands[0].arguments ==
+          std::vector<std::string>{"g++", "-Dnative"});
+
+  RunReport report;
+  REQUIRE_FALSE(glz::read_file_json(report, report_path, std::string{}));
+  REQUIRE(report.sources_missing == 2);
+  REQUIRE(report.input_entries == 3);
+  REQUIRE(report.envs[0].entries_missing == 2);
+  REQUIRE(report.envs[0].entries_lost == 2);
+}
@@ -0,0 +1,186 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "clangd.h"
+#include "stream.h"
+#include "test_fixtures.hpp"
+
+static std::string command(std::string_view env,
+                           std::string_view file,
+                           std::string_view flag) {
+  return R"({"env":")" + std::string{env} +
+         R"(","directory":"/proj","file":")" + std::string{file} +
+         R"(","arguments":["g++",")" + std::string{flag} + R"(","-c"]})";
+}
+
+static std::vector<std::string> files(const CommandStream& stream) {
+  std::vector<std::string> result;
+  for (const Entry* entry : stream.entries()) {
+    result.emplace_back(entry->file);
+  }
+  return result;
+}
+
+using Files = std::vector<std::string>;
+
+TEST_CASE("CommandStream finalizes target entries while reading",
+          "[stream]") {
+  CommandStream stream{"esp32"};
+
+  // The other environment comes first but cannot be final yet
+  REQUIRE(stream.feed(command("native", "src/main.cpp", "-DNATIVE") + "\n" +
+                      command("native", "src/lib.cpp", "-DNATIVE") + "\n"));
+  REQUIRE(stream.entries().empty());
+
+  REQUIRE(stream.feed(command("esp32", "src/main.cpp", "-DESP32") + "\n"));
+  REQUIRE(files(stream) == Files{"src/main.cpp"});
+  REQUIRE(stream.entries()[0]->arguments[0] == "-DESP32");
+
+  REQUIRE(stream.finish());
+  REQUIRE(files(stream) == Files{"src/main.cpp", "src/lib.cpp"});
+
+  auto reports = stream.env_reports();
+  REQUIRE(reports.size() == 2);
+  REQUIRE(reports[0].name == "native");
+  REQUIRE(reports[0].entries == 2);
+  REQUIRE(reports[0].entries_won == 1);
+  REQUIRE(reports[0].entries_lost == 1);
+  REQUIRE(reports[1].name == "esp32");
+  REQUIRE(reports[1].entries_won == 1);
+}
+
+TEST_CASE("CommandStream accepts arrays split at any byte", "[stream]") {
+  std::string input = "[" + command("a", "x.cpp", "-DA") + ",\n" +
+                      command("b", "y.cpp", "-DB") + "]\n[" +
+                      command("b", "x.cpp", "-DB") + "]" +
+                      R"({"directory":"/proj","file":"z.cpp",)"
+                      R"("command":"g++ -D\"Q\\\"}\" -c z.cpp"})";
+
+  CommandStream stream{"a"};
+  for (char c : input) {
+    REQUIRE(stream.feed({&c, 1}));
+  }
+  REQUIRE(stream.finish());
+
+  // Untagged commands belong to the target
+  REQUIRE(files(stream) == Files{"x.cpp", "z.cpp", "y.cpp"});
+}
+
+TEST_CASE("CommandStream takes the first environment as default target",
+          "[stream]") {
+  CommandStream stream{""};
+  REQUIRE(stream.feed(command("b", "x.cpp", "-DB")));
+  REQUIRE(stream.target_env() == "b");
+  REQUIRE(stream.entries().size() == 1);
+}
+
+TEST_CASE("CommandStream reports malformed input", "[stream]") {
+  auto error = [](std::string_view target, const std::string& input) {
+    CommandStream stream{std::string{target}};
+    auto fed = stream.feed(input);
+    if (!fed) {
+      return fed.error();
+    }
+    auto finished = stream.finish();
+    return finished ? std::string{} : finished.error();
+  };
+  using Catch::Matchers::ContainsSubstring;
+
+  REQUIRE_THAT(error("a", "nope"), ContainsSubstring("Expected a compile"));
+  REQUIRE_THAT(error("a", "[" + command("a", "x.cpp", "-DA")),
+               ContainsSubstring("Unexpected end of input"));
+  REQUIRE_THAT(error("a", "[[]]"), ContainsSubstring("Nested array"));
+  REQUIRE_THAT(error("a", R"({"file":1})"),
+               ContainsSubstring("Invalid compile command"));
+  REQUIRE_THAT(error("c", command("a", "x.cpp", "-DA")),
+               ContainsSubstring("'c' not found"));
+  REQUIRE_THAT(error("", R"({"file":"x.cpp"})"),
+               ContainsSubstring("without \"env\""));
+  REQUIRE(error("a", "").find("'a' not found") != std::string::npos);
+}
+
+TEST_CASE("stream_cmds matches gen_cmds", "[stream][gen_cmds]") {
+  TempProjectFixture fixture;
+  fixture.create_platformio_ini({"esp32", "native"});
+  auto dir = fixture.get_path_string();
+  std::string esp32 =
+      R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+      R"("arguments":["g++","-DESP32","-c","src/main.cpp"]},)"
+      R"({"directory":")" + dir + R"(",)"
+      R"("file":".pio/libdeps/esp32/Lib/lib.cpp",)"
+      R"("arguments":["g++","-DLIB","-c","lib.cpp"]}])";
+  std::string native =
+      R"([{"directory":")" + dir + R"(","file":"src/main.cpp",)"
+      R"("command":"g++ -DNATIVE -c src/main.cpp"},)"
+      R"({"directory":")" + dir + R"(",)"
+      R"("file":".pio/libdeps/native/Lib/lib.cpp",)"
+      R"("command":"g++ -DLIB -c lib.cpp"}])";
+  fixture.create_compile_commands("esp32", esp32);
+  fixture.create_compile_commands("native", native);
+
+  auto output_path = fixture.get_path() / "compile_commands.json";
+  auto read_output = [&] {
+    std::vector<CompileCommand> commands;
+    REQUIRE_FALSE(glz::read_file_json(commands, output_path.string(),
+                                      std::string{}));
+    return commands;
+  };
+
+  REQUIRE(gen_cmds(dir, "native") == EXIT_SUCCESS);
+  auto expected = read_output();
+  fs::remove(output_path);
+
+  // Same databases as JSON-lines, tagged, other environment first
+  std::string input;
+  auto tag = [&](const std::string& env, const std::string& json) {
+    std::vector<CompileCommand> commands;
+    REQUIRE_FALSE(glz::read_json(commands, json));
+    for (const auto& cmd : commands) {
+      input += R"({"env":")" + env + "\",";
+      input += glz::write_json(cmd).value().substr(1);
+      input += '\n';
+    }
+  };
+  tag("esp32", esp32);
+  tag("native", native);
+
+  std::FILE* in = std::tmpfile();
+  REQUIRE(in);
+  std::fwrite(input.data(), 1, input.size(), in);
+  std::rewind(in);
+
+  SECTION("To compile_commands.json") {
+    REQUIRE(stream_cmds(dir, "native", {}, in, nullptr) == EXIT_SUCCESS);
+    auto actual = read_output();
+    REQUIRE(actual.size() == expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      REQUIRE(actual[i].file == expected[i].file);
+      REQUIRE(actual[i].arguments == expected[i].arguments);
+    }
+  }
+
+  SECTION("To a stream") {
+    std::FILE* out = std::tmpfile();
+    REQUIRE(out);
+    REQUIRE(stream_cmds(dir, "native", {}, in, out) == EXIT_SUCCESS);
+    REQUIRE_FALSE(fs::exists(output_path));
+
+    std::string text(static_cast<size_t>(std::ftell(out)), '\0');
+    std::rewind(out);
+    REQUIRE(std::fread(text.data(), 1, text.size(), out) == text.size());
+    std::fclose(out);
+
+    std::vector<CompileCommand> actual;
+    REQUIRE_FALSE(glz::read_json(actual, text));
+    REQUIRE(actual.size() == expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      REQUIRE(actual[i].file == expected[i].file);
+      REQUIRE(actual[i].arguments == expected[i].arguments);
+    }
+  }
+  std::fclose(in);
+}
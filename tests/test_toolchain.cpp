@@ -0,0 +1,150 @@
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "database.h"
+#include "test_fixtures.hpp"
+#include "toolchain.h"
+
+// Abridged output of xtensa-esp32-elf-g++ -x c++ -E -v -dM -
+static constexpr std::string_view GCC_OUTPUT = R"(Using built-in specs.
+COLLECT_GCC=xtensa-esp32-elf-g++
+Target: xtensa-esp32-elf
+ignoring nonexistent directory "/opt/xtensa/sys-include"
+#include "..." search starts here:
+#include <...> search starts here:
+ /opt/xtensa/bin/../lib/gcc/xtensa-esp32-elf/8.4.0/../../../../include/c++/8.4.0
+ /opt/xtensa/lib/gcc/xtensa-esp32-elf/8.4.0/include/
+ /Library/Frameworks (framework directory)
+End of search list.
+#define __GNUC__ 8
+#define __xtensa__ 1
+#define __XTENSA__ 1
+#define __INT64_C(c) c ## LL
+#define __ARM_ARCH_7EM__
+#define __CHAR_UNSIGNED__ 1
+#define __VERSION__ "8.4.0"
+)";
+
+TEST_CASE("builtin_macro_needed", "[toolchain]") {
+  STATIC_REQUIRE(std::ranges::is_sorted(BUILTIN_MACRO_STEMS));
+  STATIC_REQUIRE(builtin_macro_needed("__XTENSA__"));
+  STATIC_REQUIRE(builtin_macro_needed("__ARM_ARCH"));
+  STATIC_REQUIRE(builtin_macro_needed("__riscv_xlen"));
+  STATIC_REQUIRE_FALSE(builtin_macro_needed("__GNUC__"));
+  STATIC_REQUIRE_FALSE(builtin_macro_needed("__CHAR_BIT__"));
+  STATIC_REQUIRE_FALSE(builtin_macro_needed("__AA"));
+}
+
+TEST_CASE("parse_builtins reads gcc -E -v -dM output", "[toolchain]") {
+  auto builtins = parse_builtins(GCC_OUTPUT);
+  REQUIRE(builtins);
+  REQUIRE(builtins->system_dirs ==
+          std::vector<std::string>{
+              "/opt/xtensa/include/c++/8.4.0",
+              "/opt/xtensa/lib/gcc/xtensa-esp32-elf/8.4.0/include",
+              "/Library/Frameworks"});
+  // Only the target macros, function-like ones never
+  REQUIRE(builtins->macros ==
+          std::vector<std::string>{"-D__xtensa__=1", "-D__XTENSA__=1",
+                                   "-D__ARM_ARCH_7EM__",
+                                   "-D__CHAR_UNSIGNED__=1"});
+
+  // Not a compiler
+  REQUIRE_FALSE(parse_builtins("#define __XTENSA__ 1\n"));
+}
+
+#if !defined(_WIN32)
+
+TEST_CASE("inject_toolchain_builtins queries each compiler once",
+          "[toolchain]") {
+  TempProjectFixture fixture;
+  auto dir = fixture.get_path_string();
+  auto cache_dir = fixture.get_path() / "cache";
+
+  // Stub compiler, logs its arguments
+  auto compiler = dir + "/arm-none-eabi-g++";
+  auto include = dir + "/include";
+  fixture.write_file("arm-none-eabi-g++",
+                     "#!/bin/sh\n"
+                     "echo \"$@\" >> \"$0.log\"\n"
+                     "cat >&2 <<'EOF'\n"
+                     "#include <...> search starts here:\n"
+                     " /opt/arm/include\n"
+                     " " + include + "\n"
+                     "End of search list.\n"
+                     "EOF\n"
+                     "echo '#define __ARM_ARCH 7'\n"
+                     "echo '#define __GNUC__ 8'\n");
+  fs::permissions(compiler, fs::perms::owner_all);
+  auto invocations = [&] {
+    std::ifstream log{compiler + ".log"};
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(log, line);) {
+      lines.push_back(line);
+    }
+    std::ranges::sort(lines);
+    return lines;
+  };
+
+  std::vector<CompileCommand> commands{
+      {.directory = dir,
+       .file = "src/a.cpp",
+       .arguments = {compiler, "-mcpu=cortex-m4", "-I" + include, "-DA", "-c",
+                     "src/a.cpp"}},
+      {.directory = dir,
+       .file = "src/b.cpp",
+       .command = compiler + " -mcpu=cortex-m4 -DB -c src/b.cpp"},
+      {.directory = dir,
+       .file = "src/c.c",
+       .arguments = {compiler, "-mcpu=cortex-m4", "-DC", "-c", "src/c.c"}},
+      {.directory = dir,
+       .file = "src/d.cpp",
+       .arguments = {"/nonexistent/gcc", "-DD", "-c", "src/d.cpp"}},
+  };
+  using Args = std::vector<std::string_view>;
+
+  InternPool pool;
+  std::vector<EnvDatabase> envs;
+  envs.push_back(make_env_database("stm32", commands, pool));
+  auto stats = inject_toolchain_builtins(envs, pool, cache_dir);
+
+  // One query per language, the missing compiler is reported
+  REQUIRE(stats.queried == 2);
+  REQUIRE(stats.cached == 0);
+  REQUIRE(stats.errors.size() == 1);
+  REQUIRE(invocations() ==
+          std::vector<std::string>{"-mcpu=cortex-m4 -x c -E -v -dM -",
+                                   "-mcpu=cortex-m4 -x c++ -E -v -dM -"});
+
+  // Macros first, builtin directories last; as in GCC an -I directory
+  // that is also a builtin one is searched as the builtin one
+  const auto& entries = envs[0].entries;
+  Args expected{"-D__ARM_ARCH=7", "-mcpu=cortex-m4", "-DA", "-isystem",
+                "/opt/arm/include", "-isystem", include};
+  REQUIRE(arguments(entries[0]) == expected);
+  expected[2] = "-DB";
+  REQUIRE(arguments(entries[1]) == expected);
+  REQUIRE(arguments(entries[3]) == Args{"-DD"});
+
+  // A second run takes the cache
+  std::vector<EnvDatabase> again;
+  again.push_back(make_env_database("stm32", commands, pool));
+  stats = inject_toolchain_builtins(again, pool, cache_dir);
+  REQUIRE(stats.queried == 0);
+  REQUIRE(stats.cached == 2);
+  REQUIRE(invocations().size() == 2);
+  REQUIRE(again[0].entries[1].arguments.data() ==
+          entries[1].arguments.data());
+
+  // Changed target flags are a different key
+  commands[0].arguments[1] = "-mcpu=cortex-m7";
+  std::vector<EnvDatabase> changed;
+  changed.push_back(make_env_database("stm32", commands, pool));
+  stats = inject_toolchain_builtins(changed, pool, cache_dir);
+  REQUIRE(stats.queried == 1);
+  REQUIRE(stats.cached == 2);
+}
+
+#endif
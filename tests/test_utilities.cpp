@@ -1,6 +1,14 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_string.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
 #include "clangd.h"
+#include "database.h"
+#include "intern.h"
+#include "util.h"
 
 TEST_CASE("essential_flag identifies critical compiler flags", "[utilities]") {
 
@@ -281,3 +289,180 @@ TEST_CASE("process_tokens filters compiler flags correctly", "[utilities]") {
     REQUIRE(filtered[3] == "-march=native");
   }
 }
+
+TEST_CASE("ArgCanonicalizer removes redundant flags", "[utilities]") {
+  ArgCanonicalizer canonicalizer;
+  using Args = std::vector<std::string_view>;
+
+  SECTION("Keeps the first occurrence of a directory per chain") {
+    Args args{"-Iinclude", "-I", "include/", "-Ilib", "-iquote", "src",
+              "-iquotesrc", "-Iinclude", "-Isrc"};
+    REQUIRE(canonicalizer.canonicalize(args) == 4);
+    REQUIRE(args == Args{"-Iinclude", "-Ilib", "-iquote", "src", "-Isrc"});
+  }
+
+  SECTION("System directories demote -I and -iquote") {
+    Args args{"-Isdk", "-iquotesdk", "-DX", "-isystem", "sdk", "-isystemsdk",
+              "-Iother"};
+    REQUIRE(canonicalizer.canonicalize(args) == 3);
+    REQUIRE(args == Args{"-DX", "-isystem", "sdk", "-Iother"});
+  }
+
+  SECTION("Drops only macro definitions that change nothing") {
+    Args args{"-DA",   "-DA",   "-DB=1", "-DB=2",    "-DB=2", "-UB",
+              "-DB=2", "-UC",   "-UC",   "-DF(x)=x", "-DF(x)=x"};
+    REQUIRE(canonicalizer.canonicalize(args) == 4);
+    REQUIRE(args ==
+            Args{"-DA", "-DB=1", "-DB=2", "-UB", "-DB=2", "-UC", "-DF(x)=x"});
+  }
+
+  SECTION("Leaves other flags alone") {
+    Args args{"-std=c++17", "-I-", "-I-", "-I", "-include", "a.h",
+              "-include", "a.h", "-D", "-mthumb", "-mthumb"};
+    Args expected = args;
+    REQUIRE(canonicalizer.canonicalize(args) == 0);
+    REQUIRE(args == expected);
+  }
+
+  SECTION("State does not leak between commands") {
+    Args first{"-Iinclude", "-DA"};
+    Args second{"-Iinclude", "-DA"};
+    canonicalizer.canonicalize(first);
+    REQUIRE(canonicalizer.canonicalize(second) == 0);
+  }
+}
+
+TEST_CASE("make_dedup_key normalizes paths", "[utilities]") {
+  std::string key;
+
+  SECTION("Joins directory and relative file") {
+    make_dedup_key({.directory = "/proj", .file = "src/main.cpp"}, key);
+    REQUIRE(key == "/proj/src/main.cpp");
+  }
+
+  SECTION("Absolute file ignores directory") {
+    make_dedup_key({.directory = "/proj", .file = "/other/main.cpp"}, key);
+    REQUIRE(key == "/other/main.cpp");
+  }
+
+  SECTION("Windows absolute file ignores directory") {
+    make_dedup_key({.directory = "/proj", .file = "C:/other/main.cpp"}, key);
+    REQUIRE(key == "C:/other/main.cpp");
+  }
+
+  SECTION("Directory with trailing slash") {
+    make_dedup_key({.directory = "/proj/", .file = "src/main.cpp"}, key);
+    REQUIRE(key == "/proj/src/main.cpp");
+  }
+
+  SECTION("Dot segments and repeated slashes are normalized") {
+    make_dedup_key({.directory = "/proj/build", .file = "../src//./main.cpp"},
+                   key);
+    REQUIRE(key == "/proj/src/main.cpp");
+  }
+
+  SECTION("Dotted file names are not segments") {
+    make_dedup_key({.directory = "/proj", .file = ".hidden/..main.cpp"}, key);
+    REQUIRE(key == "/proj/.hidden/..main.cpp");
+  }
+
+  SECTION("libdeps environment segment is removed") {
+    make_dedup_key({.directory = "/proj",
+                    .file = ".pio/libdeps/esp32dev/Lib/src/lib.cpp"},
+                   key);
+    REQUIRE(key == "/proj/.pio/libdeps/Lib/src/lib.cpp");
+  }
+
+  SECTION("Buffer is overwritten, not appended") {
+    key = "stale contents";
+    make_dedup_key({.directory = "/proj", .file = "a.cpp"}, key);
+    REQUIRE(key == "/proj/a.cpp");
+  }
+}
+
+TEST_CASE("InternPool stores equal contents once", "[utilities]") {
+  InternPool pool;
+  std::string a = "-DESP32";
+  std::string b = "-DESP32";
+
+  auto ia = pool.intern(a);
+  auto ib = pool.intern(b);
+  REQUIRE(ia == "-DESP32");
+  REQUIRE(ia.data() == ib.data());
+  REQUIRE(ia.data() != a.data());
+  REQUIRE(pool.intern("-DNATIVE").data() != ia.data());
+  REQUIRE(pool.intern("").empty());
+
+  std::vector<std::string_view> flags{ia, pool.intern("-Iinclude")};
+  auto list1 = pool.intern_list(flags);
+  auto list2 = pool.intern_list(flags);
+  REQUIRE(list1.data() == list2.data());
+  REQUIRE(list1.size() == 2);
+  REQUIRE(list1[1] == "-Iinclude");
+
+  flags.pop_back();
+  REQUIRE(pool.intern_list(flags).data() != list1.data());
+}
+
+TEST_CASE("lib_dep_name names the installed library", "[utilities]") {
+  REQUIRE(lib_dep_name("ArduinoJson") == "ArduinoJson");
+  REQUIRE(lib_dep_name("  bblanchon/ArduinoJson @ ^6.21.3 ") ==
+          "ArduinoJson");
+  REQUIRE(lib_dep_name("https://github.com/me/FastLED.git#3.6.0") ==
+          "FastLED");
+  REQUIRE(lib_dep_name("symlink://../shared/Utils/") == "Utils");
+  REQUIRE(lib_dep_name("Mine=https://example.com/lib.zip") == "Mine");
+}
+
+TEST_CASE("rank_entries orders entries by relevance", "[utilities]") {
+  auto command = [](std::string file) {
+    return CompileCommand{.directory = "/proj",
+                          .file = std::move(file),
+                          .arguments = {"g++"}};
+  };
+  std::vector<CompileCommand> commands{
+      command("/pkg/framework-arduino/cores/main.cpp"),
+      command(".pio/libdeps/esp32/Wire/Wire.cpp"),
+      command("test/test_main.cpp"),
+      command(".pio/libdeps/esp32/ArduinoJson/src/json.cpp"),
+      command("src/main.cpp"),
+      command("lib/Foo/foo.cpp"),
+      command("src/other.cpp"),
+  };
+  InternPool pool;
+  auto db = make_env_database("esp32", commands, pool);
+  std::vector<const Entry*> entries;
+  for (const auto& entry : db.entries) {
+    entries.push_back(&entry);
+  }
+
+  std::vector<std::string> lib_deps{"bblanchon/arduinojson@^6"};
+  std::vector<std::string_view> files;
+  for (const Entry* entry : rank_entries(entries, "/proj", lib_deps)) {
+    files.push_back(entry->file);
+  }
+  REQUIRE(files == std::vector<std::string_view>{
+                       "src/main.cpp",
+                       "lib/Foo/foo.cpp",
+                       "src/other.cpp",
+                       "test/test_main.cpp",
+                       ".pio/libdeps/esp32/ArduinoJson/src/json.cpp",
+                       ".pio/libdeps/esp32/Wire/Wire.cpp",
+                       "/pkg/framework-arduino/cores/main.cpp",
+                   });
+}
+
+TEST_CASE("parallel_for shares one thread budget", "[utilities]") {
+  constexpr size_t OUTER = 8, INNER = 64;
+  std::vector<std::atomic<int>> calls(OUTER * INNER);
+  parallel_for(OUTER, [&](size_t i) {
+    parallel_for(INNER, [&](size_t j) { calls[i * INNER + j].fetch_add(1); });
+  });
+  REQUIRE(std::ranges::all_of(calls, [](const auto& n) { return n == 1; }));
+
+  // Every worker gave its thread back
+  size_t spare = std::max(1u, std::thread::hardware_concurrency()) - 1;
+  size_t reserved = reserve_threads(SIZE_MAX);
+  release_threads(reserved);
+  REQUIRE(reserved == spare);
+}
@@ -0,0 +1,109 @@
+#include <catch2/catch_test_macros.hpp>
+#include <glaze/glaze.hpp>
+#include <string>
+#include <vector>
+#include "clangd.h"
+#include "query_index.h"
+#include "targets.h"
+#include "test_fixtures.hpp"
+#include "workspace.h"
+
+namespace {
+
+std::string ini(const std::vector<std::string>& envs) {
+  std::string text;
+  for (const auto& env : envs) {
+    text += "[env:" + env + "]\nboard = esp32dev\n";
+  }
+  return text;
+}
+
+// compile_commands.json of env in project rel below the fixture
+void write_commands(TempProjectFixture& fixture,
+                    const std::string& rel,
+                    const std::string& env,
+                    const std::vector<std::string>& files) {
+  auto dir = fixture.get_path_string() + "/" + rel;
+  std::string json = "[";
+  for (const auto& file : files) {
+    json += (json.size() > 1 ? "," : "") + std::string{R"({"directory":")"} +
+            dir + R"(","file":")" + file + R"(","arguments":["g++","-D)" +
+            env + R"(","-c",")" + file + R"("]})";
+  }
+  fixture.write_file(rel + "/.pio/build/" + env + "/compile_commands.json",
+                     json + "]");
+}
+
+}  // namespace
+
+TEST_CASE("find_projects walks the tree", "[workspace]") {
+  TempProjectFixture fixture;
+  fixture.write_file("a/platformio.ini", "");
+  fixture.write_file("a/lib/Foo/examples/x/platformio.ini", "");
+  fixture.write_file("b/nested/platformio.ini", "");
+  fixture.write_file("c/d/e/platformio.ini", "");
+  fixture.write_file(".hidden/platformio.ini", "");
+  fixture.write_file("a/.pio/libdeps/esp32/Foo/platformio.ini", "");
+  fixture.write_file("f/platformio.ini/readme.txt", "");
+  auto root = fixture.get_path().lexically_normal().generic_string();
+
+  REQUIRE(find_projects(root) == std::vector<std::string>{
+                                     root + "/a",
+                                     root + "/b/nested",
+                                     root + "/c/d/e",
+                                 });
+  REQUIRE(find_projects(root + "/a/") == std::vector<std::string>{root + "/a"});
+  REQUIRE(find_projects(root + "/a/lib") ==
+          std::vector<std::string>{root + "/a/lib/Foo/examples/x"});
+}
+
+TEST_CASE("run_workspace generates every project", "[workspace]") {
+  TempProjectFixture fixture;
+  auto root = fixture.get_path().lexically_normal().generic_string();
+  auto shared = root + "/framework/core.cpp";
+  fixture.write_file("apps/one/platformio.ini", ini({"esp32", "native"}));
+  fixture.write_file("apps/two/platformio.ini", ini({"esp32"}));
+  write_commands(fixture, "apps/one", "esp32", {"src/main.cpp", shared});
+  write_commands(fixture, "apps/one", "native", {"src/main.cpp"});
+  write_commands(fixture, "apps/two", "esp32", {"src/app.cpp", shared});
+
+  auto read = [](const std::string& path) {
+    std::vector<CompileCommand> commands;
+    REQUIRE_FALSE(glz::read_file_json(commands, path, std::string{}));
+    return commands;
+  };
+
+  WorkspaceOptions options{.root = root, .environment = "native"};
+  REQUIRE(run_workspace(options) == EXIT_SUCCESS);
+  auto one = read(root + "/apps/one/compile_commands.json");
+  REQUIRE(one.size() == 2);
+  REQUIRE(one[0].arguments == std::vector<std::string>{"g++", "-Dnative"});
+  // two has no native environment, its default is used
+  auto two = read(root + "/apps/two/compile_commands.json");
+  REQUIRE(two.size() == 2);
+  REQUIRE(two[0].arguments == std::vector<std::string>{"g++", "-Desp32"});
+  REQUIRE_FALSE(fs::exists(root + "/compile_commands.json"));
+
+  options.combined = true;
+  REQUIRE(run_workspace(options) == EXIT_SUCCESS);
+  auto combined = read(root + "/compile_commands.json");
+  REQUIRE(combined.size() == 3);
+  REQUIRE(combined[0].file == "src/main.cpp");
+  REQUIRE(combined[1].file == shared);
+  REQUIRE(combined[1].directory == root + "/apps/one");
+  REQUIRE(combined[2].file == "src/app.cpp");
+
+  auto index = QueryIndex::open(root_index_path(root));
+  REQUIRE(index);
+  REQUIRE(index->find(root + "/apps/two/src/app.cpp"));
+
+  // A failing project fails the run, the others are still written
+  fixture.write_file("apps/three/platformio.ini", ini({"esp32"}));
+  fs::remove(root + "/apps/one/compile_commands.json");
+  REQUIRE(run_workspace(options) == EXIT_FAILURE);
+  REQUIRE(fs::exists(root + "/apps/one/compile_commands.json"));
+
+  // The root cannot be a project and hold the combined database
+  fixture.write_file("platformio.ini", ini({"esp32"}));
+  REQUIRE(run_workspace(options) == EXIT_FAILURE);
+}